@@ -5,18 +5,51 @@ mkdir -p bin &
 mkdir -p log &
 
 #Compile the inspection program
-gcc src/inspection_console.c -lncurses -lm -o bin/inspection &
+gcc src/inspection_console.c -lncursesw -lm -pthread -lz -o bin/inspection &
 
 #Compile the command program
-gcc src/command_console.c -lncurses -o bin/command &
+gcc src/command_console.c -lncurses -pthread -lz -o bin/command &
 #Compile the master program
-gcc src/master.c -o bin/master &
+gcc src/master.c -pthread -lz -o bin/master &
 
 #Compile the motor x program
-gcc src/mx.c -o bin/mx &
+gcc src/mx.c -pthread -lz -o bin/mx &
 
 #Compile the motor z program
-gcc src/mz.c -o bin/mz &
+gcc src/mz.c -pthread -lz -o bin/mz &
+
+#Compile the control server program
+gcc src/control_server.c -lm -pthread -lz -o bin/control &
+
+#Compile the single process threaded runtime
+gcc src/hoist_threaded.c -pthread -lm -lz -o bin/hoist_threaded &
+
+#Compile the multi-hoist simulator
+gcc src/hoist_sim.c -pthread -lz -o bin/hoist_sim &
+
+#Compile the state estimator
+gcc src/estimator.c -lm -pthread -lz -o bin/estimator &
+
+#Compile the position controller
+gcc src/controller.c -lm -pthread -lz -o bin/controller &
+
+#Compile the web viewer
+gcc src/web_viewer.c -lm -pthread -lz -o bin/web_viewer &
+
+#Compile the benchmark of the batch kinematics, optimized like a real simulation would be
+gcc -O2 src/kinematics_bench.c -o bin/kinematics_bench &
+
+#Compile the microbenchmarks of the hot paths, built like the programs they measure
+gcc src/bench.c -lncursesw -lm -o bin/bench &
+
+#Compile the stress test of the FIFO paths
+gcc src/stress.c -o bin/stress &
+
+#Compile the test of the checkpoint sequence numbers
+gcc src/checkpoint_test.c -o bin/checkpoint_test &
+
+#Compile the log query tool
+gcc src/log_query.c -lz -o bin/log_query &
 
 #Compile the real coordinates program
-gcc src/world.c -o bin/world
\ No newline at end of file
+gcc src/world.c -pthread -lz -o bin/world
\ No newline at end of file
@@ -0,0 +1,211 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "motor_core.h"
+
+// Checkpoint of the state of the motors and of the world process, in a small
+// memory mapped file. Each process snapshots its own section at every tick, a
+// plain copy in the mapping with no system call, so the file always holds the
+// last position of the hoist: the pages belong to the kernel and survive the
+// crash of the process that wrote them. A restarted process warm-starts from
+// its section instead of the minimum position.
+//
+// Each section has a single writer and is protected by a sequence number, odd
+// while the section is being written: a process killed in the middle of a
+// snapshot leaves an odd number and the previous snapshot is lost, never
+// replaced by half of the new one. The restarted writer rounds the number up
+// to even before its first snapshot, so its snapshots are complete again.
+//
+// The master clears the file when the program starts, so only the restarts
+// after a failure resume from it. HOIST_CHECKPOINT changes its path.
+
+#define CHECKPOINT_PATH "log/hoist.ckpt"
+#define ENV_CHECKPOINT "HOIST_CHECKPOINT"
+
+#define CHECKPOINT_MAGIC 0x484b5054
+#define CHECKPOINT_VERSION 1
+
+// Sections of the motors
+#define CHECKPOINT_X 0
+#define CHECKPOINT_Z 1
+
+// State of a motor
+typedef struct {
+    uint32_t seq;
+    uint32_t stream_seq;
+    uint64_t time_ns;
+    float pos;
+    float v;
+    float target;
+    int32_t target_active;
+} CHECKPOINT_MOTOR;
+
+// State of the world process
+typedef struct {
+    uint32_t seq;
+    uint32_t stream_seq;
+    uint64_t time_ns;
+    float x;
+    float z;
+} CHECKPOINT_WORLD;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    CHECKPOINT_MOTOR motors[2];
+    CHECKPOINT_WORLD world;
+} CHECKPOINT_FILE;
+
+// Function to get the time of a snapshot
+uint64_t checkpoint_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Function to map the checkpoint file, created if needed
+// If clear is set, or the file belongs to another version, all the snapshots are dropped
+// Returns NULL on error
+CHECKPOINT_FILE *open_checkpoint(int clear)
+{
+    char *env = getenv(ENV_CHECKPOINT);
+    char *path = (env != NULL && *env != '\0') ? env : CHECKPOINT_PATH;
+
+    int fd = open(path, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    // Size the file, this is harmless if another process already did it
+    if (ftruncate(fd, sizeof(CHECKPOINT_FILE)) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    CHECKPOINT_FILE *ckpt = mmap(NULL, sizeof(CHECKPOINT_FILE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+
+    if (ckpt == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    if (clear || ckpt->magic != CHECKPOINT_MAGIC || ckpt->version != CHECKPOINT_VERSION)
+    {
+        memset(ckpt, 0, sizeof(CHECKPOINT_FILE));
+        ckpt->magic = CHECKPOINT_MAGIC;
+        ckpt->version = CHECKPOINT_VERSION;
+    }
+
+    return ckpt;
+}
+
+// Function to copy a snapshot in a section, only called by the writer of the section
+// The first word of a section is its sequence number
+void write_checkpoint_section(uint32_t *section, const void *snapshot, size_t size)
+{
+    // A writer killed while writing left an odd number, start again from the next even one
+    uint32_t seq = (__atomic_load_n(section, __ATOMIC_RELAXED) + 1) & ~1u;
+
+    // Odd while writing
+    __atomic_store_n(section, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    const uint32_t *src = snapshot;
+    for (size_t i = 1; i < size / sizeof(uint32_t); i++)
+    {
+        __atomic_store_n(&section[i], src[i], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(section, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Function to copy the last complete snapshot of a section
+// Returns 1 if there is one, 0 if the section was never written or its writer died while writing
+int read_checkpoint_section(uint32_t *section, void *snapshot, size_t size)
+{
+    uint32_t *dst = snapshot;
+    uint32_t before, after;
+
+    do
+    {
+        before = __atomic_load_n(section, __ATOMIC_ACQUIRE);
+        for (size_t i = 1; i < size / sizeof(uint32_t); i++)
+        {
+            dst[i] = __atomic_load_n(&section[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(section, __ATOMIC_RELAXED);
+    } while (before != after);
+
+    dst[0] = before;
+
+    // The readers are the restarted writers, an odd number is a snapshot that will never be completed
+    return before != 0 && !(before & 1);
+}
+
+// Function to snapshot the state of a motor and the sequence number of its last record
+void save_motor_checkpoint(CHECKPOINT_FILE *ckpt, int section, MOTOR *motor, uint32_t stream_seq)
+{
+    CHECKPOINT_MOTOR snapshot;
+    snapshot.seq = 0;
+    snapshot.stream_seq = stream_seq;
+    snapshot.time_ns = checkpoint_time_ns();
+    snapshot.pos = motor->pos;
+    snapshot.v = motor->v;
+    snapshot.target = motor->target;
+    snapshot.target_active = motor->target_active;
+
+    write_checkpoint_section(&ckpt->motors[section].seq, &snapshot, sizeof(snapshot));
+}
+
+// Function to restore the position of a motor from its last snapshot
+// The motor resumes stopped, a move interrupted by a crash is not started again on its own
+// Returns 1 if the motor was restored, with the snapshot in *snapshot
+int load_motor_checkpoint(CHECKPOINT_FILE *ckpt, int section, MOTOR *motor, CHECKPOINT_MOTOR *snapshot)
+{
+    if (!read_checkpoint_section(&ckpt->motors[section].seq, snapshot, sizeof(CHECKPOINT_MOTOR)))
+    {
+        return 0;
+    }
+
+    // Keep the position within the limits, they may have changed since the snapshot
+    motor->pos = snapshot->pos < motor->min ? motor->min : (snapshot->pos > motor->max ? motor->max : snapshot->pos);
+    stop_motor(motor);
+
+    return 1;
+}
+
+// Function to snapshot the last position sent by the world process
+void save_world_checkpoint(CHECKPOINT_FILE *ckpt, uint32_t stream_seq, float x, float z)
+{
+    CHECKPOINT_WORLD snapshot;
+    snapshot.seq = 0;
+    snapshot.stream_seq = stream_seq;
+    snapshot.time_ns = checkpoint_time_ns();
+    snapshot.x = x;
+    snapshot.z = z;
+
+    write_checkpoint_section(&ckpt->world.seq, &snapshot, sizeof(snapshot));
+}
+
+// Function to read the last snapshot of the world process
+// Returns 1 if there is one
+int load_world_checkpoint(CHECKPOINT_FILE *ckpt, CHECKPOINT_WORLD *snapshot)
+{
+    return read_checkpoint_section(&ckpt->world.seq, snapshot, sizeof(CHECKPOINT_WORLD));
+}
+
+#endif
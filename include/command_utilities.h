@@ -2,6 +2,23 @@
 #include <string.h>
 #include <unistd.h> 
 #include <math.h>
+#include <stdint.h>
+
+// Key repeat acceleration: a held key changes the velocity by one step, then
+// by one step every KEY_REPEAT_START_MS, the interval shrinking by a quarter
+// at every step down to KEY_REPEAT_MIN_MS. A key is held while its auto-repeat
+// events are less than KEY_HELD_GAP_MS apart (the first repeat of a terminal
+// comes after about half a second).
+#define KEY_REPEAT_START_MS 250
+#define KEY_REPEAT_MIN_MS 50
+#define KEY_HELD_GAP_MS 600
+
+typedef struct {
+    int key;
+    uint64_t last_event_ns;
+    uint64_t last_step_ns;
+    uint64_t interval_ns;
+} KEY_REPEAT;
 
 int BTN_SIZE_X = 7;
 int BTN_SIZE_Y = 3;
@@ -67,6 +84,35 @@ void draw_buttons() {
     draw_btn(vz_decr_btn, "Vz-", 1);
     draw_btn(vz_stp_button, "STP", 2);
     draw_btn(vz_incr_btn, "Vz+", 3);
+
+    char* keys = "Arrows: Vx/Vz   Space: stop";
+    mvprintw(vz_incr_btn->_begy + BTN_SIZE_Y + 2, (COLS - strlen(keys)) / 2, keys);
+}
+
+// Utility method to count the velocity steps of a key event, with key repeat acceleration
+int key_repeat_steps(KEY_REPEAT *repeat, int key, uint64_t now_ns) {
+
+    // New press, or another key
+    if(key != repeat->key || now_ns - repeat->last_event_ns > KEY_HELD_GAP_MS * 1000000ULL) {
+        repeat->key = key;
+        repeat->last_event_ns = now_ns;
+        repeat->last_step_ns = now_ns;
+        repeat->interval_ns = KEY_REPEAT_START_MS * 1000000ULL;
+        return 1;
+    }
+
+    // Auto-repeat of a held key, the events faster than the interval are absorbed
+    repeat->last_event_ns = now_ns;
+    if(now_ns - repeat->last_step_ns < repeat->interval_ns) {
+        return 0;
+    }
+
+    repeat->last_step_ns = now_ns;
+    repeat->interval_ns = repeat->interval_ns * 3 / 4;
+    if(repeat->interval_ns < KEY_REPEAT_MIN_MS * 1000000ULL) {
+        repeat->interval_ns = KEY_REPEAT_MIN_MS * 1000000ULL;
+    }
+    return 1;
 }
 
 // Utility method to check if button has been pressed
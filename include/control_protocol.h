@@ -0,0 +1,145 @@
+#ifndef CONTROL_PROTOCOL_H
+#define CONTROL_PROTOCOL_H
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Path of the Unix-domain socket served by the control server
+#define CTL_SOCKET_PATH "/tmp/hoist_ctl.sock"
+
+// FIFOs used by the control server to forward commands to the motors
+#define MX_CTL_FIFO "/tmp/mx_ctl_fifo"
+#define MZ_CTL_FIFO "/tmp/mz_ctl_fifo"
+
+// Shared memory segment where the motors publish their position
+#define POSE_SHM_NAME "/hoist_pose"
+
+// Magic number at the start of every request and response batch ("HOIS")
+#define CTL_MAGIC 0x484F4953
+
+// Maximum number of requests accepted in a single batch
+#define CTL_MAX_BATCH 256
+
+// Speeds used by the motors when moving to a target position
+#define CTL_MOVE_TO_SPEED 2.0
+#define CTL_RESET_SPEED 4.0
+
+// Request opcodes
+#define CTL_OP_SET_VELOCITY 1
+#define CTL_OP_MOVE_TO 2
+#define CTL_OP_STOP 3
+#define CTL_OP_RESET 4
+#define CTL_OP_QUERY_POSE 5
+
+// Record written by the master on the control FIFOs when it publishes a configuration,
+// it only wakes an idle motor and is not a request of the API
+#define CTL_OP_CONFIG 6
+
+// Axis selectors (bitmask, STOP, RESET and QUERY_POSE accept both axes)
+#define CTL_AXIS_X 1
+#define CTL_AXIS_Z 2
+#define CTL_AXIS_BOTH 3
+
+// Response status codes
+#define CTL_OK 0
+#define CTL_ERR_OP 1
+#define CTL_ERR_AXIS 2
+#define CTL_ERR_VALUE 3
+
+// Header preceding every batch of requests or responses.
+// All fields are in host byte order, the socket is local only.
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+} CTL_BATCH_HEADER;
+
+// Single request of a batch
+typedef struct {
+    uint32_t id;
+    uint8_t op;
+    uint8_t axis;
+    uint16_t reserved;
+    float value;
+} CTL_REQUEST;
+
+// Single response of a batch, one for each request and in the same order.
+// The pose is always filled with the last position published by the motors.
+typedef struct {
+    uint32_t id;
+    int32_t status;
+    float x;
+    float z;
+} CTL_RESPONSE;
+
+// Fixed size record forwarded by the control server to a motor.
+// Records are written atomically (less than PIPE_BUF bytes per write),
+// so the motor always reads whole records from its control FIFO.
+typedef struct {
+    uint8_t op;
+    uint8_t reserved[3];
+    float value;
+} MOTOR_COMMAND;
+
+// Position published by the motors, each motor only writes its own axis
+typedef struct {
+    float x;
+    float z;
+    uint32_t x_updates;
+    uint32_t z_updates;
+} POSE_SHM;
+
+// Function to open (and create if needed) the shared pose segment
+// Returns NULL on error
+POSE_SHM *open_pose_shm()
+{
+    int fd = shm_open(POSE_SHM_NAME, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    // Size the segment, this is harmless if another process already did it
+    if (ftruncate(fd, sizeof(POSE_SHM)) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    POSE_SHM *pose = mmap(NULL, sizeof(POSE_SHM), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+
+    if (pose == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    return pose;
+}
+
+// Function to publish the position of one axis
+void publish_pose(POSE_SHM *pose, char axis, float pos)
+{
+    if (axis == 'x')
+    {
+        __atomic_store(&pose->x, &pos, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&pose->x_updates, 1, __ATOMIC_RELEASE);
+    }
+    else if (axis == 'z')
+    {
+        __atomic_store(&pose->z, &pos, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&pose->z_updates, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Function to read the last published position
+void read_pose(POSE_SHM *pose, float *x, float *z)
+{
+    __atomic_load(&pose->x, x, __ATOMIC_ACQUIRE);
+    __atomic_load(&pose->z, z, __ATOMIC_ACQUIRE);
+}
+
+#endif
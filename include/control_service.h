@@ -0,0 +1,354 @@
+#ifndef CONTROL_SERVICE_H
+#define CONTROL_SERVICE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include "control_protocol.h"
+#include "metrics.h"
+
+// Maximum number of clients connected at the same time
+#define MAX_CLIENTS 16
+
+// Size of the receive buffer of each client, enough for a full batch
+#define CLIENT_BUFFER_SIZE (sizeof(CTL_BATCH_HEADER) + CTL_MAX_BATCH * sizeof(CTL_REQUEST))
+
+// Structure to store the state of a connected client
+typedef struct {
+    int fd;
+    size_t len;
+    unsigned char buffer[CLIENT_BUFFER_SIZE];
+} CLIENT;
+
+// Control socket served by the control server process or by the threaded runtime.
+// forward delivers the commands of a batch to the motors and returns 0 on success,
+// log_event logs a client event and returns 0 on success.
+typedef struct {
+    int listen_fd;
+    CLIENT clients[MAX_CLIENTS];
+    POSE_SHM *pose;
+    METRICS_SLOT *metrics;
+    int (*forward)(MOTOR_COMMAND *x_cmds, int x_count, MOTOR_COMMAND *z_cmds, int z_count);
+    int (*log_event)(char *event);
+} CONTROL_SERVICE;
+
+// Function to write a whole buffer, retrying on partial writes
+int write_all(int fd, void *data, size_t len)
+{
+    unsigned char *ptr = data;
+
+    while (len > 0)
+    {
+        ssize_t m = write(fd, ptr, len);
+        if (m == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        ptr += m;
+        len -= m;
+    }
+
+    return 0;
+}
+
+// Function to validate a request and build the command for the motors
+// Returns the status of the response
+int route_request(CTL_REQUEST *req, MOTOR_COMMAND *cmd)
+{
+    if (req->op < CTL_OP_SET_VELOCITY || req->op > CTL_OP_QUERY_POSE)
+    {
+        return CTL_ERR_OP;
+    }
+    if (req->axis == 0 || (req->axis & ~CTL_AXIS_BOTH))
+    {
+        return CTL_ERR_AXIS;
+    }
+    if ((req->op == CTL_OP_SET_VELOCITY || req->op == CTL_OP_MOVE_TO) && !isfinite(req->value))
+    {
+        return CTL_ERR_VALUE;
+    }
+
+    memset(cmd, 0, sizeof(MOTOR_COMMAND));
+    cmd->op = req->op;
+    cmd->value = req->value;
+
+    return CTL_OK;
+}
+
+// Function to execute a batch of requests and fill the responses
+// The commands for the motors are queued and forwarded once per batch
+int handle_batch(CONTROL_SERVICE *service, CTL_REQUEST *requests, CTL_RESPONSE *responses, int count)
+{
+    MOTOR_COMMAND x_cmds[CTL_MAX_BATCH], z_cmds[CTL_MAX_BATCH];
+    int x_count = 0, z_count = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        CTL_REQUEST *req = &requests[i];
+        CTL_RESPONSE *res = &responses[i];
+        MOTOR_COMMAND cmd;
+
+        res->id = req->id;
+        res->status = route_request(req, &cmd);
+
+        // Queue the command for the selected motors
+        if (res->status == CTL_OK && req->op != CTL_OP_QUERY_POSE)
+        {
+            if (req->axis & CTL_AXIS_X)
+            {
+                x_cmds[x_count++] = cmd;
+            }
+            if (req->axis & CTL_AXIS_Z)
+            {
+                z_cmds[z_count++] = cmd;
+            }
+        }
+
+        // Every response carries the last published position
+        read_pose(service->pose, &res->x, &res->z);
+    }
+
+    // Forward the commands to the motors
+    if ((x_count > 0 || z_count > 0) && service->forward(x_cmds, x_count, z_cmds, z_count))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// Function to process all the complete batches received from a client
+// Returns 0 on success, 1 on forward error, -1 if the client must be dropped
+int serve_client(CONTROL_SERVICE *service, CLIENT *client)
+{
+    size_t offset = 0;
+
+    while (client->len - offset >= sizeof(CTL_BATCH_HEADER))
+    {
+        CTL_BATCH_HEADER *header = (CTL_BATCH_HEADER *)(client->buffer + offset);
+
+        // Drop clients that do not speak the protocol
+        if (header->magic != CTL_MAGIC || header->count > CTL_MAX_BATCH)
+        {
+            return -1;
+        }
+
+        // Wait for the rest of the batch
+        size_t batch_size = sizeof(CTL_BATCH_HEADER) + header->count * sizeof(CTL_REQUEST);
+        if (client->len - offset < batch_size)
+        {
+            break;
+        }
+
+        // Response header followed by the responses, sent with a single write
+        struct {
+            CTL_BATCH_HEADER header;
+            CTL_RESPONSE responses[CTL_MAX_BATCH];
+        } reply;
+        reply.header.magic = CTL_MAGIC;
+        reply.header.count = header->count;
+
+        // Copy the requests out of the buffer to keep them aligned
+        CTL_REQUEST requests[CTL_MAX_BATCH];
+        memcpy(requests, client->buffer + offset + sizeof(CTL_BATCH_HEADER), header->count * sizeof(CTL_REQUEST));
+
+        if (handle_batch(service, requests, reply.responses, header->count))
+        {
+            return 1;
+        }
+
+        size_t reply_size = sizeof(CTL_BATCH_HEADER) + reply.header.count * sizeof(CTL_RESPONSE);
+        if (write_all(client->fd, &reply, reply_size) == -1)
+        {
+            return -1;
+        }
+        metrics_count(service->metrics, METRIC_COMMANDS, header->count);
+        metrics_count(service->metrics, METRIC_BYTES_WRITTEN, reply_size);
+
+        offset += batch_size;
+    }
+
+    // Keep the incomplete batch at the start of the buffer
+    memmove(client->buffer, client->buffer + offset, client->len - offset);
+    client->len -= offset;
+
+    return 0;
+}
+
+// Function to disconnect a client and free its slot
+void drop_client(CLIENT *client)
+{
+    close(client->fd);
+    client->fd = -1;
+    client->len = 0;
+}
+
+// Function to create the listening socket, removing the one left by a previous run
+// Returns 0 on success, -1 on error
+int open_control_service(CONTROL_SERVICE *service)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, CTL_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    unlink(CTL_SOCKET_PATH);
+
+    service->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (service->listen_fd == -1 || bind(service->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(service->listen_fd, MAX_CLIENTS) == -1)
+    {
+        return -1;
+    }
+
+    // Mark all the client slots as free
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        service->clients[i].fd = -1;
+        service->clients[i].len = 0;
+    }
+
+    return 0;
+}
+
+// Function to close the clients and the socket
+void close_control_service(CONTROL_SERVICE *service)
+{
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        if (service->clients[i].fd != -1)
+        {
+            close(service->clients[i].fd);
+        }
+    }
+    close(service->listen_fd);
+    unlink(CTL_SOCKET_PATH);
+}
+
+// Function to serve the clients until an error occurs
+// Returns 1 on system call or forward error, 2 on log error
+int run_control_service(CONTROL_SERVICE *service)
+{
+    int error = 0;
+
+    while (!error)
+    {
+        // Monitor the listening socket and all the clients
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(service->listen_fd, &readfds);
+        int max_fd = service->listen_fd;
+
+        for (int i = 0; i < MAX_CLIENTS; i++)
+        {
+            if (service->clients[i].fd != -1)
+            {
+                FD_SET(service->clients[i].fd, &readfds);
+                if (service->clients[i].fd > max_fd)
+                {
+                    max_fd = service->clients[i].fd;
+                }
+            }
+        }
+
+        // No timeout, the server only works when a client sends something
+        int ready = select(max_fd + 1, &readfds, NULL, NULL, NULL);
+        metrics_count(service->metrics, METRIC_WAKEUPS, 1);
+
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // If error occurs while waiting for the file descriptors
+            return 1;
+        }
+
+        // Accept a new client
+        if (FD_ISSET(service->listen_fd, &readfds))
+        {
+            int client_fd = accept(service->listen_fd, NULL, NULL);
+            if (client_fd == -1)
+            {
+                return 1;
+            }
+
+            // Look for a free slot
+            int slot = -1;
+            for (int i = 0; i < MAX_CLIENTS && slot == -1; i++)
+            {
+                if (service->clients[i].fd == -1)
+                {
+                    slot = i;
+                }
+            }
+
+            if (slot == -1)
+            {
+                // Too many clients, refuse the connection
+                close(client_fd);
+                if (service->log_event("refused, too many clients"))
+                {
+                    return 2;
+                }
+            }
+            else
+            {
+                service->clients[slot].fd = client_fd;
+                service->clients[slot].len = 0;
+                if (service->log_event("connected"))
+                {
+                    return 2;
+                }
+            }
+        }
+
+        // Serve the clients that sent data
+        for (int i = 0; i < MAX_CLIENTS && !error; i++)
+        {
+            CLIENT *client = &service->clients[i];
+            if (client->fd == -1 || !FD_ISSET(client->fd, &readfds))
+            {
+                continue;
+            }
+
+            int n = read(client->fd, client->buffer + client->len, CLIENT_BUFFER_SIZE - client->len);
+
+            // Client closed the connection or failed
+            if (n <= 0)
+            {
+                drop_client(client);
+                error = service->log_event("disconnected") ? 2 : 0;
+                continue;
+            }
+
+            client->len += n;
+
+            int ret = serve_client(service, client);
+            if (ret == 1)
+            {
+                // If error occurs while forwarding the commands to the motors
+                error = 1;
+            }
+            else if (ret == -1)
+            {
+                drop_client(client);
+                error = service->log_event("dropped, protocol or socket error") ? 2 : 0;
+            }
+        }
+    }
+
+    return error;
+}
+
+#endif
@@ -0,0 +1,486 @@
+#ifndef COROUTINE_SCHEDULER_H
+#define COROUTINE_SCHEDULER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+// Cooperative scheduler running stackless coroutines on a single thread.
+// A coroutine is a function that is called again from the top every time it
+// is resumed: CO_BEGIN jumps back to the await it was suspended on, so the
+// local variables do not survive an await and the state must be kept in the
+// structure pointed by task->data. The scheduler sleeps in epoll_wait() until
+// a file descriptor, a timer or a signal awaited by a task is ready, there is
+// no polling.
+//
+//   int blink(CO_TASK *task)
+//   {
+//       CO_BEGIN(task);
+//       while (1)
+//       {
+//           CO_AWAIT_TIMER(task, 500000000);
+//           ...
+//       }
+//       CO_END(task);
+//   }
+
+// Maximum number of tasks of a scheduler
+#define CO_MAX_TASKS 1024
+
+// Maximum number of file descriptors awaited by a single task, the timer included
+#define CO_MAX_WATCHES 4
+
+// Return values of a coroutine
+#define CO_DONE 0
+#define CO_WAITING 1
+#define CO_ERROR -1
+
+// Tag of the signalfd events
+#define CO_SIGNAL_EVENT UINT64_MAX
+
+typedef struct CO_TASK CO_TASK;
+typedef struct CO_SCHEDULER CO_SCHEDULER;
+
+// File descriptor awaited by a task.
+// It stays registered in epoll with EPOLLONESHOT and is only re-armed when awaited
+// again, readiness arriving while the task waits for something else is remembered.
+typedef struct {
+    int fd;
+    int armed;
+    int ready;
+} CO_WATCH;
+
+struct CO_TASK {
+    // Line of the await to resume from, 0 at the start
+    int line;
+    int (*function)(CO_TASK *task);
+    void *data;
+    CO_SCHEDULER *scheduler;
+    int index;
+    int runnable;
+    int done;
+
+    // Awaited file descriptors
+    CO_WATCH watches[CO_MAX_WATCHES];
+    int n_watches;
+
+    // Timer of the task, created at the first timer await
+    int timer_fd;
+    int timer_armed;
+    int timer_periodic;
+
+    // Number of expirations of the last timer await, more than 1 if periods were missed
+    uint64_t expirations;
+
+    // Signals awaited and received, bit n for signal n
+    uint64_t awaited_signals;
+    uint64_t pending_signals;
+};
+
+struct CO_SCHEDULER {
+    int epoll_fd;
+    int signal_fd;
+    sigset_t signals;
+    CO_TASK *tasks[CO_MAX_TASKS];
+    int n_tasks;
+    int running;
+};
+
+// Start of the body of a coroutine, resumes from the last await
+#define CO_BEGIN(task) \
+    switch ((task)->line) \
+    { \
+    case 0:
+
+// End of the body of a coroutine
+#define CO_END(task) \
+    } \
+    (task)->line = -1; \
+    return CO_DONE
+
+// Suspend the coroutine until fd is readable
+#define CO_AWAIT_READABLE(task, fd) \
+    do \
+    { \
+        (task)->line = __LINE__; \
+    case __LINE__: \
+        if (co_wait_readable((task), (fd))) \
+        { \
+            return CO_WAITING; \
+        } \
+    } while (0)
+
+// Suspend the coroutine for ns nanoseconds
+#define CO_AWAIT_TIMER(task, ns) \
+    do \
+    { \
+        (task)->line = __LINE__; \
+    case __LINE__: \
+        if (co_wait_timer((task), (ns), 0)) \
+        { \
+            return CO_WAITING; \
+        } \
+    } while (0)
+
+// Suspend the coroutine until the next tick of a period of ns nanoseconds,
+// the ticks stay on the grid of the first await
+#define CO_AWAIT_TICK(task, ns) \
+    do \
+    { \
+        (task)->line = __LINE__; \
+    case __LINE__: \
+        if (co_wait_timer((task), (ns), 1)) \
+        { \
+            return CO_WAITING; \
+        } \
+    } while (0)
+
+// Suspend the coroutine until signo is received
+#define CO_AWAIT_SIGNAL(task, signo) \
+    do \
+    { \
+        (task)->line = __LINE__; \
+    case __LINE__: \
+        if (co_wait_signal((task), (signo))) \
+        { \
+            return CO_WAITING; \
+        } \
+    } while (0)
+
+// Function to create a scheduler
+// Returns 0 on success, -1 on error
+int init_scheduler(CO_SCHEDULER *scheduler)
+{
+    memset(scheduler, 0, sizeof(CO_SCHEDULER));
+    sigemptyset(&scheduler->signals);
+    scheduler->signal_fd = -1;
+
+    if ((scheduler->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function to add a task to the scheduler, it runs at the next turn
+// Returns 0 on success, -1 if there are too many tasks
+int spawn_task(CO_SCHEDULER *scheduler, CO_TASK *task, int (*function)(CO_TASK *task), void *data)
+{
+    if (scheduler->n_tasks == CO_MAX_TASKS)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memset(task, 0, sizeof(CO_TASK));
+    task->function = function;
+    task->data = data;
+    task->scheduler = scheduler;
+    task->index = scheduler->n_tasks;
+    task->runnable = 1;
+    task->timer_fd = -1;
+
+    scheduler->tasks[scheduler->n_tasks++] = task;
+
+    return 0;
+}
+
+// Function to run again a task that is done, keeping its place in the scheduler.
+// The file descriptors it awaited must have been closed, its timer is closed here
+// Returns 0 on success, -1 if the task is not done
+int restart_task(CO_TASK *task, int (*function)(CO_TASK *task), void *data)
+{
+    if (!task->done)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (task->timer_fd != -1)
+    {
+        close(task->timer_fd);
+    }
+
+    CO_SCHEDULER *scheduler = task->scheduler;
+    int index = task->index;
+
+    memset(task, 0, sizeof(CO_TASK));
+    task->function = function;
+    task->data = data;
+    task->scheduler = scheduler;
+    task->index = index;
+    task->runnable = 1;
+    task->timer_fd = -1;
+
+    return 0;
+}
+
+// Function to await a file descriptor
+// Returns 0 if it is readable, 1 if the task must be suspended, -1 on error
+int co_wait_readable(CO_TASK *task, int fd)
+{
+    CO_WATCH *watch = NULL;
+
+    for (int i = 0; i < task->n_watches; i++)
+    {
+        if (task->watches[i].fd == fd)
+        {
+            watch = &task->watches[i];
+        }
+    }
+
+    // First await of this file descriptor
+    if (watch == NULL)
+    {
+        if (task->n_watches == CO_MAX_WATCHES)
+        {
+            errno = ENOSPC;
+            return -1;
+        }
+
+        watch = &task->watches[task->n_watches];
+        watch->fd = fd;
+        watch->armed = 0;
+        watch->ready = 0;
+
+        struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.u64 = ((uint64_t)task->index << 8) | task->n_watches};
+        if (epoll_ctl(task->scheduler->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            return -1;
+        }
+        watch->armed = 1;
+        task->n_watches++;
+        return 1;
+    }
+
+    if (watch->ready)
+    {
+        watch->ready = 0;
+        return 0;
+    }
+
+    // Re-arm the file descriptor after its last event
+    if (!watch->armed)
+    {
+        struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.u64 = ((uint64_t)task->index << 8) | (watch - task->watches)};
+        if (epoll_ctl(task->scheduler->epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1)
+        {
+            return -1;
+        }
+        watch->armed = 1;
+    }
+
+    return 1;
+}
+
+// Function to await the timer of the task
+// Returns 0 if it expired, 1 if the task must be suspended, -1 on error
+int co_wait_timer(CO_TASK *task, uint64_t ns, int periodic)
+{
+    if (task->timer_fd == -1 && (task->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+    {
+        return -1;
+    }
+
+    // Start the timer, a periodic timer is only started once
+    if (!task->timer_armed)
+    {
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec = ns / 1000000000ULL;
+        spec.it_value.tv_nsec = ns % 1000000000ULL;
+        if (periodic)
+        {
+            spec.it_interval = spec.it_value;
+        }
+
+        if (timerfd_settime(task->timer_fd, 0, &spec, NULL) == -1)
+        {
+            return -1;
+        }
+        task->timer_armed = 1;
+        task->timer_periodic = periodic;
+    }
+
+    int ret = co_wait_readable(task, task->timer_fd);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    // Read the number of expirations
+    if (read(task->timer_fd, &task->expirations, sizeof(task->expirations)) == -1)
+    {
+        // Spurious wakeup, wait again
+        if (errno == EAGAIN)
+        {
+            return co_wait_readable(task, task->timer_fd);
+        }
+        return -1;
+    }
+
+    if (!task->timer_periodic)
+    {
+        task->timer_armed = 0;
+    }
+
+    return 0;
+}
+
+// Function to await a signal, the signal is blocked and received through the signalfd
+// Returns 0 if it was received, 1 if the task must be suspended, -1 on error
+int co_wait_signal(CO_TASK *task, int signo)
+{
+    CO_SCHEDULER *scheduler = task->scheduler;
+    uint64_t bit = (uint64_t)1 << signo;
+
+    if (task->pending_signals & bit)
+    {
+        task->pending_signals &= ~bit;
+        return 0;
+    }
+
+    // Add the signal to the signalfd
+    if (!sigismember(&scheduler->signals, signo))
+    {
+        sigaddset(&scheduler->signals, signo);
+        if (sigprocmask(SIG_BLOCK, &scheduler->signals, NULL) == -1)
+        {
+            return -1;
+        }
+
+        int first = (scheduler->signal_fd == -1);
+        if ((scheduler->signal_fd = signalfd(scheduler->signal_fd, &scheduler->signals, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+        {
+            return -1;
+        }
+
+        struct epoll_event event = {.events = EPOLLIN, .data.u64 = CO_SIGNAL_EVENT};
+        if (first && epoll_ctl(scheduler->epoll_fd, EPOLL_CTL_ADD, scheduler->signal_fd, &event) == -1)
+        {
+            return -1;
+        }
+    }
+
+    task->awaited_signals |= bit;
+    return 1;
+}
+
+// Function to deliver the signals read from the signalfd to the tasks awaiting them
+// Returns 0 on success, -1 on error
+int dispatch_signals(CO_SCHEDULER *scheduler)
+{
+    struct signalfd_siginfo info;
+
+    while (read(scheduler->signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        uint64_t bit = (uint64_t)1 << info.ssi_signo;
+
+        for (int i = 0; i < scheduler->n_tasks; i++)
+        {
+            CO_TASK *task = scheduler->tasks[i];
+            if (task->awaited_signals & bit)
+            {
+                task->awaited_signals &= ~bit;
+                task->pending_signals |= bit;
+                task->runnable = 1;
+            }
+        }
+    }
+
+    return (errno == EAGAIN) ? 0 : -1;
+}
+
+// Function to make run_scheduler() return after the current turn
+void stop_scheduler(CO_SCHEDULER *scheduler)
+{
+    scheduler->running = 0;
+}
+
+// Function to run the tasks until they are all done or the scheduler is stopped
+// The runnable tasks are resumed in the order they were spawned
+// Returns 0 on success, -1 on error or if a task failed, with errno set
+int run_scheduler(CO_SCHEDULER *scheduler)
+{
+    struct epoll_event events[64];
+    scheduler->running = 1;
+
+    while (scheduler->running)
+    {
+        int alive = 0;
+
+        // Resume the runnable tasks
+        for (int i = 0; i < scheduler->n_tasks && scheduler->running; i++)
+        {
+            CO_TASK *task = scheduler->tasks[i];
+
+            if (task->done)
+            {
+                continue;
+            }
+
+            if (task->runnable)
+            {
+                task->runnable = 0;
+
+                int ret = task->function(task);
+                if (ret == CO_ERROR)
+                {
+                    return -1;
+                }
+                if (ret == CO_DONE)
+                {
+                    task->done = 1;
+                    continue;
+                }
+            }
+
+            alive++;
+        }
+
+        if (!alive || !scheduler->running)
+        {
+            break;
+        }
+
+        // Sleep until something awaited is ready
+        int n = epoll_wait(scheduler->epoll_fd, events, 64, -1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.u64 == CO_SIGNAL_EVENT)
+            {
+                if (dispatch_signals(scheduler) == -1)
+                {
+                    return -1;
+                }
+                continue;
+            }
+
+            // The task and the watch are packed in the event
+            CO_TASK *task = scheduler->tasks[events[i].data.u64 >> 8];
+            CO_WATCH *watch = &task->watches[events[i].data.u64 & 0xFF];
+            watch->armed = 0;
+            watch->ready = 1;
+            task->runnable = 1;
+        }
+    }
+
+    return 0;
+}
+
+#endif
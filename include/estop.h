@@ -0,0 +1,115 @@
+#ifndef ESTOP_H
+#define ESTOP_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "tick_timer.h"
+
+// Shared memory segment holding the emergency stop control word
+#define ESTOP_SHM_NAME "/hoist_estop"
+
+// Indexes of the motors acknowledgement slots
+#define ESTOP_MX 0
+#define ESTOP_MZ 1
+
+// Emergency stop control block.
+// word is incremented for every stop request and is also the futex the
+// motors sleep on, so a stop costs no system call on the motor side and
+// only one futex wake on the requester side.
+typedef struct {
+    uint32_t word;
+    uint32_t reserved;
+    uint64_t request_ns;
+    uint64_t ack_ns[2];
+} ESTOP_SHM;
+
+// Function to open (and create if needed) the emergency stop segment
+// Returns NULL on error
+ESTOP_SHM *open_estop_shm()
+{
+    int fd = shm_open(ESTOP_SHM_NAME, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    // Size the segment, this is harmless if another process already did it
+    if (ftruncate(fd, sizeof(ESTOP_SHM)) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    ESTOP_SHM *estop = mmap(NULL, sizeof(ESTOP_SHM), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+
+    if (estop == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    return estop;
+}
+
+// Function to read the current value of the control word
+uint32_t estop_generation(ESTOP_SHM *estop)
+{
+    return __atomic_load_n(&estop->word, __ATOMIC_ACQUIRE);
+}
+
+// Function to request an emergency stop and wake the motors
+// Returns 0 on success, -1 on error
+int request_estop(ESTOP_SHM *estop)
+{
+    __atomic_store_n(&estop->request_ns, monotonic_ns(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&estop->word, 1, __ATOMIC_RELEASE);
+
+    // Not a private futex, the waiters are in other processes
+    if (syscall(SYS_futex, &estop->word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function to sleep until the control word differs from seen
+// Returns the new value of the control word
+uint32_t wait_estop(ESTOP_SHM *estop, uint32_t seen)
+{
+    uint32_t word;
+
+    while ((word = estop_generation(estop)) == seen)
+    {
+        // Returns immediately if the word changed in the meantime
+        syscall(SYS_futex, &estop->word, FUTEX_WAIT, seen, NULL, NULL, 0);
+    }
+
+    return word;
+}
+
+// Function to record that a motor applied the last stop request
+void ack_estop(ESTOP_SHM *estop, int motor)
+{
+    __atomic_store_n(&estop->ack_ns[motor], monotonic_ns(), __ATOMIC_RELEASE);
+}
+
+// Function to get the latency between the last request and its acknowledgement
+uint64_t estop_latency_ns(ESTOP_SHM *estop, int motor)
+{
+    uint64_t request = __atomic_load_n(&estop->request_ns, __ATOMIC_ACQUIRE);
+    uint64_t ack = __atomic_load_n(&estop->ack_ns[motor], __ATOMIC_ACQUIRE);
+
+    return ack > request ? ack - request : 0;
+}
+
+#endif
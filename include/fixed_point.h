@@ -0,0 +1,167 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stdint.h>
+
+// Text encoding of the positions without printf()/scanf().
+// Values are written with 6 decimals like "%f", always with '.' as decimal
+// separator whatever the locale, and the output length is bounded.
+
+// Number of decimals written
+#define FIXED_DECIMALS 6
+#define FIXED_SCALE 1000000LL
+
+// Values are clamped to +-FIXED_LIMIT so that the integer part has at most 9 digits
+#define FIXED_LIMIT 999999999.0
+
+// Maximum length of an encoded value: sign, 9 digits, point, decimals
+#define FIXED_MAX_LEN (1 + 9 + 1 + FIXED_DECIMALS)
+
+// Maximum length of an encoded unsigned integer
+#define UINT_MAX_LEN 10
+
+// Function to write an unsigned integer, without terminator
+// Returns the number of characters written
+int encode_uint(char *out, uint32_t value)
+{
+    char digits[UINT_MAX_LEN];
+    int n = 0;
+
+    // Digits in reverse order
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = digits[n - 1 - i];
+    }
+
+    return n;
+}
+
+// Function to write a value with FIXED_DECIMALS decimals, without terminator
+// NaN is written as 0, out of range values are clamped
+// Returns the number of characters written, at most FIXED_MAX_LEN
+int encode_fixed(char *out, float value)
+{
+    double v = value;
+    int len = 0;
+
+    if (v != v)
+    {
+        v = 0.0;
+    }
+    else if (v > FIXED_LIMIT)
+    {
+        v = FIXED_LIMIT;
+    }
+    else if (v < -FIXED_LIMIT)
+    {
+        v = -FIXED_LIMIT;
+    }
+
+    // Round half away from zero to the last decimal
+    int64_t scaled = (int64_t)(v < 0 ? v * FIXED_SCALE - 0.5 : v * FIXED_SCALE + 0.5);
+
+    if (scaled < 0)
+    {
+        out[len++] = '-';
+        scaled = -scaled;
+    }
+
+    len += encode_uint(out + len, (uint32_t)(scaled / FIXED_SCALE));
+    out[len++] = '.';
+
+    // Decimals, with the leading zeros
+    uint32_t decimals = scaled % FIXED_SCALE;
+    for (int i = FIXED_DECIMALS - 1; i >= 0; i--)
+    {
+        out[len + i] = '0' + decimals % 10;
+        decimals /= 10;
+    }
+
+    return len + FIXED_DECIMALS;
+}
+
+// Function to read an unsigned integer
+// Returns a pointer to the first character not read, NULL if there are no digits or on overflow
+char *decode_uint(char *in, uint32_t *value)
+{
+    uint64_t v = 0;
+    char *start = in;
+
+    while (*in >= '0' && *in <= '9')
+    {
+        v = v * 10 + (*in++ - '0');
+        if (v > UINT32_MAX)
+        {
+            return NULL;
+        }
+    }
+
+    if (in == start)
+    {
+        return NULL;
+    }
+
+    *value = (uint32_t)v;
+    return in;
+}
+
+// Function to read a decimal value with an optional sign and decimal point
+// Decimals after the 9th are read but ignored
+// Returns a pointer to the first character not read, NULL if there are no digits or on overflow
+char *decode_fixed(char *in, float *value)
+{
+    int negative = 0;
+    int digits = 0;
+    uint64_t integer = 0;
+    uint64_t fraction = 0;
+    uint64_t divisor = 1;
+
+    if (*in == '-' || *in == '+')
+    {
+        negative = (*in == '-');
+        in++;
+    }
+
+    while (*in >= '0' && *in <= '9')
+    {
+        integer = integer * 10 + (*in++ - '0');
+        digits++;
+        if (integer > (uint64_t)FIXED_LIMIT * 10)
+        {
+            return NULL;
+        }
+    }
+
+    if (*in == '.')
+    {
+        in++;
+        while (*in >= '0' && *in <= '9')
+        {
+            if (divisor < 1000000000ULL)
+            {
+                fraction = fraction * 10 + (*in - '0');
+                divisor *= 10;
+            }
+            in++;
+            digits++;
+        }
+    }
+
+    if (digits == 0)
+    {
+        return NULL;
+    }
+
+    double v = integer + (double)fraction / divisor;
+    *value = negative ? -v : v;
+
+    return in;
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "tick_timer.h"
+
+// Frame pacing of a console.
+// A frame is drawn only when something shown on the screen changed, and at
+// most max_fps times per second: the changes arriving before the next frame
+// is allowed are drawn together in that frame. The pacer also measures the
+// achieved frame rate, the time spent drawing and the latency from the first
+// change of a frame to the end of its refresh.
+
+// Default maximum frame rate, can be changed with the environment variable below
+#define DEFAULT_MAX_FPS 30
+#define ENV_MAX_FPS "HOIST_MAX_FPS"
+
+// Period of the frame statistics
+#define FRAME_STATS_PERIOD_NS 1000000000ULL
+
+typedef struct {
+    // Minimum time between two frames and earliest time of the next one
+    uint64_t frame_ns;
+    uint64_t next_ns;
+
+    // Something changed since the last frame, and since when
+    int dirty;
+    uint64_t dirty_since_ns;
+    uint64_t draw_start_ns;
+
+    // Statistics of the current period
+    uint64_t window_start_ns;
+    unsigned long window_frames;
+    unsigned long window_skipped;
+    uint64_t window_draw_ns;
+    uint64_t window_latency_ns;
+    uint64_t window_max_draw_ns;
+    uint64_t window_max_latency_ns;
+
+    // Statistics of the last complete period
+    double fps;
+    double draw_ms;
+    double max_draw_ms;
+    double latency_ms;
+    double max_latency_ms;
+    unsigned long skipped;
+
+    // Total number of frames drawn
+    unsigned long frames;
+} FRAME_PACER;
+
+// Function to start the pacer, reading the maximum frame rate from the environment
+void init_frame_pacer(FRAME_PACER *pacer)
+{
+    memset(pacer, 0, sizeof(FRAME_PACER));
+
+    int max_fps = DEFAULT_MAX_FPS;
+    char *env = getenv(ENV_MAX_FPS);
+    if (env != NULL && atoi(env) > 0)
+    {
+        max_fps = atoi(env);
+    }
+
+    pacer->frame_ns = 1000000000ULL / max_fps;
+    pacer->window_start_ns = monotonic_ns();
+    pacer->next_ns = pacer->window_start_ns;
+
+    // The first frame draws the initial state
+    pacer->dirty = 1;
+    pacer->dirty_since_ns = pacer->window_start_ns;
+}
+
+// Function to record that the screen must be drawn again
+void mark_frame_dirty(FRAME_PACER *pacer)
+{
+    if (!pacer->dirty)
+    {
+        pacer->dirty = 1;
+        pacer->dirty_since_ns = monotonic_ns();
+    }
+}
+
+// Function to check if a frame must be drawn now
+// Returns 1 if it must, 0 if nothing changed or it is too early
+int frame_due(FRAME_PACER *pacer)
+{
+    if (!pacer->dirty)
+    {
+        // Without the pacing this would have been a redraw
+        pacer->window_skipped++;
+        return 0;
+    }
+
+    return monotonic_ns() >= pacer->next_ns;
+}
+
+// Function to get the select() timeout: up to the next frame if one is pending, idle otherwise
+struct timeval frame_timeout(FRAME_PACER *pacer, struct timeval idle)
+{
+    if (!pacer->dirty)
+    {
+        return idle;
+    }
+
+    struct timeval timeout = {0, 0};
+    uint64_t now = monotonic_ns();
+    if (pacer->next_ns > now)
+    {
+        uint64_t left_us = (pacer->next_ns - now + 999) / 1000;
+        timeout.tv_sec = left_us / 1000000;
+        timeout.tv_usec = left_us % 1000000;
+    }
+
+    return timeout;
+}
+
+// Function to check if the console can wait for its inputs without timeout:
+// no frame is pending and the last statistics period drew nothing, so the
+// overlay already shows an idle console
+int frame_idle(FRAME_PACER *pacer)
+{
+    return !pacer->dirty && pacer->fps == 0;
+}
+
+// Function to call before drawing a frame
+void begin_frame(FRAME_PACER *pacer)
+{
+    pacer->draw_start_ns = monotonic_ns();
+}
+
+// Function to call after the refresh of a frame
+// Stores the draw time and the latency of the frame in nanoseconds
+void end_frame(FRAME_PACER *pacer, uint64_t *draw_ns, uint64_t *latency_ns)
+{
+    uint64_t now = monotonic_ns();
+
+    *draw_ns = now - pacer->draw_start_ns;
+    *latency_ns = now - pacer->dirty_since_ns;
+
+    pacer->window_frames++;
+    pacer->window_draw_ns += *draw_ns;
+    pacer->window_latency_ns += *latency_ns;
+    if (*draw_ns > pacer->window_max_draw_ns)
+    {
+        pacer->window_max_draw_ns = *draw_ns;
+    }
+    if (*latency_ns > pacer->window_max_latency_ns)
+    {
+        pacer->window_max_latency_ns = *latency_ns;
+    }
+    pacer->frames++;
+
+    // Frames stay on the grid of the frame rate, a late frame does not allow a burst
+    pacer->next_ns = pacer->draw_start_ns + pacer->frame_ns;
+    pacer->dirty = 0;
+}
+
+// Function to close the statistics period when it is over
+// Returns 1 if a new period started, 0 otherwise
+int frame_stats_due(FRAME_PACER *pacer)
+{
+    uint64_t now = monotonic_ns();
+    uint64_t elapsed = now - pacer->window_start_ns;
+    if (elapsed < FRAME_STATS_PERIOD_NS)
+    {
+        return 0;
+    }
+
+    unsigned long frames = pacer->window_frames;
+    pacer->fps = frames * 1e9 / elapsed;
+    pacer->draw_ms = frames ? pacer->window_draw_ns / 1e6 / frames : 0;
+    pacer->latency_ms = frames ? pacer->window_latency_ns / 1e6 / frames : 0;
+    pacer->max_draw_ms = pacer->window_max_draw_ns / 1e6;
+    pacer->max_latency_ms = pacer->window_max_latency_ns / 1e6;
+    pacer->skipped = pacer->window_skipped;
+
+    pacer->window_start_ns = now;
+    pacer->window_frames = 0;
+    pacer->window_skipped = 0;
+    pacer->window_draw_ns = 0;
+    pacer->window_latency_ns = 0;
+    pacer->window_max_draw_ns = 0;
+    pacer->window_max_latency_ns = 0;
+
+    return 1;
+}
+
+// Function to write the statistics of the last period, for the overlay and the log
+void format_frame_stats(char *out, FRAME_PACER *pacer)
+{
+    sprintf(out, "fps %.1f, draw %.2f ms (max %.2f), latency %.2f ms (max %.2f), skipped %lu", pacer->fps, pacer->draw_ms, pacer->max_draw_ms,
+            pacer->latency_ms, pacer->max_latency_ms, pacer->skipped);
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef HOIST_CONFIG_H
+#define HOIST_CONFIG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Configuration of the hoist, shared by all the processes.
+// The master parses the configuration file once and publishes it in the
+// /hoist_config shared memory segment; the children map the segment read-only
+// and check its version once per tick, a single load. On SIGHUP the master
+// parses the file again and, if it is valid, publishes it with the next
+// version, so the limits, the tick of the motors and the error of the sensors
+// change without recompiling or restarting anything.
+//
+// The configuration is protected by a sequence number, odd while the master
+// writes it, so a child never applies half of a new configuration.
+// A child started without the master uses the defaults below.
+
+#define CONFIG_FILE "./config/hoist.conf"
+#define CONFIG_SHM_NAME "/hoist_config"
+
+// Defaults, the values the processes used before the configuration file
+#define DEFAULT_X_MIN 0.0
+#define DEFAULT_X_MAX 40.0
+#define DEFAULT_Z_MIN 0.0
+#define DEFAULT_Z_MAX 10.0
+#define DEFAULT_MOTOR_TICK_MS 500
+#define DEFAULT_SENSOR_ERROR 0.005
+
+typedef struct {
+    // Limits of the axes
+    float x_min, x_max;
+    float z_min, z_max;
+    // Period of the position updates of the motors
+    uint32_t motor_tick_ms;
+    // Maximum error of the measured positions, as a fraction of the position
+    float sensor_error;
+} HOIST_CONFIG;
+
+typedef struct {
+    uint32_t seq;
+    // Number of configurations published, 0 before the first one
+    uint32_t version;
+    HOIST_CONFIG config;
+} CONFIG_SHM;
+
+// Function to set the default configuration
+void default_config(HOIST_CONFIG *config)
+{
+    config->x_min = DEFAULT_X_MIN;
+    config->x_max = DEFAULT_X_MAX;
+    config->z_min = DEFAULT_Z_MIN;
+    config->z_max = DEFAULT_Z_MAX;
+    config->motor_tick_ms = DEFAULT_MOTOR_TICK_MS;
+    config->sensor_error = DEFAULT_SENSOR_ERROR;
+}
+
+// Function to parse a "key = value" line of the configuration file
+// Returns 0 on success, -1 on unknown key or bad value
+int parse_config_field(HOIST_CONFIG *config, char *key, char *value)
+{
+    char *end;
+    double number = strtod(value, &end);
+    if (*value == '\0' || *end != '\0')
+    {
+        return -1;
+    }
+
+    if (strcmp(key, "x_min") == 0)
+    {
+        config->x_min = number;
+    }
+    else if (strcmp(key, "x_max") == 0)
+    {
+        config->x_max = number;
+    }
+    else if (strcmp(key, "z_min") == 0)
+    {
+        config->z_min = number;
+    }
+    else if (strcmp(key, "z_max") == 0)
+    {
+        config->z_max = number;
+    }
+    else if (strcmp(key, "motor_tick_ms") == 0)
+    {
+        config->motor_tick_ms = (number >= 0) ? (uint32_t)number : 0;
+    }
+    else if (strcmp(key, "sensor_error") == 0)
+    {
+        config->sensor_error = number;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function to check a configuration
+// Returns 0 if valid, otherwise -1 with the reason in error
+int validate_config(HOIST_CONFIG *config, char *error)
+{
+    if (config->x_min < 0 || config->x_max <= config->x_min || config->z_min < 0 || config->z_max <= config->z_min)
+    {
+        sprintf(error, "the limits must be positive with min < max");
+        return -1;
+    }
+    if (config->motor_tick_ms < 10 || config->motor_tick_ms > 5000)
+    {
+        sprintf(error, "motor_tick_ms must be between 10 and 5000");
+        return -1;
+    }
+    if (config->sensor_error < 0 || config->sensor_error > 0.1)
+    {
+        sprintf(error, "sensor_error must be between 0 and 0.1");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function to load and validate the configuration file, the missing keys keep their defaults
+// Lines are "key = value", '#' starts a comment
+// Returns 0 on success (also if the file does not exist), -1 on error with the reason in error
+int load_config_file(char *path, HOIST_CONFIG *config, char *error)
+{
+    default_config(config);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+        sprintf(error, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    int line_number = 0;
+    char line[256];
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+
+        // Strip comments
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+
+        char *key = strtok(line, " \t\r\n=");
+        if (key == NULL)
+        {
+            continue;
+        }
+        char *value = strtok(NULL, " \t\r\n=");
+
+        if (value == NULL || strtok(NULL, " \t\r\n") != NULL || parse_config_field(config, key, value))
+        {
+            sprintf(error, "%s:%d: bad line for '%s'", path, line_number, key);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+
+    char reason[150];
+    if (validate_config(config, reason))
+    {
+        sprintf(error, "%s: %s", path, reason);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function to map the configuration segment
+// The master creates it writable, the children map it read-only
+// Returns NULL on error, or for a child if the master did not create it
+CONFIG_SHM *open_config_shm(int writable)
+{
+    int fd = shm_open(CONFIG_SHM_NAME, writable ? (O_CREAT | O_RDWR) : O_RDONLY, 0644);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    // Size the segment, only the master does it
+    if (writable && ftruncate(fd, sizeof(CONFIG_SHM)) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    CONFIG_SHM *shm = mmap(NULL, sizeof(CONFIG_SHM), writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+
+    if (shm == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    return shm;
+}
+
+// Function to publish a configuration with the next version, only called by the master
+// Returns the new version
+uint32_t publish_config(CONFIG_SHM *shm, HOIST_CONFIG *config)
+{
+    uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+
+    // Odd while writing
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint32_t *dst = (uint32_t *)&shm->config, *src = (uint32_t *)config;
+    for (size_t i = 0; i < sizeof(HOIST_CONFIG) / sizeof(uint32_t); i++)
+    {
+        __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+    }
+    uint32_t version = shm->version + 1;
+    __atomic_store_n(&shm->version, version, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+
+    return version;
+}
+
+// Function to read the configuration, the defaults if there is no segment or nothing was published yet
+// Returns the version read
+uint32_t read_config(CONFIG_SHM *shm, HOIST_CONFIG *config)
+{
+    if (shm == NULL || __atomic_load_n(&shm->version, __ATOMIC_ACQUIRE) == 0)
+    {
+        default_config(config);
+        return 0;
+    }
+
+    uint32_t *src = (uint32_t *)&shm->config, *dst = (uint32_t *)config;
+    uint32_t before, after, version;
+
+    do
+    {
+        before = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        for (size_t i = 0; i < sizeof(HOIST_CONFIG) / sizeof(uint32_t); i++)
+        {
+            dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+        version = __atomic_load_n(&shm->version, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+
+    return version;
+}
+
+// Function to check if a configuration newer than the version seen was published, a single load
+int config_pending(CONFIG_SHM *shm, uint32_t seen)
+{
+    return shm != NULL && __atomic_load_n(&shm->version, __ATOMIC_ACQUIRE) != seen;
+}
+
+// Function to check if a configuration newer than *seen was published, called once per tick
+// Returns 1 and reads it in config if there is one
+int config_changed(CONFIG_SHM *shm, uint32_t *seen, HOIST_CONFIG *config)
+{
+    if (!config_pending(shm, *seen))
+    {
+        return 0;
+    }
+
+    *seen = read_config(shm, config);
+    return 1;
+}
+
+#endif
@@ -1,9 +1,13 @@
+#define NCURSES_WIDECHAR 1
 #include <ncurses.h>
+#include <locale.h>
 #include <string.h>
 #include <unistd.h> 
 #include <math.h>
 #include <time.h>
 #include <stdlib.h>
+#include "subcell_render.h"
+#include "sim_random.h"
 
 typedef struct {
 	chtype 	ls, rs, ts, bs, 
@@ -21,8 +25,11 @@ typedef struct {
     int is_set;
 }CONTAINER;
 
-int HOIST_X_LIM = 40;
-int HOIST_Y_LIM = 10;
+// Limits of the workspace, from the configuration
+float HOIST_X_MIN = 0;
+float HOIST_X_MAX = 40;
+float HOIST_Y_MIN = 0;
+float HOIST_Y_MAX = 10;
 int BTN_SIZE = 7;
 
 // Hoist structure variable
@@ -33,12 +40,17 @@ WINDOW *stp_button, *rst_button;
 MEVENT event;
 // Container variable to draw random containers within the hoist's workspace
 CONTAINER container;
+// Part of the workspace shown and its scale
+VIEWPORT view;
 
 // Initialize hoist structure and parameters
 void make_hoist() {
 
-	hoist.height = HOIST_Y_LIM;
-	hoist.width = HOIST_X_LIM;
+	// Scale the workspace to the terminal, leaving room for the buttons and the messages
+	fit_viewport(&view, HOIST_X_MIN, HOIST_X_MAX, HOIST_Y_MIN, HOIST_Y_MAX, COLS - 12, LINES - 12);
+
+	hoist.height = view.height;
+	hoist.width = view.width;
 	hoist.starty = (LINES - hoist.height)/2 + 4;	
 	hoist.startx = (COLS - hoist.width)/2;
 
@@ -66,9 +78,11 @@ void make_buttons() {
 // Utility methods to spawn random container within the hoist's workspace
 void spawn_random_container() {
 
-    srand(time(NULL));
-    container.x = rand() % HOIST_X_LIM;
-    container.y = HOIST_Y_LIM - 1;
+    // Containers are on whole units, inside the limits
+    int first_x = ceilf(HOIST_X_MIN);
+    int n_x = floorf(HOIST_X_MAX) - first_x;
+    container.x = first_x + next_random() % (n_x > 0 ? n_x : 1);
+    container.y = ceilf(HOIST_Y_MAX) - 1;
     container.is_set = TRUE;
 }
 
@@ -113,11 +127,26 @@ void draw_end_effector_msg(float x, float y) {
     attroff(A_BOLD);
 }
 
+// Print the frame statistics on the last line of the screen
+void draw_frame_stats(char *stats) {
+
+    move(LINES - 1, 0);
+    clrtoeol();
+    mvprintw(LINES - 1, (COLS - strlen(stats)) / 2, "%s", stats);
+}
+
 // Method to draw container (if set) withing hoist's workspace
 void draw_container() {
 
+    // Cell of the center of the container, if it is in the viewport
+    int x = floor((container.x + 0.5 - view.x0) * view.scale);
+    int y = floor((container.y + 0.5 - view.z0) * view.scale);
+    if(x < 0 || x >= hoist.width || y < 0 || y >= hoist.height) {
+        return;
+    }
+
     attron(A_BOLD | COLOR_PAIR(2));
-    mvaddch(hoist.starty + container.y, hoist.startx + container.x, '#');
+    mvaddch(hoist.starty + y, hoist.startx + x, '#');
     attroff(A_BOLD | COLOR_PAIR(2));
 }
 
@@ -131,18 +160,17 @@ void draw_hoist_end_effector_at(float ee_x, float ee_y) {
         }
     }
 
-    // Convert  real coordinates to lower integer...
-    int ee_x_int = floor(ee_x);
-    int ee_y_int = floor(ee_y);
+    // Keep the end-effector in the viewport when it does not show the whole workspace
+    follow_viewport(&view, ee_x, ee_y);
 
-    // If ee_y_int > 0, we need to draw the ee cable...
-    for(int i = 0; i < ee_y_int; i++) {
-        mvaddch(hoist.starty + i, hoist.startx + ee_x_int, '\'');
-    }
+    // Draw the cable and the end-effector with braille dots, 2x4 per cell
+    draw_subcell_cable(hoist.starty, hoist.startx, &view, ee_x, ee_y, A_BOLD | COLOR_PAIR(1));
 
-    attron(A_BOLD | COLOR_PAIR(1));
-    mvaddch(hoist.starty + ee_y_int, hoist.startx + ee_x_int, ACS_DARROW);
-    attroff(A_BOLD | COLOR_PAIR(1));
+    // Draw the trolley on the top rail and the height marker beside the structure, in eighths of cell
+    mvhline(hoist.starty - 1, hoist.startx, hoist.border.ts, hoist.width);
+    draw_subcell_marker_x(hoist.starty - 1, hoist.startx, &view, ee_x, COLOR_PAIR(1));
+    mvvline(hoist.starty, hoist.startx + hoist.width + 2, ' ', hoist.height);
+    draw_subcell_marker_z(hoist.starty, hoist.startx + hoist.width + 2, &view, ee_y, COLOR_PAIR(1));
 
     if(container.is_set) {
         draw_container();
@@ -153,19 +181,19 @@ void draw_hoist_end_effector_at(float ee_x, float ee_y) {
 void check_ee_within_limits(float* ee_x, float* ee_y) {
 
     // Checks for horizontal axis
-    if(*ee_x <= 0) {
-        *ee_x = 0;
+    if(*ee_x <= HOIST_X_MIN) {
+        *ee_x = HOIST_X_MIN;
     }
-    else if(*ee_x >= HOIST_X_LIM) {
-        *ee_x = HOIST_X_LIM - 0.01;
+    else if(*ee_x >= HOIST_X_MAX) {
+        *ee_x = HOIST_X_MAX - 0.01;
     }
    
     // Checks for vertical axis
-    if(*ee_y <= 0) {
-        *ee_y = 0;
+    if(*ee_y <= HOIST_Y_MIN) {
+        *ee_y = HOIST_Y_MIN;
     }
-    else if(*ee_y >= HOIST_Y_LIM) {
-        *ee_y = HOIST_Y_LIM - 0.01;
+    else if(*ee_y >= HOIST_Y_MAX) {
+        *ee_y = HOIST_Y_MAX - 0.01;
     }
 }
 
@@ -219,6 +247,12 @@ int check_ee_grasped_container(float ee_x, float ee_y) {
 
 void init_console_ui() {
 
+    // Seed the containers, with HOIST_SEED or the time
+    seed_random_from_env(time(NULL));
+
+    // Use the locale of the terminal, for the Unicode glyphs
+    setlocale(LC_ALL, "");
+
     // Initialize curses mode
     initscr();		
 	start_color();
@@ -235,6 +269,9 @@ void init_console_ui() {
     init_pair(2, COLOR_WHITE, COLOR_RED);
     init_pair(3, COLOR_BLACK,   COLOR_YELLOW);
 
+    // Build the glyphs of the sub-cell rendering
+    init_glyph_tables();
+
     // Initialize UI elements
     make_hoist();
     make_buttons();
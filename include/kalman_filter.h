@@ -0,0 +1,180 @@
+#ifndef KALMAN_FILTER_H
+#define KALMAN_FILTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bank of constant velocity Kalman filters, one per axis of a hoist.
+// The state of a filter is its position and velocity, with the covariance
+// [p_pp p_pv; p_pv p_vv]. The filters are stored as a structure of arrays and
+// the predict and update steps are straight loops over all of them without
+// branches, so the compiler can run several filters per instruction when the
+// bank holds the axes of many hoists.
+//
+// The measurement noise is the one of the world process: a uniform error up to
+// a fraction of the position, plus the rounding to the resolution. A
+// measurement too far from the prediction (more than gate standard deviations)
+// is rejected as an outlier, unless max_rejects measurements in a row were
+// rejected, which means that the hoist really moved there: the filter is then
+// restarted on the measurement.
+
+// Default noise of the acceleration, in units^2/s^3
+#define KALMAN_DEFAULT_Q 0.5
+
+// Default gate in standard deviations and number of rejected measurements before a restart
+#define KALMAN_DEFAULT_GATE 5.0
+#define KALMAN_MAX_REJECTS 3
+
+// Initial variances of a filter
+#define KALMAN_INITIAL_P_PP 1.0
+#define KALMAN_INITIAL_P_VV 4.0
+
+typedef struct {
+    int n;
+    // State and covariance of each filter
+    float *pos;
+    float *vel;
+    float *p_pp;
+    float *p_pv;
+    float *p_vv;
+    // Consecutive rejected measurements of each filter
+    int32_t *rejects;
+    // Noise of the acceleration and of the measurements
+    float q;
+    float relative_error;
+    float resolution;
+    float gate;
+    // Total of the measurements accepted and rejected
+    uint64_t accepted;
+    uint64_t rejected;
+} KALMAN_BANK;
+
+// Function to allocate a bank of n filters, all at position 0 and stopped
+// Returns 0 on success, -1 on error
+int init_kalman_bank(KALMAN_BANK *bank, int n, float q, float relative_error, float resolution, float gate)
+{
+    memset(bank, 0, sizeof(KALMAN_BANK));
+    bank->n = n;
+    bank->q = q;
+    bank->relative_error = relative_error;
+    bank->resolution = resolution;
+    bank->gate = gate;
+
+    // One allocation for all the arrays
+    float *block = calloc((size_t)n * 5, sizeof(float));
+    bank->rejects = calloc(n, sizeof(int32_t));
+    if (block == NULL || bank->rejects == NULL)
+    {
+        free(block);
+        free(bank->rejects);
+        return -1;
+    }
+
+    bank->pos = block;
+    bank->vel = block + n;
+    bank->p_pp = block + 2 * n;
+    bank->p_pv = block + 3 * n;
+    bank->p_vv = block + 4 * n;
+
+    for (int i = 0; i < n; i++)
+    {
+        bank->p_pp[i] = KALMAN_INITIAL_P_PP;
+        bank->p_vv[i] = KALMAN_INITIAL_P_VV;
+    }
+
+    return 0;
+}
+
+// Function to free the arrays of a bank
+void free_kalman_bank(KALMAN_BANK *bank)
+{
+    free(bank->pos);
+    free(bank->rejects);
+}
+
+// Function to restart a filter on a position, stopped
+void reset_kalman_filter(KALMAN_BANK *bank, int i, float pos)
+{
+    bank->pos[i] = pos;
+    bank->vel[i] = 0;
+    bank->p_pp[i] = KALMAN_INITIAL_P_PP;
+    bank->p_pv[i] = 0;
+    bank->p_vv[i] = KALMAN_INITIAL_P_VV;
+    bank->rejects[i] = 0;
+}
+
+// Function to move all the filters forward by dt seconds
+void kalman_predict(KALMAN_BANK *bank, float dt)
+{
+    float *restrict pos = bank->pos, *restrict vel = bank->vel;
+    float *restrict p_pp = bank->p_pp, *restrict p_pv = bank->p_pv, *restrict p_vv = bank->p_vv;
+
+    // Noise of a constant acceleration during dt
+    float q_pp = bank->q * dt * dt * dt / 3;
+    float q_pv = bank->q * dt * dt / 2;
+    float q_vv = bank->q * dt;
+
+    for (int i = 0; i < bank->n; i++)
+    {
+        pos[i] += vel[i] * dt;
+        p_pp[i] += dt * (2 * p_pv[i] + dt * p_vv[i]) + q_pp;
+        p_pv[i] += dt * p_vv[i] + q_pv;
+        p_vv[i] += q_vv;
+    }
+}
+
+// Function to correct the filters with their measurements, has[i] tells if filter i has one
+// Returns the number of measurements rejected
+int kalman_update(KALMAN_BANK *bank, const float *measures, const uint8_t *has)
+{
+    float *restrict pos = bank->pos, *restrict vel = bank->vel;
+    float *restrict p_pp = bank->p_pp, *restrict p_pv = bank->p_pv, *restrict p_vv = bank->p_vv;
+    int32_t *restrict rejects = bank->rejects;
+    float gate2 = bank->gate * bank->gate;
+    float resolution2 = bank->resolution * bank->resolution / 12;
+    float relative2 = bank->relative_error * bank->relative_error / 3;
+    int accepted = 0, rejected = 0;
+
+    for (int i = 0; i < bank->n; i++)
+    {
+        // Variance of the uniform error at this position and of the rounding
+        float r = relative2 * measures[i] * measures[i] + resolution2;
+        float y = measures[i] - pos[i];
+        float s = p_pp[i] + r;
+
+        // A measurement is applied with weight 1, a missing or rejected one with weight 0
+        int in_gate = (y * y <= gate2 * s);
+        float w = (float)(has[i] & in_gate);
+        accepted += has[i] & in_gate;
+        rejected += has[i] & !in_gate;
+        rejects[i] = (has[i] & !in_gate) ? rejects[i] + 1 : (has[i] ? 0 : rejects[i]);
+
+        float k_p = w * p_pp[i] / s;
+        float k_v = w * p_pv[i] / s;
+        pos[i] += k_p * y;
+        vel[i] += k_v * y;
+        p_vv[i] -= k_v * p_pv[i];
+        p_pv[i] -= k_p * p_pv[i];
+        p_pp[i] -= k_p * p_pp[i];
+    }
+
+    // The hoist really moved where the rejected measurements are
+    if (rejected > 0)
+    {
+        for (int i = 0; i < bank->n; i++)
+        {
+            if (rejects[i] >= KALMAN_MAX_REJECTS)
+            {
+                reset_kalman_filter(bank, i, measures[i]);
+            }
+        }
+    }
+
+    bank->accepted += accepted;
+    bank->rejected += rejected;
+
+    return rejected;
+}
+
+#endif
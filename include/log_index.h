@@ -0,0 +1,273 @@
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+// Sparse index of a log file, from the time of a message to its offset.
+// The messages of a log are written by a single process in time order, so an
+// entry every LOG_INDEX_STRIDE bytes is enough to start reading a time range
+// at most one stride before its first message. The index is kept in a sidecar
+// file "<log>.idx" and extended when the log grows.
+
+#define LOG_INDEX_MAGIC 0x58444948
+#define LOG_INDEX_VERSION 1
+
+// Distance in bytes between two entries of the index
+#define LOG_INDEX_STRIDE (64 * 1024)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    // Inode of the indexed file, a rotated log is a new file
+    uint64_t inode;
+    // Length of the indexed content, always at the end of a line
+    uint64_t indexed;
+    uint64_t n_entries;
+} LOG_INDEX_HEADER;
+
+typedef struct {
+    int64_t time;
+    uint64_t offset;
+} LOG_INDEX_ENTRY;
+
+typedef struct {
+    LOG_INDEX_HEADER header;
+    LOG_INDEX_ENTRY *entries;
+    size_t capacity;
+} LOG_INDEX;
+
+// Function to count the days from 1970-01-01 to a date of the proleptic Gregorian calendar
+int64_t days_from_civil(int64_t y, int m, int d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Function to read a number of at most max digits
+// Returns a pointer to the first character not read, NULL if there are no digits
+char *parse_log_number(char *in, char *end, int max, int *value)
+{
+    char *start = in;
+    *value = 0;
+
+    while (in < end && in - start < max && *in >= '0' && *in <= '9')
+    {
+        *value = *value * 10 + (*in++ - '0');
+    }
+
+    return (in == start) ? NULL : in;
+}
+
+// Function to read the "Y-M-D h:m:s:" timestamp at the start of a log message.
+// The time is in seconds of local time, it is only compared with other times read the same way
+// Returns a pointer to the first character after the timestamp, NULL if the line has none
+char *parse_log_time(char *line, char *end, int64_t *time)
+{
+    int fields[6];
+    char separators[6] = {'-', '-', ' ', ':', ':', ':'};
+    int max_digits[6] = {4, 2, 2, 2, 2, 2};
+
+    for (int i = 0; i < 6; i++)
+    {
+        if ((line = parse_log_number(line, end, max_digits[i], &fields[i])) == NULL || line == end || *line != separators[i])
+        {
+            return NULL;
+        }
+        line++;
+    }
+
+    *time = days_from_civil(fields[0], fields[1], fields[2]) * 86400 + fields[3] * 3600 + fields[4] * 60 + fields[5];
+    return line;
+}
+
+// Function to get the length of the messages of a log, without the '\0' padding of the active segment
+size_t log_content_length(char *base, size_t size)
+{
+    while (size > 0 && base[size - 1] == '\0')
+    {
+        size--;
+    }
+    return size;
+}
+
+// Function to empty an index
+void reset_log_index(LOG_INDEX *index, uint64_t inode)
+{
+    index->header.magic = LOG_INDEX_MAGIC;
+    index->header.version = LOG_INDEX_VERSION;
+    index->header.inode = inode;
+    index->header.indexed = 0;
+    index->header.n_entries = 0;
+}
+
+// Function to append an entry to the index
+// Returns 0 on success, -1 on error
+int add_log_index_entry(LOG_INDEX *index, int64_t time, uint64_t offset)
+{
+    if (index->header.n_entries == index->capacity)
+    {
+        size_t capacity = index->capacity ? index->capacity * 2 : 256;
+        LOG_INDEX_ENTRY *entries = realloc(index->entries, capacity * sizeof(LOG_INDEX_ENTRY));
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+
+    index->entries[index->header.n_entries].time = time;
+    index->entries[index->header.n_entries].offset = offset;
+    index->header.n_entries++;
+
+    return 0;
+}
+
+// Function to index the complete lines of the log after the indexed content
+// Returns the number of entries added, -1 on error
+int update_log_index(LOG_INDEX *index, char *base, size_t len)
+{
+    size_t offset = index->header.indexed;
+    int added = 0;
+
+    while (offset < len)
+    {
+        char *eol = memchr(base + offset, '\n', len - offset);
+        if (eol == NULL)
+        {
+            // The last line is still being written
+            break;
+        }
+
+        // Only lines with a timestamp are entries, the others belong to the previous message
+        uint64_t n = index->header.n_entries;
+        if (n == 0 || offset >= index->entries[n - 1].offset + LOG_INDEX_STRIDE)
+        {
+            int64_t time;
+            if (parse_log_time(base + offset, eol, &time) != NULL)
+            {
+                if (add_log_index_entry(index, time, offset) == -1)
+                {
+                    return -1;
+                }
+                added++;
+            }
+        }
+
+        offset = eol - base + 1;
+    }
+
+    index->header.indexed = offset;
+    return added;
+}
+
+// Function to load the sidecar index of a log.
+// A missing, corrupted or stale index (another inode, longer than the log, last entry not
+// matching the log) is replaced by an empty one, which update_log_index() fills again
+// Returns 1 if the index was loaded, 0 if it is empty
+int load_log_index(char *path, LOG_INDEX *index, uint64_t inode, char *base, size_t len)
+{
+    memset(index, 0, sizeof(LOG_INDEX));
+    reset_log_index(index, inode);
+
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+    {
+        return 0;
+    }
+
+    LOG_INDEX_HEADER header;
+    int valid = fread(&header, sizeof(header), 1, in) == 1 && header.magic == LOG_INDEX_MAGIC && header.version == LOG_INDEX_VERSION &&
+                header.inode == inode && header.indexed <= len;
+
+    for (uint64_t i = 0; valid && i < header.n_entries; i++)
+    {
+        LOG_INDEX_ENTRY entry;
+        valid = fread(&entry, sizeof(entry), 1, in) == 1 && entry.offset < header.indexed && add_log_index_entry(index, entry.time, entry.offset) == 0;
+    }
+    fclose(in);
+
+    // The log must still have the message of the last entry where the index says
+    if (valid && header.n_entries > 0)
+    {
+        LOG_INDEX_ENTRY *last = &index->entries[header.n_entries - 1];
+        int64_t time;
+        valid = parse_log_time(base + last->offset, base + len, &time) != NULL && time == last->time;
+    }
+
+    if (!valid)
+    {
+        reset_log_index(index, inode);
+        return 0;
+    }
+
+    index->header = header;
+    return 1;
+}
+
+// Function to write the sidecar index of a log, replacing the previous one at once
+// Returns 0 on success, -1 on error
+int save_log_index(char *path, LOG_INDEX *index)
+{
+    char tmp_path[320];
+    sprintf(tmp_path, "%s.tmp", path);
+
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL)
+    {
+        return -1;
+    }
+
+    int ok = fwrite(&index->header, sizeof(LOG_INDEX_HEADER), 1, out) == 1 &&
+             fwrite(index->entries, sizeof(LOG_INDEX_ENTRY), index->header.n_entries, out) == index->header.n_entries;
+
+    if (fclose(out) != 0 || !ok || rename(tmp_path, path) == -1)
+    {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function to find where to start reading the messages from a time
+// Returns the offset of the last entry older than time, 0 if there is none
+uint64_t find_log_offset(LOG_INDEX *index, int64_t time)
+{
+    uint64_t low = 0, high = index->header.n_entries;
+
+    // First entry not older than time
+    while (low < high)
+    {
+        uint64_t mid = low + (high - low) / 2;
+        if (index->entries[mid].time < time)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return (low == 0) ? 0 : index->entries[low - 1].offset;
+}
+
+// Function to free the entries of an index
+void free_log_index(LOG_INDEX *index)
+{
+    free(index->entries);
+    index->entries = NULL;
+    index->capacity = 0;
+}
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Shared memory segment holding the metrics of all the processes
+#define METRICS_SHM_NAME "/hoist_metrics"
+
+// Slots of the processes, each process only writes its own slot
+#define METRICS_COMMAND 0
+#define METRICS_MX 1
+#define METRICS_MZ 2
+#define METRICS_WORLD 3
+#define METRICS_INSPECTION 4
+#define METRICS_CONTROL 5
+#define METRICS_SIM 6
+#define METRICS_WEB 7
+#define METRICS_CONTROLLER 8
+#define METRICS_ESTIMATOR 9
+#define METRICS_SLOTS 12
+
+// Counters
+#define METRIC_COMMANDS 0
+#define METRIC_SAMPLES 1
+#define METRIC_BYTES_WRITTEN 2
+#define METRIC_WAKEUPS 3
+#define METRIC_TIMEOUTS 4
+#define METRIC_DEADLINE_MISSES 5
+#define METRIC_COUNTERS 6
+
+// Gauges
+#define METRIC_VELOCITY 0
+#define METRIC_POSITION_X 1
+#define METRIC_POSITION_Z 2
+#define METRIC_QUEUE_DEPTH 3
+#define METRIC_GAUGES 4
+
+// Histograms, values in microseconds unless the name says otherwise
+#define METRIC_TICK_JITTER 0
+#define METRIC_DEADLINE_MISS 1
+#define METRIC_DRAW_TIME 2
+#define METRIC_DISPLAY_LATENCY 3
+#define METRIC_LOOP_TIME 4
+#define METRIC_CONTROL_LATENCY 5
+#define METRIC_ESTIMATE_LATENCY 6
+#define METRIC_HISTOGRAMS 7
+
+// Bucket i counts the values below 2^i, the last one also counts all the bigger values
+#define METRICS_BUCKETS 24
+
+// Names used when dumping the metrics
+char *counter_names[METRIC_COUNTERS] = {"commands", "samples", "bytes_written", "wakeups", "timeouts", "deadline_misses"};
+char *gauge_names[METRIC_GAUGES] = {"velocity", "position_x", "position_z", "queue_depth"};
+char *histogram_names[METRIC_HISTOGRAMS] = {"tick_jitter_us", "missed_deadline_lateness_us", "draw_time_us", "display_latency_us", "loop_time_ns", "control_latency_us", "estimate_latency_us"};
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[METRICS_BUCKETS];
+} METRICS_HISTOGRAM;
+
+typedef struct {
+    int32_t pid;
+    char name[20];
+    uint64_t counters[METRIC_COUNTERS];
+    double gauges[METRIC_GAUGES];
+    METRICS_HISTOGRAM histograms[METRIC_HISTOGRAMS];
+} METRICS_SLOT;
+
+typedef struct {
+    METRICS_SLOT slots[METRICS_SLOTS];
+} METRICS_SHM;
+
+// Function to open (and create if needed) the metrics segment
+// Returns NULL on error
+METRICS_SHM *open_metrics_shm()
+{
+    int fd = shm_open(METRICS_SHM_NAME, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    // Size the segment, this is harmless if another process already did it
+    if (ftruncate(fd, sizeof(METRICS_SHM)) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    METRICS_SHM *metrics = mmap(NULL, sizeof(METRICS_SHM), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+
+    if (metrics == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    return metrics;
+}
+
+// Function to claim the slot of a process, clearing the values of a previous run
+// Returns NULL on error
+METRICS_SLOT *register_metrics(int slot, char *name)
+{
+    METRICS_SHM *metrics = open_metrics_shm();
+    if (metrics == NULL)
+    {
+        return NULL;
+    }
+
+    METRICS_SLOT *mine = &metrics->slots[slot];
+    memset(mine, 0, sizeof(METRICS_SLOT));
+    strncpy(mine->name, name, sizeof(mine->name) - 1);
+    __atomic_store_n(&mine->pid, getpid(), __ATOMIC_RELEASE);
+
+    return mine;
+}
+
+// Function to increment a counter
+void metrics_count(METRICS_SLOT *slot, int counter, uint64_t n)
+{
+    __atomic_add_fetch(&slot->counters[counter], n, __ATOMIC_RELAXED);
+}
+
+// Function to set a gauge
+void metrics_gauge(METRICS_SLOT *slot, int gauge, double value)
+{
+    __atomic_store(&slot->gauges[gauge], &value, __ATOMIC_RELAXED);
+}
+
+// Function to add a value to a histogram
+void metrics_observe(METRICS_SLOT *slot, int histogram, uint64_t value)
+{
+    METRICS_HISTOGRAM *h = &slot->histograms[histogram];
+
+    // Index of the bucket, the number of bits of the value
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+    if (bucket >= METRICS_BUCKETS)
+    {
+        bucket = METRICS_BUCKETS - 1;
+    }
+
+    __atomic_add_fetch(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, value, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+    if (value > __atomic_load_n(&h->max, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+    }
+}
+
+// Function to get an approximated percentile of a histogram (upper bound of the bucket)
+uint64_t histogram_percentile(METRICS_HISTOGRAM *h, double percentile)
+{
+    uint64_t target = h->count * percentile;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < METRICS_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen > target)
+        {
+            uint64_t bound = (uint64_t)1 << i;
+            return (i == METRICS_BUCKETS - 1 || bound > h->max) ? h->max : bound;
+        }
+    }
+
+    return h->max;
+}
+
+// Function to write a histogram on a file
+void dump_histogram(FILE *out, char *name, METRICS_HISTOGRAM *h)
+{
+    fprintf(out, "    %s: count=%lu mean=%lu p50<=%lu p99<=%lu max=%lu\n", name, (unsigned long)h->count,
+            (unsigned long)(h->count ? h->sum / h->count : 0), (unsigned long)histogram_percentile(h, 0.5),
+            (unsigned long)histogram_percentile(h, 0.99), (unsigned long)h->max);
+}
+
+// Function to write the metrics of all the processes and their totals on a file
+void dump_metrics(METRICS_SHM *metrics, FILE *out)
+{
+    METRICS_SLOT total;
+    memset(&total, 0, sizeof(total));
+
+    for (int i = 0; i < METRICS_SLOTS; i++)
+    {
+        // Take a copy, the processes keep updating their slot
+        METRICS_SLOT slot;
+        memcpy(&slot, &metrics->slots[i], sizeof(slot));
+
+        if (slot.pid == 0)
+        {
+            continue;
+        }
+
+        fprintf(out, "%s (pid %d)\n", slot.name, slot.pid);
+        for (int c = 0; c < METRIC_COUNTERS; c++)
+        {
+            fprintf(out, "    %s: %lu\n", counter_names[c], (unsigned long)slot.counters[c]);
+            total.counters[c] += slot.counters[c];
+        }
+        for (int g = 0; g < METRIC_GAUGES; g++)
+        {
+            fprintf(out, "    %s: %.3f\n", gauge_names[g], slot.gauges[g]);
+        }
+        for (int h = 0; h < METRIC_HISTOGRAMS; h++)
+        {
+            dump_histogram(out, histogram_names[h], &slot.histograms[h]);
+
+            // Merge the histograms
+            total.histograms[h].count += slot.histograms[h].count;
+            total.histograms[h].sum += slot.histograms[h].sum;
+            if (slot.histograms[h].max > total.histograms[h].max)
+            {
+                total.histograms[h].max = slot.histograms[h].max;
+            }
+            for (int b = 0; b < METRICS_BUCKETS; b++)
+            {
+                total.histograms[h].buckets[b] += slot.histograms[h].buckets[b];
+            }
+        }
+    }
+
+    fprintf(out, "total\n");
+    for (int c = 0; c < METRIC_COUNTERS; c++)
+    {
+        fprintf(out, "    %s: %lu\n", counter_names[c], (unsigned long)total.counters[c]);
+    }
+    for (int h = 0; h < METRIC_HISTOGRAMS; h++)
+    {
+        dump_histogram(out, histogram_names[h], &total.histograms[h]);
+    }
+}
+
+// CPU time and wakeups of a process, read from /proc
+typedef struct {
+    // Seconds since the process started and CPU seconds it used, all its threads
+    double age_s;
+    double cpu_s;
+    // Times its main thread went to sleep, and was preempted
+    unsigned long voluntary_switches;
+    unsigned long involuntary_switches;
+} PROCESS_USAGE;
+
+// Function to read the usage of a process
+// Returns 0 on success, -1 if the process does not exist
+int read_process_usage(pid_t pid, PROCESS_USAGE *usage)
+{
+    char path[64], line[512];
+    long ticks = sysconf(_SC_CLK_TCK);
+    memset(usage, 0, sizeof(PROCESS_USAGE));
+
+    // utime, stime and starttime are the fields 14, 15 and 22, after the name in parentheses
+    sprintf(path, "/proc/%d/stat", pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    char *fields = fgets(line, sizeof(line), file) ? strrchr(line, ')') : NULL;
+    fclose(file);
+
+    unsigned long utime, stime;
+    unsigned long long start;
+    if (fields == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %llu", &utime, &stime, &start) != 3)
+    {
+        return -1;
+    }
+    usage->cpu_s = (double)(utime + stime) / ticks;
+
+    double uptime = 0;
+    file = fopen("/proc/uptime", "r");
+    if (file != NULL)
+    {
+        if (fscanf(file, "%lf", &uptime) != 1)
+        {
+            uptime = 0;
+        }
+        fclose(file);
+    }
+    usage->age_s = uptime - (double)start / ticks;
+
+    sprintf(path, "/proc/%d/status", pid);
+    file = fopen(path, "r");
+    if (file != NULL)
+    {
+        while (fgets(line, sizeof(line), file) != NULL)
+        {
+            sscanf(line, "voluntary_ctxt_switches: %lu", &usage->voluntary_switches);
+            sscanf(line, "nonvoluntary_ctxt_switches: %lu", &usage->involuntary_switches);
+        }
+        fclose(file);
+    }
+
+    return 0;
+}
+
+// Function to write the wakeups per second and the CPU time of a process on a file
+// wakeups are the ones counted by the process, the context switches are counted by the kernel
+// Returns 0 on success, -1 if the process is not running
+int dump_process_usage(FILE *out, char *name, pid_t pid, unsigned long wakeups)
+{
+    PROCESS_USAGE usage;
+    if (read_process_usage(pid, &usage) == -1 || usage.age_s <= 0)
+    {
+        return -1;
+    }
+
+    fprintf(out, "    %s (pid %d): %.2f wakeups/s, %.2f sleeps/s, %.2f preemptions/s, cpu %.3f s in %.0f s (%.3f %%)\n", name, pid, wakeups / usage.age_s,
+            usage.voluntary_switches / usage.age_s, usage.involuntary_switches / usage.age_s, usage.cpu_s, usage.age_s, 100 * usage.cpu_s / usage.age_s);
+    return 0;
+}
+
+// Function to write the usage of the running processes with metrics on a file
+void dump_idle_report(METRICS_SHM *metrics, FILE *out)
+{
+    fprintf(out, "usage since start\n");
+    for (int i = 0; i < METRICS_SLOTS; i++)
+    {
+        int32_t pid = __atomic_load_n(&metrics->slots[i].pid, __ATOMIC_ACQUIRE);
+        if (pid == 0)
+        {
+            continue;
+        }
+
+        uint64_t *counters = metrics->slots[i].counters;
+        dump_process_usage(out, metrics->slots[i].name, pid, counters[METRIC_WAKEUPS] + counters[METRIC_TIMEOUTS]);
+    }
+}
+
+#endif
@@ -0,0 +1,501 @@
+#ifndef MMAP_LOG_H
+#define MMAP_LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <zlib.h>
+#include <sys/mman.h>
+
+// Log file written through a memory mapping.
+// The active segment is the log file itself, preallocated to the segment size
+// and filled with '\0' after the last message, so writing a message is a memcpy.
+// When it is full, or older than MMAP_LOG_MAX_AGE, it is truncated to its
+// content, renamed "<path>.<n>" and a new segment takes its place. The closed
+// segment is compressed to "<path>.<n>.gz" by a thread of the log, so the
+// writer (also a signal handler) never waits for it and never has a child to
+// reap. Only the last MMAP_LOG_SEGMENTS closed segments are kept. The
+// modification time is updated at most once per second, so the watchdog of
+// the master still sees the processes that are logging.
+// The padding of a process killed with SIGKILL stays in the file until the
+// master trims it (trim_mmap_log) or the log is opened again.
+
+// Default size of a segment, can be changed with the environment variable below
+#define MMAP_LOG_SEGMENT_SIZE (1024 * 1024)
+#define ENV_LOG_SEGMENT_KB "HOIST_LOG_SEGMENT_KB"
+
+// Number of closed segments kept for each log
+#define MMAP_LOG_SEGMENTS 5
+
+// Maximum age of a segment in seconds
+#define MMAP_LOG_MAX_AGE 3600
+
+typedef struct {
+    char path[64];
+    int fd;
+    char *base;
+    size_t size;
+    size_t offset;
+    time_t opened;
+    time_t touched;
+    unsigned int segment;
+    // Pipe of the numbers of the segments to compress, -1 without the compression thread
+    int compress_pipe[2];
+} MMAP_LOG;
+
+// Function to get the path of a closed segment
+void mmap_log_segment_path(char *out, MMAP_LOG *log, unsigned int segment, int compressed)
+{
+    sprintf(out, "%s.%u%s", log->path, segment, compressed ? ".gz" : "");
+}
+
+// Function to find the number of the last closed segment of a previous run
+unsigned int last_mmap_log_segment(char *path)
+{
+    char dir[64], prefix[72];
+    strcpy(dir, path);
+    char *slash = strrchr(dir, '/');
+    char *name = slash ? slash + 1 : dir;
+    sprintf(prefix, "%s.", name);
+    if (slash)
+    {
+        *slash = '\0';
+    }
+
+    unsigned int last = 0;
+    DIR *d = opendir(slash ? dir : ".");
+    if (d == NULL)
+    {
+        return 0;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0)
+        {
+            unsigned int n = strtoul(entry->d_name + strlen(prefix), NULL, 10);
+            if (n > last)
+            {
+                last = n;
+            }
+        }
+    }
+    closedir(d);
+
+    return last;
+}
+
+// Function to map a segment file, preallocating it
+// Returns 0 on success, -1 on error
+int map_mmap_log_segment(MMAP_LOG *log, int fd)
+{
+    // Reserve the blocks, so a full disk is detected here and not with a SIGBUS
+    if ((errno = posix_fallocate(fd, 0, log->size)) != 0)
+    {
+        return -1;
+    }
+
+    char *base = mmap(NULL, log->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    log->base = base;
+    log->fd = fd;
+    return 0;
+}
+
+// Function to find the length of the messages in a log file of the given size, without the padding
+size_t mmap_log_content_length(int fd, size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    char *old = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (old == MAP_FAILED)
+    {
+        return size;
+    }
+
+    size_t used = size;
+    while (used > 0 && old[used - 1] == '\0')
+    {
+        used--;
+    }
+    munmap(old, size);
+
+    return used;
+}
+
+// Function to remove the padding of a log whose writer has been killed
+// The writer must be dead: a store past the new end of the file would raise SIGBUS
+// Returns 0 on success, -1 on error
+int trim_mmap_log(char *path)
+{
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    int ret = fstat(fd, &st);
+    if (ret == 0)
+    {
+        size_t used = mmap_log_content_length(fd, st.st_size);
+        if (used < (size_t)st.st_size)
+        {
+            ret = ftruncate(fd, used);
+        }
+    }
+    close(fd);
+
+    return ret;
+}
+
+// Function to compress a closed segment to "<path>.<n>.gz"
+// The compressed file gets its name only when complete, then the plain segment is removed
+// Returns 0 on success, -1 on error
+int compress_mmap_log_segment(MMAP_LOG *log, unsigned int segment)
+{
+    char plain_path[80], gz_path[84], tmp_path[88];
+    mmap_log_segment_path(plain_path, log, segment, 0);
+    mmap_log_segment_path(gz_path, log, segment, 1);
+    sprintf(tmp_path, "%s.tmp", gz_path);
+
+    int fd = open(plain_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    gzFile out = gzopen(tmp_path, "wbe");
+    if (out == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    char buffer[65536];
+    ssize_t n;
+    int ret = 0;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        if (gzwrite(out, buffer, n) != n)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    if (n == -1)
+    {
+        ret = -1;
+    }
+    close(fd);
+
+    if (gzclose(out) != Z_OK || ret == -1 || rename(tmp_path, gz_path) == -1)
+    {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return unlink(plain_path);
+}
+
+// Thread compressing the segments whose numbers are written on the pipe of the log
+// It ends when the pipe is closed by close_mmap_log()
+void *mmap_log_compressor(void *arg)
+{
+    MMAP_LOG *log = arg;
+    int fd = log->compress_pipe[0];
+    unsigned int segment;
+
+    while (read(fd, &segment, sizeof(segment)) == sizeof(segment))
+    {
+        // A segment that cannot be compressed stays readable as plain text
+        compress_mmap_log_segment(log, segment);
+    }
+    close(fd);
+
+    return NULL;
+}
+
+// Function to start the compression thread of a log
+// The thread runs with all the signals blocked, so the handlers of the process always run in its own threads,
+// and with SCHED_OTHER whatever the policy of the process, so it never competes with a real-time loop
+// Returns 0 on success, -1 on error
+int start_mmap_log_compressor(MMAP_LOG *log)
+{
+    if (pipe(log->compress_pipe) == -1)
+    {
+        log->compress_pipe[0] = log->compress_pipe[1] = -1;
+        return -1;
+    }
+
+    // The children of the process do not inherit the pipe
+    fcntl(log->compress_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(log->compress_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    // The writer never waits: with a full pipe the segment is left uncompressed
+    fcntl(log->compress_pipe[1], F_SETFL, O_NONBLOCK);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_attr_t attr;
+    struct sched_param param = {.sched_priority = 0};
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, mmap_log_compressor, log);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err != 0)
+    {
+        close(log->compress_pipe[0]);
+        close(log->compress_pipe[1]);
+        log->compress_pipe[0] = log->compress_pipe[1] = -1;
+        errno = err;
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+// Function to hand a closed segment to the compression thread, safe in a signal handler
+void queue_mmap_log_segment(MMAP_LOG *log, unsigned int segment)
+{
+    if (log->compress_pipe[1] != -1 && write(log->compress_pipe[1], &segment, sizeof(segment)) == -1)
+    {
+        // The pipe is full, the segment stays uncompressed
+    }
+}
+
+// Function to stop writing a log after an error: the mapping is released and the next writes fail
+void disable_mmap_log(MMAP_LOG *log)
+{
+    if (log->base != NULL)
+    {
+        munmap(log->base, log->size);
+        log->base = NULL;
+    }
+    if (log->fd != -1)
+    {
+        close(log->fd);
+        log->fd = -1;
+    }
+}
+
+// Function to close the active segment and start a new one
+// On error the log is disabled, a later write fails instead of using the released mapping
+// Returns 0 on success, -1 on error
+int rotate_mmap_log(MMAP_LOG *log)
+{
+    char segment_path[80], tmp_path[80];
+
+    // Close the active segment, keeping only its content
+    munmap(log->base, log->size);
+    log->base = NULL;
+    if (ftruncate(log->fd, log->offset) == -1)
+    {
+        disable_mmap_log(log);
+        return -1;
+    }
+    close(log->fd);
+    log->fd = -1;
+
+    // Give it its closed segment name, it stays reachable from the log path until replaced
+    log->segment++;
+    mmap_log_segment_path(segment_path, log, log->segment, 0);
+    if (link(log->path, segment_path) == -1)
+    {
+        return -1;
+    }
+
+    // Prepare the new segment and swap it in with a single rename
+    sprintf(tmp_path, "%s.tmp", log->path);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (map_mmap_log_segment(log, fd) == -1 || rename(tmp_path, log->path) == -1)
+    {
+        int saved_errno = errno;
+        if (log->fd != fd)
+        {
+            close(fd);
+        }
+        disable_mmap_log(log);
+        unlink(tmp_path);
+        errno = saved_errno;
+        return -1;
+    }
+    log->offset = 0;
+    log->opened = time(NULL);
+
+    queue_mmap_log_segment(log, log->segment);
+
+    // Remove the oldest segment
+    if (log->segment > MMAP_LOG_SEGMENTS)
+    {
+        mmap_log_segment_path(segment_path, log, log->segment - MMAP_LOG_SEGMENTS, 1);
+        unlink(segment_path);
+        mmap_log_segment_path(segment_path, log, log->segment - MMAP_LOG_SEGMENTS, 0);
+        unlink(segment_path);
+    }
+
+    return 0;
+}
+
+// Function to open a log, appending to the messages of a previous run
+// Returns 0 on success, -1 on error
+int open_mmap_log(MMAP_LOG *log, char *path)
+{
+    memset(log, 0, sizeof(MMAP_LOG));
+    strncpy(log->path, path, sizeof(log->path) - 1);
+    log->size = MMAP_LOG_SEGMENT_SIZE;
+    log->segment = last_mmap_log_segment(path);
+    log->opened = time(NULL);
+    log->fd = -1;
+
+    // Without the thread the closed segments are only left uncompressed
+    start_mmap_log_compressor(log);
+
+    // The last segments of a previous run may have been closed without being compressed
+    for (unsigned int segment = (log->segment > MMAP_LOG_SEGMENTS) ? log->segment - MMAP_LOG_SEGMENTS + 1 : 1; segment <= log->segment; segment++)
+    {
+        char segment_path[80];
+        mmap_log_segment_path(segment_path, log, segment, 0);
+        if (access(segment_path, F_OK) == 0)
+        {
+            queue_mmap_log_segment(log, segment);
+        }
+    }
+
+    char *segment_kb = getenv(ENV_LOG_SEGMENT_KB);
+    if (segment_kb != NULL && atoi(segment_kb) > 0)
+    {
+        log->size = (size_t)atoi(segment_kb) * 1024;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    // Length of the messages already in the file, without the padding
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    size_t used = st.st_size;
+
+    if (used > 0 && used <= log->size)
+    {
+        used = mmap_log_content_length(fd, used);
+    }
+
+    if (map_mmap_log_segment(log, fd) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    log->offset = used;
+
+    // A file bigger than a segment, e.g. written before the rotation existed, is closed at once
+    if (used >= log->size)
+    {
+        log->offset = used;
+        return rotate_mmap_log(log);
+    }
+
+    return 0;
+}
+
+// Function to write a message on the log
+// Returns 0 on success, -1 on error
+int mmap_log_write(MMAP_LOG *log, char *data, size_t len)
+{
+    time_t now = time(NULL);
+
+    // The log was disabled by a failed rotation
+    if (log->base == NULL)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    // Messages longer than a segment are truncated
+    if (len > log->size)
+    {
+        len = log->size;
+    }
+
+    if (log->offset + len > log->size || now - log->opened >= MMAP_LOG_MAX_AGE)
+    {
+        if (rotate_mmap_log(log) == -1)
+        {
+            return -1;
+        }
+    }
+
+    memcpy(log->base + log->offset, data, len);
+    log->offset += len;
+
+    // Stores in the mapping do not reliably update the modification time
+    if (now != log->touched)
+    {
+        log->touched = now;
+        if (futimens(log->fd, NULL) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Function to close the log, the padding is removed so the file can be read as plain text
+// The compression thread ends after the segments already queued
+void close_mmap_log(MMAP_LOG *log)
+{
+    if (log->base != NULL)
+    {
+        munmap(log->base, log->size);
+        log->base = NULL;
+        ftruncate(log->fd, log->offset);
+    }
+    if (log->fd != -1)
+    {
+        close(log->fd);
+        log->fd = -1;
+    }
+    if (log->compress_pipe[1] != -1)
+    {
+        close(log->compress_pipe[1]);
+        log->compress_pipe[1] = -1;
+    }
+}
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef MOTOR_BATCH_H
+#define MOTOR_BATCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "motor_core.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MOTOR_BATCH_X86 1
+#endif
+
+// Kinematics of many axes at once, for the simulations of a whole yard.
+// The axes are stored as a structure of arrays and a step applies to all of
+// them the same rules as motor_step(): integrate the velocity, stop at the
+// limits, stop on the target. The step has no branches: every rule is a
+// comparison mask selecting between two values, so the kernels below run 4
+// (SSE) or 8 (AVX) axes per instruction and a large batch is bounded by the
+// memory bandwidth. Like motor_step(), the position is integrated in double
+// and rounded to float once, so any dt gives the same position.
+//
+// The kernel is chosen when the batch is created: AVX if the CPU has it, SSE
+// (always there on x86-64) otherwise, the scalar loop on the other machines.
+// HOIST_KINEMATICS=scalar|sse|avx forces one of them. All the kernels give
+// results bit-identical to motor_step(), unless the compiler is allowed to
+// contract its multiply-add into an FMA (e.g. -march with FMA).
+
+// Arrays are aligned and padded to the widest vector
+#define MOTOR_BATCH_ALIGN 8
+
+typedef struct MOTOR_BATCH MOTOR_BATCH;
+
+// Kernel stepping the axes [first, last) by dt seconds
+// Returns the number of axes whose position changed
+typedef int (*MOTOR_BATCH_KERNEL)(MOTOR_BATCH *batch, int first, int last, double dt);
+
+struct MOTOR_BATCH {
+    int n;
+    int capacity;
+    // State, limits and target of each axis
+    float *pos;
+    float *v;
+    float *min;
+    float *max;
+    float *target;
+    // All ones if the axis is moving to its target, 0 otherwise
+    int32_t *active;
+    // Kernel used by motor_batch_step() and its name
+    MOTOR_BATCH_KERNEL kernel;
+    const char *kernel_name;
+};
+
+// Scalar kernel, also used for the axes after the last full vector
+int motor_batch_step_scalar(MOTOR_BATCH *batch, int first, int last, double dt)
+{
+    float *restrict pos = batch->pos, *restrict v = batch->v, *restrict target = batch->target;
+    const float *restrict min = batch->min, *restrict max = batch->max;
+    int32_t *restrict active = batch->active;
+    int moved = 0;
+
+    for (int i = first; i < last; i++)
+    {
+        float p = pos[i] + v[i] * dt;
+
+        // Stop at the limits
+        int below = p < min[i];
+        int above = p > max[i];
+        p = below ? min[i] : (above ? max[i] : p);
+        float vi = (below | above) ? 0.0f : v[i];
+
+        // Stop on the target if it has been reached
+        int reached = (active[i] != 0) & (((vi > 0) & (p >= target[i])) | ((vi < 0) & (p <= target[i])));
+        p = reached ? target[i] : p;
+        vi = reached ? 0.0f : vi;
+        active[i] = reached ? 0 : active[i];
+
+        moved += (p != pos[i]);
+        pos[i] = p;
+        v[i] = vi;
+    }
+
+    return moved;
+}
+
+#ifdef MOTOR_BATCH_X86
+
+// SSE kernel, 4 axes per instruction, only SSE2 so it runs on every x86-64
+int motor_batch_step_sse(MOTOR_BATCH *batch, int first, int last, double dt)
+{
+    __m128d dtv = _mm_set1_pd(dt);
+    __m128 zero = _mm_setzero_ps();
+    int moved = 0;
+    int i = first;
+
+    for (; i + 4 <= last; i += 4)
+    {
+        __m128 old = _mm_load_ps(&batch->pos[i]);
+        __m128 v = _mm_load_ps(&batch->v[i]);
+        __m128 min = _mm_load_ps(&batch->min[i]);
+        __m128 max = _mm_load_ps(&batch->max[i]);
+        __m128 target = _mm_load_ps(&batch->target[i]);
+        __m128 active = _mm_load_ps((float *)&batch->active[i]);
+
+        // Integrate in double, two axes per instruction, and round to float
+        __m128d lo = _mm_add_pd(_mm_cvtps_pd(old), _mm_mul_pd(_mm_cvtps_pd(v), dtv));
+        __m128d hi = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(old, old)), _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), dtv));
+        __m128 p = _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+
+        // Stop at the limits
+        __m128 below = _mm_cmplt_ps(p, min);
+        __m128 above = _mm_cmpgt_ps(p, max);
+        p = _mm_or_ps(_mm_and_ps(below, min), _mm_andnot_ps(below, _mm_or_ps(_mm_and_ps(above, max), _mm_andnot_ps(above, p))));
+        v = _mm_andnot_ps(_mm_or_ps(below, above), v);
+
+        // Stop on the target if it has been reached
+        __m128 forward = _mm_and_ps(_mm_cmpgt_ps(v, zero), _mm_cmpge_ps(p, target));
+        __m128 backward = _mm_and_ps(_mm_cmplt_ps(v, zero), _mm_cmple_ps(p, target));
+        __m128 reached = _mm_and_ps(active, _mm_or_ps(forward, backward));
+        p = _mm_or_ps(_mm_and_ps(reached, target), _mm_andnot_ps(reached, p));
+        v = _mm_andnot_ps(reached, v);
+        active = _mm_andnot_ps(reached, active);
+
+        moved += __builtin_popcount(_mm_movemask_ps(_mm_cmpneq_ps(p, old)));
+        _mm_store_ps(&batch->pos[i], p);
+        _mm_store_ps(&batch->v[i], v);
+        _mm_store_ps((float *)&batch->active[i], active);
+    }
+
+    return moved + motor_batch_step_scalar(batch, i, last, dt);
+}
+
+// AVX kernel, 8 axes per instruction, only called if the CPU supports it
+__attribute__((target("avx"))) int motor_batch_step_avx(MOTOR_BATCH *batch, int first, int last, double dt)
+{
+    __m256d dtv = _mm256_set1_pd(dt);
+    __m256 zero = _mm256_setzero_ps();
+    int moved = 0;
+    int i = first;
+
+    for (; i + 8 <= last; i += 8)
+    {
+        __m256 old = _mm256_load_ps(&batch->pos[i]);
+        __m256 v = _mm256_load_ps(&batch->v[i]);
+        __m256 min = _mm256_load_ps(&batch->min[i]);
+        __m256 max = _mm256_load_ps(&batch->max[i]);
+        __m256 target = _mm256_load_ps(&batch->target[i]);
+        __m256 active = _mm256_load_ps((float *)&batch->active[i]);
+
+        // Integrate in double, four axes per instruction, and round to float
+        __m256d lo = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(old)), _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), dtv));
+        __m256d hi = _mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(old, 1)), _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)), dtv));
+        __m256 p = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1);
+
+        // Stop at the limits
+        __m256 below = _mm256_cmp_ps(p, min, _CMP_LT_OQ);
+        __m256 above = _mm256_cmp_ps(p, max, _CMP_GT_OQ);
+        p = _mm256_blendv_ps(_mm256_blendv_ps(p, max, above), min, below);
+        v = _mm256_andnot_ps(_mm256_or_ps(below, above), v);
+
+        // Stop on the target if it has been reached
+        __m256 forward = _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GT_OQ), _mm256_cmp_ps(p, target, _CMP_GE_OQ));
+        __m256 backward = _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(p, target, _CMP_LE_OQ));
+        __m256 reached = _mm256_and_ps(active, _mm256_or_ps(forward, backward));
+        p = _mm256_blendv_ps(p, target, reached);
+        v = _mm256_andnot_ps(reached, v);
+        active = _mm256_andnot_ps(reached, active);
+
+        moved += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(p, old, _CMP_NEQ_UQ)));
+        _mm256_store_ps(&batch->pos[i], p);
+        _mm256_store_ps(&batch->v[i], v);
+        _mm256_store_ps((float *)&batch->active[i], active);
+    }
+
+    return moved + motor_batch_step_scalar(batch, i, last, dt);
+}
+
+#endif
+
+// Function to choose a kernel by name, or the fastest one the CPU supports if name is NULL
+// Returns 0 on success, -1 if the kernel is unknown or not supported
+int select_motor_batch_kernel(MOTOR_BATCH *batch, const char *name)
+{
+    if (name == NULL)
+    {
+        name = getenv("HOIST_KINEMATICS");
+    }
+
+#ifdef MOTOR_BATCH_X86
+    __builtin_cpu_init();
+    int has_avx = __builtin_cpu_supports("avx");
+
+    if ((name == NULL && has_avx) || (name != NULL && strcmp(name, "avx") == 0))
+    {
+        if (!has_avx)
+        {
+            return -1;
+        }
+        batch->kernel = motor_batch_step_avx;
+        batch->kernel_name = "avx";
+        return 0;
+    }
+    if (name == NULL || strcmp(name, "sse") == 0)
+    {
+        batch->kernel = motor_batch_step_sse;
+        batch->kernel_name = "sse";
+        return 0;
+    }
+#endif
+
+    if (name == NULL || strcmp(name, "scalar") == 0)
+    {
+        batch->kernel = motor_batch_step_scalar;
+        batch->kernel_name = "scalar";
+        return 0;
+    }
+
+    return -1;
+}
+
+// Function to allocate a batch of n axes, all stopped at 0 with limits [0, 0]
+// Returns 0 on success, -1 on error (also if HOIST_KINEMATICS names a kernel not supported)
+int init_motor_batch(MOTOR_BATCH *batch, int n)
+{
+    memset(batch, 0, sizeof(MOTOR_BATCH));
+    batch->n = n;
+    batch->capacity = (n + MOTOR_BATCH_ALIGN - 1) / MOTOR_BATCH_ALIGN * MOTOR_BATCH_ALIGN;
+
+    if (select_motor_batch_kernel(batch, NULL) == -1)
+    {
+        return -1;
+    }
+
+    // One aligned allocation for all the arrays
+    size_t size = (size_t)batch->capacity * sizeof(float);
+    char *block = aligned_alloc(MOTOR_BATCH_ALIGN * sizeof(float), 6 * size);
+    if (block == NULL)
+    {
+        return -1;
+    }
+    memset(block, 0, 6 * size);
+
+    batch->pos = (float *)block;
+    batch->v = (float *)(block + size);
+    batch->min = (float *)(block + 2 * size);
+    batch->max = (float *)(block + 3 * size);
+    batch->target = (float *)(block + 4 * size);
+    batch->active = (int32_t *)(block + 5 * size);
+
+    return 0;
+}
+
+// Function to free the arrays of a batch
+void free_motor_batch(MOTOR_BATCH *batch)
+{
+    free(batch->pos);
+}
+
+// Function to copy a motor in an axis of the batch
+void set_motor_batch_axis(MOTOR_BATCH *batch, int i, MOTOR *motor)
+{
+    batch->pos[i] = motor->pos;
+    batch->v[i] = motor->v;
+    batch->min[i] = motor->min;
+    batch->max[i] = motor->max;
+    batch->target[i] = motor->target;
+    batch->active[i] = motor->target_active ? -1 : 0;
+}
+
+// Function to copy an axis of the batch back in a motor
+void get_motor_batch_axis(MOTOR_BATCH *batch, int i, MOTOR *motor)
+{
+    motor->pos = batch->pos[i];
+    motor->v = batch->v[i];
+    motor->min = batch->min[i];
+    motor->max = batch->max[i];
+    motor->target = batch->target[i];
+    motor->target_active = batch->active[i] != 0;
+}
+
+// Function to move all the axes of the batch for dt seconds
+// Returns the number of axes whose position changed
+int motor_batch_step(MOTOR_BATCH *batch, double dt)
+{
+    return batch->kernel(batch, 0, batch->n, dt);
+}
+
+#endif
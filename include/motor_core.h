@@ -0,0 +1,158 @@
+#ifndef MOTOR_CORE_H
+#define MOTOR_CORE_H
+
+#include "control_protocol.h"
+#include "velocity_command.h"
+
+// Kinematics of one axis of the hoist, shared by the mx/mz processes
+// and by the threaded runtime
+typedef struct {
+    char axis;
+    float min;
+    float max;
+    float pos;
+    float v;
+    float target;
+    int target_active;
+} MOTOR;
+
+// Function to initialize a motor at the minimum position and stopped
+void init_motor(MOTOR *motor, char axis, float min, float max)
+{
+    motor->axis = axis;
+    motor->min = min;
+    motor->max = max;
+    motor->pos = min;
+    motor->v = 0.0;
+    motor->target = min;
+    motor->target_active = 0;
+}
+
+// Function to stop the motor and forget the target
+void stop_motor(MOTOR *motor)
+{
+    motor->v = 0.0;
+    motor->target_active = 0;
+}
+
+// Function to apply a command of the command console
+// The increments are ignored at the maximum position and the decrements at the minimum one
+// Returns 1 if the velocity changed
+int motor_apply_velocity_command(MOTOR *motor, VELOCITY_COMMAND *cmd)
+{
+    // Stop motor
+    if (cmd->stop)
+    {
+        if (motor->v == 0)
+        {
+            return 0;
+        }
+        stop_motor(motor);
+        return 1;
+    }
+
+    if ((cmd->delta > 0 && motor->pos < motor->max) || (cmd->delta < 0 && motor->pos > motor->min))
+    {
+        // Change the velocity, this cancels any move to a target
+        motor->v += cmd->delta;
+        motor->target_active = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Function to apply a command forwarded by the control server
+void motor_apply_command(MOTOR *motor, MOTOR_COMMAND *cmd)
+{
+    switch (cmd->op)
+    {
+    case CTL_OP_SET_VELOCITY:
+        motor->v = cmd->value;
+        motor->target_active = 0;
+        break;
+
+    case CTL_OP_MOVE_TO:
+    case CTL_OP_RESET:
+        // Reset is a move to the minimum position at the reset speed
+        motor->target = (cmd->op == CTL_OP_RESET) ? motor->min : cmd->value;
+
+        // Keep the target within the limits
+        if (motor->target < motor->min)
+        {
+            motor->target = motor->min;
+        }
+        else if (motor->target > motor->max)
+        {
+            motor->target = motor->max;
+        }
+
+        // Keep the current speed if the motor is moving, otherwise use the default one
+        float speed = (cmd->op == CTL_OP_RESET) ? CTL_RESET_SPEED : (motor->v != 0 ? motor->v : CTL_MOVE_TO_SPEED);
+        if (speed < 0)
+        {
+            speed = -speed;
+        }
+
+        if (motor->target == motor->pos)
+        {
+            stop_motor(motor);
+        }
+        else
+        {
+            motor->v = (motor->target > motor->pos) ? speed : -speed;
+            motor->target_active = 1;
+        }
+        break;
+
+    case CTL_OP_STOP:
+        stop_motor(motor);
+        break;
+    }
+}
+
+// Function to compute the next position after dt seconds
+// The position is not applied, but the motor is stopped here when it reaches
+// a limit (velocity 0) or the target (velocity 0 and no target)
+float motor_next_pos(MOTOR *motor, double dt)
+{
+    float new_pos = motor->pos + motor->v * dt;
+
+    // Check if the position is out of bounds
+    if (new_pos < motor->min)
+    {
+        new_pos = motor->min;
+        motor->v = 0;
+    }
+    else if (new_pos > motor->max)
+    {
+        new_pos = motor->max;
+        motor->v = 0;
+    }
+
+    // Stop on the target if it has been reached
+    if (motor->target_active && ((motor->v > 0 && new_pos >= motor->target) || (motor->v < 0 && new_pos <= motor->target)))
+    {
+        new_pos = motor->target;
+        stop_motor(motor);
+    }
+
+    return new_pos;
+}
+
+// Function to move the motor for dt seconds
+// Returns 1 if the position changed
+int motor_step(MOTOR *motor, double dt)
+{
+    float new_pos = motor_next_pos(motor, dt);
+
+    if (new_pos == motor->pos)
+    {
+        return 0;
+    }
+
+    motor->pos = new_pos;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef PID_CONTROLLER_H
+#define PID_CONTROLLER_H
+
+#include <stdlib.h>
+#include <math.h>
+
+// Position controller of one axis of the hoist, driving the velocity of its motor.
+// The reference moves towards the target at most at the maximum speed and its
+// velocity is fed forward; the PID corrects the difference between the
+// reference and the measured position. The measurements are noisy (the world
+// process adds up to 0.5% of the position), so they are smoothed before the
+// derivative, and errors inside the tolerance are ignored so the noise does not
+// keep the motor moving back and forth around the target.
+//
+// Gains and limits can be changed with environment variables:
+//   HOIST_CTL_KP, HOIST_CTL_KI, HOIST_CTL_KD, HOIST_CTL_KFF,
+//   HOIST_CTL_VMAX (maximum speed), HOIST_CTL_TOLERANCE, HOIST_CTL_SMOOTHING
+//   (weight of a new measurement in the smoothed position, 0 to 1)
+
+// Default gains, the motors integrate the velocity every 0.5 s
+#define PID_DEFAULT_KP 1.0
+#define PID_DEFAULT_KI 0.1
+#define PID_DEFAULT_KD 0.05
+#define PID_DEFAULT_KFF 1.0
+#define PID_DEFAULT_VMAX 2.0
+#define PID_DEFAULT_TOLERANCE 0.05
+#define PID_DEFAULT_SMOOTHING 0.5
+
+// Shortest interval the derivative is measured on, the world process publishes
+// the changes of the two axes microseconds apart
+#define PID_DERIVATIVE_WINDOW 0.25
+
+typedef struct {
+    float kp, ki, kd, kff;
+    float vmax;
+    float tolerance;
+    float smoothing;
+} PID_GAINS;
+
+typedef struct {
+    // Target, and reference moving towards it with its velocity
+    float target;
+    float reference;
+    float reference_v;
+    // Smoothed measurement, 0 until the first one
+    int measured;
+    float position;
+    float derivative;
+    double measure_time;
+    // Smoothed measurement at the start of the derivative window
+    float window_position;
+    double window_time;
+    // Integral of the error, limited so that it alone cannot exceed the maximum speed
+    float integral;
+    // Velocity requested to the motor
+    float output;
+} PID_AXIS;
+
+// Function to read a gain from the environment
+float pid_env(char *name, float value)
+{
+    char *env = getenv(name);
+    return (env != NULL && *env != '\0') ? atof(env) : value;
+}
+
+// Function to load the gains, the defaults replaced by the environment variables
+void load_pid_gains(PID_GAINS *gains)
+{
+    gains->kp = pid_env("HOIST_CTL_KP", PID_DEFAULT_KP);
+    gains->ki = pid_env("HOIST_CTL_KI", PID_DEFAULT_KI);
+    gains->kd = pid_env("HOIST_CTL_KD", PID_DEFAULT_KD);
+    gains->kff = pid_env("HOIST_CTL_KFF", PID_DEFAULT_KFF);
+    gains->vmax = fabsf(pid_env("HOIST_CTL_VMAX", PID_DEFAULT_VMAX));
+    gains->tolerance = fabsf(pid_env("HOIST_CTL_TOLERANCE", PID_DEFAULT_TOLERANCE));
+    gains->smoothing = fminf(fmaxf(pid_env("HOIST_CTL_SMOOTHING", PID_DEFAULT_SMOOTHING), 0.01), 1.0);
+}
+
+// Function to start an axis with its target, the reference starts at the first measurement
+void init_pid_axis(PID_AXIS *axis, float target)
+{
+    axis->target = target;
+    axis->reference = target;
+    axis->reference_v = 0;
+    axis->measured = 0;
+    axis->position = 0;
+    axis->derivative = 0;
+    axis->measure_time = 0;
+    axis->window_position = 0;
+    axis->window_time = 0;
+    axis->integral = 0;
+    axis->output = 0;
+}
+
+// Function to add a measurement taken at time t (seconds)
+void pid_measure(PID_AXIS *axis, PID_GAINS *gains, float position, double t)
+{
+    if (!axis->measured)
+    {
+        axis->measured = 1;
+        axis->position = position;
+        axis->reference = position;
+        axis->measure_time = t;
+        axis->window_position = position;
+        axis->window_time = t;
+        return;
+    }
+
+    if (t <= axis->measure_time)
+    {
+        return;
+    }
+    axis->position += gains->smoothing * (position - axis->position);
+    axis->measure_time = t;
+
+    // Derivative over the last window, a shorter interval would turn the noise into huge speeds
+    if (t - axis->window_time >= PID_DERIVATIVE_WINDOW)
+    {
+        axis->derivative = (axis->position - axis->window_position) / (t - axis->window_time);
+        axis->window_position = axis->position;
+        axis->window_time = t;
+    }
+}
+
+// Function to advance the reference and compute the velocity for a period of dt seconds
+// Returns the velocity to request to the motor
+float pid_update(PID_AXIS *axis, PID_GAINS *gains, double dt)
+{
+    // Nothing to control before the first measurement
+    if (!axis->measured)
+    {
+        return 0;
+    }
+
+    // Move the reference towards the target at the maximum speed
+    float step = axis->target - axis->reference;
+    float max_step = gains->vmax * dt;
+    if (fabsf(step) > max_step)
+    {
+        step = copysignf(max_step, step);
+    }
+    axis->reference += step;
+    axis->reference_v = dt > 0 ? step / dt : 0;
+
+    float error = axis->reference - axis->position;
+
+    // Once the reference has arrived, errors inside the tolerance are noise
+    if (axis->reference == axis->target && fabsf(error) < gains->tolerance)
+    {
+        axis->output = 0;
+        return 0;
+    }
+
+    // Integrate the error, the integral alone never exceeds the maximum speed
+    if (gains->ki > 0)
+    {
+        float limit = gains->vmax / gains->ki;
+        axis->integral = fminf(fmaxf(axis->integral + error * dt, -limit), limit);
+    }
+
+    // The derivative is taken on the measurement, so a new target does not kick the output
+    float v = gains->kff * axis->reference_v + gains->kp * error + gains->ki * axis->integral - gains->kd * axis->derivative;
+    axis->output = fminf(fmaxf(v, -gains->vmax), gains->vmax);
+
+    return axis->output;
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef POSE_BUS_H
+#define POSE_BUS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "tick_timer.h"
+
+// Shared memory ring of the positions measured by the world process.
+// The world process is the only writer: publishing a sample costs a few
+// stores and never waits for the readers. Any number of readers follow the
+// ring with their own cursor; a reader slower than the ring loses the
+// oldest samples and is told how many. Each slot is protected by its
+// sequence number, set to 0 while the slot is being written. A reader can
+// sleep until the next sample: the writer only makes the wake system call
+// when some reader is sleeping.
+
+#define POSE_BUS_NAME "/hoist_pose_bus"
+
+// Number of samples kept, a power of 2
+#define POSE_BUS_SLOTS 4096
+
+typedef struct {
+    uint64_t seq;
+    uint64_t time_ns;
+    float x;
+    float z;
+} POSE_SAMPLE;
+
+typedef struct {
+    // Sequence number of the last published sample, the first one is 1
+    uint64_t head;
+    // Counter readers sleep on, and number of sleeping readers
+    uint32_t notify;
+    uint32_t waiters;
+    char pad[48];
+    POSE_SAMPLE slots[POSE_BUS_SLOTS];
+} POSE_BUS;
+
+// Function to open (and create if needed) the pose bus
+// Returns NULL on error
+POSE_BUS *open_pose_bus()
+{
+    int fd = shm_open(POSE_BUS_NAME, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    // Size the segment, this is harmless if another process already did it
+    if (ftruncate(fd, sizeof(POSE_BUS)) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    POSE_BUS *bus = mmap(NULL, sizeof(POSE_BUS), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+
+    if (bus == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    return bus;
+}
+
+// Function to publish a sample, only called by the writer
+void publish_pose_sample(POSE_BUS *bus, float x, float z)
+{
+    uint64_t seq = __atomic_load_n(&bus->head, __ATOMIC_RELAXED) + 1;
+    POSE_SAMPLE *slot = &bus->slots[seq & (POSE_BUS_SLOTS - 1)];
+
+    // Mark the slot as being written before changing it
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->time_ns, monotonic_ns(), __ATOMIC_RELAXED);
+    __atomic_store(&slot->x, &x, __ATOMIC_RELAXED);
+    __atomic_store(&slot->z, &z, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&bus->head, seq, __ATOMIC_RELEASE);
+
+    // Wake the sleeping readers, the segment is shared between processes
+    __atomic_add_fetch(&bus->notify, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&bus->waiters, __ATOMIC_SEQ_CST))
+    {
+        syscall(SYS_futex, &bus->notify, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Function to get the value to pass to wait_pose_bus(), read it before reading the samples
+uint32_t pose_bus_notify(POSE_BUS *bus)
+{
+    return __atomic_load_n(&bus->notify, __ATOMIC_SEQ_CST);
+}
+
+// Function to sleep until a sample is published after seen or the monotonic deadline passes
+void wait_pose_bus(POSE_BUS *bus, uint32_t seen, uint64_t deadline_ns)
+{
+    uint64_t now = monotonic_ns();
+    if (now >= deadline_ns)
+    {
+        return;
+    }
+    struct timespec timeout = {(deadline_ns - now) / 1000000000ULL, (deadline_ns - now) % 1000000000ULL};
+
+    __atomic_add_fetch(&bus->waiters, 1, __ATOMIC_SEQ_CST);
+
+    // Returns immediately if a sample was published in the meantime
+    syscall(SYS_futex, &bus->notify, FUTEX_WAIT, seen, &timeout, NULL, 0);
+
+    __atomic_sub_fetch(&bus->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+// Function to get the sequence number of the last published sample
+uint64_t pose_bus_head(POSE_BUS *bus)
+{
+    return __atomic_load_n(&bus->head, __ATOMIC_ACQUIRE);
+}
+
+// Function to read the samples published after the cursor, at most max.
+// The cursor is the sequence number of the last sample read, it is advanced
+// over the samples read and the samples lost, which are added to lost
+// Returns the number of samples read
+int read_pose_samples(POSE_BUS *bus, uint64_t *cursor, POSE_SAMPLE *out, int max, uint64_t *lost)
+{
+    uint64_t head = pose_bus_head(bus);
+    int n = 0;
+
+    // The samples older than the ring are gone
+    if (head > *cursor + POSE_BUS_SLOTS)
+    {
+        *lost += head - POSE_BUS_SLOTS - *cursor;
+        *cursor = head - POSE_BUS_SLOTS;
+    }
+
+    while (*cursor < head && n < max)
+    {
+        uint64_t seq = *cursor + 1;
+        POSE_SAMPLE *slot = &bus->slots[seq & (POSE_BUS_SLOTS - 1)];
+
+        uint64_t before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        out[n].time_ns = __atomic_load_n(&slot->time_ns, __ATOMIC_RELAXED);
+        __atomic_load(&slot->x, &out[n].x, __ATOMIC_RELAXED);
+        __atomic_load(&slot->z, &out[n].z, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t after = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+        // The writer reused the slot for a newer sample meanwhile
+        if (before != seq || after != seq)
+        {
+            (*lost)++;
+        }
+        else
+        {
+            out[n++].seq = seq;
+        }
+        *cursor = seq;
+    }
+
+    return n;
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef POSE_ESTIMATE_H
+#define POSE_ESTIMATE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Shared memory segment with the filtered position, velocity and covariance
+// of the hoists. The estimator process writes the estimate of the hoist of the
+// world process, the multi-hoist simulator the estimates of its hoists in its
+// own segment. Each estimate is protected by a sequence number, odd while the
+// estimate is being written, so the readers never see half an update and the
+// writer never waits for them.
+
+#define ESTIMATE_SHM_NAME "/hoist_estimate"
+#define SIM_ESTIMATE_SHM_NAME "/hoist_sim_estimate"
+
+// Maximum number of hoists of a segment
+#define ESTIMATE_MAX_HOISTS 512
+
+// Estimate of a hoist, the covariance of an axis is [pp pv vv]
+typedef struct {
+    uint32_t seq;
+    uint32_t pad;
+    uint64_t time_ns;
+    float x, vx;
+    float z, vz;
+    float cov_x[3];
+    float cov_z[3];
+} POSE_ESTIMATE;
+
+typedef struct {
+    uint32_t n_hoists;
+    uint32_t pad;
+    POSE_ESTIMATE hoists[ESTIMATE_MAX_HOISTS];
+} ESTIMATE_SHM;
+
+// Function to open (and create if needed) an estimate segment
+// Returns NULL on error
+ESTIMATE_SHM *open_estimate_shm(char *name)
+{
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    // Size the segment, this is harmless if another process already did it
+    if (ftruncate(fd, sizeof(ESTIMATE_SHM)) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    ESTIMATE_SHM *shm = mmap(NULL, sizeof(ESTIMATE_SHM), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+
+    if (shm == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    return shm;
+}
+
+// Function to publish the estimate of a hoist, only called by the writer of the segment
+void publish_estimate(ESTIMATE_SHM *shm, int hoist, POSE_ESTIMATE *estimate)
+{
+    POSE_ESTIMATE *slot = &shm->hoists[hoist];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+    // Odd while writing
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint32_t *dst = (uint32_t *)slot, *src = (uint32_t *)estimate;
+    for (size_t i = 2; i < sizeof(POSE_ESTIMATE) / sizeof(uint32_t); i++)
+    {
+        __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Function to read the estimate of a hoist
+// Returns 1 if there is one, 0 if the hoist was never estimated
+int read_estimate(ESTIMATE_SHM *shm, int hoist, POSE_ESTIMATE *estimate)
+{
+    POSE_ESTIMATE *slot = &shm->hoists[hoist];
+    uint32_t *src = (uint32_t *)slot, *dst = (uint32_t *)estimate;
+    uint32_t before, after;
+
+    do
+    {
+        before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        for (size_t i = 2; i < sizeof(POSE_ESTIMATE) / sizeof(uint32_t); i++)
+        {
+            dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+
+    estimate->seq = before;
+    return before != 0;
+}
+
+// Function to extrapolate the position of an estimate to a later time
+void extrapolate_estimate(POSE_ESTIMATE *estimate, uint64_t now_ns, float *x, float *z)
+{
+    float dt = now_ns > estimate->time_ns ? (now_ns - estimate->time_ns) / 1e9 : 0;
+    *x = estimate->x + estimate->vx * dt;
+    *z = estimate->z + estimate->vz * dt;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef POSE_STREAM_H
+#define POSE_STREAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "fixed_point.h"
+
+// Records exchanged on the position FIFOs are newline terminated text:
+//   motor -> world:      "<seq>;<pos>\n"
+//   world -> inspection: "<seq>;<x>;<z>\n"
+// Every producer numbers its records starting from 1, so a consumer can
+// split concatenated or partial reads and detect lost, duplicated or
+// reordered records.
+
+// Maximum length of a single record, newline and terminator included
+// The longest one is a world record: seq;x;z
+#define POSE_RECORD_MAX (UINT_MAX_LEN + 2 * (1 + FIXED_MAX_LEN) + 2)
+
+// Size of the reassembly buffer of a consumer
+#define POSE_READER_SIZE 4096
+
+// Number of already received records remembered to tell duplicates from late records
+#define POSE_WINDOW 64
+
+// Reassembly buffer for the records read from a FIFO
+typedef struct {
+    char buffer[POSE_READER_SIZE];
+    size_t len;
+    size_t start;
+} POSE_READER;
+
+// Per consumer counters of a stream
+typedef struct {
+    int started;
+    uint32_t expected;
+    uint64_t window;
+    unsigned long received;
+    unsigned long lost;
+    unsigned long duplicated;
+    unsigned long reordered;
+    unsigned long malformed;
+} POSE_STATS;
+
+// Function to format a motor record, returns its length
+// The record is terminated by the string terminator, not counted in the length
+int format_axis_record(char *record, uint32_t seq, float pos)
+{
+    int len = encode_uint(record, seq);
+    record[len++] = ';';
+    len += encode_fixed(record + len, pos);
+    record[len++] = '\n';
+    record[len] = '\0';
+
+    return len;
+}
+
+// Function to format a world record, returns its length
+int format_pose_record(char *record, uint32_t seq, float x, float z)
+{
+    int len = encode_uint(record, seq);
+    record[len++] = ';';
+    len += encode_fixed(record + len, x);
+    record[len++] = ';';
+    len += encode_fixed(record + len, z);
+    record[len++] = '\n';
+    record[len] = '\0';
+
+    return len;
+}
+
+// Function to parse a motor record, returns 0 on success
+int parse_axis_record(char *record, uint32_t *seq, float *pos)
+{
+    if ((record = decode_uint(record, seq)) == NULL || *record++ != ';')
+    {
+        return -1;
+    }
+
+    return ((record = decode_fixed(record, pos)) == NULL || *record != '\0') ? -1 : 0;
+}
+
+// Function to parse a world record, returns 0 on success
+int parse_pose_record(char *record, uint32_t *seq, float *x, float *z)
+{
+    if ((record = decode_uint(record, seq)) == NULL || *record++ != ';' || (record = decode_fixed(record, x)) == NULL || *record++ != ';')
+    {
+        return -1;
+    }
+
+    return ((record = decode_fixed(record, z)) == NULL || *record != '\0') ? -1 : 0;
+}
+
+// Function to read from the FIFO into the reassembly buffer
+// Returns the number of bytes read or -1 on error
+int fill_pose_reader(int fd, POSE_READER *reader, POSE_STATS *stats)
+{
+    // Move the incomplete record at the start of the buffer
+    if (reader->start > 0)
+    {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->len - reader->start);
+        reader->len -= reader->start;
+        reader->start = 0;
+    }
+
+    // A record longer than the whole buffer is garbage, drop it
+    if (reader->len == POSE_READER_SIZE)
+    {
+        reader->len = 0;
+        stats->malformed++;
+    }
+
+    int n = read(fd, reader->buffer + reader->len, POSE_READER_SIZE - reader->len);
+    if (n > 0)
+    {
+        reader->len += n;
+    }
+
+    return n;
+}
+
+// Function to extract the next complete record from the reassembly buffer
+// The newline is replaced by the string terminator
+// Returns 1 if a record was extracted, 0 if there are no complete records
+int next_pose_record(POSE_READER *reader, char **record)
+{
+    char *begin = reader->buffer + reader->start;
+    char *end = memchr(begin, '\n', reader->len - reader->start);
+
+    if (end == NULL)
+    {
+        return 0;
+    }
+
+    *end = '\0';
+    *record = begin;
+    reader->start += end - begin + 1;
+
+    return 1;
+}
+
+// Function to update the counters with the sequence number of a received record
+void track_pose_sequence(POSE_STATS *stats, uint32_t seq)
+{
+    stats->received++;
+
+    // The first record only sets the expected sequence number
+    if (!stats->started)
+    {
+        stats->started = 1;
+        stats->expected = seq + 1;
+        stats->window = 1;
+        return;
+    }
+
+    int32_t diff = (int32_t)(seq - stats->expected);
+
+    if (diff >= 0)
+    {
+        // In order, or after a gap of diff records
+        stats->lost += diff;
+        stats->window = (diff + 1 >= POSE_WINDOW) ? 1 : (stats->window << (diff + 1)) | 1;
+        stats->expected = seq + 1;
+        return;
+    }
+
+    // Older than the last one, bit age of the window holds seq
+    uint32_t age = -diff - 1;
+
+    if (age < POSE_WINDOW && (stats->window & ((uint64_t)1 << age)))
+    {
+        stats->duplicated++;
+    }
+    else
+    {
+        // Late record, it was counted as lost when the gap was seen
+        stats->reordered++;
+        if (stats->lost > 0)
+        {
+            stats->lost--;
+        }
+        if (age < POSE_WINDOW)
+        {
+            stats->window |= (uint64_t)1 << age;
+        }
+    }
+}
+
+// Function to write the counters in a string
+void format_pose_stats(char *to_write, POSE_STATS *stats)
+{
+    sprintf(to_write, "received=%lu lost=%lu duplicated=%lu reordered=%lu malformed=%lu", stats->received, stats->lost, stats->duplicated, stats->reordered, stats->malformed);
+}
+
+#endif
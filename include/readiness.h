@@ -0,0 +1,42 @@
+#ifndef READINESS_H
+#define READINESS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Readiness handshake between the children and the master.
+// The master creates the FIFO before starting the children and keeps it open;
+// each child writes one "<name> <pid>\n" record when its channels are open and
+// its loop is about to start. A record is shorter than PIPE_BUF, so the records
+// of children starting together are never mixed.
+//
+// A child started by hand, without the master, finds no reader (or no FIFO)
+// and just goes on.
+
+#define READY_FIFO "/tmp/hoist_ready_fifo"
+
+// Longest readiness record
+#define READY_RECORD_MAX 64
+
+// Function to tell the master that the process is ready
+// Returns 0 on success or if there is no master, -1 on error
+int notify_ready(char *name)
+{
+    int fd = open(READY_FIFO, O_WRONLY | O_NONBLOCK);
+    if (fd == -1)
+    {
+        return (errno == ENXIO || errno == ENOENT) ? 0 : -1;
+    }
+
+    char record[READY_RECORD_MAX];
+    int len = snprintf(record, sizeof(record), "%s %d\n", name, getpid());
+    int m = write(fd, record, len);
+    close(fd);
+
+    return (m == len) ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,366 @@
+#ifndef RUNTIME_PROFILE_H
+#define RUNTIME_PROFILE_H
+
+// The includers must define _GNU_SOURCE before any other include for the CPU_* macros
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// File with the runtime profiles of the processes
+#define RUNTIME_PROFILE_FILE "./config/runtime_profile.conf"
+
+// Maximum number of profiles in the file
+#define MAX_RUNTIME_PROFILES 16
+
+// Environment variables used to pass the memory settings to the children,
+// mlockall() and the prefaulted stack do not survive exec()
+#define ENV_MLOCK "HOIST_MLOCK"
+#define ENV_PREFAULT_KB "HOIST_PREFAULT_KB"
+
+// Largest stack prefault, and the stack left free under RLIMIT_STACK for the frames of the process
+#define MAX_PREFAULT_KB 8192
+#define PREFAULT_STACK_MARGIN_KB 256
+
+// Runtime profile of a process.
+// cpu is -1 to leave the affinity untouched.
+typedef struct {
+    char name[20];
+    int cpu;
+    int policy;
+    int priority;
+    int mlock;
+    int prefault_kb;
+} RUNTIME_PROFILE;
+
+// Function to get the name of a scheduling policy
+char *policy_name(int policy)
+{
+    if (policy == SCHED_FIFO)
+    {
+        return "fifo";
+    }
+    else if (policy == SCHED_RR)
+    {
+        return "rr";
+    }
+    return "other";
+}
+
+// Function to parse a "key=value" field of a profile
+// Returns 0 on success, -1 on unknown key or bad value
+int parse_profile_field(RUNTIME_PROFILE *profile, char *field)
+{
+    char *value = strchr(field, '=');
+    if (value == NULL)
+    {
+        return -1;
+    }
+    *value++ = '\0';
+
+    if (strcmp(field, "policy") == 0)
+    {
+        if (strcmp(value, "fifo") == 0)
+        {
+            profile->policy = SCHED_FIFO;
+        }
+        else if (strcmp(value, "rr") == 0)
+        {
+            profile->policy = SCHED_RR;
+        }
+        else if (strcmp(value, "other") == 0)
+        {
+            profile->policy = SCHED_OTHER;
+        }
+        else
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+    // All the other fields are integers
+    char *end;
+    long number = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0')
+    {
+        return -1;
+    }
+
+    if (strcmp(field, "cpu") == 0)
+    {
+        profile->cpu = number;
+    }
+    else if (strcmp(field, "priority") == 0)
+    {
+        profile->priority = number;
+    }
+    else if (strcmp(field, "mlock") == 0)
+    {
+        profile->mlock = number;
+    }
+    else if (strcmp(field, "prefault_kb") == 0)
+    {
+        profile->prefault_kb = number;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function to get the largest stack that can be prefaulted under the stack limit of the process
+// The children inherit the limit of the master, so the same bound holds when they apply the profile
+int max_prefault_kb()
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_STACK, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY ||
+        limit.rlim_cur / 1024 >= MAX_PREFAULT_KB + PREFAULT_STACK_MARGIN_KB)
+    {
+        return MAX_PREFAULT_KB;
+    }
+    if (limit.rlim_cur / 1024 <= PREFAULT_STACK_MARGIN_KB)
+    {
+        return 0;
+    }
+    return limit.rlim_cur / 1024 - PREFAULT_STACK_MARGIN_KB;
+}
+
+// Function to check that a profile can be applied on this machine
+// Returns 0 if valid, otherwise -1 with the reason in error
+int validate_runtime_profile(RUNTIME_PROFILE *profile, char *error)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (profile->cpu < -1 || profile->cpu >= cpus)
+    {
+        sprintf(error, "%s: cpu %d out of range (%ld online)", profile->name, profile->cpu, cpus);
+        return -1;
+    }
+    if (profile->priority < sched_get_priority_min(profile->policy) || profile->priority > sched_get_priority_max(profile->policy))
+    {
+        sprintf(error, "%s: priority %d not valid for policy %s (%d-%d)", profile->name, profile->priority, policy_name(profile->policy),
+                sched_get_priority_min(profile->policy), sched_get_priority_max(profile->policy));
+        return -1;
+    }
+    if (profile->mlock != 0 && profile->mlock != 1)
+    {
+        sprintf(error, "%s: mlock must be 0 or 1", profile->name);
+        return -1;
+    }
+    if (profile->prefault_kb < 0 || profile->prefault_kb > max_prefault_kb())
+    {
+        sprintf(error, "%s: prefault_kb must be between 0 and %d (stack limit)", profile->name, max_prefault_kb());
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function to load and validate the profiles
+// Lines are "<process> key=value ...", '#' starts a comment
+// Returns the number of profiles, 0 if the file does not exist, -1 on error with the reason in error
+int load_runtime_profiles(char *path, RUNTIME_PROFILE *profiles, char *error)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+        sprintf(error, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    int count = 0;
+    int line_number = 0;
+    char line[256];
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+
+        // Strip comments
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+
+        char *token = strtok(line, " \t\r\n");
+        if (token == NULL)
+        {
+            continue;
+        }
+
+        if (count == MAX_RUNTIME_PROFILES)
+        {
+            sprintf(error, "%s:%d: too many profiles", path, line_number);
+            fclose(file);
+            return -1;
+        }
+
+        // Defaults, a process with only its name keeps the default scheduling
+        RUNTIME_PROFILE *profile = &profiles[count];
+        memset(profile, 0, sizeof(RUNTIME_PROFILE));
+        strncpy(profile->name, token, sizeof(profile->name) - 1);
+        profile->cpu = -1;
+        profile->policy = SCHED_OTHER;
+
+        while ((token = strtok(NULL, " \t\r\n")) != NULL)
+        {
+            if (parse_profile_field(profile, token))
+            {
+                sprintf(error, "%s:%d: bad field '%s'", path, line_number, token);
+                fclose(file);
+                return -1;
+            }
+        }
+
+        char reason[150];
+        if (validate_runtime_profile(profile, reason))
+        {
+            sprintf(error, "%s:%d: %s", path, line_number, reason);
+            fclose(file);
+            return -1;
+        }
+
+        count++;
+    }
+
+    fclose(file);
+    return count;
+}
+
+// Function to find the profile of a process, NULL if it has none
+RUNTIME_PROFILE *find_runtime_profile(RUNTIME_PROFILE *profiles, int count, char *name)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(profiles[i].name, name) == 0)
+        {
+            return &profiles[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Function to apply the affinity and the scheduling policy to a process or a thread
+// The children of the master apply it to themselves before exec(), so their threads inherit it
+// Writes what was applied or why it failed in report
+// Returns 0 if everything was applied, -1 otherwise
+int apply_runtime_profile(pid_t pid, RUNTIME_PROFILE *profile, char *report)
+{
+    int ret = 0;
+    report += sprintf(report, "%s (pid %d):", profile->name, pid);
+
+    if (profile->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(profile->cpu, &set);
+
+        if (sched_setaffinity(pid, sizeof(set), &set) == -1)
+        {
+            report += sprintf(report, " cpu %d not applied (%s);", profile->cpu, strerror(errno));
+            ret = -1;
+        }
+        else
+        {
+            report += sprintf(report, " cpu %d;", profile->cpu);
+        }
+    }
+
+    struct sched_param param;
+    param.sched_priority = profile->priority;
+
+    if (sched_setscheduler(pid, profile->policy, &param) == -1)
+    {
+        report += sprintf(report, " policy %s priority %d not applied (%s);", policy_name(profile->policy), profile->priority, strerror(errno));
+        ret = -1;
+    }
+    else
+    {
+        report += sprintf(report, " policy %s priority %d;", policy_name(profile->policy), profile->priority);
+    }
+
+    sprintf(report, " mlock %d, prefault %d kB requested", profile->mlock, profile->prefault_kb);
+
+    return ret;
+}
+
+// Function called by the child before exec() to pass the memory settings
+void export_runtime_profile(RUNTIME_PROFILE *profile)
+{
+    char value[16];
+
+    sprintf(value, "%d", profile->mlock);
+    setenv(ENV_MLOCK, value, 1);
+    sprintf(value, "%d", profile->prefault_kb);
+    setenv(ENV_PREFAULT_KB, value, 1);
+}
+
+// Function to touch the stack pages so they are mapped before the main loop
+// Kept out of line so that the array is really on the stack, the pages are
+// written through a volatile pointer so the compiler cannot drop the stores
+__attribute__((noinline)) void prefault_stack(int kb)
+{
+    char stack[kb * 1024];
+    volatile char *page = stack;
+    for (int i = 0; i < kb * 1024; i += 4096)
+    {
+        page[i] = 0;
+    }
+}
+
+// Function called by a process at startup to apply the memory settings passed by the master
+// Writes what was applied in report, which is empty if there is no profile
+// Returns 0 on success, -1 if mlockall() failed
+int apply_memory_profile(char *report)
+{
+    char *mlock = getenv(ENV_MLOCK);
+    char *prefault = getenv(ENV_PREFAULT_KB);
+    int ret = 0;
+
+    report[0] = '\0';
+
+    if (prefault != NULL && atoi(prefault) > 0)
+    {
+        // Never more than the stack limit allows, the array would overflow the stack
+        int kb = atoi(prefault);
+        int limited = kb > max_prefault_kb();
+        if (limited)
+        {
+            kb = max_prefault_kb();
+        }
+        prefault_stack(kb);
+        report += sprintf(report, "stack prefaulted (%d kB%s); ", kb, limited ? ", limited by RLIMIT_STACK" : "");
+    }
+
+    if (mlock != NULL && atoi(mlock))
+    {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+        {
+            sprintf(report, "mlockall failed (%s)", strerror(errno));
+            ret = -1;
+        }
+        else
+        {
+            sprintf(report, "memory locked");
+        }
+    }
+
+    return ret;
+}
+
+#endif
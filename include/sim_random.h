@@ -0,0 +1,55 @@
+#ifndef SIM_RANDOM_H
+#define SIM_RANDOM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Pseudo-random numbers of the simulation: the noise of the sensors and the
+// containers of the inspection console.
+// The generator is a xorshift with its own state instead of rand(), so a seed
+// gives the same numbers with any C library and nothing else in the process
+// consumes them. HOIST_SEED sets the seed of every process (the master passes
+// its environment to the children); without it each process keeps the seed it
+// had with rand(): 1 for the noise, the time for the containers.
+
+#define ENV_SEED "HOIST_SEED"
+
+// Seed of rand() when srand() is never called
+#define DEFAULT_SEED 1
+
+// State of the generator, never 0
+uint32_t random_state = DEFAULT_SEED;
+
+// Function to set the seed
+void seed_random(uint32_t seed)
+{
+    // The seeds are spread so that close seeds give unrelated sequences
+    seed = (seed ^ 61) ^ (seed >> 16);
+    seed *= 0x27d4eb2d;
+    seed ^= seed >> 15;
+    random_state = seed ? seed : DEFAULT_SEED;
+}
+
+// Function to set the seed from HOIST_SEED, or to fallback if it is not set
+// Returns the seed used
+uint32_t seed_random_from_env(uint32_t fallback)
+{
+    char *env = getenv(ENV_SEED);
+    uint32_t seed = (env != NULL && *env != '\0') ? (uint32_t)strtoul(env, NULL, 0) : fallback;
+    seed_random(seed);
+    return seed;
+}
+
+// Function to get the next number, between 0 and 2^31 - 1 like rand()
+int next_random()
+{
+    uint32_t x = random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random_state = x;
+
+    return (int)(x >> 1);
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "tick_timer.h"
+
+// Lock-free queue with a single producer thread and a single consumer thread.
+// head is only written by the consumer and tail only by the producer, they are
+// kept on different cache lines so that the two threads do not share a line.
+typedef struct {
+    uint32_t head;
+    char head_pad[60];
+    uint32_t tail;
+    char tail_pad[60];
+    uint32_t capacity;
+    uint32_t item_size;
+    unsigned char *items;
+} SPSC_QUEUE;
+
+// Counter the consumer sleeps on when its queues are empty.
+// The producers only make the wake system call if the consumer is sleeping.
+typedef struct {
+    uint32_t seq;
+    uint32_t waiters;
+} DOORBELL;
+
+// Function to allocate a queue, capacity must be a power of two
+// Returns 0 on success, -1 on error
+int init_spsc_queue(SPSC_QUEUE *queue, uint32_t capacity, uint32_t item_size)
+{
+    memset(queue, 0, sizeof(SPSC_QUEUE));
+    queue->capacity = capacity;
+    queue->item_size = item_size;
+
+    if ((queue->items = malloc((size_t)capacity * item_size)) == NULL)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function to add an item to the queue
+// Returns 0 on success, -1 if the queue is full
+int spsc_push(SPSC_QUEUE *queue, void *item)
+{
+    uint32_t tail = queue->tail;
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    if (tail - head == queue->capacity)
+    {
+        return -1;
+    }
+
+    memcpy(queue->items + (size_t)(tail & (queue->capacity - 1)) * queue->item_size, item, queue->item_size);
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+// Function to remove the oldest item from the queue
+// Returns 1 if an item was removed, 0 if the queue is empty
+int spsc_pop(SPSC_QUEUE *queue, void *item)
+{
+    uint32_t head = queue->head;
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+    {
+        return 0;
+    }
+
+    memcpy(item, queue->items + (size_t)(head & (queue->capacity - 1)) * queue->item_size, queue->item_size);
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+// Function to get the number of items in the queue
+uint32_t spsc_size(SPSC_QUEUE *queue)
+{
+    return __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+}
+
+// Function to get the value to pass to wait_doorbell(), read it before draining the queues
+uint32_t doorbell_seq(DOORBELL *bell)
+{
+    return __atomic_load_n(&bell->seq, __ATOMIC_SEQ_CST);
+}
+
+// Function to wake the consumer after pushing items
+void ring_doorbell(DOORBELL *bell)
+{
+    __atomic_add_fetch(&bell->seq, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&bell->waiters, __ATOMIC_SEQ_CST))
+    {
+        syscall(SYS_futex, &bell->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+// Function to sleep until the doorbell rings after seen or the monotonic deadline passes
+// A deadline of 0 waits without timeout
+void wait_doorbell(DOORBELL *bell, uint32_t seen, uint64_t deadline_ns)
+{
+    struct timespec timeout, *timeout_ptr = NULL;
+
+    if (deadline_ns)
+    {
+        uint64_t now = monotonic_ns();
+        if (now >= deadline_ns)
+        {
+            return;
+        }
+        timeout.tv_sec = (deadline_ns - now) / 1000000000ULL;
+        timeout.tv_nsec = (deadline_ns - now) % 1000000000ULL;
+        timeout_ptr = &timeout;
+    }
+
+    __atomic_add_fetch(&bell->waiters, 1, __ATOMIC_SEQ_CST);
+
+    // Returns immediately if the doorbell rang in the meantime
+    syscall(SYS_futex, &bell->seq, FUTEX_WAIT_PRIVATE, seen, timeout_ptr, NULL, 0);
+
+    __atomic_sub_fetch(&bell->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+#endif
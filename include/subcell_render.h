@@ -0,0 +1,233 @@
+#ifndef SUBCELL_RENDER_H
+#define SUBCELL_RENDER_H
+
+#ifndef NCURSES_WIDECHAR
+#define NCURSES_WIDECHAR 1
+#endif
+#include <ncurses.h>
+#include <wchar.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Sub-cell rendering of the hoist on a scalable viewport.
+// A character cell holds 2x4 braille dots, so the cable and the end-effector
+// are drawn with 2 dots per cell horizontally and 4 vertically, while the
+// trolley on the top rail and the marker beside the structure are one cell
+// blocks shifted by eighths of a cell. The glyphs are built once in tables
+// indexed by the dots or the eighths to draw: a frame costs one lookup per
+// drawn cell whatever the resolution.
+
+// First braille pattern, the other 255 follow in the order of their dot bits
+#define BRAILLE_BASE 0x2800
+
+// Dots of a braille cell
+#define BRAILLE_COLS 2
+#define BRAILLE_ROWS 4
+
+// Scale of the viewport in cells per world unit, by default the largest fitting the terminal
+#define ENV_VIEW_SCALE "HOIST_VIEW_SCALE"
+
+// Part of the viewport kept between the end-effector and the edges when it does not show the whole world
+#define VIEW_MARGIN 0.2
+
+typedef struct {
+    // World coordinates of the top left corner
+    float x0, z0;
+    // Cells per world unit, on both axes
+    float scale;
+    // Size in cells
+    int width, height;
+    // Origin and size of the world
+    float world_x0, world_z0;
+    float world_w, world_h;
+} VIEWPORT;
+
+// Glyphs of the 256 braille patterns, of the blocks filled from the left and of the blocks filled from the bottom
+cchar_t braille_glyphs[256];
+cchar_t left_eighth_glyphs[9];
+cchar_t lower_eighth_glyphs[9];
+
+// Bit of each braille dot, by row and column
+int braille_bits[BRAILLE_ROWS][BRAILLE_COLS] = {{0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}};
+
+// Patterns of a cell crossed by the cable, by column, and of the cell of the end-effector,
+// by column and row of the end-effector
+int cable_patterns[BRAILLE_COLS];
+int end_effector_patterns[BRAILLE_COLS][BRAILLE_ROWS];
+
+// Function to build the glyph tables, after setlocale() and before drawing
+void init_glyph_tables()
+{
+    wchar_t glyph[2] = {0, 0};
+
+    for (int i = 0; i < 256; i++)
+    {
+        glyph[0] = BRAILLE_BASE + i;
+        setcchar(&braille_glyphs[i], glyph, A_NORMAL, 0, NULL);
+    }
+
+    wchar_t *left = L" ▏▎▍▌▋▊▉█";
+    wchar_t *lower = L" ▁▂▃▄▅▆▇█";
+    for (int i = 0; i <= 8; i++)
+    {
+        glyph[0] = left[i];
+        setcchar(&left_eighth_glyphs[i], glyph, A_NORMAL, 0, NULL);
+        glyph[0] = lower[i];
+        setcchar(&lower_eighth_glyphs[i], glyph, A_NORMAL, 0, NULL);
+    }
+
+    for (int c = 0; c < BRAILLE_COLS; c++)
+    {
+        cable_patterns[c] = 0;
+        for (int r = 0; r < BRAILLE_ROWS; r++)
+        {
+            // The cable ends on the end-effector dot, which has its neighbour on the other column
+            end_effector_patterns[c][r] = cable_patterns[c] | braille_bits[r][0] | braille_bits[r][1];
+            cable_patterns[c] |= braille_bits[r][c];
+        }
+    }
+}
+
+// Function to size the viewport for the available cells, the world goes from (x_min, z_min) to (x_max, z_max)
+void fit_viewport(VIEWPORT *view, float x_min, float x_max, float z_min, float z_max, int avail_w, int avail_h)
+{
+    float world_w = x_max - x_min;
+    float world_h = z_max - z_min;
+
+    view->world_x0 = x_min;
+    view->world_z0 = z_min;
+    view->world_w = world_w;
+    view->world_h = world_h;
+    view->scale = fminf(avail_w / world_w, avail_h / world_h);
+
+    char *env = getenv(ENV_VIEW_SCALE);
+    if (env != NULL && atof(env) > 0)
+    {
+        view->scale = atof(env);
+    }
+
+    // Show the whole world if it fits, all the available cells otherwise
+    view->width = (int)fminf(avail_w, ceilf(world_w * view->scale));
+    view->height = (int)fminf(avail_h, ceilf(world_h * view->scale));
+    if (view->width < 1)
+    {
+        view->width = 1;
+    }
+    if (view->height < 1)
+    {
+        view->height = 1;
+    }
+    view->x0 = x_min;
+    view->z0 = z_min;
+}
+
+// Function to move the viewport along an axis so that a coordinate stays visible
+// The world goes from world_origin to world_origin + world
+float follow_axis(float origin, float pos, float visible, float world_origin, float world)
+{
+    if (visible >= world)
+    {
+        return world_origin;
+    }
+
+    float margin = visible * VIEW_MARGIN;
+    if (pos < origin + margin)
+    {
+        origin = pos - margin;
+    }
+    else if (pos > origin + visible - margin)
+    {
+        origin = pos - visible + margin;
+    }
+
+    return fminf(fmaxf(origin, world_origin), world_origin + world - visible);
+}
+
+// Function to move the viewport so that the end-effector stays visible
+// Returns 1 if the viewport moved, 0 otherwise
+int follow_viewport(VIEWPORT *view, float x, float z)
+{
+    float x0 = follow_axis(view->x0, x, view->width / view->scale, view->world_x0, view->world_w);
+    float z0 = follow_axis(view->z0, z, view->height / view->scale, view->world_z0, view->world_h);
+    int moved = (x0 != view->x0 || z0 != view->z0);
+
+    view->x0 = x0;
+    view->z0 = z0;
+    return moved;
+}
+
+// Function to convert a world coordinate to a number of sub-cells from the origin of the viewport,
+// clamped to the sub-cells of the viewport
+long to_subcells(float pos, float origin, float scale, int subcells, int cells)
+{
+    long n = (long)floorf((pos - origin) * scale * subcells);
+    long max = (long)cells * subcells - 1;
+
+    return n < 0 ? 0 : (n > max ? max : n);
+}
+
+// Function to draw the cable from the top of the viewport down to the end-effector, in braille dots
+void draw_subcell_cable(int starty, int startx, VIEWPORT *view, float x, float z, attr_t end_effector_attr)
+{
+    long dot_x = to_subcells(x, view->x0, view->scale, BRAILLE_COLS, view->width);
+    long dot_z = to_subcells(z, view->z0, view->scale, BRAILLE_ROWS, view->height);
+    int col = dot_x / BRAILLE_COLS;
+    int row = dot_z / BRAILLE_ROWS;
+
+    for (int r = 0; r < row; r++)
+    {
+        mvadd_wch(starty + r, startx + col, &braille_glyphs[cable_patterns[dot_x % BRAILLE_COLS]]);
+    }
+
+    attron(end_effector_attr);
+    mvadd_wch(starty + row, startx + col, &braille_glyphs[end_effector_patterns[dot_x % BRAILLE_COLS][dot_z % BRAILLE_ROWS]]);
+    attroff(end_effector_attr);
+}
+
+// Function to draw a one cell block on a row, shifted right by eighths of a cell
+void draw_subcell_marker_x(int y, int startx, VIEWPORT *view, float x, attr_t attr)
+{
+    long eighths = to_subcells(x - 0.5 / view->scale, view->x0, view->scale, 8, view->width - 1);
+    int col = eighths / 8;
+    int shift = eighths % 8;
+
+    attron(attr);
+    if (shift == 0)
+    {
+        mvadd_wch(y, startx + col, &left_eighth_glyphs[8]);
+    }
+    else
+    {
+        // The right part of the first cell is the inverse of its left part
+        attron(A_REVERSE);
+        mvadd_wch(y, startx + col, &left_eighth_glyphs[shift]);
+        attroff(A_REVERSE);
+        mvadd_wch(y, startx + col + 1, &left_eighth_glyphs[shift]);
+    }
+    attroff(attr);
+}
+
+// Function to draw a one cell block on a column, shifted down by eighths of a cell
+void draw_subcell_marker_z(int starty, int x, VIEWPORT *view, float z, attr_t attr)
+{
+    long eighths = to_subcells(z - 0.5 / view->scale, view->z0, view->scale, 8, view->height - 1);
+    int row = eighths / 8;
+    int shift = eighths % 8;
+
+    attron(attr);
+    if (shift == 0)
+    {
+        mvadd_wch(starty + row, x, &lower_eighth_glyphs[8]);
+    }
+    else
+    {
+        // The first cell is filled from the bottom, the second one from the top
+        mvadd_wch(starty + row, x, &lower_eighth_glyphs[8 - shift]);
+        attron(A_REVERSE);
+        mvadd_wch(starty + row + 1, x, &lower_eighth_glyphs[8 - shift]);
+        attroff(A_REVERSE);
+    }
+    attroff(attr);
+}
+
+#endif
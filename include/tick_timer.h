@@ -0,0 +1,82 @@
+#ifndef TICK_TIMER_H
+#define TICK_TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+// Periodic deadline for a loop waiting on select().
+// Inputs may wake the loop before the deadline, so the loop only advances
+// when the deadline has passed and uses the real time elapsed since the
+// previous advance instead of the nominal period.
+typedef struct {
+    uint64_t period_ns;
+    uint64_t next_ns;
+    uint64_t last_ns;
+} TICK_TIMER;
+
+// Result of an advance of the timer
+typedef struct {
+    double dt;
+    uint64_t lateness_ns;
+    uint64_t missed;
+} TICK;
+
+// Function to get the monotonic time in nanoseconds
+uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Function to start the timer, the first deadline is one period from now
+void start_tick_timer(TICK_TIMER *timer, uint64_t period_ns)
+{
+    timer->period_ns = period_ns;
+    timer->last_ns = monotonic_ns();
+    timer->next_ns = timer->last_ns + period_ns;
+}
+
+// Function to get the select() timeout up to the next deadline
+struct timeval tick_timeout(TICK_TIMER *timer)
+{
+    struct timeval timeout = {0, 0};
+    uint64_t now = monotonic_ns();
+
+    if (timer->next_ns > now)
+    {
+        uint64_t left_us = (timer->next_ns - now + 999) / 1000;
+        timeout.tv_sec = left_us / 1000000;
+        timeout.tv_usec = left_us % 1000000;
+    }
+
+    return timeout;
+}
+
+// Function to check if the deadline has passed
+int tick_due(TICK_TIMER *timer)
+{
+    return monotonic_ns() >= timer->next_ns;
+}
+
+// Function to advance the timer after the deadline has passed
+// Returns the real time since the previous advance, how late this tick is
+// and how many whole periods were skipped
+TICK advance_tick_timer(TICK_TIMER *timer)
+{
+    TICK tick;
+    uint64_t now = monotonic_ns();
+
+    tick.dt = (now - timer->last_ns) / 1e9;
+    tick.lateness_ns = now > timer->next_ns ? now - timer->next_ns : 0;
+    tick.missed = tick.lateness_ns / timer->period_ns;
+
+    // Keep the deadlines on the original grid, skipping the missed ones
+    timer->next_ns += (tick.missed + 1) * timer->period_ns;
+    timer->last_ns = now;
+
+    return tick;
+}
+
+#endif
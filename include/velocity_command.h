@@ -0,0 +1,112 @@
+#ifndef VELOCITY_COMMAND_H
+#define VELOCITY_COMMAND_H
+
+#include <stdio.h>
+#include <string.h>
+#include "fixed_point.h"
+
+// Commands sent by the command console on the velocity FIFOs, newline terminated text:
+//   "velocity delta <n>\n"   change the velocity by n steps, n is signed
+//   "velocity stop\n"        stop the motor
+// The console coalesces the keys and buttons of a frame in one write per axis,
+// so a write holds at most a stop followed by a delta. The motors split the
+// records with the reassembly buffer of the position FIFOs (see pose_stream.h).
+
+// Maximum length of the commands of a frame, newlines and terminator included
+#define VELOCITY_BATCH_MAX 48
+
+// Maximum number of steps of a single delta
+#define VELOCITY_DELTA_MAX 1000
+
+// Command parsed by a motor
+typedef struct {
+    int stop;
+    int delta;
+} VELOCITY_COMMAND;
+
+// Keys and buttons of an axis coalesced during a frame
+typedef struct {
+    int stop;
+    int delta;
+    int events;
+} VELOCITY_BATCH;
+
+// Function to add steps to the batch of an axis
+void batch_velocity_delta(VELOCITY_BATCH *batch, int delta)
+{
+    batch->delta += delta;
+    batch->events++;
+}
+
+// Function to add a stop to the batch of an axis, the steps before it are cancelled
+void batch_velocity_stop(VELOCITY_BATCH *batch)
+{
+    batch->stop = 1;
+    batch->delta = 0;
+    batch->events++;
+}
+
+// Function to format the commands of a batch
+// Returns their length, 0 if the batch does not change the velocity
+int format_velocity_batch(char *out, VELOCITY_BATCH *batch)
+{
+    int len = 0;
+
+    if (batch->stop)
+    {
+        len += sprintf(out + len, "velocity stop\n");
+    }
+
+    // Steps cancelling each other are not sent
+    if (batch->delta != 0)
+    {
+        int delta = batch->delta;
+        if (delta > VELOCITY_DELTA_MAX)
+        {
+            delta = VELOCITY_DELTA_MAX;
+        }
+        else if (delta < -VELOCITY_DELTA_MAX)
+        {
+            delta = -VELOCITY_DELTA_MAX;
+        }
+        len += sprintf(out + len, "velocity delta %d\n", delta);
+    }
+
+    return len;
+}
+
+// Function to parse a command, without the newline
+// Returns 0 on success, -1 if the command is not valid
+int parse_velocity_command(char *record, VELOCITY_COMMAND *cmd)
+{
+    if (strcmp(record, "velocity stop") == 0)
+    {
+        cmd->stop = 1;
+        cmd->delta = 0;
+        return 0;
+    }
+
+    if (strncmp(record, "velocity delta ", 15) != 0)
+    {
+        return -1;
+    }
+    record += 15;
+
+    int negative = (*record == '-');
+    if (negative || *record == '+')
+    {
+        record++;
+    }
+
+    uint32_t steps;
+    if ((record = decode_uint(record, &steps)) == NULL || *record != '\0' || steps > VELOCITY_DELTA_MAX)
+    {
+        return -1;
+    }
+
+    cmd->stop = 0;
+    cmd->delta = negative ? -(int)steps : (int)steps;
+    return 0;
+}
+
+#endif
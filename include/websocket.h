@@ -0,0 +1,250 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Minimal server side of the WebSocket protocol (RFC 6455): the handshake
+// key, the header of the frames sent by the server and the parsing of the
+// masked frames sent by the browsers. Messages are never fragmented.
+
+// Key appended to the one of the client before hashing it
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+// Opcodes
+#define WS_OP_TEXT 0x1
+#define WS_OP_BINARY 0x2
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xA
+
+// Maximum length of the header of a frame sent by the server
+#define WS_HEADER_MAX 10
+
+// Length of the Sec-WebSocket-Accept value, without terminator
+#define WS_ACCEPT_LEN 28
+
+// Function to rotate a word left
+uint32_t rotate_left(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// Function to compute the SHA-1 digest of a message
+void sha1(const uint8_t *data, size_t len, uint8_t digest[20])
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint64_t bits = (uint64_t)len * 8;
+
+    // Blocks of the message, the last ones with the padding and the length
+    size_t total = ((len + 8) / 64 + 1) * 64;
+    for (size_t offset = 0; offset < total; offset += 64)
+    {
+        uint8_t block[64];
+        for (int i = 0; i < 64; i++)
+        {
+            size_t pos = offset + i;
+            if (pos < len)
+            {
+                block[i] = data[pos];
+            }
+            else if (pos == len)
+            {
+                block[i] = 0x80;
+            }
+            else if (pos >= total - 8)
+            {
+                block[i] = bits >> (8 * (total - 1 - pos));
+            }
+            else
+            {
+                block[i] = 0;
+            }
+        }
+
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+        }
+        for (int i = 16; i < 80; i++)
+        {
+            w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            uint32_t tmp = rotate_left(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotate_left(b, 30);
+            b = a;
+            a = tmp;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    for (int i = 0; i < 20; i++)
+    {
+        digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
+
+// Function to encode bytes in base64, with terminator
+void base64_encode(const uint8_t *data, size_t len, char *out)
+{
+    const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    for (size_t i = 0; i < len; i += 3)
+    {
+        uint32_t group = (uint32_t)data[i] << 16;
+        if (i + 1 < len)
+        {
+            group |= (uint32_t)data[i + 1] << 8;
+        }
+        if (i + 2 < len)
+        {
+            group |= data[i + 2];
+        }
+
+        *out++ = alphabet[(group >> 18) & 0x3F];
+        *out++ = alphabet[(group >> 12) & 0x3F];
+        *out++ = (i + 1 < len) ? alphabet[(group >> 6) & 0x3F] : '=';
+        *out++ = (i + 2 < len) ? alphabet[group & 0x3F] : '=';
+    }
+    *out = '\0';
+}
+
+// Function to compute the Sec-WebSocket-Accept value of a client key
+void ws_accept_key(const char *key, size_t key_len, char accept[WS_ACCEPT_LEN + 1])
+{
+    uint8_t message[128];
+    uint8_t digest[20];
+
+    // Longer keys are not valid, they are truncated so that the handshake fails
+    if (key_len > sizeof(message) - strlen(WS_GUID))
+    {
+        key_len = sizeof(message) - strlen(WS_GUID);
+    }
+
+    memcpy(message, key, key_len);
+    memcpy(message + key_len, WS_GUID, strlen(WS_GUID));
+    sha1(message, key_len + strlen(WS_GUID), digest);
+    base64_encode(digest, 20, accept);
+}
+
+// Function to write the header of an unmasked, unfragmented frame
+// Returns the length of the header
+int ws_frame_header(uint8_t *out, int opcode, uint64_t payload_len)
+{
+    out[0] = 0x80 | opcode;
+
+    if (payload_len < 126)
+    {
+        out[1] = payload_len;
+        return 2;
+    }
+    if (payload_len < 65536)
+    {
+        out[1] = 126;
+        out[2] = payload_len >> 8;
+        out[3] = payload_len;
+        return 4;
+    }
+
+    out[1] = 127;
+    for (int i = 0; i < 8; i++)
+    {
+        out[2 + i] = payload_len >> (56 - 8 * i);
+    }
+    return 10;
+}
+
+// Function to parse a frame sent by a client, unmasking its payload in place
+// Returns the length of the frame, 0 if it is not complete, -1 if it is not valid
+long ws_parse_frame(uint8_t *data, size_t len, int *opcode, uint8_t **payload, uint64_t *payload_len)
+{
+    if (len < 2)
+    {
+        return 0;
+    }
+
+    // Frames from the clients must be masked
+    if (!(data[1] & 0x80))
+    {
+        return -1;
+    }
+
+    *opcode = data[0] & 0x0F;
+    uint64_t n = data[1] & 0x7F;
+    size_t header = 2;
+
+    if (n == 126)
+    {
+        if (len < 4)
+        {
+            return 0;
+        }
+        n = (uint64_t)data[2] << 8 | data[3];
+        header = 4;
+    }
+    else if (n == 127)
+    {
+        if (len < 10)
+        {
+            return 0;
+        }
+        n = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            n = n << 8 | data[2 + i];
+        }
+        header = 10;
+    }
+
+    // Mask and payload
+    if (n > len || len < header + 4 + n)
+    {
+        return 0;
+    }
+
+    uint8_t *mask = data + header;
+    *payload = data + header + 4;
+    *payload_len = n;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        (*payload)[i] ^= mask[i % 4];
+    }
+
+    return header + 4 + n;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef WORLD_CORE_H
+#define WORLD_CORE_H
+
+#include <stdlib.h>
+#include "sim_random.h"
+
+// Define maximum and minimum positions, the world process takes them from the configuration
+float min_x_pos = 0.0;
+float max_x_pos = 40.0;
+float min_z_pos = 0.0;
+float max_z_pos = 10.0;
+
+// Error of the measured positions: a uniform error up to this fraction of the
+// position, in hundredths (the resolution) as add_error() returns them
+#define SENSOR_RELATIVE_ERROR 0.005
+#define SENSOR_RESOLUTION 0.01
+
+// Error currently applied, the world process takes it from the configuration
+float sensor_relative_error = SENSOR_RELATIVE_ERROR;
+
+// Function to randomly get a number between two integers
+int random_between(int a, int b)
+{
+    return (next_random() % (b - a + 1)) + a;
+}
+
+// Function to pick a random number between two integers
+int pick_random(int a, int b)
+{
+    int num = random_between(a, b);
+
+    // If num is closer to a, return a
+    if (num - a < b - num)
+    {
+        return a;
+    }
+    // If num is closer to b, return b
+    else
+    {
+        return b;
+    }
+}
+
+// Function to add a random 0.5% error to the position
+float add_error(float pos)
+{
+    // Calculate the error
+    float error = pos * sensor_relative_error;
+
+    // Calculate the minimum and maximum values
+    float min = pos - error;
+    float max = pos + error;
+
+    // Return a random value between the minimum and maximum
+    return (float)random_between((int)(min * 100), (int)(max * 100)) / 100;
+}
+
+// Function to get the position measured on an axis, with the error and within the limits
+float sense_position(char axis, float pos)
+{
+    // Add a random 0.5% error
+    float real_pos = add_error(pos);
+
+    // Check if the position is out of bounds
+    if (axis == 'x')
+    {
+        if (real_pos < min_x_pos)
+        {
+            real_pos = min_x_pos;
+        }
+        else if (real_pos > max_x_pos)
+        {
+            real_pos = max_x_pos;
+        }
+    }
+    else if (axis == 'z')
+    {
+        if (real_pos < min_z_pos)
+        {
+            real_pos = min_z_pos;
+        }
+        else if (real_pos > max_z_pos)
+        {
+            real_pos = max_z_pos;
+        }
+    }
+
+    return real_pos;
+}
+
+#endif
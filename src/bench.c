@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "./../include/inspection_utilities.h"
+#include "./../include/velocity_command.h"
+#include "./../include/pose_stream.h"
+#include "./../include/world_core.h"
+#include "./../include/tick_timer.h"
+
+// Microbenchmarks of the hot paths of the processes: the velocity commands of
+// the command console, the encoding and decoding of the positions, the noise
+// of the world process, its merge of the motors streams and the drawing of the
+// inspection console on an off-screen terminal.
+//
+// Every case is run in BENCH_SAMPLES samples and the median is reported, as a
+// JSON document on the standard output with the cases always in the same order,
+// so two runs can be compared with a plain diff or a script. The benchmark is
+// compiled with the same flags as the processes, it measures the code as it runs.
+//
+// Usage: bench [seconds [case]]
+//   seconds  time spent on each case, 1 by default
+//   case     only run the cases whose name starts with this prefix
+
+// Number of samples of a case
+#define BENCH_SAMPLES 5
+
+// Operations run once before measuring a case
+#define BENCH_WARMUP 100
+
+// Records merged by the world case, a burst of a motor in a slow tick
+#define MERGE_RECORDS 16
+
+// Size of the off-screen terminal of the render cases
+#define RENDER_COLUMNS "120"
+#define RENDER_LINES "40"
+
+// Result kept alive so the compiler cannot drop the work
+volatile long sink;
+
+// Pipe of the velocity round trip and reassembly buffer of its reader
+int bench_pipe[2];
+POSE_READER bench_reader;
+POSE_STATS bench_stats;
+
+// Records of the merge case and of the decode cases
+char merge_records[MERGE_RECORDS * POSE_RECORD_MAX];
+int merge_len;
+char pose_record[POSE_RECORD_MAX];
+
+// Case of the benchmark, run runs the operation iterations times
+typedef struct {
+    const char *name;
+    const char *description;
+    void (*run)(long iterations);
+} BENCH_CASE;
+
+// Command console: a frame with a stop and a delta formatted like send_velocity()
+void bench_velocity_encode(long iterations)
+{
+    char buffer[VELOCITY_BATCH_MAX];
+    for (long i = 0; i < iterations; i++)
+    {
+        VELOCITY_BATCH batch = {0, 0, 0};
+        batch_velocity_stop(&batch);
+        batch_velocity_delta(&batch, (int)(i & 7) + 1);
+        sink += format_velocity_batch(buffer, &batch);
+    }
+}
+
+// Motors: decode of a delta command
+void bench_velocity_decode(long iterations)
+{
+    char record[] = "velocity delta -12";
+    VELOCITY_COMMAND cmd;
+    for (long i = 0; i < iterations; i++)
+    {
+        sink += parse_velocity_command(record, &cmd) + cmd.delta;
+    }
+}
+
+// Command console to motor: format, write on a pipe, read, split and decode
+void bench_velocity_pipe(long iterations)
+{
+    char buffer[VELOCITY_BATCH_MAX];
+    for (long i = 0; i < iterations; i++)
+    {
+        VELOCITY_BATCH batch = {0, 0, 0};
+        batch_velocity_delta(&batch, (int)(i & 7) + 1);
+        int len = format_velocity_batch(buffer, &batch);
+        if (write(bench_pipe[1], buffer, len) != len || fill_pose_reader(bench_pipe[0], &bench_reader, &bench_stats) <= 0)
+        {
+            perror("Error on the benchmark pipe");
+            exit(1);
+        }
+
+        char *record;
+        VELOCITY_COMMAND cmd;
+        while (next_pose_record(&bench_reader, &record))
+        {
+            sink += parse_velocity_command(record, &cmd) + cmd.delta;
+        }
+    }
+}
+
+// World process: record of the real position with the fixed point encoder
+void bench_pose_encode_fixed(long iterations)
+{
+    char record[POSE_RECORD_MAX];
+    for (long i = 0; i < iterations; i++)
+    {
+        sink += format_pose_record(record, (uint32_t)i, 12.345678 + (i & 15), 3.5 - (i & 7));
+    }
+}
+
+// The same record with sprintf(), as the processes did before the fixed point encoder
+void bench_pose_encode_sprintf(long iterations)
+{
+    char record[POSE_RECORD_MAX + 16];
+    for (long i = 0; i < iterations; i++)
+    {
+        sink += sprintf(record, "%u;%f;%f\n", (uint32_t)i, 12.345678 + (i & 15), 3.5 - (i & 7));
+    }
+}
+
+// Inspection console: decode of a world record with the fixed point decoder
+void bench_pose_decode_fixed(long iterations)
+{
+    char record[POSE_RECORD_MAX];
+    uint32_t seq;
+    float x, z;
+    for (long i = 0; i < iterations; i++)
+    {
+        strcpy(record, pose_record);
+        sink += parse_pose_record(record, &seq, &x, &z) + (long)x;
+    }
+}
+
+// The same record with strtoul()/atof(), as the processes did before the fixed point decoder
+void bench_pose_decode_atof(long iterations)
+{
+    char record[POSE_RECORD_MAX];
+    for (long i = 0; i < iterations; i++)
+    {
+        strcpy(record, pose_record);
+        char *end;
+        unsigned long seq = strtoul(record, &end, 10);
+        float x = atof(end + 1);
+        float z = atof(strchr(end + 1, ';') + 1);
+        sink += seq + (long)x + (long)z;
+    }
+}
+
+// World process: noise added to a position
+void bench_add_error(long iterations)
+{
+    float sum = 0;
+    for (long i = 0; i < iterations; i++)
+    {
+        sum += add_error(12.5 + (i & 31));
+    }
+    sink += (long)sum;
+}
+
+// World process: a burst of records of a motor merged like read_real_pos(), then the real position sent
+void bench_world_merge(long iterations)
+{
+    POSE_READER reader;
+    POSE_STATS stats;
+    memset(&stats, 0, sizeof(stats));
+    char record_out[POSE_RECORD_MAX];
+
+    for (long i = 0; i < iterations; i++)
+    {
+        memcpy(reader.buffer, merge_records, merge_len);
+        reader.len = merge_len;
+        reader.start = 0;
+        stats.started = 0;
+
+        // Only the last record is used, the previous ones are checked and counted
+        char *record;
+        float last_pos = 0;
+        while (next_pose_record(&reader, &record))
+        {
+            uint32_t seq;
+            float value;
+            if (parse_axis_record(record, &seq, &value))
+            {
+                stats.malformed++;
+                continue;
+            }
+            track_pose_sequence(&stats, seq);
+            last_pos = value;
+        }
+
+        float real_x = sense_position('x', last_pos);
+        sink += format_pose_record(record_out, (uint32_t)i, real_x, 3.0);
+    }
+}
+
+// Inspection console: drawing of the end-effector in the off-screen terminal, without the output
+void bench_render_draw(long iterations)
+{
+    for (long i = 0; i < iterations; i++)
+    {
+        draw_hoist_end_effector_at((i % 4000) / 100.0, (i % 1000) / 100.0);
+    }
+}
+
+// Inspection console: drawing and refresh, the escape sequences are written on /dev/null
+void bench_render_refresh(long iterations)
+{
+    for (long i = 0; i < iterations; i++)
+    {
+        draw_hoist_end_effector_at((i % 4000) / 100.0, (i % 1000) / 100.0);
+        refresh();
+    }
+}
+
+BENCH_CASE cases[] = {
+    {"velocity_encode", "format of the stop and delta of a console frame", bench_velocity_encode},
+    {"velocity_decode", "decode of a velocity delta command", bench_velocity_decode},
+    {"velocity_pipe", "velocity command through a pipe: format, write, read, split, decode", bench_velocity_pipe},
+    {"pose_encode_fixed", "world record with the fixed point encoder", bench_pose_encode_fixed},
+    {"pose_encode_sprintf", "world record with sprintf", bench_pose_encode_sprintf},
+    {"pose_decode_fixed", "world record with the fixed point decoder", bench_pose_decode_fixed},
+    {"pose_decode_atof", "world record with strtoul and atof", bench_pose_decode_atof},
+    {"add_error", "noise of a measured position", bench_add_error},
+    {"world_merge", "merge of a burst of motor records and send of the real position", bench_world_merge},
+    {"render_draw", "draw of the end-effector, off-screen", bench_render_draw},
+    {"render_refresh", "draw and refresh of the end-effector, off-screen", bench_render_refresh},
+};
+
+#define N_CASES (int)(sizeof(cases) / sizeof(cases[0]))
+
+// Function to prepare the pipe, the records and the off-screen terminal
+void setup_bench()
+{
+    // Non blocking so that a bug fails instead of hanging
+    if (pipe2(bench_pipe, O_NONBLOCK) == -1)
+    {
+        perror("Error creating the pipe");
+        exit(1);
+    }
+
+    for (int i = 0; i < MERGE_RECORDS; i++)
+    {
+        merge_len += format_axis_record(merge_records + merge_len, i + 1, 10.0 + i * 0.5);
+    }
+    format_pose_record(pose_record, 123456, 12.345678, 3.5);
+    pose_record[strlen(pose_record) - 1] = '\0';
+
+    // Terminal of a fixed size writing on /dev/null, the same for every run
+    setlocale(LC_ALL, "C.UTF-8");
+    setenv("COLUMNS", RENDER_COLUMNS, 1);
+    setenv("LINES", RENDER_LINES, 1);
+    FILE *out = fopen("/dev/null", "w");
+    FILE *in = fopen("/dev/null", "r");
+    SCREEN *screen;
+    if (out == NULL || in == NULL || (screen = newterm("xterm-256color", out, in)) == NULL)
+    {
+        fprintf(stderr, "Error creating the off-screen terminal\n");
+        exit(1);
+    }
+    set_term(screen);
+    start_color();
+    init_pair(1, COLOR_GREEN, COLOR_BLACK);
+    init_pair(2, COLOR_WHITE, COLOR_RED);
+    init_pair(3, COLOR_BLACK, COLOR_YELLOW);
+    init_glyph_tables();
+    make_hoist();
+    draw_hoist();
+    container.is_set = FALSE;
+    refresh();
+}
+
+// Function to compare two numbers for qsort()
+int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to measure a case, with the median and the minimum time of an operation
+void measure_case(BENCH_CASE *bench, double seconds, long *iterations, double *median_ns, double *min_ns)
+{
+    // Warm up the caches and the pages, then find how many operations take a tenth of a sample
+    bench->run(BENCH_WARMUP);
+    long n = 1;
+    uint64_t elapsed;
+    do
+    {
+        n *= 2;
+        uint64_t start = monotonic_ns();
+        bench->run(n);
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < seconds * 1e9 / BENCH_SAMPLES / 10);
+    n = n * (seconds * 1e9 / BENCH_SAMPLES) / elapsed + 1;
+
+    double samples[BENCH_SAMPLES];
+    for (int s = 0; s < BENCH_SAMPLES; s++)
+    {
+        uint64_t start = monotonic_ns();
+        bench->run(n);
+        samples[s] = (double)(monotonic_ns() - start) / n;
+    }
+    qsort(samples, BENCH_SAMPLES, sizeof(double), compare_double);
+
+    *iterations = n * BENCH_SAMPLES;
+    *median_ns = samples[BENCH_SAMPLES / 2];
+    *min_ns = samples[0];
+}
+
+int main(int argc, char const *argv[])
+{
+    double seconds = (argc > 1 && atof(argv[1]) > 0) ? atof(argv[1]) : 1.0;
+    const char *prefix = (argc > 2) ? argv[2] : "";
+
+    setup_bench();
+
+    // Measure all the cases before writing, the terminal must be closed first
+    long iterations[N_CASES];
+    double median_ns[N_CASES], min_ns[N_CASES];
+    int selected[N_CASES];
+    for (int i = 0; i < N_CASES; i++)
+    {
+        selected[i] = (strncmp(cases[i].name, prefix, strlen(prefix)) == 0);
+        if (selected[i])
+        {
+            measure_case(&cases[i], seconds, &iterations[i], &median_ns[i], &min_ns[i]);
+        }
+    }
+    endwin();
+
+    printf("{\n  \"benchmark\": \"hoist\",\n  \"version\": 1,\n  \"samples\": %d,\n  \"seconds_per_case\": %.3f,\n  \"cases\": [", BENCH_SAMPLES, seconds);
+    int first = 1;
+    for (int i = 0; i < N_CASES; i++)
+    {
+        if (!selected[i])
+        {
+            continue;
+        }
+        printf("%s\n    {\"name\": \"%s\", \"description\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, \"ops_per_second\": %.0f}",
+               first ? "" : ",", cases[i].name, cases[i].description, iterations[i], median_ns[i], min_ns[i], 1e9 / median_ns[i]);
+        first = 0;
+    }
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "./../include/checkpoint.h"
+
+// Test of the sequence numbers of the checkpoint (see checkpoint.h).
+// A writer is killed in the middle of a snapshot, then restarted twice: the
+// snapshot being written must be dropped, and every snapshot completed by a
+// restarted writer must be read back. The writers are child processes that
+// share the mapped file, like the motors restarted by the master.
+//
+// Usage: checkpoint_test
+// The checkpoint is a temporary file, HOIST_CHECKPOINT is overwritten.
+
+#define TEST_CHECKPOINT "/tmp/hoist_checkpoint_test.ckpt"
+
+// Function to crash in the middle of a snapshot, after the sequence number is odd
+// The snapshot ends right before a page without access, so copying its second word raises SIGSEGV
+void crash_while_writing(CHECKPOINT_FILE *ckpt)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    char *pages = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED || mprotect(pages + page, page, PROT_NONE) == -1)
+    {
+        _exit(2);
+    }
+
+    CHECKPOINT_MOTOR *snapshot = (CHECKPOINT_MOTOR *)(pages + page - sizeof(uint32_t));
+    snapshot->seq = 0;
+    write_checkpoint_section(&ckpt->motors[CHECKPOINT_X].seq, snapshot, sizeof(CHECKPOINT_MOTOR));
+
+    // Not reached
+    _exit(0);
+}
+
+// Function to run a writer in a child process
+// The writer completes a snapshot at pos, then crashes while writing the next one if crash is set
+// Returns 0 if the writer ended as expected
+int run_writer(CHECKPOINT_FILE *ckpt, float pos, int crash)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        return -1;
+    }
+    if (pid == 0)
+    {
+        MOTOR motor;
+        init_motor(&motor, 'x', 0.0, 40.0);
+        motor.pos = pos;
+        save_motor_checkpoint(ckpt, CHECKPOINT_X, &motor, 1);
+
+        if (crash)
+        {
+            crash_while_writing(ckpt);
+        }
+        _exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1)
+    {
+        return -1;
+    }
+    if (crash)
+    {
+        return (WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV) ? 0 : -1;
+    }
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+// Function to check what a restarted writer reads from the section
+// Returns 0 if there is a snapshot exactly when expected, at pos
+int check_section(CHECKPOINT_FILE *ckpt, int expected, float pos, const char *step)
+{
+    CHECKPOINT_MOTOR snapshot;
+    int found = read_checkpoint_section(&ckpt->motors[CHECKPOINT_X].seq, &snapshot, sizeof(CHECKPOINT_MOTOR));
+
+    if (found != expected || (found && snapshot.pos != pos))
+    {
+        printf("%s: FAIL, sequence %u, %s", step, snapshot.seq, found ? "snapshot" : "no snapshot");
+        if (found)
+        {
+            printf(" at %f", snapshot.pos);
+        }
+        printf(" instead of %s\n", expected ? "a snapshot" : "none");
+        return -1;
+    }
+
+    printf("%s: ok, sequence %u\n", step, snapshot.seq);
+    return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+    setenv(ENV_CHECKPOINT, TEST_CHECKPOINT, 1);
+    CHECKPOINT_FILE *ckpt = open_checkpoint(1);
+    if (ckpt == NULL)
+    {
+        perror("Error opening the checkpoint");
+        exit(1);
+    }
+
+    int ret = 0;
+
+    // First writer, killed in the middle of its second snapshot
+    if (run_writer(ckpt, 10.0, 1) == -1)
+    {
+        printf("writer 1 did not crash while writing\n");
+        ret = 1;
+    }
+    ret |= check_section(ckpt, 0, 0.0, "killed while writing") ? 1 : 0;
+
+    // First restart, it completes a snapshot and is killed in the middle of the next one
+    if (run_writer(ckpt, 20.0, 0) == -1)
+    {
+        printf("writer 2 failed\n");
+        ret = 1;
+    }
+    ret |= check_section(ckpt, 1, 20.0, "first restart") ? 1 : 0;
+
+    if (run_writer(ckpt, 30.0, 1) == -1)
+    {
+        printf("writer 3 did not crash while writing\n");
+        ret = 1;
+    }
+    ret |= check_section(ckpt, 0, 0.0, "first restart killed while writing") ? 1 : 0;
+
+    // Second restart, it completes a snapshot
+    if (run_writer(ckpt, 40.0, 0) == -1)
+    {
+        printf("writer 4 failed\n");
+        ret = 1;
+    }
+    ret |= check_section(ckpt, 1, 40.0, "second restart") ? 1 : 0;
+
+    unlink(TEST_CHECKPOINT);
+
+    printf("%s\n", ret ? "FAILED" : "passed");
+    return ret;
+}
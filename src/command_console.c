@@ -6,12 +6,23 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include "./../include/metrics.h"
+#include "./../include/mmap_log.h"
+#include "./../include/tick_timer.h"
+#include "./../include/velocity_command.h"
+#include "./../include/readiness.h"
+
+// Period of the frames in which the keys and buttons are coalesced
+#define COMMAND_FRAME_NS 50000000
 
 // Buffer to store the log message
-char log_buffer[100];
+char log_buffer[150];
+
+// Memory mapped log file
+MMAP_LOG log_file;
 
-// File descriptor for the log file
-int log_fd;
+// Metrics of this process
+METRICS_SLOT *metrics;
 
 // Function to write on log file the pressed button
 int write_log(char *to_write, char type)
@@ -24,15 +35,18 @@ int write_log(char *to_write, char type)
         // If button message
         sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <command_process> Button %s pressed\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
     }
+    else if (type == 'v')
+    {
+        // If velocity commands of a frame
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <command_process> Velocity %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
     else if (type == 'e')
     {
         // If error message
         sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <command_process> Error: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
     }
-    int m = write(log_fd, log_buffer, strlen(log_buffer));
-
-    // Check for errors
-    if (m == -1 || m != strlen(log_buffer))
+    // Copy the message in the mapped segment
+    if (mmap_log_write(&log_file, log_buffer, strlen(log_buffer)) == -1)
     {
         return 2;
     }
@@ -40,14 +54,20 @@ int write_log(char *to_write, char type)
     return 0;
 }
 
-// Function to send velocity to motor
-int send_velocity(int *fd, int v)
+// Function to send the commands of a frame to a motor, in a single write
+int send_velocity(int *fd, char *axis, VELOCITY_BATCH *batch)
 {
-    // Send velocity to pipe fd
-    char buffer[2];
-    sprintf(buffer, "%d", v);
-    int m = write(*fd, buffer, strlen(buffer));
-    if (m == -1 || m != strlen(buffer))
+    char buffer[VELOCITY_BATCH_MAX];
+    int len = format_velocity_batch(buffer, batch);
+
+    // Nothing to send if the keys of the frame cancel each other
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    int m = write(*fd, buffer, len);
+    if (m == -1 || m != len)
     {
         // Log the error
         if (write_log(strerror(errno), 'e') == 2)
@@ -59,18 +79,51 @@ int send_velocity(int *fd, int v)
         return 1;
     }
 
+    metrics_count(metrics, METRIC_COMMANDS, batch->stop + (batch->delta != 0));
+    metrics_count(metrics, METRIC_BYTES_WRITTEN, m);
+
+    // Log the commands with the number of keys and buttons they replace
+    char to_write[60];
+    if (batch->delta == 0)
+    {
+        sprintf(to_write, "%s stop, %d events", axis, batch->events);
+    }
+    else
+    {
+        sprintf(to_write, "%s%s delta %+d, %d events", axis, batch->stop ? " stop," : "", batch->delta, batch->events);
+    }
+    if (write_log(to_write, 'v') == 2)
+    {
+        return 2;
+    }
+
     return 0;
 }
 
 int main(int argc, char const *argv[])
 {
     // Open the log file
-    if ((log_fd = open("log/command.log", O_WRONLY | O_APPEND | O_CREAT, 0666)) == -1)
+    if (open_mmap_log(&log_file, "log/command.log") == -1)
     {
         // If error accured while opening the log file
         exit(errno);
     }
 
+    // Register the metrics
+    if ((metrics = register_metrics(METRICS_COMMAND, "command")) == NULL)
+    {
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close the log file
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            exit(errno);
+        }
+
+        exit(1);
+    }
+
     // Utility variable to avoid trigger resize event on launch
     int first_resize = TRUE;
 
@@ -92,7 +145,7 @@ int main(int argc, char const *argv[])
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close the log file
-        close(log_fd);
+        close_mmap_log(&log_file);
         // If error accured while writing on log file
         if (ret)
         {
@@ -107,7 +160,7 @@ int main(int argc, char const *argv[])
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close file descriptors
-        close(log_fd);
+        close_mmap_log(&log_file);
         close(fd_vx);
         // If error accured while writing on log file
         if (ret)
@@ -118,14 +171,48 @@ int main(int argc, char const *argv[])
         exit(1);
     }
 
-    // Variable to store the error code
-    int err = 0;
+    // Variable to store the error code, the console is ready once the FIFOs are open
+    int err = (notify_ready("command") == -1);
+
+    // Keys and buttons of the current frame, by axis, and state of the held key
+    VELOCITY_BATCH batch_x = {0}, batch_z = {0};
+    KEY_REPEAT repeat = {0};
+    uint64_t frame_end_ns = monotonic_ns() + COMMAND_FRAME_NS;
 
-    // Infinite loop
-    while (TRUE)
+    // Loop until an error occurs
+    while (!err)
     {
-        // Get mouse/resize commands in non-blocking mode...
+        uint64_t now_ns = monotonic_ns();
+
+        // At the end of the frame send the coalesced commands, one write per axis
+        if (now_ns >= frame_end_ns)
+        {
+            if ((err = send_velocity(&fd_vx, "Vx", &batch_x)) || (err = send_velocity(&fd_vz, "Vz", &batch_z)))
+            {
+                // If error accured while sending velocity
+                break;
+            }
+            memset(&batch_x, 0, sizeof(batch_x));
+            memset(&batch_z, 0, sizeof(batch_z));
+
+            // Frames missed while the console was busy are not caught up
+            frame_end_ns += COMMAND_FRAME_NS;
+            if (frame_end_ns <= now_ns)
+            {
+                frame_end_ns = now_ns + COMMAND_FRAME_NS;
+            }
+            continue;
+        }
+
+        // Wait for keys, mouse or resize events up to the end of the frame,
+        // without timeout if there is nothing to send: the next frame starts with the next event
+        int idle = (batch_x.events == 0 && batch_z.events == 0);
+        timeout(idle ? -1 : (int)((frame_end_ns - now_ns + 999999) / 1000000));
         int cmd = getch();
+        if (idle)
+        {
+            frame_end_ns = monotonic_ns() + COMMAND_FRAME_NS;
+        }
 
         // If user resizes screen, re-draw UI
         if (cmd == KEY_RESIZE)
@@ -139,6 +226,27 @@ int main(int argc, char const *argv[])
                 reset_console_ui();
             }
         }
+        // Arrow keys change the velocity, with key repeat acceleration
+        else if (cmd == KEY_RIGHT || cmd == KEY_LEFT || cmd == KEY_DOWN || cmd == KEY_UP)
+        {
+            // The repeats absorbed by the acceleration count as events without steps
+            int steps = key_repeat_steps(&repeat, cmd, now_ns);
+            if (cmd == KEY_RIGHT || cmd == KEY_LEFT)
+            {
+                batch_velocity_delta(&batch_x, cmd == KEY_RIGHT ? steps : -steps);
+            }
+            else
+            {
+                // The z axis grows downwards
+                batch_velocity_delta(&batch_z, cmd == KEY_DOWN ? steps : -steps);
+            }
+        }
+        // Space stops both motors
+        else if (cmd == ' ')
+        {
+            batch_velocity_stop(&batch_x);
+            batch_velocity_stop(&batch_z);
+        }
         // Else if mouse has been pressed
         else if (cmd == KEY_MOUSE)
         {
@@ -146,113 +254,55 @@ int main(int argc, char const *argv[])
             // Check which button has been pressed...
             if (getmouse(&event) == OK)
             {
+                char *button = NULL;
 
                 // Vx++ button pressed
                 if (check_button_pressed(vx_incr_btn, &event))
                 {
-                    // Log button pressed
-                    if (err = write_log("Vx++", 'b'))
-                    {
-                        // If error accured while writing on log file
-                        break;
-                    }
-
-                    // Send velocity to motor x
-                    if (err = send_velocity(&fd_vx, 1))
-                    {
-                        // If error accured while sending velocity
-                        break;
-                    }
+                    button = "Vx++";
+                    batch_velocity_delta(&batch_x, 1);
                 }
 
                 // Vx-- button pressed
                 else if (check_button_pressed(vx_decr_btn, &event))
                 {
-                    // Log button pressed
-                    if (err = write_log("Vx--", 'b'))
-                    {
-                        // If error accured while writing on log file
-                        break;
-                    }
-
-                    // Send velocity to motor x
-                    if (err = send_velocity(&fd_vx, 2))
-                    { // 2 is the code for Vx--
-                        // If error accured while sending velocity
-                        break;
-                    }
+                    button = "Vx--";
+                    batch_velocity_delta(&batch_x, -1);
                 }
 
                 // Vx stop button pressed
                 else if (check_button_pressed(vx_stp_button, &event))
                 {
-                    // Log button pressed
-                    if (err = write_log("Vx stop", 'b'))
-                    {
-                        // If error accured while writing on log file
-                        break;
-                    }
-
-                    // Send velocity to motor x
-                    if (err = send_velocity(&fd_vx, 0))
-                    {
-                        // If error accured while sending velocity
-                        break;
-                    }
+                    button = "Vx stop";
+                    batch_velocity_stop(&batch_x);
                 }
 
                 // Vz++ button pressed
                 else if (check_button_pressed(vz_incr_btn, &event))
                 {
-                    // Log button pressed
-                    if (err = write_log("Vz++", 'b'))
-                    {
-                        // If error accured while writing on log file
-                        break;
-                    }
-
-                    // Send velocity to motor z
-                    if (err = send_velocity(&fd_vz, 1))
-                    {
-                        // If error accured while sending velocity
-                        break;
-                    }
+                    button = "Vz++";
+                    batch_velocity_delta(&batch_z, 1);
                 }
 
                 // Vz-- button pressed
                 else if (check_button_pressed(vz_decr_btn, &event))
                 {
-                    // Log button pressed
-                    if (err = write_log("Vz--", 'b'))
-                    {
-                        // If error accured while writing on log file
-                        break;
-                    }
-
-                    // Send velocity to motor z
-                    if (err = send_velocity(&fd_vz, 2))
-                    { // 2 is the code for Vz--
-                        // If error accured while sending velocity
-                        break;
-                    }
+                    button = "Vz--";
+                    batch_velocity_delta(&batch_z, -1);
                 }
 
                 // Vz stop button pressed
                 else if (check_button_pressed(vz_stp_button, &event))
                 {
-                    // Log button pressed
-                    if (err = write_log("Vz stop", 'b'))
-                    {
-                        // If error accured while writing on log file
-                        break;
-                    }
-
-                    // Send velocity to motor z
-                    if (err = send_velocity(&fd_vz, 0))
-                    {
-                        // If error accured while sending velocity
-                        break;
-                    }
+                    button = "Vz stop";
+                    batch_velocity_stop(&batch_z);
+                }
+
+                // Log button pressed
+                if (button != NULL && (err = write_log(button, 'b')))
+                {
+                    // If error accured while writing on log file
+                    break;
                 }
             }
         }
@@ -272,7 +322,7 @@ int main(int argc, char const *argv[])
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close the log file
-        close(log_fd);
+        close_mmap_log(&log_file);
         if (ret)
         {
             // If error occurs while writing on log file
@@ -282,7 +332,7 @@ int main(int argc, char const *argv[])
     }
     
     // Close the log file
-    close(log_fd);
+    close_mmap_log(&log_file);
 
     if(err == 2){
         // If error occurs while writing on log file
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include "./../include/control_service.h"
+#include "./../include/metrics.h"
+#include "./../include/runtime_profile.h"
+#include "./../include/mmap_log.h"
+#include "./../include/readiness.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <limits.h>
+#include <math.h>
+
+// Control socket and connected clients
+CONTROL_SERVICE service;
+
+// Memory mapped log file
+MMAP_LOG log_file;
+
+// File descriptors for the motors control FIFOs
+int fd_mx_ctl, fd_mz_ctl;
+
+// Buffer to store the log message
+char log_buffer[150];
+
+// Variable to store the errors
+// 0 = no error
+// 1 = system call error
+// 2 = error while writing on log file
+volatile int error = 0;
+
+// Function to write on log
+int write_log(char *to_write, char type)
+{
+    time_t t = time(NULL);
+    struct tm tm = *localtime(&t);
+
+    // If type is 'e' then it is an error
+    if (type == 'e')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <control_process> error: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'c' then it is a client event
+    else if (type == 'c')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <control_process> client %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'p' then it is the runtime profile
+    else if (type == 'p')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <control_process> runtime profile: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+
+    // Copy the message in the mapped segment
+    if (mmap_log_write(&log_file, log_buffer, strlen(log_buffer)) == -1)
+    {
+        return 2;
+    }
+
+    return 0;
+}
+
+// Function to forward the commands queued for a motor
+// Each write is kept below PIPE_BUF so that records are never split
+int flush_commands(int fd, MOTOR_COMMAND *cmds, int count)
+{
+    int per_write = PIPE_BUF / sizeof(MOTOR_COMMAND);
+
+    for (int i = 0; i < count; i += per_write)
+    {
+        int n = (count - i < per_write) ? count - i : per_write;
+        if (write_all(fd, &cmds[i], n * sizeof(MOTOR_COMMAND)) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Function to forward the commands of a batch to the motors control FIFOs
+int forward_to_fifos(MOTOR_COMMAND *x_cmds, int x_count, MOTOR_COMMAND *z_cmds, int z_count)
+{
+    if (flush_commands(fd_mx_ctl, x_cmds, x_count) == -1 || flush_commands(fd_mz_ctl, z_cmds, z_count) == -1)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// Function to log a client event
+int log_client_event(char *event)
+{
+    return write_log(event, 'c');
+}
+
+int main(int argc, char const *argv[])
+{
+    // Open the log file
+    if (open_mmap_log(&log_file, "log/control.log") == -1)
+    {
+        // If error occurs while opening the log file
+        exit(errno);
+    }
+
+    // Apply the memory settings of the runtime profile passed by the master
+    // A failure does not stop the process, it runs without the memory locked and logs it as an error
+    char profile_report[100];
+    int profile_failed = apply_memory_profile(profile_report);
+    if (profile_report[0] != '\0' && write_log(profile_report, profile_failed ? 'e' : 'p'))
+    {
+        // If error occurs while writing to the log file
+        close_mmap_log(&log_file);
+        exit(errno);
+    }
+
+    // A client closing its socket must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Create the FIFOs
+    mkfifo(MX_CTL_FIFO, 0666);
+    mkfifo(MZ_CTL_FIFO, 0666);
+
+    // Open the FIFOs
+    if ((fd_mx_ctl = open(MX_CTL_FIFO, O_WRONLY)) == -1)
+    {
+        // If error occurs while opening the FIFO
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close the log file
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing to the log file
+            exit(errno);
+        }
+
+        exit(1);
+    }
+
+    if ((fd_mz_ctl = open(MZ_CTL_FIFO, O_WRONLY)) == -1)
+    {
+        // If error occurs while opening the FIFO
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close file descriptors
+        close(fd_mx_ctl);
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing to the log file
+            exit(errno);
+        }
+
+        exit(1);
+    }
+
+    // Map the shared pose and register the metrics
+    if ((service.pose = open_pose_shm()) == NULL || (service.metrics = register_metrics(METRICS_CONTROL, "control")) == NULL)
+    {
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close file descriptors
+        close(fd_mx_ctl);
+        close(fd_mz_ctl);
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing to the log file
+            exit(errno);
+        }
+
+        exit(1);
+    }
+
+    // Create the listening socket
+    service.forward = forward_to_fifos;
+    service.log_event = log_client_event;
+    if (open_control_service(&service) == -1)
+    {
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close file descriptors
+        close(fd_mx_ctl);
+        close(fd_mz_ctl);
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing to the log file
+            exit(errno);
+        }
+
+        exit(1);
+    }
+
+    // Tell the master that the server is ready, then serve the clients until an error occurs
+    error = (notify_ready("control") == -1) ? 1 : run_control_service(&service);
+
+    // Close the clients and the socket
+    close_control_service(&service);
+
+    // Close the FIFOs
+    close(fd_mx_ctl);
+    close(fd_mz_ctl);
+
+    if (error == 1)
+    {
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close the log file
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing on log file
+            exit(errno);
+        }
+        exit(1);
+    }
+
+    // Close the log file
+    close_mmap_log(&log_file);
+
+    if (error == 2)
+    {
+        // If error occurs while writing on log file
+        exit(errno);
+    }
+
+    exit(0);
+}
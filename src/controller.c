@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/select.h>
+#include "./../include/control_protocol.h"
+#include "./../include/pid_controller.h"
+#include "./../include/pose_bus.h"
+#include "./../include/tick_timer.h"
+#include "./../include/metrics.h"
+#include "./../include/mmap_log.h"
+#include "./../include/hoist_config.h"
+
+// Closed-loop position controller: it reads the noisy positions of the world
+// process from the pose bus, runs a PID with velocity feedforward on each axis
+// at a fixed rate and sends the velocities to the motors on their control
+// FIFOs, like the control server does.
+//
+//   controller <x> <z>
+//
+// HOIST_CTL_RATE sets the rate of the loop in Hz (100 by default), see
+// pid_controller.h for the gains. The timing of the loop is written in the
+// metrics and every 10 seconds in log/controller.log, with a summary on exit.
+
+// Default rate of the loop
+#define DEFAULT_RATE 100
+#define MAX_RATE 10000
+
+// Smallest change of velocity sent to a motor
+#define VELOCITY_RESOLUTION 0.01
+
+// Maximum number of samples read in a period
+#define MAX_SAMPLES 256
+
+// Period of the report written on the log file
+#define REPORT_PERIOD_NS 10000000000ULL
+
+// Memory mapped log file
+MMAP_LOG log_file;
+
+// Buffer to store the log message
+char log_buffer[400];
+
+// Variable to store the errors
+// 0 = no error
+// 1 = system call error
+// 2 = error while writing on log file
+int error = 0;
+
+// Flag set by SIGINT and SIGTERM
+volatile sig_atomic_t stop_flag = 0;
+
+// Control FIFOs of the motors
+int fd_ctl[2];
+
+// Controller of each axis
+PID_GAINS gains;
+PID_AXIS axes[2];
+
+// Last velocity sent to each motor
+float sent[2];
+
+// Metrics of this process
+METRICS_SLOT *metrics;
+
+// Statistics of the current report period
+unsigned long loops = 0, commands = 0;
+double squared_error[2] = {0, 0};
+unsigned long error_samples = 0;
+
+// Function to write on log
+int write_log(char *to_write, char type)
+{
+    time_t t = time(NULL);
+    struct tm tm = *localtime(&t);
+
+    // If type is 'e' then it is an error
+    if (type == 'e')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <controller_process> error: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 't' then it is a new target
+    else if (type == 't')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <controller_process> target: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'r' then it is the periodic report
+    else if (type == 'r')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <controller_process> report: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 's' then it is a signal
+    else if (type == 's')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <controller_process> signal received: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+
+    // Copy the message in the mapped segment
+    if (mmap_log_write(&log_file, log_buffer, strlen(log_buffer)) == -1)
+    {
+        return 2;
+    }
+
+    return 0;
+}
+
+// Stop signal handler
+void stop_handler(int signo)
+{
+    stop_flag = signo;
+}
+
+// Function to send a velocity to a motor if it changed enough since the last one
+// Returns 1 if it was sent, 0 if not, -1 on error
+int send_velocity(int axis, float v)
+{
+    if (fabsf(v - sent[axis]) < VELOCITY_RESOLUTION && !(v == 0 && sent[axis] != 0))
+    {
+        return 0;
+    }
+
+    MOTOR_COMMAND cmd = {.op = CTL_OP_SET_VELOCITY, .value = v};
+    int m = write(fd_ctl[axis], &cmd, sizeof(cmd));
+    if (m == -1 && errno == EAGAIN)
+    {
+        // The motor is not reading, try again in the next period
+        return 0;
+    }
+    if (m != sizeof(cmd))
+    {
+        return -1;
+    }
+
+    sent[axis] = v;
+    commands++;
+    metrics_count(metrics, METRIC_COMMANDS, 1);
+    metrics_count(metrics, METRIC_BYTES_WRITTEN, m);
+
+    return 1;
+}
+
+// Function to write the statistics of a period in a string
+void format_report(char *to_write, double seconds)
+{
+    METRICS_HISTOGRAM *jitter = &metrics->histograms[METRIC_TICK_JITTER];
+    METRICS_HISTOGRAM *loop = &metrics->histograms[METRIC_LOOP_TIME];
+    METRICS_HISTOGRAM *latency = &metrics->histograms[METRIC_CONTROL_LATENCY];
+    double rms_x = error_samples ? sqrt(squared_error[0] / error_samples) : 0;
+    double rms_z = error_samples ? sqrt(squared_error[1] / error_samples) : 0;
+
+    sprintf(to_write, "%.1f loops/s, %lu commands, rms error x=%.3f z=%.3f, position x=%.3f z=%.3f, jitter p99<=%luus, loop max %luns, latency p50<=%luus p99<=%luus",
+            loops / seconds, commands, rms_x, rms_z, axes[0].position, axes[1].position, (unsigned long)histogram_percentile(jitter, 0.99),
+            (unsigned long)loop->max, (unsigned long)histogram_percentile(latency, 0.5), (unsigned long)histogram_percentile(latency, 0.99));
+}
+
+// Function to open the control FIFO of a motor without waiting for it
+// Returns the file descriptor, -1 on error
+int open_ctl_fifo(char *path)
+{
+    // Opening for writing without a reader fails instead of blocking
+    mkfifo(path, 0666);
+    return open(path, O_WRONLY | O_NONBLOCK);
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <x> <z>\n", argv[0]);
+        exit(1);
+    }
+
+    // Targets within the workspace of the shared configuration
+    HOIST_CONFIG config;
+    read_config(open_config_shm(0), &config);
+    float target_x = fminf(fmaxf(atof(argv[1]), config.x_min), config.x_max);
+    float target_z = fminf(fmaxf(atof(argv[2]), config.z_min), config.z_max);
+
+    int rate = (int)pid_env("HOIST_CTL_RATE", DEFAULT_RATE);
+    if (rate < 1 || rate > MAX_RATE)
+    {
+        rate = DEFAULT_RATE;
+    }
+    uint64_t period_ns = 1000000000ULL / rate;
+
+    // Open the log file
+    if (open_mmap_log(&log_file, "log/controller.log") == -1)
+    {
+        // If error occurs while opening the log file
+        exit(errno);
+    }
+
+    load_pid_gains(&gains);
+    init_pid_axis(&axes[0], target_x);
+    init_pid_axis(&axes[1], target_z);
+
+    char to_write[300];
+    sprintf(to_write, "x=%.3f z=%.3f at %d Hz, kp=%.3f ki=%.3f kd=%.3f kff=%.3f vmax=%.3f tolerance=%.3f", target_x, target_z, rate, gains.kp, gains.ki,
+            gains.kd, gains.kff, gains.vmax, gains.tolerance);
+    if (error = write_log(to_write, 't'))
+    {
+        // If error occurs while writing on log file
+        close_mmap_log(&log_file);
+        exit(errno);
+    }
+
+    // Open the pose bus, the pose of the motors, the control FIFOs and the metrics, and listen for signals
+    POSE_BUS *bus = NULL;
+    POSE_SHM *pose = NULL;
+    fd_ctl[0] = fd_ctl[1] = -1;
+    if ((bus = open_pose_bus()) == NULL || (pose = open_pose_shm()) == NULL || (fd_ctl[0] = open_ctl_fifo(MX_CTL_FIFO)) == -1 || (fd_ctl[1] = open_ctl_fifo(MZ_CTL_FIFO)) == -1 ||
+        (metrics = register_metrics(METRICS_CONTROLLER, "controller")) == NULL || signal(SIGINT, stop_handler) == SIG_ERR ||
+        signal(SIGTERM, stop_handler) == SIG_ERR)
+    {
+        error = 1;
+    }
+
+    // Start from the position published by the motors, the world only publishes when the hoist moves
+    uint64_t cursor = 0;
+    if (!error)
+    {
+        float x, z;
+        double now = monotonic_ns() / 1e9;
+        read_pose(pose, &x, &z);
+        pid_measure(&axes[0], &gains, x, now);
+        pid_measure(&axes[1], &gains, z, now);
+        cursor = pose_bus_head(bus);
+    }
+
+    POSE_SAMPLE samples[MAX_SAMPLES];
+    TICK_TIMER tick_timer;
+    start_tick_timer(&tick_timer, period_ns);
+    uint64_t report_ns = tick_timer.last_ns + REPORT_PERIOD_NS;
+    uint64_t report_start_ns = tick_timer.last_ns;
+
+    while (!error && !stop_flag)
+    {
+        // Sleep up to the next tick, a signal wakes the loop
+        struct timeval timeout = tick_timeout(&tick_timer);
+        if (select(0, NULL, NULL, NULL, &timeout) == -1 && errno != EINTR)
+        {
+            error = 1;
+            break;
+        }
+        if (!tick_due(&tick_timer))
+        {
+            continue;
+        }
+
+        // Measure how late the tick is and how many deadlines were missed
+        TICK tick = advance_tick_timer(&tick_timer);
+        uint64_t start_ns = tick_timer.last_ns;
+        metrics_observe(metrics, METRIC_TICK_JITTER, tick.lateness_ns / 1000);
+        if (tick.missed)
+        {
+            metrics_count(metrics, METRIC_DEADLINE_MISSES, tick.missed);
+            metrics_observe(metrics, METRIC_DEADLINE_MISS, tick.lateness_ns / 1000);
+        }
+
+        // Read the positions published since the previous tick
+        uint64_t lost = 0;
+        int n = read_pose_samples(bus, &cursor, samples, MAX_SAMPLES, &lost);
+        for (int i = 0; i < n; i++)
+        {
+            double t = samples[i].time_ns / 1e9;
+            pid_measure(&axes[0], &gains, samples[i].x, t);
+            pid_measure(&axes[1], &gains, samples[i].z, t);
+        }
+        metrics_count(metrics, METRIC_SAMPLES, n);
+
+        // Compute and send the velocities
+        int sent_now = 0;
+        for (int a = 0; a < 2 && !error; a++)
+        {
+            int ret = send_velocity(a, pid_update(&axes[a], &gains, tick.dt));
+            if (ret == -1)
+            {
+                error = 1;
+            }
+            sent_now |= ret;
+        }
+
+        // Time from the publication of the newest position to the command computed from it, and time spent in the loop
+        uint64_t end_ns = monotonic_ns();
+        if (n > 0 && sent_now)
+        {
+            metrics_observe(metrics, METRIC_CONTROL_LATENCY, (end_ns - samples[n - 1].time_ns) / 1000);
+        }
+        metrics_observe(metrics, METRIC_LOOP_TIME, end_ns - start_ns);
+        metrics_gauge(metrics, METRIC_POSITION_X, axes[0].position);
+        metrics_gauge(metrics, METRIC_POSITION_Z, axes[1].position);
+
+        // Error of the measured position from the target
+        if (axes[0].measured)
+        {
+            squared_error[0] += pow(axes[0].target - axes[0].position, 2);
+            squared_error[1] += pow(axes[1].target - axes[1].position, 2);
+            error_samples++;
+        }
+        loops++;
+
+        if (end_ns >= report_ns)
+        {
+            format_report(to_write, (end_ns - report_start_ns) / 1e9);
+            if (error = write_log(to_write, 'r'))
+            {
+                break;
+            }
+            report_ns += REPORT_PERIOD_NS;
+            report_start_ns = end_ns;
+            loops = commands = error_samples = 0;
+            squared_error[0] = squared_error[1] = 0;
+        }
+    }
+
+    // Stop the motors before leaving
+    if (error != 1)
+    {
+        MOTOR_COMMAND stop = {.op = CTL_OP_SET_VELOCITY, .value = 0};
+        write(fd_ctl[0], &stop, sizeof(stop));
+        write(fd_ctl[1], &stop, sizeof(stop));
+    }
+
+    if (stop_flag && !error)
+    {
+        error = write_log(stop_flag == SIGINT ? "SIGINT" : "SIGTERM", 's');
+
+        // Summary of the whole run
+        if (!error)
+        {
+            printf("position x=%.3f z=%.3f, target x=%.3f z=%.3f\n", axes[0].position, axes[1].position, target_x, target_z);
+            dump_histogram(stdout, histogram_names[METRIC_TICK_JITTER], &metrics->histograms[METRIC_TICK_JITTER]);
+            dump_histogram(stdout, histogram_names[METRIC_LOOP_TIME], &metrics->histograms[METRIC_LOOP_TIME]);
+            dump_histogram(stdout, histogram_names[METRIC_CONTROL_LATENCY], &metrics->histograms[METRIC_CONTROL_LATENCY]);
+        }
+    }
+
+    // Close the FIFOs
+    if (fd_ctl[0] != -1)
+    {
+        close(fd_ctl[0]);
+    }
+    if (fd_ctl[1] != -1)
+    {
+        close(fd_ctl[1]);
+    }
+
+    if (error == 1)
+    {
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close the log file
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing on log file
+            exit(errno);
+        }
+        exit(1);
+    }
+
+    // Close the log file
+    close_mmap_log(&log_file);
+
+    if (error == 2)
+    {
+        // If error occurs while writing on log file
+        exit(errno);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <math.h>
+#include "./../include/kalman_filter.h"
+#include "./../include/pose_bus.h"
+#include "./../include/pose_estimate.h"
+#include "./../include/world_core.h"
+#include "./../include/hoist_config.h"
+#include "./../include/tick_timer.h"
+#include "./../include/metrics.h"
+#include "./../include/mmap_log.h"
+
+// State estimator: it sleeps on the pose bus, runs a constant velocity Kalman
+// filter on each axis over the noisy positions of the world process and
+// publishes the filtered position, velocity and covariance in the
+// /hoist_estimate shared memory segment (see pose_estimate.h), as soon as a
+// position arrives.
+//
+// HOIST_KF_Q sets the noise of the acceleration and HOIST_KF_GATE the gate of
+// the outliers in standard deviations (see kalman_filter.h).
+
+// The world process only publishes when the hoist moves: after this time
+// without positions the hoist is still and the last position is measured again,
+// so that the velocity goes to zero instead of moving the estimate forever
+#define STILL_TIMEOUT_NS 750000000ULL
+
+// Maximum number of samples read at once
+#define MAX_SAMPLES 256
+
+// Period of the report written on the log file
+#define REPORT_PERIOD_NS 10000000000ULL
+
+// Filters of the two axes in the bank
+#define FILTER_X 0
+#define FILTER_Z 1
+
+// Memory mapped log file
+MMAP_LOG log_file;
+
+// Buffer to store the log message
+char log_buffer[300];
+
+// Variable to store the errors
+// 0 = no error
+// 1 = system call error
+// 2 = error while writing on log file
+int error = 0;
+
+// Flag set by SIGINT and SIGTERM
+volatile sig_atomic_t stop_flag = 0;
+
+// Filters, last measurement and its time
+KALMAN_BANK bank;
+float last_measures[2];
+uint64_t filter_time_ns = 0;
+uint64_t last_sample_ns = 0;
+
+// Published estimate
+ESTIMATE_SHM *estimates;
+
+// Metrics of this process
+METRICS_SLOT *metrics;
+
+// Function to write on log
+int write_log(char *to_write, char type)
+{
+    time_t t = time(NULL);
+    struct tm tm = *localtime(&t);
+
+    // If type is 'e' then it is an error
+    if (type == 'e')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <estimator_process> error: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'r' then it is the periodic report
+    else if (type == 'r')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <estimator_process> report: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 's' then it is a signal
+    else if (type == 's')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <estimator_process> signal received: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+
+    // Copy the message in the mapped segment
+    if (mmap_log_write(&log_file, log_buffer, strlen(log_buffer)) == -1)
+    {
+        return 2;
+    }
+
+    return 0;
+}
+
+// Stop signal handler
+void stop_handler(int signo)
+{
+    stop_flag = signo;
+}
+
+// Function to run the filters on a measurement of both axes taken at time_ns
+void filter_measures(float x, float z, uint64_t time_ns)
+{
+    float measures[2] = {x, z};
+    uint8_t has[2] = {1, 1};
+
+    // The first measurement starts the filters
+    if (filter_time_ns == 0)
+    {
+        reset_kalman_filter(&bank, FILTER_X, x);
+        reset_kalman_filter(&bank, FILTER_Z, z);
+    }
+    else
+    {
+        if (time_ns > filter_time_ns)
+        {
+            kalman_predict(&bank, (time_ns - filter_time_ns) / 1e9);
+        }
+        kalman_update(&bank, measures, has);
+    }
+
+    if (time_ns > filter_time_ns)
+    {
+        filter_time_ns = time_ns;
+    }
+    last_measures[FILTER_X] = x;
+    last_measures[FILTER_Z] = z;
+}
+
+// Function to publish the state of the filters
+void publish_filters()
+{
+    POSE_ESTIMATE estimate;
+    memset(&estimate, 0, sizeof(estimate));
+
+    estimate.time_ns = filter_time_ns;
+    estimate.x = bank.pos[FILTER_X];
+    estimate.vx = bank.vel[FILTER_X];
+    estimate.z = bank.pos[FILTER_Z];
+    estimate.vz = bank.vel[FILTER_Z];
+    estimate.cov_x[0] = bank.p_pp[FILTER_X];
+    estimate.cov_x[1] = bank.p_pv[FILTER_X];
+    estimate.cov_x[2] = bank.p_vv[FILTER_X];
+    estimate.cov_z[0] = bank.p_pp[FILTER_Z];
+    estimate.cov_z[1] = bank.p_pv[FILTER_Z];
+    estimate.cov_z[2] = bank.p_vv[FILTER_Z];
+
+    publish_estimate(estimates, 0, &estimate);
+    metrics_gauge(metrics, METRIC_POSITION_X, estimate.x);
+    metrics_gauge(metrics, METRIC_POSITION_Z, estimate.z);
+    metrics_gauge(metrics, METRIC_VELOCITY, hypotf(estimate.vx, estimate.vz));
+}
+
+int main(int argc, char const *argv[])
+{
+    // Open the log file
+    if (open_mmap_log(&log_file, "log/estimator.log") == -1)
+    {
+        // If error occurs while opening the log file
+        exit(errno);
+    }
+
+    // Noise of the model, the one of the measurements is the error of the world process
+    char *env_q = getenv("HOIST_KF_Q");
+    char *env_gate = getenv("HOIST_KF_GATE");
+    float q = (env_q != NULL && atof(env_q) > 0) ? atof(env_q) : KALMAN_DEFAULT_Q;
+    float gate = (env_gate != NULL && atof(env_gate) > 0) ? atof(env_gate) : KALMAN_DEFAULT_GATE;
+
+    // The error of the measurements follows the shared configuration
+    HOIST_CONFIG config;
+    CONFIG_SHM *config_shm = open_config_shm(0);
+    uint32_t config_seen = read_config(config_shm, &config);
+
+    // Open the pose bus, the estimate segment and the metrics, create the filters and listen for signals
+    POSE_BUS *bus;
+    if ((bus = open_pose_bus()) == NULL || (estimates = open_estimate_shm(ESTIMATE_SHM_NAME)) == NULL ||
+        (metrics = register_metrics(METRICS_ESTIMATOR, "estimator")) == NULL || init_kalman_bank(&bank, 2, q, config.sensor_error, SENSOR_RESOLUTION, gate) == -1 ||
+        signal(SIGINT, stop_handler) == SIG_ERR || signal(SIGTERM, stop_handler) == SIG_ERR)
+    {
+        error = 1;
+    }
+    else
+    {
+        estimates->n_hoists = 1;
+    }
+
+    // Only the positions published from now on are filtered
+    uint64_t cursor = error ? 0 : pose_bus_head(bus);
+    uint64_t report_ns = monotonic_ns() + REPORT_PERIOD_NS;
+    unsigned long samples = 0, still = 0;
+    uint64_t lost = 0;
+    POSE_SAMPLE buffer[MAX_SAMPLES];
+
+    while (!error && !stop_flag)
+    {
+        // Read the counter before the samples, a sample published after the read wakes the wait
+        uint32_t seen = pose_bus_notify(bus);
+        int n = read_pose_samples(bus, &cursor, buffer, MAX_SAMPLES, &lost);
+        uint64_t now = monotonic_ns();
+
+        if (config_changed(config_shm, &config_seen, &config))
+        {
+            bank.relative_error = config.sensor_error;
+        }
+
+        if (n > 0)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                filter_measures(buffer[i].x, buffer[i].z, buffer[i].time_ns);
+            }
+            publish_filters();
+
+            // Time from the publication of the newest position to the publication of its estimate
+            metrics_observe(metrics, METRIC_ESTIMATE_LATENCY, (monotonic_ns() - buffer[n - 1].time_ns) / 1000);
+            metrics_count(metrics, METRIC_SAMPLES, n);
+            samples += n;
+            last_sample_ns = now;
+        }
+        else if (filter_time_ns != 0 && now - last_sample_ns >= STILL_TIMEOUT_NS)
+        {
+            // The hoist is still, measure the last position again
+            filter_measures(last_measures[FILTER_X], last_measures[FILTER_Z], now);
+            publish_filters();
+            last_sample_ns = now;
+            still++;
+        }
+
+        if (now >= report_ns)
+        {
+            char to_write[250];
+            sprintf(to_write, "%lu positions, %lu still updates, %lu lost, %lu rejected, x=%.3f (sd %.3f) vx=%.3f z=%.3f (sd %.3f) vz=%.3f", samples, still,
+                    (unsigned long)lost, (unsigned long)bank.rejected, bank.pos[FILTER_X], sqrtf(bank.p_pp[FILTER_X]), bank.vel[FILTER_X], bank.pos[FILTER_Z],
+                    sqrtf(bank.p_pp[FILTER_Z]), bank.vel[FILTER_Z]);
+            if (error = write_log(to_write, 'r'))
+            {
+                break;
+            }
+            report_ns += REPORT_PERIOD_NS;
+        }
+
+        // Sleep until the next position, the still timeout or the report
+        uint64_t deadline = report_ns;
+        if (filter_time_ns != 0 && last_sample_ns + STILL_TIMEOUT_NS < deadline)
+        {
+            deadline = last_sample_ns + STILL_TIMEOUT_NS;
+        }
+        metrics_count(metrics, METRIC_WAKEUPS, 1);
+        wait_pose_bus(bus, seen, deadline);
+    }
+
+    if (stop_flag && !error)
+    {
+        error = write_log(stop_flag == SIGINT ? "SIGINT" : "SIGTERM", 's');
+    }
+
+    free_kalman_bank(&bank);
+
+    if (error == 1)
+    {
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close the log file
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing on log file
+            exit(errno);
+        }
+        exit(1);
+    }
+
+    // Close the log file
+    close_mmap_log(&log_file);
+
+    if (error == 2)
+    {
+        // If error occurs while writing on log file
+        exit(errno);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,679 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "./../include/coroutine_scheduler.h"
+#include "./../include/motor_core.h"
+#include "./../include/world_core.h"
+#include "./../include/pose_stream.h"
+#include "./../include/kalman_filter.h"
+#include "./../include/pose_estimate.h"
+#include "./../include/tick_timer.h"
+#include "./../include/metrics.h"
+#include "./../include/mmap_log.h"
+#include "./../include/sim_random.h"
+
+// Simulation of many hoists on a single thread: every hoist is a task of the
+// coroutine scheduler ticking its two motors, and a console task reads the
+// commands from the standard input. After the hoists, a filter task runs the
+// Kalman filters of all the hoists at once and publishes the estimates in the
+// /hoist_sim_estimate shared memory segment.
+//
+// Commands, one per line:
+//   <hoist|*> velocity <x|z|both> <value>
+//   <hoist|*> move <x|z|both> <value>
+//   <hoist|*> stop
+//   <hoist|*> reset
+//   status
+//
+// With a script, the simulation replays it in virtual time instead: the
+// commands are applied at their tick, in the order of the ticks then of the
+// lines, the hoists move exactly TICK_PERIOD_NS per tick and the positions,
+// measures and estimates of every hoist are written after every tick. The
+// noise is seeded (HOIST_SEED, 1 by default), so a script always gives the same
+// trace, bit for bit; with a golden trace the replay compares them instead of
+// printing the trace, to check that a change keeps the behaviour of the hoists.
+//
+// Script lines: <tick> <command>, '#' starts a comment. The replay ends at the
+// tick of the last command.
+
+// Period of the position updates, the same as the motor processes
+#define TICK_PERIOD_NS 500000000
+
+// Period of the report written on the log file
+#define REPORT_PERIOD_NS 1000000000
+
+// Default and maximum number of hoists
+#define DEFAULT_HOISTS 4
+#define MAX_HOISTS 512
+
+// Maximum number of commands of a replayed script and length of a command
+#define REPLAY_MAX_COMMANDS 4096
+#define REPLAY_COMMAND_MAX 128
+
+// State of a simulated hoist
+typedef struct {
+    MOTOR x;
+    MOTOR z;
+    float real_x;
+    float real_z;
+    unsigned long ticks;
+} HOIST;
+
+// Memory mapped log file
+MMAP_LOG log_file;
+
+// Buffer to store the log message
+char log_buffer[200];
+
+// Variable to store the errors
+// 0 = no error
+// 1 = system call error
+// 2 = error while writing on log file
+int error = 0;
+
+// Hoists and their tasks
+HOIST hoists[MAX_HOISTS];
+CO_TASK hoist_tasks[MAX_HOISTS];
+int n_hoists = DEFAULT_HOISTS;
+
+// Scheduler running all the tasks
+CO_SCHEDULER scheduler;
+
+// Kalman filters of the x axes of all the hoists, followed by the z axes, and their measurements
+KALMAN_BANK filters;
+float *filter_measures;
+uint8_t *filter_has;
+ESTIMATE_SHM *estimates;
+
+// Reassembly buffer of the console commands
+POSE_READER console_reader;
+POSE_STATS console_stats;
+
+// Metrics of this process
+METRICS_SLOT *metrics;
+
+// Command of a replayed script
+typedef struct {
+    unsigned long tick;
+    int line;
+    char command[REPLAY_COMMAND_MAX];
+} REPLAY_COMMAND;
+
+// Function to write on log
+int write_log(char *to_write, char type)
+{
+    time_t t = time(NULL);
+    struct tm tm = *localtime(&t);
+
+    // If type is 'e' then it is an error
+    if (type == 'e')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <hoist_sim_process> error: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'c' then it is a console command
+    else if (type == 'c')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <hoist_sim_process> command: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'r' then it is the periodic report
+    else if (type == 'r')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <hoist_sim_process> report: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 's' then it is a signal
+    else if (type == 's')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <hoist_sim_process> signal received: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+
+    // Copy the message in the mapped segment
+    if (mmap_log_write(&log_file, log_buffer, strlen(log_buffer)) == -1)
+    {
+        return 2;
+    }
+
+    return 0;
+}
+
+// Function to move a hoist for dt seconds and measure its position like the world process
+void step_hoist(HOIST *hoist, double dt)
+{
+    int moved = motor_step(&hoist->x, dt);
+    moved |= motor_step(&hoist->z, dt);
+    if (moved)
+    {
+        hoist->real_x = sense_position('x', hoist->x.pos);
+        hoist->real_z = sense_position('z', hoist->z.pos);
+        metrics_count(metrics, METRIC_SAMPLES, 1);
+    }
+    hoist->ticks++;
+}
+
+// Function to run the filters of all the hoists after they moved for dt seconds
+// The estimates are published with the time of the tick
+void run_filters(double dt, uint64_t time_ns)
+{
+    // Every hoist is measured at every tick, a still hoist keeps its last measurement
+    for (int i = 0; i < n_hoists; i++)
+    {
+        filter_measures[i] = hoists[i].real_x;
+        filter_measures[n_hoists + i] = hoists[i].real_z;
+    }
+    kalman_predict(&filters, dt);
+    kalman_update(&filters, filter_measures, filter_has);
+
+    for (int i = 0; i < n_hoists; i++)
+    {
+        int z = n_hoists + i;
+        POSE_ESTIMATE estimate = {.time_ns = time_ns,
+                                  .x = filters.pos[i],
+                                  .vx = filters.vel[i],
+                                  .z = filters.pos[z],
+                                  .vz = filters.vel[z],
+                                  .cov_x = {filters.p_pp[i], filters.p_pv[i], filters.p_vv[i]},
+                                  .cov_z = {filters.p_pp[z], filters.p_pv[z], filters.p_vv[z]}};
+        publish_estimate(estimates, i, &estimate);
+    }
+}
+
+// Task moving a hoist on the tick grid
+int hoist_task(CO_TASK *task)
+{
+    HOIST *hoist = task->data;
+
+    CO_BEGIN(task);
+
+    while (1)
+    {
+        CO_AWAIT_TICK(task, TICK_PERIOD_NS);
+
+        // A late tick covers all the periods elapsed since the previous one
+        if (task->expirations > 1)
+        {
+            metrics_count(metrics, METRIC_DEADLINE_MISSES, task->expirations - 1);
+        }
+        step_hoist(hoist, task->expirations * (TICK_PERIOD_NS / 1e9));
+    }
+
+    CO_END(task);
+}
+
+// Task running the filters of all the hoists after they moved
+int filter_task(CO_TASK *task)
+{
+    CO_BEGIN(task);
+
+    while (1)
+    {
+        CO_AWAIT_TICK(task, TICK_PERIOD_NS);
+
+        run_filters(task->expirations * (TICK_PERIOD_NS / 1e9), monotonic_ns());
+    }
+
+    CO_END(task);
+}
+
+// Function to print the position of all the hoists
+void print_status(FILE *out)
+{
+    for (int i = 0; i < n_hoists; i++)
+    {
+        fprintf(out, "hoist %d: x=%.2f z=%.2f vx=%.2f vz=%.2f, filtered x=%.2f z=%.2f\n", i, hoists[i].real_x, hoists[i].real_z, hoists[i].x.v, hoists[i].z.v,
+                filters.pos[i], filters.pos[n_hoists + i]);
+    }
+    fflush(out);
+}
+
+// Function to execute a console command, status is printed on out
+// Returns 0 if the command was executed, -1 if it is not valid
+int execute_command(char *line, FILE *out)
+{
+    char target[16], op_name[16], axis_name[16];
+    float value = 0.0;
+
+    int fields = sscanf(line, "%15s %15s %15s %f", target, op_name, axis_name, &value);
+    if (fields >= 1 && strcmp(target, "status") == 0)
+    {
+        print_status(out);
+        return 0;
+    }
+    if (fields < 2)
+    {
+        return -1;
+    }
+
+    // Hoists the command is applied to
+    int first = 0, last = n_hoists - 1;
+    if (strcmp(target, "*") != 0)
+    {
+        char *end;
+        first = last = strtol(target, &end, 10);
+        if (*end != '\0' || first < 0 || first >= n_hoists)
+        {
+            return -1;
+        }
+    }
+
+    MOTOR_COMMAND cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    int axis = CTL_AXIS_BOTH;
+
+    if (strcmp(op_name, "stop") == 0 || strcmp(op_name, "reset") == 0)
+    {
+        cmd.op = (op_name[0] == 's') ? CTL_OP_STOP : CTL_OP_RESET;
+    }
+    else if (fields == 4 && (strcmp(op_name, "velocity") == 0 || strcmp(op_name, "move") == 0))
+    {
+        cmd.op = (op_name[0] == 'v') ? CTL_OP_SET_VELOCITY : CTL_OP_MOVE_TO;
+        cmd.value = value;
+
+        if (strcmp(axis_name, "x") == 0)
+        {
+            axis = CTL_AXIS_X;
+        }
+        else if (strcmp(axis_name, "z") == 0)
+        {
+            axis = CTL_AXIS_Z;
+        }
+        else if (strcmp(axis_name, "both") != 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        return -1;
+    }
+
+    for (int i = first; i <= last; i++)
+    {
+        if (axis & CTL_AXIS_X)
+        {
+            motor_apply_command(&hoists[i].x, &cmd);
+        }
+        if (axis & CTL_AXIS_Z)
+        {
+            motor_apply_command(&hoists[i].z, &cmd);
+        }
+    }
+    metrics_count(metrics, METRIC_COMMANDS, last - first + 1);
+
+    return 0;
+}
+
+// Task reading the commands from the standard input
+int console_task(CO_TASK *task)
+{
+    CO_BEGIN(task);
+
+    while (1)
+    {
+        CO_AWAIT_READABLE(task, STDIN_FILENO);
+        metrics_count(metrics, METRIC_WAKEUPS, 1);
+
+        int n = fill_pose_reader(STDIN_FILENO, &console_reader, &console_stats);
+        if (n == -1)
+        {
+            error = 1;
+            return CO_ERROR;
+        }
+
+        // The console is closed, the hoists keep running
+        if (n == 0)
+        {
+            break;
+        }
+
+        char *line;
+        while (next_pose_record(&console_reader, &line))
+        {
+            if (line[0] == '\0')
+            {
+                continue;
+            }
+
+            if (execute_command(line, stdout) == -1)
+            {
+                printf("invalid command: %s\n", line);
+                fflush(stdout);
+            }
+            else if (error = write_log(line, 'c'))
+            {
+                return CO_ERROR;
+            }
+        }
+    }
+
+    CO_END(task);
+}
+
+// Task writing the number of moving hoists on the log file
+int report_task(CO_TASK *task)
+{
+    CO_BEGIN(task);
+
+    while (1)
+    {
+        CO_AWAIT_TICK(task, REPORT_PERIOD_NS);
+
+        int moving = 0;
+        for (int i = 0; i < n_hoists; i++)
+        {
+            if (hoists[i].x.v != 0 || hoists[i].z.v != 0)
+            {
+                moving++;
+            }
+        }
+
+        char to_write[60];
+        sprintf(to_write, "%d hoists, %d moving", n_hoists, moving);
+        if (error = write_log(to_write, 'r'))
+        {
+            return CO_ERROR;
+        }
+    }
+
+    CO_END(task);
+}
+
+// Function to compare two script commands by tick, then by line
+int compare_replay_commands(const void *a, const void *b)
+{
+    const REPLAY_COMMAND *x = a, *y = b;
+    if (x->tick != y->tick)
+    {
+        return (x->tick > y->tick) - (x->tick < y->tick);
+    }
+    return x->line - y->line;
+}
+
+// Function to load a script, ordered by virtual time
+// Returns the number of commands, -1 on error with the reason printed
+int load_replay_script(const char *path, REPLAY_COMMAND *commands)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    int n = 0, line_number = 0;
+    char line[REPLAY_COMMAND_MAX + 32];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+
+        // Strip comments and the newline
+        line[strcspn(line, "#\r\n")] = '\0';
+
+        unsigned long tick;
+        int start;
+        if (sscanf(line, " %lu %n", &tick, &start) != 1)
+        {
+            // Blank lines are allowed, anything else is an error
+            if (line[strspn(line, " \t")] == '\0')
+            {
+                continue;
+            }
+            fprintf(stderr, "%s:%d: expected <tick> <command>\n", path, line_number);
+            fclose(file);
+            return -1;
+        }
+        if (n == REPLAY_MAX_COMMANDS || strlen(line + start) >= REPLAY_COMMAND_MAX)
+        {
+            fprintf(stderr, "%s:%d: too many commands or command too long\n", path, line_number);
+            fclose(file);
+            return -1;
+        }
+
+        commands[n].tick = tick;
+        commands[n].line = line_number;
+        strcpy(commands[n].command, line + start);
+        n++;
+    }
+    fclose(file);
+
+    qsort(commands, n, sizeof(REPLAY_COMMAND), compare_replay_commands);
+    return n;
+}
+
+// Function to write the state of every hoist after a tick
+// Values are written with 9 significant digits, enough to tell apart any two floats
+void write_trace(FILE *trace, unsigned long tick)
+{
+    for (int i = 0; i < n_hoists; i++)
+    {
+        fprintf(trace, "%lu %d x=%.9g z=%.9g vx=%.9g vz=%.9g real_x=%.9g real_z=%.9g est_x=%.9g est_z=%.9g\n", tick, i, hoists[i].x.pos, hoists[i].z.pos,
+                hoists[i].x.v, hoists[i].z.v, hoists[i].real_x, hoists[i].real_z, filters.pos[i], filters.pos[n_hoists + i]);
+    }
+}
+
+// Function to compare a trace with the golden trace, printing the first difference
+// Returns 0 if they are identical, 1 if they differ, -1 on error
+int compare_trace(char *trace, size_t len, const char *golden_path)
+{
+    FILE *golden = fopen(golden_path, "r");
+    FILE *current = fmemopen(trace, len, "r");
+    if (golden == NULL || current == NULL)
+    {
+        perror(golden_path);
+        return -1;
+    }
+
+    char expected[512], got[512];
+    int line_number = 0, ret = 0;
+    while (ret == 0)
+    {
+        line_number++;
+        char *e = fgets(expected, sizeof(expected), golden);
+        char *g = fgets(got, sizeof(got), current);
+        if (e == NULL && g == NULL)
+        {
+            break;
+        }
+        if (e == NULL || g == NULL || strcmp(expected, got) != 0)
+        {
+            printf("trace differs from %s at line %d\n  expected: %s  got:      %s", golden_path, line_number, e ? expected : "end of trace\n",
+                   g ? got : "end of trace\n");
+            ret = 1;
+        }
+    }
+
+    if (ret == 0)
+    {
+        printf("trace identical to %s, %d lines\n", golden_path, line_number - 1);
+    }
+
+    fclose(golden);
+    fclose(current);
+    return ret;
+}
+
+// Function to replay a script in virtual time, comparing the trace with golden if not NULL
+// Returns 0 on success, 1 if the trace differs from the golden one, -1 on error
+int run_replay(const char *script, const char *golden, uint32_t seed)
+{
+    static REPLAY_COMMAND commands[REPLAY_MAX_COMMANDS];
+    int n = load_replay_script(script, commands);
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    // The trace is kept in memory when it is compared
+    char *buffer = NULL;
+    size_t len = 0;
+    FILE *trace = golden ? open_memstream(&buffer, &len) : stdout;
+    if (trace == NULL)
+    {
+        return -1;
+    }
+    // Only the name of the script, the same replay started from another directory gives the same trace
+    const char *script_name = strrchr(script, '/') ? strrchr(script, '/') + 1 : script;
+    fprintf(trace, "# %s: %d hoists, seed %u, tick %d ms\n", script_name, n_hoists, seed, TICK_PERIOD_NS / 1000000);
+
+    double dt = TICK_PERIOD_NS / 1e9;
+    unsigned long last_tick = (n > 0) ? commands[n - 1].tick : 0;
+    int next = 0;
+
+    for (unsigned long tick = 0; tick <= last_tick; tick++)
+    {
+        // The commands of a tick are applied before the hoists move
+        for (; next < n && commands[next].tick == tick; next++)
+        {
+            fprintf(trace, "%lu > %s\n", tick, commands[next].command);
+            if (execute_command(commands[next].command, trace) == -1)
+            {
+                fprintf(stderr, "%s:%d: invalid command: %s\n", script, commands[next].line, commands[next].command);
+                return -1;
+            }
+        }
+
+        for (int i = 0; i < n_hoists; i++)
+        {
+            step_hoist(&hoists[i], dt);
+        }
+        run_filters(dt, tick * (uint64_t)TICK_PERIOD_NS);
+        write_trace(trace, tick);
+    }
+
+    if (golden == NULL)
+    {
+        fflush(stdout);
+        return 0;
+    }
+
+    fclose(trace);
+    int ret = compare_trace(buffer, len, golden);
+    free(buffer);
+    return ret;
+}
+
+// Task stopping the simulation when the signal in task->data is received
+int signal_task(CO_TASK *task)
+{
+    int *signo = task->data;
+
+    CO_BEGIN(task);
+
+    CO_AWAIT_SIGNAL(task, *signo);
+
+    error = write_log(*signo == SIGINT ? "SIGINT" : "SIGTERM", 's');
+    stop_scheduler(task->scheduler);
+
+    CO_END(task);
+}
+
+int main(int argc, char const *argv[])
+{
+    // Open the log file
+    if (open_mmap_log(&log_file, "log/hoist_sim.log") == -1)
+    {
+        // If error occurs while opening the log file
+        exit(errno);
+    }
+
+    // Number of hoists to simulate
+    if (argc > 1)
+    {
+        n_hoists = atoi(argv[1]);
+        if (n_hoists < 1 || n_hoists > MAX_HOISTS)
+        {
+            fprintf(stderr, "usage: %s [hoists, 1-%d [script [golden trace]]]\n", argv[0], MAX_HOISTS);
+            close_mmap_log(&log_file);
+            exit(1);
+        }
+    }
+
+    // Seed the noise of the sensors
+    uint32_t seed = seed_random_from_env(DEFAULT_SEED);
+
+    // All the hoists start stopped at the minimum position
+    for (int i = 0; i < n_hoists; i++)
+    {
+        init_motor(&hoists[i].x, 'x', min_x_pos, max_x_pos);
+        init_motor(&hoists[i].z, 'z', min_z_pos, max_z_pos);
+    }
+
+    // Create the filters of the hoists and map the segment of their estimates
+    int ret = init_kalman_bank(&filters, 2 * n_hoists, KALMAN_DEFAULT_Q, SENSOR_RELATIVE_ERROR, SENSOR_RESOLUTION, KALMAN_DEFAULT_GATE);
+    filter_measures = calloc(2 * n_hoists, sizeof(float));
+    filter_has = malloc(2 * n_hoists);
+    if (ret == -1 || filter_measures == NULL || filter_has == NULL || (estimates = open_estimate_shm(SIM_ESTIMATE_SHM_NAME)) == NULL)
+    {
+        ret = -1;
+    }
+    else
+    {
+        memset(filter_has, 1, 2 * n_hoists);
+        estimates->n_hoists = n_hoists;
+    }
+
+    if (ret == 0 && (metrics = register_metrics(METRICS_SIM, "hoist_sim")) == NULL)
+    {
+        ret = -1;
+    }
+
+    // Replay the script in virtual time instead of running live
+    if (ret == 0 && argc > 2)
+    {
+        int replay = run_replay(argv[2], argc > 3 ? argv[3] : NULL, seed);
+        close_mmap_log(&log_file);
+        exit(replay == 0 ? 0 : 1);
+    }
+
+    // Create the tasks, the hoists first so that they are resumed before the filters and the console in a turn
+    static int sigint = SIGINT, sigterm = SIGTERM;
+    CO_TASK filter, console, report, int_task, term_task;
+
+    if (ret == 0)
+    {
+        ret = init_scheduler(&scheduler);
+    }
+    for (int i = 0; i < n_hoists && ret == 0; i++)
+    {
+        ret = spawn_task(&scheduler, &hoist_tasks[i], hoist_task, &hoists[i]);
+    }
+    if (ret == 0 && (spawn_task(&scheduler, &filter, filter_task, NULL) == -1 || spawn_task(&scheduler, &console, console_task, NULL) == -1 || spawn_task(&scheduler, &report, report_task, NULL) == -1 ||
+                     spawn_task(&scheduler, &int_task, signal_task, &sigint) == -1 || spawn_task(&scheduler, &term_task, signal_task, &sigterm) == -1))
+    {
+        ret = -1;
+    }
+
+    // Run until an error occurs or the simulation is stopped
+    if (ret == -1 || (run_scheduler(&scheduler) == -1 && !error))
+    {
+        error = 1;
+    }
+
+    if (error == 1)
+    {
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close the log file
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing on log file
+            exit(errno);
+        }
+        exit(1);
+    }
+
+    // Close the log file
+    close_mmap_log(&log_file);
+
+    if (error == 2)
+    {
+        // If error occurs while writing on log file
+        exit(errno);
+    }
+
+    exit(0);
+}
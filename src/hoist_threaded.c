@@ -0,0 +1,765 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "./../include/control_service.h"
+#include "./../include/motor_core.h"
+#include "./../include/world_core.h"
+#include "./../include/pose_stream.h"
+#include "./../include/spsc_queue.h"
+#include "./../include/estop.h"
+#include "./../include/metrics.h"
+#include "./../include/tick_timer.h"
+#include "./../include/runtime_profile.h"
+#include "./../include/mmap_log.h"
+#include "./../include/pose_bus.h"
+#include "./../include/hoist_config.h"
+
+// Single process version of the hoist: the motors, the world and the control
+// server run as threads of this process and exchange data through lock-free
+// queues instead of FIFOs. The command and inspection consoles are replaced by
+// the control socket, the inspection console can still be attached with --inspection.
+// There is no master: the runtime parses the configuration file itself, shares
+// it in /hoist_config and parses it again on SIGHUP, and the threads apply it
+// at their next tick like the processes.
+
+// Capacity of the queues, powers of two
+#define COMMAND_QUEUE_SIZE 1024
+#define SAMPLE_QUEUE_SIZE 256
+
+// Indexes of the motors
+#define MOTOR_X 0
+#define MOTOR_Z 1
+
+// Position sample sent by a motor thread to the world thread
+typedef struct {
+    uint32_t seq;
+    float pos;
+} AXIS_SAMPLE;
+
+// Memory mapped log file
+MMAP_LOG log_file;
+
+// Buffer to store the log message, shared by all the threads
+char log_buffer[200];
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Variable to store the errors
+// 0 = no error
+// 1 = system call error
+// 2 = error while writing on log file
+volatile int error = 0;
+
+// Motors, commands queues from the control thread and doorbells of the motor threads
+MOTOR motors[2];
+SPSC_QUEUE command_queues[2];
+DOORBELL motor_bells[2];
+
+// Reset requested by SIGUSR2 and not yet applied by the motor threads
+uint32_t reset_requests[2];
+
+// Samples queues from the motor threads and doorbell of the world thread
+SPSC_QUEUE sample_queues[2];
+DOORBELL world_bell;
+
+// Position published by the motors, read by the control thread
+// This is the same structure used by the processes, kept in private memory
+POSE_SHM pose;
+
+// Counters of the samples received by the world thread
+POSE_STATS stats[2];
+
+// FIFO of the inspection console, -1 if not attached
+int fd_real_pos = -1;
+
+// Ring of the positions measured by the world thread, shared with the other processes
+POSE_BUS *pose_bus;
+
+// Control socket and connected clients
+CONTROL_SERVICE service;
+
+// Shared memory emergency stop, so the inspection console can still stop the hoist
+ESTOP_SHM *estop;
+
+// Metrics of the threads
+METRICS_SLOT *motor_metrics[2];
+METRICS_SLOT *world_metrics;
+
+// Runtime profiles of the threads
+RUNTIME_PROFILE profiles[MAX_RUNTIME_PROFILES];
+int n_profiles = 0;
+
+// Shared configuration, published by the main thread
+CONFIG_SHM *config_shm;
+
+// Function to write on log
+int write_log(char *to_write, char type)
+{
+    time_t t = time(NULL);
+    struct tm tm;
+    localtime_r(&t, &tm);
+
+    // The buffer is shared by all the threads
+    pthread_mutex_lock(&log_mutex);
+
+    // If type is 'e' then it is an error
+    if (type == 'e')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <threaded_process> error: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'm' then it is a batch of motor commands
+    else if (type == 'm')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <threaded_process> motor commands: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'i' then it is the position
+    else if (type == 'i')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <threaded_process> Position: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 's' then it is a signal
+    else if (type == 's')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <threaded_process> signal received: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 't' then it is the samples stream
+    else if (type == 't')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <threaded_process> Stream %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'c' then it is a client event
+    else if (type == 'c')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <threaded_process> client %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'p' then it is the runtime profile
+    else if (type == 'p')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <threaded_process> runtime profile: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'g' then it is a new configuration
+    else if (type == 'g')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <threaded_process> configuration: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+
+    // Copy the message in the mapped segment
+    int ret = (mmap_log_write(&log_file, log_buffer, strlen(log_buffer)) == -1) ? 2 : 0;
+
+    pthread_mutex_unlock(&log_mutex);
+
+    return ret;
+}
+
+// Function called by a thread to stop the runtime
+// The main thread is waiting for the termination signal
+void fail(int code)
+{
+    if (!error)
+    {
+        error = code;
+    }
+    kill(getpid(), SIGTERM);
+}
+
+// Function to apply the runtime profile of a process to the calling thread
+// Returns 0 on success, 2 on log error
+int apply_thread_profile(char *name)
+{
+    RUNTIME_PROFILE *profile = find_runtime_profile(profiles, n_profiles, name);
+    if (profile == NULL)
+    {
+        return 0;
+    }
+
+    char report[150];
+    apply_runtime_profile(syscall(SYS_gettid), profile, report);
+
+    return write_log(report, 'p') ? 2 : 0;
+}
+
+// Function to parse the configuration file and share it with the next version, like the master does
+// An invalid file is logged and the current configuration is kept
+// Returns 0 on success or invalid file, 1 if the file is invalid at the startup, 2 on log error
+int share_config_file(int startup)
+{
+    HOIST_CONFIG config;
+    char config_error[300];
+    char to_write[sizeof(config_error) + 60];
+
+    if (load_config_file(CONFIG_FILE, &config, config_error) == -1)
+    {
+        sprintf(to_write, "invalid, keeping version %u: %s", config_shm->version, config_error);
+        if (write_log(to_write, 'g'))
+        {
+            return 2;
+        }
+        return startup ? 1 : 0;
+    }
+
+    uint32_t version = publish_config(config_shm, &config);
+    sprintf(to_write, "version %u: x %.2f-%.2f, z %.2f-%.2f, motor tick %u ms, sensor error %.4f", version, config.x_min, config.x_max, config.z_min, config.z_max,
+            config.motor_tick_ms, config.sensor_error);
+    return write_log(to_write, 'g') ? 2 : 0;
+}
+
+// Function to apply a configuration to a motor thread: the limits of its axis and the period of its ticks
+// A motor outside the new limits is moved within them and stopped
+// Returns 1 if the position changed
+int apply_motor_config(int m, HOIST_CONFIG *config, TICK_TIMER *tick_timer)
+{
+    MOTOR *motor = &motors[m];
+    float old_pos = motor->pos;
+
+    motor->min = (m == MOTOR_X) ? config->x_min : config->z_min;
+    motor->max = (m == MOTOR_X) ? config->x_max : config->z_max;
+    if (motor->pos < motor->min || motor->pos > motor->max)
+    {
+        motor->pos = motor->pos < motor->min ? motor->min : motor->max;
+        stop_motor(motor);
+    }
+    tick_timer->period_ns = config->motor_tick_ms * 1000000ULL;
+
+    return motor->pos != old_pos;
+}
+
+// Function to forward the commands of a batch to the motor threads
+// Waits for the motors if a queue is full, like a write on a full FIFO
+int forward_to_queues(MOTOR_COMMAND *x_cmds, int x_count, MOTOR_COMMAND *z_cmds, int z_count)
+{
+    MOTOR_COMMAND *cmds[2] = {x_cmds, z_cmds};
+    int count[2] = {x_count, z_count};
+
+    for (int m = 0; m < 2; m++)
+    {
+        for (int i = 0; i < count[m]; i++)
+        {
+            while (spsc_push(&command_queues[m], &cmds[m][i]) == -1)
+            {
+                ring_doorbell(&motor_bells[m]);
+                sched_yield();
+            }
+        }
+
+        if (count[m] > 0)
+        {
+            ring_doorbell(&motor_bells[m]);
+        }
+    }
+
+    return 0;
+}
+
+// Function to log a client event
+int log_client_event(char *event)
+{
+    return write_log(event, 'c');
+}
+
+// Control thread, serves the control socket
+void *control_thread(void *arg)
+{
+    int ret = apply_thread_profile("control");
+    if (!ret)
+    {
+        ret = run_control_service(&service);
+    }
+
+    fail(ret);
+    return NULL;
+}
+
+// Motor thread, the same loop as the motor processes with the FIFOs replaced by queues
+void *motor_thread(void *arg)
+{
+    int m = *(int *)arg;
+    MOTOR *motor = &motors[m];
+    METRICS_SLOT *metrics = motor_metrics[m];
+
+    if (apply_thread_profile(m == MOTOR_X ? "mx" : "mz"))
+    {
+        fail(2);
+        return NULL;
+    }
+
+    // Sequence number of the last sample sent to the world thread
+    uint32_t seq = 0;
+
+    // Last emergency stop request applied by this thread, the requests made before starting are ignored
+    uint32_t estop_seen = estop_generation(estop);
+
+    // Configuration applied by this thread
+    HOIST_CONFIG config;
+    uint32_t config_seen = read_config(config_shm, &config);
+
+    // Deadlines of the position updates
+    TICK_TIMER tick_timer;
+    start_tick_timer(&tick_timer, config.motor_tick_ms * 1000000ULL);
+    apply_motor_config(m, &config, &tick_timer);
+
+    while (!error)
+    {
+        // Read the doorbell before draining, a command pushed after this wakes the next wait
+        uint32_t seen = doorbell_seq(&motor_bells[m]);
+
+        // Apply the queued commands in the order they were sent
+        MOTOR_COMMAND cmd;
+        int count = 0;
+        while (spsc_pop(&command_queues[m], &cmd))
+        {
+            motor_apply_command(motor, &cmd);
+            count++;
+        }
+
+        // A reset requested by signal is a reset command
+        if (__atomic_exchange_n(&reset_requests[m], 0, __ATOMIC_ACQ_REL))
+        {
+            cmd.op = CTL_OP_RESET;
+            motor_apply_command(motor, &cmd);
+            count++;
+        }
+
+        if (count > 0)
+        {
+            metrics_count(metrics, METRIC_COMMANDS, count);
+
+            // Log the whole batch once
+            char to_write[40];
+            sprintf(to_write, "%s %d, speed %.2f", m == MOTOR_X ? "mx" : "mz", count, motor->v);
+            if (write_log(to_write, 'm'))
+            {
+                fail(2);
+                break;
+            }
+        }
+
+        // Apply the emergency stop after the queued commands, so none of them restarts the motor
+        // Checked at every wakeup, the estop thread rings the doorbell and the ticks wake the thread anyway
+        uint32_t estop_word = estop_generation(estop);
+        if (estop_word != estop_seen)
+        {
+            estop_seen = estop_word;
+            stop_motor(motor);
+            ack_estop(estop, m == MOTOR_X ? ESTOP_MX : ESTOP_MZ);
+
+            // Log the stop with the time it took to be applied
+            char to_write[60];
+            sprintf(to_write, "%s STOP (shared memory), latency %lu us", m == MOTOR_X ? "mx" : "mz",
+                    (unsigned long)(estop_latency_ns(estop, m == MOTOR_X ? ESTOP_MX : ESTOP_MZ) / 1000));
+            if (write_log(to_write, 's'))
+            {
+                fail(2);
+                break;
+            }
+        }
+
+        // Commands arriving before the tick only change the velocity
+        if (!tick_due(&tick_timer))
+        {
+            wait_doorbell(&motor_bells[m], seen, tick_timer.next_ns);
+            metrics_count(metrics, METRIC_WAKEUPS, 1);
+            continue;
+        }
+
+        // Measure how late the tick is and how many deadlines were missed
+        TICK tick = advance_tick_timer(&tick_timer);
+        metrics_observe(metrics, METRIC_TICK_JITTER, tick.lateness_ns / 1000);
+        if (tick.missed)
+        {
+            metrics_count(metrics, METRIC_DEADLINE_MISSES, tick.missed);
+            metrics_observe(metrics, METRIC_DEADLINE_MISS, tick.lateness_ns / 1000);
+        }
+
+        // Apply a new configuration, a single load when there is none
+        int moved = 0;
+        if (config_changed(config_shm, &config_seen, &config))
+        {
+            moved = apply_motor_config(m, &config, &tick_timer);
+        }
+
+        // Update the position with the real time elapsed since the previous tick
+        moved |= motor_step(motor, tick.dt);
+        if (moved)
+        {
+            // Publish the position for the control thread
+            publish_pose(&pose, motor->axis, motor->pos);
+
+            // Send the sample to the world thread, a full queue is seen as lost samples
+            AXIS_SAMPLE sample = {++seq, motor->pos};
+            if (spsc_push(&sample_queues[m], &sample) == 0)
+            {
+                ring_doorbell(&world_bell);
+                metrics_count(metrics, METRIC_SAMPLES, 1);
+            }
+        }
+
+        // Update the gauges
+        metrics_gauge(metrics, METRIC_VELOCITY, motor->v);
+        metrics_gauge(metrics, m == MOTOR_X ? METRIC_POSITION_X : METRIC_POSITION_Z, motor->pos);
+        metrics_gauge(metrics, METRIC_QUEUE_DEPTH, spsc_size(&command_queues[m]));
+    }
+
+    return NULL;
+}
+
+// Function to log the counters of both samples streams
+int log_stream_stats()
+{
+    char to_write[150];
+    char counters[120];
+
+    format_pose_stats(counters, &stats[MOTOR_X]);
+    sprintf(to_write, "x: %s", counters);
+    if (write_log(to_write, 't'))
+    {
+        return 2;
+    }
+
+    format_pose_stats(counters, &stats[MOTOR_Z]);
+    sprintf(to_write, "z: %s", counters);
+    return write_log(to_write, 't');
+}
+
+// World thread, adds the error to the samples of the motors
+void *world_thread(void *arg)
+{
+    if (apply_thread_profile("world"))
+    {
+        fail(2);
+        return NULL;
+    }
+
+    // Variables to store the real position
+    float real_pos[2] = {0.0, 0.0};
+
+    // Variable to count the loops
+    int loops = 0;
+
+    // Sequence number of the last record sent to the inspection console
+    uint32_t real_pos_seq = 0;
+
+    // Configuration applied by this thread, the limits and the error of the sensors
+    HOIST_CONFIG config;
+    uint32_t config_seen = 0;
+
+    while (!error)
+    {
+        uint32_t seen = doorbell_seq(&world_bell);
+        int found = 0;
+
+        // Apply a new configuration before the positions, a single load when there is none
+        if (config_changed(config_shm, &config_seen, &config))
+        {
+            min_x_pos = config.x_min;
+            max_x_pos = config.x_max;
+            min_z_pos = config.z_min;
+            max_z_pos = config.z_max;
+            sensor_relative_error = config.sensor_error;
+        }
+
+        // Only the last sample of each motor is used, the previous ones are just counted
+        for (int m = 0; m < 2; m++)
+        {
+            AXIS_SAMPLE sample;
+            int got = 0;
+
+            while (spsc_pop(&sample_queues[m], &sample))
+            {
+                track_pose_sequence(&stats[m], sample.seq);
+                got = 1;
+            }
+
+            if (got)
+            {
+                real_pos[m] = sense_position(m == MOTOR_X ? 'x' : 'z', sample.pos);
+                found = 1;
+            }
+        }
+
+        // Sleep until a motor sends a sample, no timeout
+        if (!found)
+        {
+            wait_doorbell(&world_bell, seen, 0);
+            metrics_count(world_metrics, METRIC_WAKEUPS, 1);
+            continue;
+        }
+
+        loops++;
+
+        // Log every 10 loops, with the streams counters every 100 loops
+        if (loops % 10 == 0)
+        {
+            char to_write[40];
+            sprintf(to_write, "%f;%f", real_pos[MOTOR_X], real_pos[MOTOR_Z]);
+            if (write_log(to_write, 'i'))
+            {
+                fail(2);
+                break;
+            }
+        }
+        if (loops == 100)
+        {
+            if (log_stream_stats())
+            {
+                fail(2);
+                break;
+            }
+            loops = 0;
+        }
+
+        // Write the real position to the inspection console, if attached
+        if (fd_real_pos != -1)
+        {
+            char record[POSE_RECORD_MAX];
+            int len = format_pose_record(record, real_pos_seq + 1, real_pos[MOTOR_X], real_pos[MOTOR_Z]);
+
+            int m = write(fd_real_pos, record, len);
+            if (m == -1 || m != len)
+            {
+                fail(1);
+                break;
+            }
+            real_pos_seq++;
+            metrics_count(world_metrics, METRIC_BYTES_WRITTEN, len);
+        }
+
+        publish_pose_sample(pose_bus, real_pos[MOTOR_X], real_pos[MOTOR_Z]);
+        metrics_count(world_metrics, METRIC_SAMPLES, 1);
+        metrics_gauge(world_metrics, METRIC_POSITION_X, real_pos[MOTOR_X]);
+        metrics_gauge(world_metrics, METRIC_POSITION_Z, real_pos[MOTOR_Z]);
+    }
+
+    return NULL;
+}
+
+// Emergency stop thread, wakes both motor threads as soon as a request is made
+// The motors belong to their threads, which stop them and acknowledge the request
+void *estop_thread(void *arg)
+{
+    uint32_t seen = estop_generation(estop);
+
+    while (1)
+    {
+        seen = wait_estop(estop, seen);
+
+        for (int m = 0; m < 2; m++)
+        {
+            ring_doorbell(&motor_bells[m]);
+        }
+    }
+
+    return NULL;
+}
+
+// Function to log an error during the startup and exit
+void startup_error(char *reason)
+{
+    int ret = write_log(reason, 'e');
+    close_mmap_log(&log_file);
+    if (ret)
+    {
+        // If error occurs while writing to the log file
+        exit(errno);
+    }
+    exit(1);
+}
+
+int main(int argc, char const *argv[])
+{
+    // Open the log file
+    if (open_mmap_log(&log_file, "log/threaded.log") == -1)
+    {
+        // If error occurs while opening the log file
+        exit(errno);
+    }
+
+    // Apply the memory settings of the runtime profile, if any
+    // A failure does not stop the process, it runs without the memory locked and logs it as an error
+    char profile_report[100];
+    int profile_failed = apply_memory_profile(profile_report);
+    if (profile_report[0] != '\0' && write_log(profile_report, profile_failed ? 'e' : 'p'))
+    {
+        // If error occurs while writing to the log file
+        close_mmap_log(&log_file);
+        exit(errno);
+    }
+
+    // Seed the noise of the sensors, HOIST_SEED makes the measures reproducible
+    seed_random_from_env(DEFAULT_SEED);
+
+    // Load the runtime profiles, each thread applies the one of its process
+    char profile_error[200];
+    if ((n_profiles = load_runtime_profiles(RUNTIME_PROFILE_FILE, profiles, profile_error)) == -1)
+    {
+        startup_error(profile_error);
+    }
+
+    // A client closing its socket must not kill the runtime
+    signal(SIGPIPE, SIG_IGN);
+
+    int ret = 0;
+
+    // Create the queues
+    for (int m = 0; m < 2; m++)
+    {
+        if (init_spsc_queue(&command_queues[m], COMMAND_QUEUE_SIZE, sizeof(MOTOR_COMMAND)) == -1 ||
+            init_spsc_queue(&sample_queues[m], SAMPLE_QUEUE_SIZE, sizeof(AXIS_SAMPLE)) == -1)
+        {
+            startup_error(strerror(errno));
+        }
+    }
+
+    // Parse the configuration file and share it, an invalid file is a configuration error
+    if ((config_shm = open_config_shm(1)) == NULL)
+    {
+        startup_error(strerror(errno));
+    }
+    if ((ret = share_config_file(1)))
+    {
+        close_mmap_log(&log_file);
+        exit(ret == 2 ? errno : 1);
+    }
+    HOIST_CONFIG config;
+    read_config(config_shm, &config);
+
+    // The motors start stopped at the minimum position
+    init_motor(&motors[MOTOR_X], 'x', config.x_min, config.x_max);
+    init_motor(&motors[MOTOR_Z], 'z', config.z_min, config.z_max);
+    publish_pose(&pose, 'x', motors[MOTOR_X].pos);
+    publish_pose(&pose, 'z', motors[MOTOR_Z].pos);
+
+    // Map the emergency stop and the pose bus and register the metrics, in the slots of the processes they replace
+    if ((estop = open_estop_shm()) == NULL || (motor_metrics[MOTOR_X] = register_metrics(METRICS_MX, "mx_thread")) == NULL ||
+        (motor_metrics[MOTOR_Z] = register_metrics(METRICS_MZ, "mz_thread")) == NULL ||
+        (world_metrics = register_metrics(METRICS_WORLD, "world_thread")) == NULL ||
+        (service.metrics = register_metrics(METRICS_CONTROL, "control_thread")) == NULL || (pose_bus = open_pose_bus()) == NULL)
+    {
+        startup_error(strerror(errno));
+    }
+
+    // Attach the inspection console, this waits for it to open the FIFO
+    if (argc > 1 && strcmp(argv[1], "--inspection") == 0)
+    {
+        char *real_pos_fifo = "/tmp/real_pos_fifo";
+        mkfifo(real_pos_fifo, 0666);
+        if ((fd_real_pos = open(real_pos_fifo, O_WRONLY)) == -1)
+        {
+            startup_error(strerror(errno));
+        }
+    }
+
+    // Create the control socket
+    service.pose = &pose;
+    service.forward = forward_to_queues;
+    service.log_event = log_client_event;
+    if (open_control_service(&service) == -1)
+    {
+        startup_error(strerror(errno));
+    }
+
+    // Block the signals in all the threads, they are handled by the main thread only
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // Start the threads
+    static int motor_index[2] = {MOTOR_X, MOTOR_Z};
+    pthread_t tid;
+    if ((ret = pthread_create(&tid, NULL, estop_thread, NULL)) || (ret = pthread_create(&tid, NULL, motor_thread, &motor_index[MOTOR_X])) ||
+        (ret = pthread_create(&tid, NULL, motor_thread, &motor_index[MOTOR_Z])) || (ret = pthread_create(&tid, NULL, world_thread, NULL)) ||
+        (ret = pthread_create(&tid, NULL, control_thread, NULL)))
+    {
+        // pthread_create() does not set errno
+        close_control_service(&service);
+        startup_error(strerror(ret));
+    }
+
+    // Handle the signals until the runtime is stopped or a thread fails
+    // SIGUSR1 and SIGUSR2 are the stop and reset of the inspection console, SIGHUP reloads the configuration
+    while (1)
+    {
+        int signo;
+        sigwait(&signals, &signo);
+
+        if (signo == SIGHUP)
+        {
+            // The motor threads apply it at their next tick, the world thread is woken to apply it now
+            if (share_config_file(0))
+            {
+                error = 2;
+                break;
+            }
+            ring_doorbell(&world_bell);
+            continue;
+        }
+        else if (signo == SIGUSR1)
+        {
+            request_estop(estop);
+        }
+        else if (signo == SIGUSR2)
+        {
+            for (int m = 0; m < 2; m++)
+            {
+                __atomic_store_n(&reset_requests[m], 1, __ATOMIC_RELEASE);
+                ring_doorbell(&motor_bells[m]);
+            }
+        }
+        else
+        {
+            break;
+        }
+
+        if (write_log(signo == SIGUSR1 ? "STOP" : "RESET", 's'))
+        {
+            error = 2;
+            break;
+        }
+    }
+
+    // Close the clients, the socket and the FIFO
+    // The other threads end with the process
+    close_control_service(&service);
+    if (fd_real_pos != -1)
+    {
+        close(fd_real_pos);
+    }
+
+    if (error == 1)
+    {
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close the log file
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing on log file
+            exit(errno);
+        }
+        exit(1);
+    }
+
+    // Close the log file
+    close_mmap_log(&log_file);
+
+    if (error == 2)
+    {
+        // If error occurs while writing on log file
+        exit(errno);
+    }
+
+    exit(0);
+}
@@ -8,20 +8,41 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
-
-// File descriptor for the log file
-int log_fd;
+#include <sys/ioctl.h>
+#include "./../include/pose_stream.h"
+#include "./../include/estop.h"
+#include "./../include/metrics.h"
+#include "./../include/mmap_log.h"
+#include "./../include/frame_pacing.h"
+#include "./../include/readiness.h"
+#include "./../include/hoist_config.h"
+
+// Memory mapped log file
+MMAP_LOG log_file;
 
 // Variable to store the error
 volatile int error = 0;
 
+// Reassembly buffer and counters of the world position stream
+POSE_READER reader;
+POSE_STATS stats;
+
+// Number of records received when the counters were last logged
+unsigned long last_logged = 0;
+
+// Pacing and statistics of the frames
+FRAME_PACER pacer;
+
+// Frame statistics shown on the screen
+char frame_stats[120] = "";
+
 // Function to write on log file errors or button pressed
 int write_log(char *to_write, char type)
 {
     // Log that in command_console process button has been pressed or error with date and time
     time_t t = time(NULL);
     struct tm tm = *localtime(&t);
-    char buffer[100];
+    char buffer[200];
 
     // If type is 'e' write error
     if (type == 'e')
@@ -33,12 +54,19 @@ int write_log(char *to_write, char type)
     {
         sprintf(buffer, "%d-%d-%d %d:%d:%d: <inspection_process> button pressed: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
     }
+    // If type is 's' write the stream counters
+    else if (type == 's')
+    {
+        sprintf(buffer, "%d-%d-%d %d:%d:%d: <inspection_process> stream %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'f' write the frame statistics
+    else if (type == 'f')
+    {
+        sprintf(buffer, "%d-%d-%d %d:%d:%d: <inspection_process> frames: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
 
-    // Write on log file
-    int m = write(log_fd, buffer, strlen(buffer));
-
-    // Check for errors
-    if (m == -1 || m != strlen(buffer))
+    // Write on log file, copying the message in the mapped segment
+    if (mmap_log_write(&log_file, buffer, strlen(buffer)) == -1)
     {
         return 2;
     }
@@ -53,7 +81,7 @@ int main(int argc, char const *argv[])
     pid_t pid_mz = atoi(argv[2]);
 
     // Open log file
-    if ((log_fd = open("log/inspection.log", O_WRONLY | O_APPEND | O_CREAT, 0666)) == -1)
+    if (open_mmap_log(&log_file, "log/inspection.log") == -1)
     {
         // If error occurs while opening log file
         exit(errno);
@@ -75,7 +103,25 @@ int main(int argc, char const *argv[])
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close log file
-        close(log_fd);
+        close_mmap_log(&log_file);
+        if(ret){
+            // If error occurs while writing on log file
+            exit(errno);
+        }
+
+        exit(1);
+    }
+
+    // Map the emergency stop control word and register the metrics
+    ESTOP_SHM *estop;
+    METRICS_SLOT *metrics;
+    if ((estop = open_estop_shm()) == NULL || (metrics = register_metrics(METRICS_INSPECTION, "inspection")) == NULL)
+    {
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close file descriptors
+        close(fd_real_pos);
+        close_mmap_log(&log_file);
         if(ret){
             // If error occurs while writing on log file
             exit(errno);
@@ -91,12 +137,41 @@ int main(int argc, char const *argv[])
     float ee_x = 0.0;
     float ee_z = 0.0;
 
+    // Position shown on the screen, at the precision of the coordinates message
+    long shown_x = -1;
+    long shown_z = -1;
+
+    // The workspace drawn is the one of the shared configuration
+    HOIST_CONFIG config;
+    CONFIG_SHM *config_shm = open_config_shm(0);
+    uint32_t config_seen = read_config(config_shm, &config);
+    HOIST_X_MIN = config.x_min;
+    HOIST_X_MAX = config.x_max;
+    HOIST_Y_MIN = config.z_min;
+    HOIST_Y_MAX = config.z_max;
+
     // Initialize User Interface
     init_console_ui();
+    init_frame_pacer(&pacer);
+
+    // Tell the master that the console is ready
+    error = (notify_ready("inspection") == -1);
 
-    // Infinite loop
-    while (TRUE)
+    // Loop until an error occurs
+    while (!error)
     {
+        // Redraw the workspace when the configuration changes its limits
+        if (config_changed(config_shm, &config_seen, &config) && (HOIST_X_MIN != config.x_min || HOIST_X_MAX != config.x_max ||
+                                                                   HOIST_Y_MIN != config.z_min || HOIST_Y_MAX != config.z_max))
+        {
+            HOIST_X_MIN = config.x_min;
+            HOIST_X_MAX = config.x_max;
+            HOIST_Y_MIN = config.z_min;
+            HOIST_Y_MAX = config.z_max;
+            reset_console_ui();
+            mark_frame_dirty(&pacer);
+        }
+
         // Get mouse/resize commands in non-blocking mode...
         int cmd = getch();
 
@@ -110,6 +185,7 @@ int main(int argc, char const *argv[])
             else
             {
                 reset_console_ui();
+                mark_frame_dirty(&pacer);
             }
         }
         // Else if mouse has been pressed
@@ -123,9 +199,10 @@ int main(int argc, char const *argv[])
                 // STOP button pressed
                 if (check_button_pressed(stp_button, &event))
                 {
-                    // Send stop signal to mx and mz
-                    if(kill(pid_mx, SIGUSR1) || kill(pid_mz, SIGUSR1)){
-                        // If error occurs while sending signal
+                    // Raise the emergency stop, the motors apply it within one tick
+                    metrics_count(metrics, METRIC_COMMANDS, 1);
+                    if(request_estop(estop)){
+                        // If error occurs while waking the motors
                         error = 1;
                         break;
                     }
@@ -141,6 +218,7 @@ int main(int argc, char const *argv[])
                 else if (check_button_pressed(rst_button, &event))
                 {
                     // Send reset signal to mx and mz
+                    metrics_count(metrics, METRIC_COMMANDS, 1);
                     if(kill(pid_mx, SIGUSR2) || kill(pid_mz, SIGUSR2)){
                         // If error occurs while sending signal
                         error = 1;
@@ -156,22 +234,29 @@ int main(int argc, char const *argv[])
             }
         }
 
-        // Variables to store the real values of the positions
-        char real_pos_str[20];
-
         // Setting parameters for select function
         fd_set readfds;
         struct timeval timeout;
         FD_ZERO(&readfds);
         FD_SET(fd_real_pos, &readfds);
+        FD_SET(STDIN_FILENO, &readfds);
         int max_fd = fd_real_pos + 1;
 
-        // Setting timeout for select function
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 200000;
+        // Setting timeout for select function, shorter if a frame is waiting to be drawn
+        struct timeval idle = {0, 200000};
+        timeout = frame_timeout(&pacer, idle);
 
-        // Wait for the file descriptor to be ready
-        int ready = select(max_fd, &readfds, NULL, NULL, &timeout);
+        // Wait for a position, a mouse event or a resize, without timeout when nothing is left to draw
+        int ready = select(max_fd, &readfds, NULL, NULL, frame_idle(&pacer) ? NULL : &timeout);
+
+        // Count the wakeups and how many bytes are waiting to be read
+        metrics_count(metrics, ready == 0 ? METRIC_TIMEOUTS : METRIC_WAKEUPS, 1);
+        if (ready > 0)
+        {
+            int queued = 0;
+            ioctl(fd_real_pos, FIONREAD, &queued);
+            metrics_gauge(metrics, METRIC_QUEUE_DEPTH, queued);
+        }
 
         // Check if the file descriptor is ready
         if (ready < 0 && errno != EINTR) // errno != EINTR is to avoid the select function to be interrupted by resize signal
@@ -180,31 +265,109 @@ int main(int argc, char const *argv[])
             error = 1;
             break;
         }
-        else if (ready > 0)
+        else if (ready > 0 && FD_ISSET(fd_real_pos, &readfds))
         {
-            // Read the real position
-            if (read(fd_real_pos, real_pos_str, 20) == -1)
+            // Read the available position records
+            if (fill_pose_reader(fd_real_pos, &reader, &stats) == -1)
             {
                 // If error occurs while reading the real position
                 error = 1;
                 break;
             }
 
-            // When pressing the reset button, sometimes the read x_pos value is wrong
-            // If this happens, I set the x position to the previous value
-            float old_x = ee_x;
+            // Counters before this read, to log them only when something went wrong
+            unsigned long old_anomalies = stats.lost + stats.duplicated + stats.reordered + stats.malformed;
+
+            // Process all the records, the display shows the last one
+            char *record;
+            while (next_pose_record(&reader, &record))
+            {
+                uint32_t seq;
+                float x, z;
+
+                // Store the x and z position from the record with format "seq;x;z"
+                if (parse_pose_record(record, &seq, &x, &z))
+                {
+                    stats.malformed++;
+                    continue;
+                }
+                track_pose_sequence(&stats, seq);
+                metrics_count(metrics, METRIC_SAMPLES, 1);
+
+                // When pressing the reset button, sometimes the read x_pos value is wrong
+                // If this happens, I keep the previous value
+                if (x <= config.x_max)
+                {
+                    ee_x = x;
+                }
+                ee_z = z;
+            }
+
+            // Log the counters when an anomaly is detected and every 100 records
+            if (stats.lost + stats.duplicated + stats.reordered + stats.malformed != old_anomalies || stats.received - last_logged >= 100)
+            {
+                last_logged = stats.received;
+                char to_write[150];
+                format_pose_stats(to_write, &stats);
+                if (error = write_log(to_write, 's'))
+                {
+                    // If error occurs while writing on log file
+                    break;
+                }
+            }
+        }
+
+        // Redraw only if the position shown changed
+        if (lroundf(ee_x * 100) != shown_x || lroundf(ee_z * 100) != shown_z)
+        {
+            mark_frame_dirty(&pacer);
+        }
 
-            // Store the x and z position from the string with format "x;z"
-            sscanf(real_pos_str, "%f;%f", &ee_x, &ee_z);
+        // Update the frame statistics every second, the overlay is redrawn only if they changed.
+        // It is not counted as a frame, otherwise it would change the statistics it shows
+        if (frame_stats_due(&pacer))
+        {
+            char stats[120];
+            format_frame_stats(stats, &pacer);
+            if (strcmp(stats, frame_stats) != 0)
+            {
+                strcpy(frame_stats, stats);
+                draw_frame_stats(frame_stats);
+                refresh();
+            }
 
-            if(ee_x > 40.0)
+            // Log the statistics of the periods with frames
+            if (pacer.fps > 0 && (error = write_log(stats, 'f')))
             {
-                ee_x = old_x;
+                // If error occurs while writing on log file
+                break;
             }
         }
 
-        // Update UI
-        update_console_ui(&ee_x, &ee_z);
+        // Update UI, at most at the maximum frame rate
+        if (frame_due(&pacer))
+        {
+            int had_container = container.is_set;
+            begin_frame(&pacer);
+            draw_frame_stats(frame_stats);
+            update_console_ui(&ee_x, &ee_z);
+
+            uint64_t draw_ns, latency_ns;
+            end_frame(&pacer, &draw_ns, &latency_ns);
+            metrics_observe(metrics, METRIC_DRAW_TIME, draw_ns / 1000);
+            metrics_observe(metrics, METRIC_DISPLAY_LATENCY, latency_ns / 1000);
+
+            shown_x = lroundf(ee_x * 100);
+            shown_z = lroundf(ee_z * 100);
+
+            // A container grasped or spawned by this frame is drawn in the next one
+            if (container.is_set != had_container)
+            {
+                mark_frame_dirty(&pacer);
+            }
+        }
+        metrics_gauge(metrics, METRIC_POSITION_X, ee_x);
+        metrics_gauge(metrics, METRIC_POSITION_Z, ee_z);
     }
 
     // Close the FIFO
@@ -218,7 +381,7 @@ int main(int argc, char const *argv[])
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close log file
-        close(log_fd);
+        close_mmap_log(&log_file);
         if(ret){
             // If error occurs while writing on log file
             exit(errno);
@@ -228,7 +391,7 @@ int main(int argc, char const *argv[])
     }
 
     // Close log file
-    close(log_fd);
+    close_mmap_log(&log_file);
 
     if(error == 2){
         // If error occurs while writing on log file
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./../include/motor_batch.h"
+#include "./../include/tick_timer.h"
+
+// Microbenchmark of the batch kinematics (see motor_batch.h).
+// It first checks that every kernel gives the same axes as motor_step(), then
+// runs each kernel on batches of growing size and prints the axes updated per
+// second and the memory traffic they need: the small batches stay in the
+// caches, the largest ones show where the memory bandwidth becomes the limit.
+//
+// Usage: kinematics_bench [axes [seconds]]
+//   axes     size of a single batch to measure, all the default sizes without it
+//   seconds  time each kernel runs on each size, 0.5 by default
+
+// Sizes measured by default, from L1 to well beyond the last level cache
+int default_sizes[] = {1024, 16384, 262144, 4194304};
+
+// Kernels measured, the unsupported ones are skipped
+const char *kernels[] = {"scalar", "sse", "avx"};
+
+// Bytes read and written per axis and step: 6 arrays read, 3 written
+#define BYTES_PER_AXIS (9 * sizeof(float))
+
+// Steps and axes of the check against motor_step()
+#define CHECK_STEPS 400
+#define CHECK_AXES 1003
+
+// Steps of the check, cycled: the nominal tick, non-dyadic periods and measured periods with jitter
+double check_dts[] = {0.5, 0.013, 0.1, 0.0333, 0.500137, 0.012994, 0.049871};
+
+// Function to give random states to the axes, the same for the same seed
+void fill_batch(MOTOR_BATCH *batch, unsigned int seed)
+{
+    srand(seed);
+    for (int i = 0; i < batch->n; i++)
+    {
+        MOTOR motor;
+        init_motor(&motor, 'x', 0.0, (i % 2) ? 40.0 : 10.0);
+        motor.pos = (rand() % (int)(motor.max * 100)) / 100.0;
+        motor.v = (rand() % 801 - 400) / 100.0;
+
+        // A quarter of the axes move to a target
+        if (rand() % 4 == 0)
+        {
+            motor.target = (rand() % (int)(motor.max * 100)) / 100.0;
+            motor.target_active = 1;
+            motor.v = (motor.target >= motor.pos) ? 1.0 : -1.0;
+        }
+        set_motor_batch_axis(batch, i, &motor);
+    }
+}
+
+// Function to give new random velocities to some axes, so the check does not end with all of them stopped
+void kick_batch(MOTOR_BATCH *batch, MOTOR *motors)
+{
+    for (int i = 0; i < batch->n; i++)
+    {
+        if (rand() % 8 == 0)
+        {
+            motors[i].v = (rand() % 801 - 400) / 100.0;
+            motors[i].target_active = 0;
+            batch->v[i] = motors[i].v;
+            batch->active[i] = 0;
+        }
+    }
+}
+
+// Function to check a kernel against motor_step() on the same axes
+// Returns 0 if all the axes are identical after every step
+int check_kernel(const char *name)
+{
+    MOTOR_BATCH batch;
+    if (init_motor_batch(&batch, CHECK_AXES) == -1 || select_motor_batch_kernel(&batch, name) == -1)
+    {
+        return -1;
+    }
+    fill_batch(&batch, 1);
+
+    MOTOR *motors = malloc(CHECK_AXES * sizeof(MOTOR));
+    for (int i = 0; i < CHECK_AXES; i++)
+    {
+        get_motor_batch_axis(&batch, i, &motors[i]);
+    }
+
+    int ret = 0;
+    srand(2);
+    for (int step = 0; step < CHECK_STEPS && ret == 0; step++)
+    {
+        double dt = check_dts[step % (sizeof(check_dts) / sizeof(check_dts[0]))];
+
+        int moved = 0;
+        for (int i = 0; i < CHECK_AXES; i++)
+        {
+            moved += motor_step(&motors[i], dt);
+        }
+
+        int batch_moved = motor_batch_step(&batch, dt);
+        if (batch_moved != moved)
+        {
+            fprintf(stderr, "%s: step %d: %d axes moved instead of %d\n", name, step, batch_moved, moved);
+            ret = -1;
+        }
+
+        for (int i = 0; i < CHECK_AXES && ret == 0; i++)
+        {
+            MOTOR axis;
+            get_motor_batch_axis(&batch, i, &axis);
+            if (axis.pos != motors[i].pos || axis.v != motors[i].v || axis.target_active != motors[i].target_active)
+            {
+                fprintf(stderr, "%s: step %d: axis %d at %f speed %f instead of %f speed %f\n", name, step, i, axis.pos, axis.v, motors[i].pos, motors[i].v);
+                ret = -1;
+            }
+        }
+
+        if (step % 10 == 9)
+        {
+            kick_batch(&batch, motors);
+        }
+    }
+
+    free(motors);
+    free_motor_batch(&batch);
+    return ret;
+}
+
+// Function to measure a kernel on n axes for the given time
+void measure_kernel(const char *name, int n, double seconds)
+{
+    MOTOR_BATCH batch;
+    if (init_motor_batch(&batch, n) == -1)
+    {
+        perror("Error allocating the batch");
+        exit(1);
+    }
+    select_motor_batch_kernel(&batch, name);
+    fill_batch(&batch, 3);
+
+    // Touch all the pages once before measuring
+    motor_batch_step(&batch, 0.01);
+
+    // Steps between two reads of the clock, about a millisecond of work
+    long chunk = 1 + 1000000 / n;
+    long steps = 0;
+    volatile long moved = 0;
+    uint64_t start = monotonic_ns(), now;
+
+    do
+    {
+        for (long i = 0; i < chunk; i++)
+        {
+            moved += motor_batch_step(&batch, 0.01);
+        }
+        steps += chunk;
+        now = monotonic_ns();
+    } while (now - start < seconds * 1e9);
+
+    double elapsed = (now - start) / 1e9;
+    double axes_per_second = (double)n * steps / elapsed;
+
+    printf("%-8s %10d %10ld %12.1f %10.2f\n", name, n, steps, axes_per_second / 1e6, axes_per_second * BYTES_PER_AXIS / 1e9);
+    fflush(stdout);
+
+    free_motor_batch(&batch);
+}
+
+int main(int argc, char const *argv[])
+{
+    int sizes[4];
+    int n_sizes = 0;
+    double seconds = 0.5;
+
+    if (argc > 1)
+    {
+        sizes[n_sizes++] = atoi(argv[1]);
+        if (sizes[0] <= 0)
+        {
+            fprintf(stderr, "usage: %s [axes [seconds]]\n", argv[0]);
+            exit(1);
+        }
+    }
+    else
+    {
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+        n_sizes = 4;
+    }
+    if (argc > 2 && atof(argv[2]) > 0)
+    {
+        seconds = atof(argv[2]);
+    }
+
+    // Check all the kernels before measuring them
+    int supported[3];
+    for (int k = 0; k < 3; k++)
+    {
+        MOTOR_BATCH probe;
+        supported[k] = (select_motor_batch_kernel(&probe, kernels[k]) == 0);
+        if (!supported[k])
+        {
+            printf("%s: not supported, skipped\n", kernels[k]);
+            continue;
+        }
+        if (check_kernel(kernels[k]))
+        {
+            printf("%s: results differ from motor_step()\n", kernels[k]);
+            exit(1);
+        }
+        printf("%s: same results as motor_step() on %d axes for %d steps\n", kernels[k], CHECK_AXES, CHECK_STEPS);
+    }
+
+    printf("\n%-8s %10s %10s %12s %10s\n", "kernel", "axes", "steps", "Maxes/s", "GB/s");
+    for (int s = 0; s < n_sizes; s++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            if (supported[k])
+            {
+                measure_kernel(kernels[k], sizes[s], seconds);
+            }
+        }
+    }
+
+    return 0;
+}
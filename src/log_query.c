@@ -0,0 +1,701 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include "./../include/log_index.h"
+
+// Queries on the log files of a session, merged in one timeline.
+//
+//   log_query [-d dir] index
+//   log_query [-d dir] range <from> <to> [text]
+//   log_query [-d dir] stops [<from> <to>]
+//
+// Times are "Y-M-D h:m:s" (one argument) or "-" for no limit. The active logs
+// and their rotated segments are read through mmap() and their sidecar index,
+// the compressed segments are decompressed in memory and read from the start.
+
+// Maximum number of log files read
+#define MAX_SOURCES 256
+
+// Time used for "-"
+#define NO_TIME_LIMIT INT64_MAX
+
+// Message of a motor applying a stop and of the world process writing the position
+#define STOP_PATTERN "STOP"
+#define POSITION_PATTERN "> Position: "
+
+// Log file read by the query
+typedef struct {
+    char path[300];
+    char *base;
+    size_t len;
+    size_t size;
+    int mapped;
+    LOG_INDEX index;
+    // Current line and time of the last timestamp read
+    size_t line;
+    size_t line_end;
+    int64_t time;
+    // Last position written before position_cursor, for the stops query
+    size_t position_cursor;
+    char position[100];
+    int64_t position_time;
+} LOG_SOURCE;
+
+// Stop found in a log
+typedef struct {
+    int64_t time;
+    int source;
+    size_t line;
+    size_t line_end;
+} STOP_EVENT;
+
+LOG_SOURCE sources[MAX_SOURCES];
+int n_sources = 0;
+
+// Sources ordered by the time of their current line
+int heap[MAX_SOURCES];
+int heap_size = 0;
+
+// Function to get a time in milliseconds
+double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Function to read a time argument
+// Returns 0 on success, -1 if it is not valid
+int parse_time_argument(const char *arg, int64_t *time, int64_t no_limit)
+{
+    if (strcmp(arg, "-") == 0)
+    {
+        *time = no_limit;
+        return 0;
+    }
+
+    // Same format as the messages, with the final ':'
+    char buffer[40];
+    snprintf(buffer, sizeof(buffer), "%s:", arg);
+    char *end = parse_log_time(buffer, buffer + strlen(buffer), time);
+
+    return (end != NULL && *end == '\0') ? 0 : -1;
+}
+
+// Function to check if a file name is a log or a segment of a log: "x.log", "x.log.N" or "x.log.N.gz"
+int is_log_name(char *name)
+{
+    char *ext = strstr(name, ".log");
+    if (ext == NULL)
+    {
+        return 0;
+    }
+    ext += strlen(".log");
+    if (*ext == '\0')
+    {
+        return 1;
+    }
+    if (*ext++ != '.' || *ext < '0' || *ext > '9')
+    {
+        return 0;
+    }
+    while (*ext >= '0' && *ext <= '9')
+    {
+        ext++;
+    }
+
+    return *ext == '\0' || strcmp(ext, ".gz") == 0;
+}
+
+// Function to decompress a segment in memory, with zlib like the logs compress it
+// Returns 0 on success, -1 on error
+int read_compressed_source(LOG_SOURCE *source)
+{
+    gzFile in = gzopen(source->path, "rb");
+    if (in == NULL)
+    {
+        return -1;
+    }
+
+    // zlib would read a file that is not compressed as it is, like gzip -d a segment must be compressed
+    if (gzdirect(in))
+    {
+        gzclose(in);
+        errno = EIO;
+        return -1;
+    }
+
+    size_t capacity = 1024 * 1024;
+    source->base = malloc(capacity);
+    source->len = 0;
+
+    int n;
+    while (source->base != NULL && (n = gzread(in, source->base + source->len, capacity - source->len)) > 0)
+    {
+        source->len += n;
+        if (source->len == capacity)
+        {
+            capacity *= 2;
+            char *base = realloc(source->base, capacity);
+            if (base == NULL)
+            {
+                free(source->base);
+            }
+            source->base = base;
+        }
+    }
+
+    // A truncated or corrupted segment is an error, not a shorter log
+    int gz_error;
+    gzerror(in, &gz_error);
+    if (gzclose(in) != Z_OK || gz_error != Z_OK || source->base == NULL)
+    {
+        free(source->base);
+        errno = EIO;
+        return -1;
+    }
+
+    source->mapped = 0;
+    return 0;
+}
+
+// Function to map a log and bring its sidecar index up to date
+// Returns 0 on success, -1 on error
+int read_mapped_source(LOG_SOURCE *source)
+{
+    int fd = open(source->path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    source->size = st.st_size;
+    source->base = NULL;
+    if (source->size > 0)
+    {
+        source->base = mmap(NULL, source->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (source->base == MAP_FAILED)
+        {
+            close(fd);
+            return -1;
+        }
+        madvise(source->base, source->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    source->mapped = 1;
+    source->len = log_content_length(source->base, source->size);
+
+    // Index only what was added since the last query
+    char index_path[320];
+    sprintf(index_path, "%s.idx", source->path);
+    load_log_index(index_path, &source->index, st.st_ino, source->base, source->len);
+
+    uint64_t indexed = source->index.header.indexed;
+    if (update_log_index(&source->index, source->base, source->len) == -1)
+    {
+        return -1;
+    }
+
+    // The index is only a cache, the query works without it
+    if (source->index.header.indexed != indexed)
+    {
+        save_log_index(index_path, &source->index);
+    }
+
+    return 0;
+}
+
+// Function to open all the logs of a directory
+// Returns 0 on success, -1 on error
+int open_sources(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+    {
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL && n_sources < MAX_SOURCES)
+    {
+        if (!is_log_name(entry->d_name))
+        {
+            continue;
+        }
+
+        LOG_SOURCE *source = &sources[n_sources];
+        memset(source, 0, sizeof(LOG_SOURCE));
+        snprintf(source->path, sizeof(source->path), "%s/%s", dir, entry->d_name);
+
+        int compressed = strlen(entry->d_name) > 3 && strcmp(entry->d_name + strlen(entry->d_name) - 3, ".gz") == 0;
+        int ret = compressed ? read_compressed_source(source) : read_mapped_source(source);
+        if (ret == -1)
+        {
+            // A segment removed by a rotation while listing the directory is not an error
+            if (errno == ENOENT)
+            {
+                continue;
+            }
+            fprintf(stderr, "%s: %s\n", source->path, strerror(errno));
+            closedir(d);
+            return -1;
+        }
+        n_sources++;
+    }
+    closedir(d);
+
+    return 0;
+}
+
+// Function to move a source to the next line
+// Returns 1 if there is a line, 0 at the end of the log
+int next_line(LOG_SOURCE *source)
+{
+    source->line = source->line_end;
+    if (source->line >= source->len)
+    {
+        return 0;
+    }
+
+    char *start = source->base + source->line;
+    char *eol = memchr(start, '\n', source->len - source->line);
+    source->line_end = (eol == NULL) ? source->len : (size_t)(eol - source->base + 1);
+
+    // Lines without a timestamp keep the time of the previous message
+    parse_log_time(start, source->base + source->line_end, &source->time);
+
+    return 1;
+}
+
+// Function to move a source to its first line not older than from
+// Returns 1 if there is one, 0 otherwise
+int seek_source(LOG_SOURCE *source, int64_t from)
+{
+    source->line_end = (source->index.header.n_entries > 0) ? find_log_offset(&source->index, from) : 0;
+    source->time = INT64_MIN;
+
+    while (next_line(source))
+    {
+        if (source->time >= from)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Function to compare the current lines of two sources, the first source wins a tie
+int source_before(int a, int b)
+{
+    if (sources[a].time != sources[b].time)
+    {
+        return sources[a].time < sources[b].time;
+    }
+    return a < b;
+}
+
+// Function to restore the heap order from a position downwards
+void sift_down(int i)
+{
+    while (1)
+    {
+        int first = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < heap_size && source_before(heap[left], heap[first]))
+        {
+            first = left;
+        }
+        if (right < heap_size && source_before(heap[right], heap[first]))
+        {
+            first = right;
+        }
+        if (first == i)
+        {
+            return;
+        }
+        int tmp = heap[i];
+        heap[i] = heap[first];
+        heap[first] = tmp;
+        i = first;
+    }
+}
+
+// Function to start the merge of all the sources from a time
+void start_merge(int64_t from)
+{
+    heap_size = 0;
+    for (int i = 0; i < n_sources; i++)
+    {
+        if (seek_source(&sources[i], from))
+        {
+            heap[heap_size++] = i;
+        }
+    }
+    for (int i = heap_size / 2 - 1; i >= 0; i--)
+    {
+        sift_down(i);
+    }
+}
+
+// Function to get the next line of the timeline, up to a time
+// Returns the source of the line, NULL at the end
+LOG_SOURCE *next_merged_line(int64_t to, LOG_SOURCE *previous)
+{
+    // Advance the source of the previous line
+    if (previous != NULL)
+    {
+        if (!next_line(previous))
+        {
+            heap[0] = heap[--heap_size];
+        }
+        sift_down(0);
+    }
+
+    if (heap_size == 0 || sources[heap[0]].time > to)
+    {
+        return NULL;
+    }
+
+    return &sources[heap[0]];
+}
+
+// Function to find a text in a line
+int line_contains(LOG_SOURCE *source, char *text, size_t text_len)
+{
+    return memmem(source->base + source->line, source->line_end - source->line, text, text_len) != NULL;
+}
+
+// Function to find the last line containing a text between two line boundaries of a source,
+// searching backwards one stride at a time
+// Returns the offset of the line, -1 if there is none
+long find_last_line_with(LOG_SOURCE *source, size_t from, size_t to, char *text)
+{
+    size_t text_len = strlen(text);
+    size_t end = to;
+
+    while (end > from)
+    {
+        size_t start = (end - from > LOG_INDEX_STRIDE) ? end - LOG_INDEX_STRIDE : from;
+
+        // The chunk overlaps the following one, so a text across the two is found
+        size_t chunk_end = (end + text_len - 1 < to) ? end + text_len - 1 : to;
+        char *last = NULL, *found, *p = source->base + start;
+        while ((found = memmem(p, source->base + chunk_end - p, text, text_len)) != NULL)
+        {
+            last = found;
+            p = found + 1;
+        }
+
+        if (last != NULL)
+        {
+            size_t line = last - source->base;
+            while (line > from && source->base[line - 1] != '\n')
+            {
+                line--;
+            }
+            return line;
+        }
+        end = start;
+    }
+
+    return -1;
+}
+
+// Function to update the last position written by a source up to a time.
+// The stops are handled in time order, so only the part of the log after the previous search is read
+void update_source_position(LOG_SOURCE *source, int64_t time)
+{
+    // First line after the time
+    seek_source(source, time + 1);
+    size_t boundary = source->line;
+    if (boundary <= source->position_cursor)
+    {
+        return;
+    }
+
+    long line = find_last_line_with(source, source->position_cursor, boundary, POSITION_PATTERN);
+    if (line != -1)
+    {
+        source->line_end = line;
+        next_line(source);
+
+        char *value = (char *)memmem(source->base + line, source->line_end - line, POSITION_PATTERN, strlen(POSITION_PATTERN)) + strlen(POSITION_PATTERN);
+        int n = source->base + source->line_end - value;
+        if (n > 0 && value[n - 1] == '\n')
+        {
+            n--;
+        }
+        snprintf(source->position, sizeof(source->position), "%.*s", n, value);
+        source->position_time = source->time;
+    }
+    source->position_cursor = boundary;
+}
+
+// Function to compare two stops by time, then by log
+int compare_stops(const void *a, const void *b)
+{
+    const STOP_EVENT *x = a, *y = b;
+    if (x->time != y->time)
+    {
+        return (x->time < y->time) ? -1 : 1;
+    }
+    return x->source - y->source;
+}
+
+// Function to print the lines between two times, containing a text if it is not NULL
+// Returns the number of lines printed
+long query_range(int64_t from, int64_t to, char *text)
+{
+    long count = 0;
+    size_t text_len = text ? strlen(text) : 0;
+
+    start_merge(from);
+    LOG_SOURCE *source = NULL;
+    while ((source = next_merged_line(to, source)) != NULL)
+    {
+        if (text == NULL || line_contains(source, text, text_len))
+        {
+            fwrite(source->base + source->line, 1, source->line_end - source->line, stdout);
+            if (source->base[source->line_end - 1] != '\n')
+            {
+                putchar('\n');
+            }
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// Function to print every stop between two times with the last position written before it
+// Returns the number of stops printed, -1 on error
+long query_stops(int64_t from, int64_t to)
+{
+    STOP_EVENT *stops = NULL;
+    size_t n_stops = 0, capacity = 0;
+
+    // The stops are rare, look for them directly instead of reading every line
+    for (int i = 0; i < n_sources; i++)
+    {
+        LOG_SOURCE *source = &sources[i];
+        if (!seek_source(source, from))
+        {
+            continue;
+        }
+
+        size_t offset = source->line;
+        char *found;
+        while (offset < source->len && (found = memmem(source->base + offset, source->len - offset, STOP_PATTERN, strlen(STOP_PATTERN))) != NULL)
+        {
+            // Read the line of the stop
+            size_t line = found - source->base;
+            while (line > offset && source->base[line - 1] != '\n')
+            {
+                line--;
+            }
+            source->line_end = line;
+            next_line(source);
+            if (source->time > to)
+            {
+                break;
+            }
+
+            if (n_stops == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 64;
+                STOP_EVENT *bigger = realloc(stops, capacity * sizeof(STOP_EVENT));
+                if (bigger == NULL)
+                {
+                    free(stops);
+                    return -1;
+                }
+                stops = bigger;
+            }
+            stops[n_stops].time = source->time;
+            stops[n_stops].source = i;
+            stops[n_stops].line = source->line;
+            stops[n_stops].line_end = source->line_end;
+            n_stops++;
+
+            offset = source->line_end;
+        }
+    }
+
+    qsort(stops, n_stops, sizeof(STOP_EVENT), compare_stops);
+
+    for (int i = 0; i < n_sources; i++)
+    {
+        sources[i].position_cursor = 0;
+        sources[i].position_time = INT64_MIN;
+    }
+
+    for (size_t k = 0; k < n_stops; k++)
+    {
+        // Most recent position written in any log up to the stop
+        LOG_SOURCE *latest = NULL;
+        for (int i = 0; i < n_sources; i++)
+        {
+            update_source_position(&sources[i], stops[k].time);
+            if (sources[i].position_time != INT64_MIN && (latest == NULL || sources[i].position_time > latest->position_time))
+            {
+                latest = &sources[i];
+            }
+        }
+
+        LOG_SOURCE *source = &sources[stops[k].source];
+        int len = stops[k].line_end - stops[k].line;
+        if (source->base[stops[k].line_end - 1] == '\n')
+        {
+            len--;
+        }
+
+        if (latest != NULL)
+        {
+            printf("%.*s | position %s (%llds before)\n", len, source->base + stops[k].line, latest->position, (long long)(stops[k].time - latest->position_time));
+        }
+        else
+        {
+            printf("%.*s | position unknown\n", len, source->base + stops[k].line);
+        }
+    }
+
+    free(stops);
+    return n_stops;
+}
+
+// Function to print the size and the index of every log
+void print_index_stats()
+{
+    for (int i = 0; i < n_sources; i++)
+    {
+        LOG_SOURCE *source = &sources[i];
+        printf("%s: %zu bytes, %llu index entries%s\n", source->path, source->len, (unsigned long long)source->index.header.n_entries,
+               source->mapped ? "" : " (compressed, not indexed)");
+    }
+}
+
+// Function to print how to use the program
+void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-d dir] index\n"
+                    "       %s [-d dir] range <from> <to> [text]\n"
+                    "       %s [-d dir] stops [<from> <to>]\n"
+                    "times are \"Y-M-D h:m:s\" or \"-\"\n",
+            name, name, name);
+}
+
+int main(int argc, char const *argv[])
+{
+    const char *dir = "log";
+    int arg = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-d") == 0)
+    {
+        dir = argv[2];
+        arg = 3;
+    }
+    if (arg >= argc)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    const char *query = argv[arg++];
+    int64_t from = INT64_MIN, to = NO_TIME_LIMIT;
+    char *text = NULL;
+
+    // Check the arguments before reading the logs
+    if (strcmp(query, "range") == 0)
+    {
+        if (argc - arg < 2 || argc - arg > 3 || parse_time_argument(argv[arg], &from, INT64_MIN) == -1 ||
+            parse_time_argument(argv[arg + 1], &to, NO_TIME_LIMIT) == -1)
+        {
+            usage(argv[0]);
+            exit(1);
+        }
+        text = (argc - arg == 3) ? (char *)argv[arg + 2] : NULL;
+    }
+    else if (strcmp(query, "stops") == 0)
+    {
+        if ((argc - arg != 0 && argc - arg != 2) ||
+            (argc - arg == 2 && (parse_time_argument(argv[arg], &from, INT64_MIN) == -1 || parse_time_argument(argv[arg + 1], &to, NO_TIME_LIMIT) == -1)))
+        {
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    else if (strcmp(query, "index") != 0 || arg != argc)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    // Large output buffer, the timeline can be long
+    static char out_buffer[1 << 20];
+    setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+
+    double start = now_ms();
+    if (open_sources(dir) == -1)
+    {
+        perror("Error reading the logs");
+        exit(1);
+    }
+    double opened = now_ms();
+
+    long count = 0;
+    if (strcmp(query, "index") == 0)
+    {
+        print_index_stats();
+    }
+    else if (strcmp(query, "range") == 0)
+    {
+        count = query_range(from, to, text);
+    }
+    else
+    {
+        count = query_stops(from, to);
+    }
+    fflush(stdout);
+
+    if (count == -1)
+    {
+        perror("Error running the query");
+        exit(1);
+    }
+
+    // Timing on the standard error, so it is not mixed with the lines
+    fprintf(stderr, "%ld lines from %d logs, opening and indexing %.2f ms, query %.2f ms\n", count, n_sources, opened - start, now_ms() - opened);
+
+    for (int i = 0; i < n_sources; i++)
+    {
+        if (sources[i].mapped && sources[i].base != NULL)
+        {
+            munmap(sources[i].base, sources[i].size);
+        }
+        else if (!sources[i].mapped)
+        {
+            free(sources[i].base);
+        }
+        free_log_index(&sources[i].index);
+    }
+
+    exit(0);
+}
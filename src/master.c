@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -8,6 +9,17 @@
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include "./../include/metrics.h"
+#include "./../include/runtime_profile.h"
+#include "./../include/mmap_log.h"
+#include "./../include/checkpoint.h"
+#include "./../include/readiness.h"
+#include "./../include/pose_stream.h"
+#include "./../include/control_protocol.h"
+#include "./../include/tick_timer.h"
+#include "./../include/hoist_config.h"
 
 // Variables to store the PIDs
 pid_t pid_cmd;
@@ -15,31 +27,238 @@ pid_t pid_mx;
 pid_t pid_mz;
 pid_t pid_world;
 pid_t pid_insp;
+pid_t pid_ctl;
 
 // Variable to store the status of the child process
 int status;
 
+// Component started by the master, with the name of its readiness record
+// and the times it was spawned and became ready
+typedef struct {
+  char *name;
+  pid_t *pid;
+  uint64_t spawned_ns;
+  uint64_t ready_ns;
+  // Pid of the readiness record, the console itself when it runs in a terminal emulator
+  pid_t ready_pid;
+} COMPONENT;
+
+#define N_COMPONENTS 6
+
+// Table of the components, in the order they are spawned
+COMPONENT components[N_COMPONENTS] = {
+    {"mx", &pid_mx}, {"mz", &pid_mz}, {"world", &pid_world}, {"control", &pid_ctl}, {"command", &pid_cmd}, {"inspection", &pid_insp}};
+
+// Default time the components have to become ready, in milliseconds
+#define DEFAULT_STARTUP_TIMEOUT_MS 5000
+
+// Read end of the readiness FIFO and its reassembly buffer
+int fd_ready;
+POSE_READER ready_reader;
+POSE_STATS ready_stats;
+
+// Runtime profiles of the children
+RUNTIME_PROFILE profiles[MAX_RUNTIME_PROFILES];
+int n_profiles = 0;
+
+// Shared metrics of all the processes
+METRICS_SHM *metrics;
+
+// Checkpoint file of the motors and world processes
+CHECKPOINT_FILE *checkpoint;
+
+// Time without any log written after which the children are stopped
+#define INACTIVITY_TIMEOUT_S 60
+
+// Number of times the watchdog woke up, for the idle report
+unsigned long watchdog_wakeups = 0;
+
+// Default number of times the children are restarted after a crash
+#define DEFAULT_MAX_RESTARTS 3
+
+// Flag set by SIGUSR1 to ask for a dump of the metrics
+volatile sig_atomic_t dump_requested = 0;
+
+// Handler of SIGUSR1, the dump is done by the watchdog loop
+void dump_handler(int signo)
+{
+  dump_requested = 1;
+}
+
+// Shared configuration of the processes
+CONFIG_SHM *config_shm;
+
+// Flag set by SIGHUP to reload the configuration file
+volatile sig_atomic_t reload_requested = 0;
+
+// Handler of SIGHUP, the reload is done by the watchdog loop
+void reload_handler(int signo)
+{
+  reload_requested = 1;
+}
+
+// Handler of SIGCHLD, it only interrupts the sleep of the watchdog so a crash is seen at once
+void child_handler(int signo)
+{
+}
+
+// Function to write the aggregated metrics in log/metrics.log
+int write_metrics()
+{
+  FILE *out = fopen("./log/metrics.log", "w");
+  if (out == NULL)
+  {
+    return 1;
+  }
+
+  // Timestamp of the dump
+  time_t t = time(NULL);
+  struct tm tm = *localtime(&t);
+  fprintf(out, "%d-%d-%d %d:%d:%d: <master_process> Metrics\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+  dump_metrics(metrics, out);
+
+  // Wakeups and CPU time of every process, the master included, to check that an idle hoist sleeps
+  dump_idle_report(metrics, out);
+  dump_process_usage(out, "master", getpid(), watchdog_wakeups);
+
+  return fclose(out) == 0 ? 0 : 1;
+}
+
+// Function to write a message with date and time on the master log file
+int write_log(MMAP_LOG *log_file, char *to_write)
+{
+  time_t t = time(NULL);
+  struct tm tm = *localtime(&t);
+  char buffer[400];
+  sprintf(buffer, "%d-%d-%d %d:%d:%d: <master_process> %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+
+  if (mmap_log_write(log_file, buffer, strlen(buffer)) == -1)
+  {
+    return 1;
+  }
+  return 0;
+}
+
+// Function to wake the motors after a new configuration, an idle motor waits on its control FIFO without timeout
+// A motor that is not running is not woken, it reads the configuration when it starts
+void wake_motors()
+{
+  char *fifos[] = {MX_CTL_FIFO, MZ_CTL_FIFO};
+  MOTOR_COMMAND wakeup = {.op = CTL_OP_CONFIG};
+
+  for (int i = 0; i < 2; i++)
+  {
+    int fd = open(fifos[i], O_WRONLY | O_NONBLOCK);
+    if (fd != -1)
+    {
+      if (write(fd, &wakeup, sizeof(wakeup)) == -1)
+      {
+        // With a full FIFO the motor is already awake
+      }
+      close(fd);
+    }
+  }
+}
+
+// Function to publish a configuration to the children with the next version and log it
+// Returns 0 on success, 1 on log error
+int share_config(MMAP_LOG *log_file, HOIST_CONFIG *config)
+{
+  char message[300];
+  uint32_t version = publish_config(config_shm, config);
+  wake_motors();
+  sprintf(message, "Configuration version %u: x %.2f-%.2f, z %.2f-%.2f, motor tick %u ms, sensor error %.4f", version, config->x_min, config->x_max, config->z_min,
+          config->z_max, config->motor_tick_ms, config->sensor_error);
+  return write_log(log_file, message);
+}
+
+// Function to parse the configuration file again and share it
+// An invalid file is logged and the current configuration is kept
+// Returns 0 on success or invalid file, 1 on log error
+int reload_config(MMAP_LOG *log_file)
+{
+  HOIST_CONFIG config;
+  char config_error[300];
+
+  if (load_config_file(CONFIG_FILE, &config, config_error) == -1)
+  {
+    char message[sizeof(config_error) + 60];
+    sprintf(message, "Invalid configuration, keeping version %u: %s", config_shm->version, config_error);
+    return write_log(log_file, message);
+  }
+
+  return share_config(log_file, &config);
+}
+
+// Result of the runtime profile of a child, sent to the master before exec()
+typedef struct {
+  int ret;
+  char report[300];
+} PROFILE_RESULT;
+
 // Function to fork and create a child process
-int spawn(const char *program, char *arg_list[])
+// name selects the runtime profile of the child, which the child applies to itself
+// before exec() so that all the threads of the program inherit the affinity and the policy.
+// What was applied is written in result, result->report is empty if there is no profile
+int spawn(const char *program, char *arg_list[], char *name, PROFILE_RESULT *result)
 {
+  RUNTIME_PROFILE *profile = find_runtime_profile(profiles, n_profiles, name);
+  result->ret = 0;
+  result->report[0] = '\0';
+
+  // Pipe where the child sends the result, closed by exec()
+  int result_pipe[2];
+  if (pipe(result_pipe) == -1)
+  {
+    return -1;
+  }
+  fcntl(result_pipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(result_pipe[1], F_SETFD, FD_CLOEXEC);
 
   pid_t child_pid = fork();
 
   // If fork() returns a negative value, the fork failed.
   if (child_pid < 0)
   {
+    close(result_pipe[0]);
+    close(result_pipe[1]);
     return -1;
   }
 
   // If fork() returns a positive value, we are in the parent process.
   else if (child_pid != 0)
   {
+    close(result_pipe[1]);
+
+    // Wait until the child has applied its profile, a short read leaves an empty report
+    PROFILE_RESULT received;
+    if (read(result_pipe[0], &received, sizeof(received)) == sizeof(received))
+    {
+      *result = received;
+    }
+    close(result_pipe[0]);
+
     return child_pid;
   }
 
   // If fork() returns 0, we are in the child process.
   else
   {
+    close(result_pipe[0]);
+
+    if (profile != NULL)
+    {
+      PROFILE_RESULT applied;
+      applied.ret = apply_runtime_profile(getpid(), profile, applied.report);
+      if (write(result_pipe[1], &applied, sizeof(applied)) == -1)
+        ;
+
+      // Pass the memory settings, they are applied by the program itself
+      export_runtime_profile(profile);
+    }
+    close(result_pipe[1]);
+
     if (execvp(program, arg_list) == 0)
       ;
 
@@ -48,6 +267,227 @@ int spawn(const char *program, char *arg_list[])
   }
 }
 
+// Function to find a component by name
+COMPONENT *find_component(char *name)
+{
+  for (int i = 0; i < N_COMPONENTS; i++)
+  {
+    if (strcmp(components[i].name, name) == 0)
+    {
+      return &components[i];
+    }
+  }
+  return NULL;
+}
+
+// Function to log the components not ready at the startup timeout, with where they are waiting
+int report_startup_timeout(MMAP_LOG *log_file, uint64_t now)
+{
+  for (int i = 0; i < N_COMPONENTS; i++)
+  {
+    if (components[i].ready_ns != 0)
+    {
+      continue;
+    }
+
+    // The kernel function the process is sleeping in, like the open of a FIFO without a peer
+    char path[64], wchan[64] = "unknown";
+    sprintf(path, "/proc/%d/wchan", *components[i].pid);
+    FILE *file = fopen(path, "r");
+    if (file != NULL)
+    {
+      if (fgets(wchan, sizeof(wchan), file) == NULL || wchan[0] == '\0')
+      {
+        strcpy(wchan, "running");
+      }
+      fclose(file);
+    }
+
+    char message[200];
+    sprintf(message, "Startup timeout: %s (pid %d) not ready after %.1f ms, waiting in %s", components[i].name, *components[i].pid,
+            (now - components[i].spawned_ns) / 1e6, wchan);
+    if (write_log(log_file, message))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Function to wait for the readiness records of all the components
+// Returns 0 when all of them are ready, 1 on error, timeout or if a component exits during the startup
+int wait_ready(MMAP_LOG *log_file)
+{
+  char *env_timeout = getenv("HOIST_STARTUP_TIMEOUT_MS");
+  int timeout_ms = (env_timeout != NULL && atoi(env_timeout) > 0) ? atoi(env_timeout) : DEFAULT_STARTUP_TIMEOUT_MS;
+  uint64_t deadline = components[0].spawned_ns + (uint64_t)timeout_ms * 1000000ULL;
+  int pending = N_COMPONENTS;
+
+  while (pending > 0)
+  {
+    uint64_t now = monotonic_ns();
+    if (now >= deadline)
+    {
+      report_startup_timeout(log_file, now);
+      errno = ETIMEDOUT;
+      return 1;
+    }
+
+    // A component that exits will never be ready, look at it without reaping it so the watchdog still sees it
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0)
+    {
+      char message[200];
+      sprintf(message, "Startup failed: child %d exited before being ready", info.si_pid);
+      write_log(log_file, message);
+      errno = ECHILD;
+      return 1;
+    }
+
+    // Wait for the next record, SIGCHLD interrupts the wait
+    struct pollfd pfd = {fd_ready, POLLIN, 0};
+    int ret = poll(&pfd, 1, (deadline - now + 999999) / 1000000);
+    if (ret == -1 && errno != EINTR)
+    {
+      return 1;
+    }
+    if (ret <= 0)
+    {
+      continue;
+    }
+
+    if (fill_pose_reader(fd_ready, &ready_reader, &ready_stats) == -1 && errno != EAGAIN)
+    {
+      return 1;
+    }
+
+    char *record;
+    now = monotonic_ns();
+    while (next_pose_record(&ready_reader, &record))
+    {
+      char name[32];
+      int pid;
+      COMPONENT *component;
+      if (sscanf(record, "%31s %d", name, &pid) != 2 || (component = find_component(name)) == NULL || component->ready_ns != 0)
+      {
+        continue;
+      }
+
+      component->ready_ns = now;
+      component->ready_pid = pid;
+      pending--;
+
+      char message[200];
+      sprintf(message, "%s (pid %d) ready in %.1f ms", name, pid, (now - component->spawned_ns) / 1e6);
+      if (write_log(log_file, message))
+      {
+        return 1;
+      }
+    }
+  }
+
+  // Time from the first spawn to the last component ready
+  char message[200];
+  sprintf(message, "All components ready in %.1f ms", (monotonic_ns() - components[0].spawned_ns) / 1e6);
+  return write_log(log_file, message);
+}
+
+// Function to spawn a component, record when it was spawned and log its runtime profile
+// Returns 0 on success, 1 on error
+int spawn_component(MMAP_LOG *log_file, COMPONENT *component, const char *program, char *arg_list[])
+{
+  PROFILE_RESULT result;
+  component->spawned_ns = monotonic_ns();
+  *component->pid = spawn(program, arg_list, component->name, &result);
+  if (*component->pid == -1)
+  {
+    return 1;
+  }
+
+  if (result.report[0] != '\0')
+  {
+    char message[sizeof(result.report) + 40];
+    sprintf(message, "Runtime profile %s %s", result.ret == 0 ? "applied:" : "partially applied:", result.report);
+    if (write_log(log_file, message))
+    {
+      // If error orccurs while writing to log file
+      errno = EIO;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Function to start all the child processes at once and wait until they are ready
+// The channels already exist, so the children do not depend on the order they start in
+// Returns 0 on success, 1 on error
+int spawn_all(MMAP_LOG *log_file)
+{
+  // Forget the readiness of the previous start
+  for (int i = 0; i < N_COMPONENTS; i++)
+  {
+    components[i].spawned_ns = 0;
+    components[i].ready_ns = 0;
+    components[i].ready_pid = 0;
+  }
+  ready_reader.len = 0;
+  ready_reader.start = 0;
+
+  // Mx process
+  char *arg_list_mx[] = {"./bin/mx", NULL};
+  if (spawn_component(log_file, find_component("mx"), "./bin/mx", arg_list_mx))
+  {
+    return 1;
+  }
+  // Convert pid to string to pass as argument to inspection process
+  char pid_mx_str[10];
+  sprintf(pid_mx_str, "%d", pid_mx);
+
+  // Mz process
+  char *arg_list_mz[] = {"./bin/mz", NULL};
+  if (spawn_component(log_file, find_component("mz"), "./bin/mz", arg_list_mz))
+  {
+    return 1;
+  }
+  // Convert pid to string to pass as argument to inspection process
+  char pid_mz_str[10];
+  sprintf(pid_mz_str, "%d", pid_mz);
+
+  // World process
+  char *arg_list_world[] = {"./bin/world", NULL};
+  if (spawn_component(log_file, find_component("world"), "./bin/world", arg_list_world))
+  {
+    return 1;
+  }
+
+  // Control server process
+  char *arg_list_control[] = {"./bin/control", NULL};
+  if (spawn_component(log_file, find_component("control"), "./bin/control", arg_list_control))
+  {
+    return 1;
+  }
+
+  // Command console process
+  char *arg_list_command[] = {"/usr/bin/konsole", "-e", "./bin/command", NULL};
+  if (spawn_component(log_file, find_component("command"), "/usr/bin/konsole", arg_list_command))
+  {
+    return 1;
+  }
+
+  // Inspection console process
+  char *arg_list_inspection[] = {"/usr/bin/konsole", "-e", "./bin/inspection", pid_mx_str, pid_mz_str, NULL};
+  if (spawn_component(log_file, find_component("inspection"), "/usr/bin/konsole", arg_list_inspection))
+  {
+    return 1;
+  }
+
+  // The children start in parallel, wait until all of them are ready
+  return wait_ready(log_file);
+}
+
 // Function to create all the log files
 int create_log_files()
 {
@@ -57,9 +497,10 @@ int create_log_files()
   int fd_mz = open("./log/mz.log", O_CREAT | O_RDWR, 0666);
   int fd_world = open("./log/world.log", O_CREAT | O_RDWR, 0666);
   int fd_insp = open("./log/inspection.log", O_CREAT | O_RDWR, 0666);
+  int fd_ctl = open("./log/control.log", O_CREAT | O_RDWR, 0666);
 
   // Check if the log files were created successfully
-  if (fd_cmd < 0 || fd_mx < 0 || fd_mz < 0 || fd_world < 0 || fd_insp < 0)
+  if (fd_cmd < 0 || fd_mx < 0 || fd_mz < 0 || fd_world < 0 || fd_insp < 0 || fd_ctl < 0)
   {
     return 1;
   }
@@ -69,6 +510,35 @@ int create_log_files()
   close(fd_mz);
   close(fd_world);
   close(fd_insp);
+  close(fd_ctl);
+
+  return 0;
+}
+
+// Function to create all the FIFOs before the children start and open the readiness one
+// Returns 0 on success, 1 on error
+int create_channels()
+{
+  char *fifos[] = {"/tmp/vx_fifo", "/tmp/vz_fifo", "/tmp/x_pos_fifo", "/tmp/z_pos_fifo", "/tmp/real_pos_fifo", MX_CTL_FIFO, MZ_CTL_FIFO, READY_FIFO};
+
+  for (int i = 0; i < 8; i++)
+  {
+    if (mkfifo(fifos[i], 0666) == -1 && errno != EEXIST)
+    {
+      return 1;
+    }
+  }
+
+  // O_RDWR so the children can open it without waiting and the master never reads EOF
+  if ((fd_ready = open(READY_FIFO, O_RDWR | O_NONBLOCK)) == -1)
+  {
+    return 1;
+  }
+
+  // Drop the records of a previous run
+  char discard[256];
+  while (read(fd_ready, discard, sizeof(discard)) > 0)
+    ;
 
   return 0;
 }
@@ -84,6 +554,9 @@ time_t get_last_modified(char *filename)
   return attr.st_mtime;
 }
 
+// Log files of the child processes
+char *log_files[N_COMPONENTS] = {"./log/command.log", "./log/mx.log", "./log/mz.log", "./log/world.log", "./log/inspection.log", "./log/control.log"};
+
 // Function to kill all the child processes
 void kill_all()
 {
@@ -92,6 +565,59 @@ void kill_all()
   kill(pid_mz, SIGKILL);
   kill(pid_world, SIGKILL);
   kill(pid_insp, SIGKILL);
+  kill(pid_ctl, SIGKILL);
+
+  // The consoles are not children of the master but of their terminal emulator
+  for (int i = 0; i < N_COMPONENTS; i++)
+  {
+    if (components[i].ready_pid != 0 && components[i].ready_pid != *components[i].pid)
+    {
+      kill(components[i].ready_pid, SIGKILL);
+    }
+  }
+}
+
+// Function to wait for all the child processes after kill_all() and remove the padding of their logs
+// The children were killed with SIGKILL, so they could not trim their logs themselves
+void reap_all()
+{
+  while (waitpid(-1, NULL, 0) > 0)
+    ;
+
+  for (int i = 0; i < N_COMPONENTS; i++)
+  {
+    trim_mmap_log(log_files[i]);
+  }
+}
+
+// Function to restart all the child processes after a crash
+// The motors and the world process resume from the checkpoint
+// Returns 0 on success, 1 on error
+int restart_all(MMAP_LOG *log_file, int restart)
+{
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // The watchdog killed the children, wait for all of them before starting the new ones
+  reap_all();
+
+  if (spawn_all(log_file))
+  {
+    kill_all();
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  // Log how long the restart took and where the motors resume
+  CHECKPOINT_MOTOR x_snapshot, z_snapshot;
+  int has_x = read_checkpoint_section(&checkpoint->motors[CHECKPOINT_X].seq, &x_snapshot, sizeof(CHECKPOINT_MOTOR));
+  int has_z = read_checkpoint_section(&checkpoint->motors[CHECKPOINT_Z].seq, &z_snapshot, sizeof(CHECKPOINT_MOTOR));
+  char message[200];
+  sprintf(message, "Restart %d: all processes restarted in %.1f ms, from x=%f z=%f", restart,
+          (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6, has_x ? x_snapshot.pos : 0.0, has_z ? z_snapshot.pos : 0.0);
+
+  return write_log(log_file, message);
 }
 
 // Function to control the child processes
@@ -99,28 +625,24 @@ void kill_all()
 // If they are not, it will kill them
 // It will also check if the child processes are still alive
 // If at least one of the processes terminated unexpectedly, it will kill the others
-int watchdog()
+// wake_signals are blocked by the caller and only received while waiting
+int watch_children(MMAP_LOG *log_file, sigset_t *wake_signals)
 {
-  // Array of the log file paths
-  char *log_files[5] = {"./log/command.log", "./log/mx.log", "./log/mz.log", "./log/world.log", "./log/inspection.log"};
-
-  // Array of the PIDs
-  pid_t pids[5] = {pid_cmd, pid_mx, pid_mz, pid_world, pid_insp};
-
-  // Flag to check if a file was modified
-  int mod_flag = 0;
-
-  // Variable to keep the number of seconds since the last modification
-  int seconds_since_mod = 0;
+  // The inactivity is counted from the start of the watchdog at the earliest, also after a restart
+  time_t watchdog_started = time(NULL);
 
   // Infinite loop
   while (1)
   {
     // Get current time
     time_t current_time = time(NULL);
+    watchdog_wakeups++;
+
+    // Most recent modification of the log files
+    time_t newest_modified = watchdog_started;
 
     // Loop through the log files
-    for (int i = 0; i < 5; i++)
+    for (int i = 0; i < 6; i++)
     {
       // Get the last modified time of the log file
       time_t last_modified = get_last_modified(log_files[i]);
@@ -134,26 +656,12 @@ int watchdog()
         return 1;
       }
 
-      // Check if the file was modified in the last 2 seconds
-      if (current_time - last_modified > 2)
-      {
-        // If the file wasn't modified in the last 2 seconds, set the flag to 0
-        mod_flag = 0;
-      }
-      else
+      if (last_modified > newest_modified)
       {
-        // If the file was modified in the last 2 seconds, set the flag to 1 and reset the counter
-        mod_flag = 1;
-        seconds_since_mod = 0;
+        newest_modified = last_modified;
       }
     }
 
-    // If the flag is 0, increment the counter
-    if (mod_flag == 0)
-    {
-      seconds_since_mod += 2;
-    }
-
     // Variable to store the return value of the waitpid() function
     int ret;
 
@@ -173,26 +681,74 @@ int watchdog()
       return 1;
     }
 
-    // If the counter is greater than 60, kill the child processes
-    if (seconds_since_mod > 60)
+    // If no log file was modified for more than 60 seconds, kill the child processes
+    if (current_time - newest_modified > INACTIVITY_TIMEOUT_S)
     {
       kill_all();
       return 0;
     }
 
-    // Sleep for 2 seconds
-    sleep(2);
+    // Dump the metrics if asked with SIGUSR1
+    if (dump_requested)
+    {
+      dump_requested = 0;
+      write_metrics();
+    }
+
+    // Reload the configuration if asked with SIGHUP, the children apply it at their next tick
+    if (reload_requested)
+    {
+      reload_requested = 0;
+      if (reload_config(log_file))
+      {
+        kill_all();
+        return 1;
+      }
+    }
+
+    // Wait up to the inactivity deadline instead of polling the log files:
+    // a crash (SIGCHLD), a dump or a reload request wakes the watchdog earlier,
+    // also if it arrived during the checks above, since it stayed pending
+    struct timespec timeout = {newest_modified + INACTIVITY_TIMEOUT_S + 1 - current_time, 0};
+    int signo = sigtimedwait(wake_signals, NULL, &timeout);
+    if (signo == SIGUSR1)
+    {
+      dump_requested = 1;
+    }
+    else if (signo == SIGHUP)
+    {
+      reload_requested = 1;
+    }
   }
 }
 
+// Function to run the watchdog with the signals that wake it blocked
+// A signal arriving between a check and the wait would otherwise be noticed only at the inactivity deadline
+int watchdog(MMAP_LOG *log_file)
+{
+  sigset_t wake_signals, old_mask;
+  sigemptyset(&wake_signals);
+  sigaddset(&wake_signals, SIGCHLD);
+  sigaddset(&wake_signals, SIGUSR1);
+  sigaddset(&wake_signals, SIGHUP);
+  sigprocmask(SIG_BLOCK, &wake_signals, &old_mask);
+
+  int ret = watch_children(log_file, &wake_signals);
+
+  // The children started by a restart must not inherit the blocked signals
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  return ret;
+}
+
 int main()
 {
 
-  // File descriptor for the log file
-  int log_fd;
+  // Memory mapped log file
+  MMAP_LOG log_file;
 
   // Open the log file
-  if ((log_fd = open("log/master.log", O_WRONLY | O_APPEND | O_CREAT, 0666)) == -1)
+  if (open_mmap_log(&log_file, "log/master.log") == -1)
   {
     // If the file could not be opened, print an error message and exit
     perror("Error opening log file");
@@ -204,79 +760,84 @@ int main()
   struct tm tm = *localtime(&t);
   char buffer[100];
   sprintf(buffer, "%d-%d-%d %d:%d:%d: <master_process> Master process started\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-  int m = write(log_fd, buffer, strlen(buffer));
+  int m = mmap_log_write(&log_file, buffer, strlen(buffer));
 
   // Check for errors
-  if (m == -1 || m != strlen(buffer))
+  if (m == -1)
   {
     // If an error occurred, print an error message and exit
     perror("Error writing to log file");
     // Close the log file
-    close(log_fd);
+    close_mmap_log(&log_file);
     return 1;
   }
 
-  // Command console process
-  char *arg_list_command[] = {"/usr/bin/konsole", "-e", "./bin/command", NULL};
-  pid_cmd = spawn("/usr/bin/konsole", arg_list_command);
-  if (pid_cmd == -1)
+  // Create the metrics segment before the children register in it and clear the snapshots of the previous run
+  if ((metrics = open_metrics_shm()) == NULL || (checkpoint = open_checkpoint(1)) == NULL || signal(SIGUSR1, dump_handler) == SIG_ERR ||
+      signal(SIGCHLD, child_handler) == SIG_ERR)
   {
-    // Go to spawn_err if spawn() returns -1
-    goto spawn_err;
+    perror("Error creating the metrics");
+    close_mmap_log(&log_file);
+    return 1;
   }
 
-  // Mx process
-  char *arg_list_mx[] = {"./bin/mx", NULL};
-  pid_mx = spawn("./bin/mx", arg_list_mx);
-  if (pid_mx == -1)
+  // Load and validate the runtime profiles
+  char profile_error[300];
+  if ((n_profiles = load_runtime_profiles(RUNTIME_PROFILE_FILE, profiles, profile_error)) == -1)
   {
-    // Go to spawn_err if spawn() returns -1
-    goto spawn_err;
+    // An invalid profile is a configuration error, do not start
+    char message[sizeof(profile_error) + 40];
+    sprintf(message, "Invalid runtime profile: %s", profile_error);
+    write_log(&log_file, message);
+    fprintf(stderr, "%s\n", message);
+    close_mmap_log(&log_file);
+    return 1;
   }
-  // Convert pid to string to pass as argument to inspection process
-  char pid_mx_str[10];
-  sprintf(pid_mx_str, "%d", pid_mx);
 
-  // Mz process
-  char *arg_list_mz[] = {"./bin/mz", NULL};
-  pid_mz = spawn("./bin/mz", arg_list_mz);
-  if (pid_mz == -1)
+  // Parse the configuration once and share it, an invalid file is a configuration error
+  HOIST_CONFIG config;
+  char config_error[300];
+  if (load_config_file(CONFIG_FILE, &config, config_error) == -1)
   {
-    // Go to spawn_err if spawn() returns -1
-    goto spawn_err;
+    char message[sizeof(config_error) + 40];
+    sprintf(message, "Invalid configuration: %s", config_error);
+    write_log(&log_file, message);
+    fprintf(stderr, "%s\n", message);
+    close_mmap_log(&log_file);
+    return 1;
+  }
+  if ((config_shm = open_config_shm(1)) == NULL || share_config(&log_file, &config) || signal(SIGHUP, reload_handler) == SIG_ERR)
+  {
+    perror("Error sharing the configuration");
+    close_mmap_log(&log_file);
+    return 1;
   }
-  // Convert pid to string to pass as argument to inspection process
-  char pid_mz_str[10];
-  sprintf(pid_mz_str, "%d", pid_mz);
 
-  // World process
-  char *arg_list_world[] = {"./bin/world", NULL};
-  pid_world = spawn("./bin/world", arg_list_world);
-  if (pid_world == -1)
+  // Create the log files and all the channels before the children start
+  if (create_log_files() || create_channels())
   {
-    // Go to spawn_err if spawn() returns -1
-    goto spawn_err;
+    perror("Error creating log files and channels");
+    close_mmap_log(&log_file);
+    return 1;
   }
 
-  // Inspection console process
-  char *arg_list_inspection[] = {"/usr/bin/konsole", "-e", "./bin/inspection", pid_mx_str, pid_mz_str, NULL};
-  pid_insp = spawn("/usr/bin/konsole", arg_list_inspection);
-  if (pid_insp == -1)
+  // Start all the child processes, apply their runtime profiles and wait until they are ready
+  if (spawn_all(&log_file))
   {
-    // Go to spawn_err if spawn() returns -1
+    // Go to spawn_err if spawn_all() fails
     goto spawn_err;
   }
 
   // If no error occured, log that all processes have been started
   t = time(NULL);
   tm = *localtime(&t);
-  sprintf(buffer, "%d-%d-%d %d:%d:%d: <master_process> All processes started\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-  m = write(log_fd, buffer, strlen(buffer));
-  if (m == -1 || m != strlen(buffer))
+  sprintf(buffer, "%d-%d-%d %d:%d:%d: <master_process> All processes started and ready\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+  m = mmap_log_write(&log_file, buffer, strlen(buffer));
+  if (m == -1)
   {
     // If error orccurs while writing to log file, print error message and exit
     perror("Error writing to log file");
-    close(log_fd);
+    close_mmap_log(&log_file);
     return 1;
   }
 
@@ -286,33 +847,50 @@ int main()
 // If an error occurred while spawning a process
 spawn_err:
   // Print an error message and exit
-  perror("Error spawning process");
+  perror("Error starting processes");
   // Close the log file
-  close(log_fd);
+  close_mmap_log(&log_file);
   // Kill all the child processes
   kill_all();
   return 1;
 
 // If no error occured
-no_err:
+no_err:;
 
-  // Create all the log files
-  int ret = create_log_files();
-  if (ret == -1)
-  {
-    // If an error occured while creating the log files, print an error message and exit
-    perror("Error creating log files");
-    // Close the log file
-    close(log_fd);
-    // Kill all the child processes
-    kill_all();
-    return 1;
-  }
+  // Number of restarts allowed after a crash
+  char *env_restarts = getenv("HOIST_MAX_RESTARTS");
+  int max_restarts = (env_restarts != NULL && *env_restarts != '\0') ? atoi(env_restarts) : DEFAULT_MAX_RESTARTS;
 
   // Call the watchdog function
-  ret = watchdog();
+  int ret = watchdog(&log_file);
 
-  // No need to wait for child processes to terminate as they have already been killed by the watchdog function
+  // If a child crashed, restart all the processes from the checkpoint
+  // A child that exited normally (a console closed by the user) still stops the program
+  for (int restarts = 1; ret == -1 && restarts <= max_restarts && !(WIFEXITED(status) && WEXITSTATUS(status) == 0); restarts++)
+  {
+    char message[200];
+    if (WIFSIGNALED(status))
+    {
+      sprintf(message, "Child killed by signal %d, restarting all processes", WTERMSIG(status));
+    }
+    else
+    {
+      sprintf(message, "Child terminated with status %d, restarting all processes", WEXITSTATUS(status));
+    }
+
+    if (write_log(&log_file, message) || restart_all(&log_file, restarts))
+    {
+      // If an error occurs while restarting, print an error message and exit
+      perror("Error restarting processes");
+      close_mmap_log(&log_file);
+      return 1;
+    }
+
+    ret = watchdog(&log_file);
+  }
+
+  // The children have already been killed by the watchdog function, wait for them and trim their logs
+  reap_all();
 
   // If watchdog() returns 0, the processes have been terminated for inactivity
   if (ret == 0)
@@ -321,12 +899,12 @@ no_err:
     t = time(NULL);
     tm = *localtime(&t);
     sprintf(buffer, "%d-%d-%d %d:%d:%d: <master_process> All processes terminated for inactivity\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-    m = write(log_fd, buffer, strlen(buffer));
-    if (m == -1 || m != strlen(buffer))
+    m = mmap_log_write(&log_file, buffer, strlen(buffer));
+    if (m == -1)
     {
       // If error orccurs while writing to log file, print error message and exit
       perror("Error writing to log file");
-      close(log_fd);
+      close_mmap_log(&log_file);
       return 1;
     }
   }
@@ -338,19 +916,19 @@ no_err:
     t = time(NULL);
     tm = *localtime(&t);
     sprintf(buffer, "%d-%d-%d %d:%d:%d: <master_process> Error in watchdog: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, strerror(errno));
-    m = write(log_fd, buffer, strlen(buffer));
-    if (m == -1 || m != strlen(buffer))
+    m = mmap_log_write(&log_file, buffer, strlen(buffer));
+    if (m == -1)
     {
       // If error orccurs while writing to log file, print error message and exit
       perror("Error writing to log file");
-      close(log_fd);
+      close_mmap_log(&log_file);
       return 1;
     }
     // Print an error message and exit
     printf("An error occured, check log file for details\n");
     fflush(stdout);
     // Close the log file
-    close(log_fd);
+    close_mmap_log(&log_file);
     return 1;
   }
 
@@ -361,12 +939,12 @@ no_err:
     t = time(NULL);
     tm = *localtime(&t);
     sprintf(buffer, "%d-%d-%d %d:%d:%d: <master_process> Child terminated unexpectedly\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-    m = write(log_fd, buffer, strlen(buffer));
-    if (m == -1 || m != strlen(buffer))
+    m = mmap_log_write(&log_file, buffer, strlen(buffer));
+    if (m == -1)
     {
       // If error orccurs while writing to log file, print error message and exit
       perror("Error writing to log file");
-      close(log_fd);
+      close_mmap_log(&log_file);
       return 1;
     }
 
@@ -388,24 +966,27 @@ no_err:
     }
   }
 
+  // Dump the metrics of the session
+  write_metrics();
+
   // Log the end of the program
   t = time(NULL);
   tm = *localtime(&t);
   sprintf(buffer, "%d-%d-%d %d:%d:%d: <master_process> Master process terminated\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-  m = write(log_fd, buffer, strlen(buffer));
+  m = mmap_log_write(&log_file, buffer, strlen(buffer));
 
   // Check for errors
-  if (m == -1 || m != strlen(buffer))
+  if (m == -1)
   {
     // If an error occurred, print an error message and exit
     perror("Error writing to log file");
     // Close the log file
-    close(log_fd);
+    close_mmap_log(&log_file);
     return 1;
   }
 
   // Close the log file
-  close(log_fd);
+  close_mmap_log(&log_file);
 
   return 0;
 }
\ No newline at end of file
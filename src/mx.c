@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -9,27 +10,66 @@
 #include <time.h>
 #include <stdlib.h>
 #include <signal.h>
-
-// Flag to check if stop or reset handlers were called
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "./../include/control_protocol.h"
+#include "./../include/motor_core.h"
+#include "./../include/pose_stream.h"
+#include "./../include/estop.h"
+#include "./../include/metrics.h"
+#include "./../include/tick_timer.h"
+#include "./../include/runtime_profile.h"
+#include "./../include/checkpoint.h"
+#include "./../include/readiness.h"
+#include "./../include/hoist_config.h"
+#include "./../include/mmap_log.h"
+
+// Flag to check if the stop handler was called
 int stop_flag = 0;
-int reset_flag = 0;
 
-// Constants to store the minimum and maximum x position
-const float x_min = 0.0;
-const float x_max = 40.0;
+// Shared configuration, with the limits of the axis and the period of the position updates,
+// and the version applied
+CONFIG_SHM *config_shm;
+HOIST_CONFIG config;
+uint32_t config_seen;
 
-// File descriptor for the log file
-int log_fd;
+// Memory mapped log file
+MMAP_LOG log_file;
 
 // File descriptors for pipes
-int fd_vx, fdx_pos;
+int fd_vx, fdx_pos, fd_ctl;
+
+// Reassembly buffer of the commands of the command console, only the malformed counter is used
+POSE_READER vx_reader;
+POSE_STATS vx_stats;
+
+// Position, velocity and target of the motor
+MOTOR motor;
+
+// Shared memory where the position is published for the control server
+POSE_SHM *pose_shm;
+
+// Sequence number of the last position record sent to the world process
+uint32_t x_seq = 0;
+
+// Checkpoint file where the state of the motor is saved at every tick
+CHECKPOINT_FILE *checkpoint;
 
-// Variables to store position and velocity
-float x_pos = 0.0;
-int vx = 0;
+// Shared memory emergency stop and last request applied by the main loop
+ESTOP_SHM *estop;
+uint32_t estop_seen;
+
+// Pipe where the emergency stop thread wakes the main loop
+int estop_pipe[2];
+
+// Metrics of this process
+METRICS_SLOT *metrics;
+
+// Deadlines of the position updates, shared by the main loop and the reset handler
+TICK_TIMER tick_timer;
 
 // Buffer to store the log message
-char log_buffer[100];
+char log_buffer[200];
 
 // Variable to store the errors
 // 0 = no error
@@ -63,10 +103,29 @@ int write_log(char *to_write, char type)
     {
         sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <mx_process> signal received: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
     }
+    // If type is 'c' then it is a batch of control commands
+    else if (type == 'c')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <mx_process> control commands: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'p' then it is the runtime profile
+    else if (type == 'p')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <mx_process> runtime profile: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'g' then it is a new configuration
+    else if (type == 'g')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <mx_process> configuration: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'w' then it is a warm start from the checkpoint
+    else if (type == 'w')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <mx_process> warm start: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
 
-    int m = write(log_fd, log_buffer, strlen(log_buffer));
-    // Check for errors
-    if (m == -1 || m != strlen(log_buffer))
+    // Copy the message in the mapped segment
+    if (mmap_log_write(&log_file, log_buffer, strlen(log_buffer)) == -1)
     {
         return 2;
     }
@@ -74,6 +133,14 @@ int write_log(char *to_write, char type)
     return 0;
 }
 
+// Function to empty the wakeup pipe of the emergency stop thread
+void drain_estop_pipe()
+{
+    char bytes[16];
+    while (read(estop_pipe[0], bytes, sizeof(bytes)) > 0)
+        ;
+}
+
 // Stop signal handler
 void stop_handler(int signo)
 {
@@ -89,7 +156,7 @@ void stop_handler(int signo)
         }
 
         // Stop the motor
-        vx = 0;
+        stop_motor(&motor);
 
         // Listen for the next signal
         if (signal(SIGUSR1, stop_handler) == SIG_ERR || signal(SIGUSR2, reset_handler) == SIG_ERR)
@@ -109,9 +176,6 @@ void reset_handler(int signo)
         // Setting stop_flag to false
         stop_flag = 0;
 
-        // Setting reset_flag to true
-        reset_flag = 1;
-
         // Log that the process has received a signal
         if (error = write_log("RESET", 's'))
         {
@@ -119,11 +183,12 @@ void reset_handler(int signo)
             return;
         }
 
-        // Variable to count the loops
-        int loops = 0;
+        // Move to the minimum position at the reset speed, the same move as the reset of the control API
+        MOTOR_COMMAND reset = {.op = CTL_OP_RESET};
+        motor_apply_command(&motor, &reset);
 
-        // Setting velocity to -4
-        vx = -4;
+        // The first tick of the reset is one period from now, the motor may have been idle
+        start_tick_timer(&tick_timer, tick_timer.period_ns);
 
         // Listen for stop signal
         if (signal(SIGUSR1, stop_handler) == SIG_ERR)
@@ -133,34 +198,44 @@ void reset_handler(int signo)
             return;
         }
 
-        // Looping for 5 seconds
-        while (loops < 10)
+        // Looping until the motor stops on the minimum position
+        while (motor.target_active)
         {
             // Setting up the select to read from the pipe and ignore the read values
             // Set the file descriptors to be monitored
             fd_set readfds;
             FD_ZERO(&readfds);
             FD_SET(fd_vx, &readfds);
+            FD_SET(estop_pipe[0], &readfds);
+            int max_fd = (fd_vx > estop_pipe[0] ? fd_vx : estop_pipe[0]) + 1;
 
-            // Set the timeout
-            struct timeval timeout;
-            timeout.tv_sec = 0;
-            timeout.tv_usec = 500000;
+            // Set the timeout up to the next tick
+            struct timeval timeout = tick_timeout(&tick_timer);
 
-            // Wait for the file descriptor to be ready
-            int ready = select(fd_vx + 1, &readfds, NULL, NULL, &timeout);
+            // Wait for the file descriptors to be ready
+            int ready = select(max_fd, &readfds, NULL, NULL, &timeout);
+
+            // A wakeup of the emergency stop thread is seen below through the control word
+            if (ready > 0 && FD_ISSET(estop_pipe[0], &readfds))
+            {
+                drain_estop_pipe();
+            }
 
             // Check if the file descriptor is ready
-            if (ready > 0)
+            if (ready > 0 && FD_ISSET(fd_vx, &readfds))
             {
-                // Read the velocity increment
-                char buffer[2];
-                if (read(fd_vx, buffer, 2) == -1)
+                // Read the commands and drop them, keeping the following ones whole
+                char *record;
+                if (fill_pose_reader(fd_vx, &vx_reader, &vx_stats) == -1)
                 {
                     // If error occurs, set handler_error to 1
                     error = 1;
                     return;
                 }
+                while (next_pose_record(&vx_reader, &record))
+                {
+                    // Commands are ignored during the reset
+                }
             }
             // Error handling
             else if (ready < 0 && errno != EINTR)
@@ -171,38 +246,47 @@ void reset_handler(int signo)
             }
 
             // If reset was interrupted by a stop, exit the handler
-            if (stop_flag)
+            // An emergency stop is applied by the main loop
+            if (stop_flag || estop_generation(estop) != estop_seen)
             {
                 return;
             }
 
-            // Updating position
-            x_pos += vx;
-
-            // If position is lower than 0, make it 0
-            if (x_pos < 0)
+            // Inputs arriving before the tick must not speed up the reset
+            if (!tick_due(&tick_timer))
             {
-                x_pos = 0;
+                continue;
             }
+            TICK tick = advance_tick_timer(&tick_timer);
+
+            // Updating position with the real time elapsed since the previous tick
+            motor_step(&motor, tick.dt);
+
+            // Publish the position for the control server
+            publish_pose(pose_shm, 'x', motor.pos);
 
             // Writing position to pipe
-            char x_pos_str[10];
-            sprintf(x_pos_str, "%f", x_pos);
+            char x_pos_str[POSE_RECORD_MAX];
+            int len = format_axis_record(x_pos_str, x_seq + 1, motor.pos);
 
-            int m = write(fdx_pos, x_pos_str, strlen(x_pos_str) + 1);
-            if (m == -1 || m != strlen(x_pos_str) + 1)
+            int m = write(fdx_pos, x_pos_str, len);
+            if (m == -1 || m != len)
             {
                 // If error occurs, set handler_error to 1
                 error = 1;
                 return;
             }
+            x_seq++;
+            metrics_count(metrics, METRIC_SAMPLES, 1);
+            metrics_count(metrics, METRIC_BYTES_WRITTEN, len);
+            metrics_gauge(metrics, METRIC_POSITION_X, motor.pos);
 
-            // Increment loops
-            loops++;
+            // Snapshot the motor, a crash during the reset resumes where it stopped
+            save_motor_checkpoint(checkpoint, CHECKPOINT_X, &motor, x_seq);
         }
 
         // Set velocity to 0
-        vx = 0;
+        motor.v = 0;
 
         // Listen for the next signal
         if (signal(SIGUSR1, stop_handler) == SIG_ERR || signal(SIGUSR2, reset_handler) == SIG_ERR)
@@ -214,20 +298,97 @@ void reset_handler(int signo)
     }
 }
 
+// Thread sleeping on the emergency stop futex
+// It only wakes the main loop as soon as a request is made, the motor belongs to the main thread
+void *estop_thread(void *arg)
+{
+    uint32_t seen = estop_seen;
+    char byte = 0;
+
+    while (1)
+    {
+        seen = wait_estop(estop, seen);
+
+        // A full pipe already holds a wakeup
+        if (write(estop_pipe[1], &byte, 1) == -1)
+            ;
+    }
+
+    return NULL;
+}
+
+// Function to apply the emergency stop requests not yet seen by the main loop
+// Called after the commands of the wakeup and once per tick, so a stop is applied
+// immediately when the thread wakes the loop and within one tick otherwise
+// Returns 1 if a new request was applied
+int check_estop()
+{
+    uint32_t word = estop_generation(estop);
+    if (word == estop_seen)
+    {
+        return 0;
+    }
+    estop_seen = word;
+
+    // Stop the motor and acknowledge the request
+    stop_motor(&motor);
+    ack_estop(estop, ESTOP_MX);
+
+    return 1;
+}
+
+// Function to apply the configuration read in config
+// The motor is kept within the new limits and the new period starts at the next tick
+// Returns 0 on success, 2 on log error
+int apply_config()
+{
+    motor.min = config.x_min;
+    motor.max = config.x_max;
+    if (motor.pos < motor.min || motor.pos > motor.max)
+    {
+        motor.pos = motor.pos < motor.min ? motor.min : motor.max;
+        stop_motor(&motor);
+    }
+    tick_timer.period_ns = config.motor_tick_ms * 1000000ULL;
+
+    char to_write[100];
+    sprintf(to_write, "version %u, limits %.2f-%.2f, tick %u ms", config_seen, config.x_min, config.x_max, config.motor_tick_ms);
+    return write_log(to_write, 'g');
+}
+
 int main(int argc, char const *argv[])
 {
     // Open the log file
-    if ((log_fd = open("log/mx.log", O_WRONLY | O_APPEND | O_CREAT, 0666)) == -1)
+    if (open_mmap_log(&log_file, "log/mx.log") == -1)
     {
         // If error occurs while opening the log file
         exit(errno);
     }
 
+    // Apply the memory settings of the runtime profile passed by the master
+    // A failure does not stop the process, it runs without the memory locked and logs it as an error
+    char profile_report[100];
+    int profile_failed = apply_memory_profile(profile_report);
+    if (profile_report[0] != '\0' && write_log(profile_report, profile_failed ? 'e' : 'p'))
+    {
+        // If error occurs while writing to the log file
+        close_mmap_log(&log_file);
+        exit(errno);
+    }
+
+    // Read the configuration published by the master, the defaults without it
+    config_shm = open_config_shm(0);
+    config_seen = read_config(config_shm, &config);
+
+    // The motor starts stopped at the minimum position
+    init_motor(&motor, 'x', config.x_min, config.x_max);
+
     // Create the FIFOs
     char *vx_fifo = "/tmp/vx_fifo";
     char *x_pos_fifo = "/tmp/x_pos_fifo";
     mkfifo(vx_fifo, 0666);
     mkfifo(x_pos_fifo, 0666);
+    mkfifo(MX_CTL_FIFO, 0666);
 
     // Open the FIFOs
     if ((fd_vx = open(vx_fifo, O_RDWR)) == -1) // O_RDWR is needed to avoid receiving EOF in select
@@ -236,7 +397,24 @@ int main(int argc, char const *argv[])
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close the log file
-        close(log_fd);
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing to the log file
+            exit(errno);
+        }
+
+        exit(1);
+    }
+
+    if ((fd_ctl = open(MX_CTL_FIFO, O_RDWR)) == -1) // O_RDWR for the same reason as above
+    {
+        // If error occurs while opening the FIFO
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close file descriptors
+        close(fd_vx);
+        close_mmap_log(&log_file);
         if (ret)
         {
             // If error occurs while writing to the log file
@@ -253,7 +431,28 @@ int main(int argc, char const *argv[])
         int ret = write_log(strerror(errno), 'e');
         // Close file descriptors
         close(fd_vx);
-        close(log_fd);
+        close(fd_ctl);
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing to the log file
+            exit(errno);
+        }
+
+        exit(1);
+    }
+
+    // Map the shared pose and the checkpoint and listen for signals
+    if ((pose_shm = open_pose_shm()) == NULL || (checkpoint = open_checkpoint(0)) == NULL || signal(SIGUSR1, stop_handler) == SIG_ERR || signal(SIGUSR2, reset_handler) == SIG_ERR)
+    {
+        // If error occurs while mapping the pose or setting the signal handlers
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close file descriptors
+        close(fd_vx);
+        close(fd_ctl);
+        close(fdx_pos);
+        close_mmap_log(&log_file);
         if (ret)
         {
             // If error occurs while writing to the log file
@@ -263,16 +462,78 @@ int main(int argc, char const *argv[])
         exit(1);
     }
 
-    // Listen for signals
-    if (signal(SIGUSR1, stop_handler) == SIG_ERR || signal(SIGUSR2, reset_handler) == SIG_ERR)
+    // After a crash, resume from the last snapshot instead of the minimum position
+    CHECKPOINT_MOTOR snapshot;
+    if (load_motor_checkpoint(checkpoint, CHECKPOINT_X, &motor, &snapshot))
+    {
+        x_seq = snapshot.stream_seq;
+
+        char to_write[100];
+        sprintf(to_write, "position %f from the snapshot taken %.1f ms before", motor.pos, (checkpoint_time_ns() - snapshot.time_ns) / 1e6);
+        if (write_log(to_write, 'w'))
+        {
+            // If error occurs while writing to the log file
+            close(fd_vx);
+            close(fd_ctl);
+            close(fdx_pos);
+            close_mmap_log(&log_file);
+            exit(errno);
+        }
+    }
+
+    // Publish the initial position
+    publish_pose(pose_shm, 'x', motor.pos);
+
+    // Map the emergency stop, ignoring the requests made before starting, and the metrics
+    if ((estop = open_estop_shm()) == NULL || (metrics = register_metrics(METRICS_MX, "mx")) == NULL)
     {
-        // If error occurs while setting the signal handlers
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close file descriptors
         close(fd_vx);
+        close(fd_ctl);
+        close(fdx_pos);
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing to the log file
+            exit(errno);
+        }
+
+        exit(1);
+    }
+    estop_seen = estop_generation(estop);
+
+    // Start the emergency stop thread with the stop and reset signals blocked,
+    // so that they are always handled by the main thread
+    sigset_t signals, old_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+
+    // Neither the thread nor the loop ever block on the wakeup pipe
+    pthread_t estop_tid;
+    int ret = pipe(estop_pipe) == -1 ? errno : 0;
+    if (ret == 0)
+    {
+        fcntl(estop_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(estop_pipe[1], F_SETFL, O_NONBLOCK);
+        ret = pthread_create(&estop_tid, NULL, estop_thread, NULL);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    if (ret)
+    {
+        // pthread_create() does not set errno, the error of pipe() is in ret too
+        errno = ret;
+        // Log the error
+        ret = write_log(strerror(errno), 'e');
+        // Close file descriptors
+        close(fd_vx);
+        close(fd_ctl);
         close(fdx_pos);
-        close(log_fd);
+        close_mmap_log(&log_file);
         if (ret)
         {
             // If error occurs while writing to the log file
@@ -282,12 +543,20 @@ int main(int argc, char const *argv[])
         exit(1);
     }
 
+    // Tell the master that the motor is ready
+    if (notify_ready("mx") == -1)
+    {
+        error = 1;
+    }
+
+    // Start the position updates
+    start_tick_timer(&tick_timer, config.motor_tick_ms * 1000000ULL);
+
     // Loop until handler_error is set to true
     while (!error)
     {
         // Setting signal falgs to false
         stop_flag = 0;
-        reset_flag = 0;
 
         // Boolean to check if the position has changed
         int pos_changed = 0;
@@ -296,58 +565,105 @@ int main(int argc, char const *argv[])
         fd_set readfds;
         FD_ZERO(&readfds);
         FD_SET(fd_vx, &readfds);
+        FD_SET(fd_ctl, &readfds);
+        FD_SET(estop_pipe[0], &readfds);
+        int max_fd = (fd_vx > fd_ctl ? fd_vx : fd_ctl);
+        max_fd = (max_fd > estop_pipe[0] ? max_fd : estop_pipe[0]) + 1;
+
+        // Set the timeout up to the next tick
+        struct timeval timeout = tick_timeout(&tick_timer);
+
+        // A stopped motor has nothing to do at the ticks, it waits for a command without timeout
+        // (the emergency stop thread wakes it through its pipe and the signals interrupt it)
+        // A new configuration is applied at the next tick: the master wakes an idle motor through
+        // the control FIFO when it publishes one, and a pending one keeps the ticks running
+        int idle = (motor.v == 0 && !motor.target_active && !config_pending(config_shm, config_seen));
 
-        // Set the timeout
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 500000;
+        // Wait for the file descriptors to be ready
+        int ready = select(max_fd, &readfds, NULL, NULL, idle ? NULL : &timeout);
 
-        // Wait for the file descriptor to be ready
-        int ready = select(fd_vx + 1, &readfds, NULL, NULL, &timeout);
+        // After an idle wait the ticks start again one period from now, not from the last tick
+        if (idle)
+        {
+            start_tick_timer(&tick_timer, tick_timer.period_ns);
+        }
 
-        // Check if the file descriptor is ready
+        // Count the wakeups and how many bytes are waiting to be read
+        metrics_count(metrics, ready == 0 ? METRIC_TIMEOUTS : METRIC_WAKEUPS, 1);
         if (ready > 0)
         {
-            // Read the velocity increment
-            char buffer[2];
-            if (read(fd_vx, buffer, 2) == -1)
+            int queued_vx = 0, queued_ctl = 0;
+            ioctl(fd_vx, FIONREAD, &queued_vx);
+            ioctl(fd_ctl, FIONREAD, &queued_ctl);
+            metrics_gauge(metrics, METRIC_QUEUE_DEPTH, queued_vx + queued_ctl);
+        }
+
+        // Check if the control FIFO is ready
+        if (ready > 0 && FD_ISSET(fd_ctl, &readfds))
+        {
+            // Read all the queued commands at once
+            MOTOR_COMMAND cmds[64];
+            int n = read(fd_ctl, cmds, sizeof(cmds));
+            if (n == -1)
             {
                 // If error occurs while reading from the FIFO
                 error = 1;
                 break;
             }
 
-            int vx_increment = atoi(buffer);
-
-            // Stop motor
-            if (vx_increment == 0 && vx != 0)
+            // Apply the commands in the order they were sent, the wakeups of a new configuration are not commands
+            int n_cmds = 0;
+            for (int i = 0; i < n / (int)sizeof(MOTOR_COMMAND); i++)
             {
-                vx = 0;
-
-                // Log that the motor has been stopped
-                char to_write[4];
-                sprintf(to_write, "%d", vx);
-                if (error = write_log(to_write, 'i'))
+                if (cmds[i].op != CTL_OP_CONFIG)
                 {
-                    // If error occurs while writing to the log file
-                    break;
+                    motor_apply_command(&motor, &cmds[i]);
+                    n_cmds++;
                 }
             }
+            metrics_count(metrics, METRIC_COMMANDS, n_cmds);
 
-            // Ignore the velocity increment or decrement if the position is at the limit
-            else if ((vx_increment == 1 && x_pos < x_max) || (vx_increment == 2 && x_pos > x_min))
+            // Log the whole batch once
+            char to_write[40];
+            sprintf(to_write, "%d, speed %.2f", n_cmds, motor.v);
+            if (n_cmds > 0 && (error = write_log(to_write, 'c')))
             {
-                if (vx_increment == 2)
+                // If error occurs while writing to the log file
+                break;
+            }
+        }
+
+        // Check if the velocity FIFO is ready
+        if (ready > 0 && FD_ISSET(fd_vx, &readfds))
+        {
+            // Read the queued commands of the command console
+            if (fill_pose_reader(fd_vx, &vx_reader, &vx_stats) == -1)
+            {
+                // If error occurs while reading from the FIFO
+                error = 1;
+                break;
+            }
+
+            // Apply the complete commands, the increments are ignored if the position is at the limit
+            int changed = 0;
+            char *record;
+            while (next_pose_record(&vx_reader, &record))
+            {
+                VELOCITY_COMMAND cmd;
+                if (parse_velocity_command(record, &cmd) == -1)
                 {
-                    vx_increment = -1;
+                    vx_stats.malformed++;
+                    continue;
                 }
+                changed |= motor_apply_velocity_command(&motor, &cmd);
+                metrics_count(metrics, METRIC_COMMANDS, 1);
+            }
 
-                // Increment the velocity
-                vx += vx_increment;
-
-                // Log the new velocity
-                char to_write[4];
-                sprintf(to_write, "%d", vx);
+            if (changed)
+            {
+                // Log the new velocity once for all the commands
+                char to_write[16];
+                sprintf(to_write, "%.2f", motor.v);
                 if (error = write_log(to_write, 'i'))
                 {
                     // If error occurs while writing to the log file
@@ -363,70 +679,105 @@ int main(int argc, char const *argv[])
             break;
         }
 
-        // Update the position
-        float pos_increment = vx * 0.5;
-        float new_x_pos = x_pos + pos_increment;
+        // The emergency stop thread only wakes the loop, the stop is applied here after the commands
+        if (ready > 0 && FD_ISSET(estop_pipe[0], &readfds))
+        {
+            drain_estop_pipe();
+        }
+
+        // Apply the emergency stop before moving
+        if (check_estop())
+        {
+            // Log the stop with the time it took to be applied
+            char to_write[60];
+            sprintf(to_write, "STOP (shared memory), latency %lu us", (unsigned long)(estop_latency_ns(estop, ESTOP_MX) / 1000));
+            if (error = write_log(to_write, 's'))
+            {
+                // If error occurs while writing to the log file
+                break;
+            }
+        }
 
-        // Check if the position is out of bounds
-        if (new_x_pos < x_min)
+        // Commands arriving before the tick only change the velocity
+        if (!tick_due(&tick_timer))
         {
-            new_x_pos = x_min;
+            continue;
+        }
 
-            // Stop the motor
-            vx = 0;
+        // Measure how late the tick is and how many deadlines were missed
+        TICK tick = advance_tick_timer(&tick_timer);
+        metrics_observe(metrics, METRIC_TICK_JITTER, tick.lateness_ns / 1000);
+        if (tick.missed)
+        {
+            metrics_count(metrics, METRIC_DEADLINE_MISSES, tick.missed);
+            metrics_observe(metrics, METRIC_DEADLINE_MISS, tick.lateness_ns / 1000);
         }
-        else if (new_x_pos > x_max)
+
+        // Apply a new configuration, a single load when there is none
+        if (config_changed(config_shm, &config_seen, &config))
         {
-            new_x_pos = x_max;
+            float old_pos = motor.pos;
+            if (error = apply_config())
+            {
+                break;
+            }
 
-            // Stop the motor
-            vx = 0;
+            // Send the position if the motor was moved within the new limits
+            if (motor.pos != old_pos)
+            {
+                pos_changed = 1;
+                publish_pose(pose_shm, 'x', motor.pos);
+            }
         }
 
-        // Check if the position has changed
-        if (new_x_pos != x_pos)
+        // Update the position with the real time elapsed since the previous tick
+        // The motor stops at the limits and on the target
+        if (motor_step(&motor, tick.dt))
         {
-            // Update the position
-            x_pos = new_x_pos;
             pos_changed = 1;
+
+            // Publish the position for the control server
+            publish_pose(pose_shm, 'x', motor.pos);
         }
 
+        // Update the gauges
+        metrics_gauge(metrics, METRIC_VELOCITY, motor.v);
+        metrics_gauge(metrics, METRIC_POSITION_X, motor.pos);
+
+        // Snapshot the motor, it is only a copy in the mapped file
+        save_motor_checkpoint(checkpoint, CHECKPOINT_X, &motor, x_seq);
+
         // Write the position to the FIFO if it has changed
         if (pos_changed)
         {
-            // Write the position
-            char x_pos_str[10];
-            sprintf(x_pos_str, "%f", x_pos);
-
-            // If reset signal was received,
-            if (reset_flag)
-            {
-                vx = 0;
-                x_pos = 0.0;
-                // Skip writing to the FIFO
-                continue;
-            }
+            // Write the position record
+            char x_pos_str[POSE_RECORD_MAX];
+            int len = format_axis_record(x_pos_str, x_seq + 1, motor.pos);
 
             // If stop signal was received
             if (stop_flag)
             {
-                vx = 0;
+                motor.v = 0;
                 // Skip writing to the FIFO
                 continue;
             }
 
-            int m = write(fdx_pos, x_pos_str, strlen(x_pos_str) + 1);
-            if (m == -1 || m != strlen(x_pos_str) + 1)
+            int m = write(fdx_pos, x_pos_str, len);
+            if (m == -1 || m != len)
             {
                 // If error occurs while writing to the FIFO
                 error = 1;
                 break;
             }
+            x_seq++;
+            metrics_count(metrics, METRIC_SAMPLES, 1);
+            metrics_count(metrics, METRIC_BYTES_WRITTEN, len);
         }
     }
 
     // Close the FIFOs
     close(fd_vx);
+    close(fd_ctl);
     close(fdx_pos);
 
     if (error == 1)
@@ -435,7 +786,7 @@ int main(int argc, char const *argv[])
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close the log file
-        close(log_fd);
+        close_mmap_log(&log_file);
         if (ret)
         {
             // If error occurs while writing on log file
@@ -445,7 +796,7 @@ int main(int argc, char const *argv[])
     }
     
     // Close the log file
-    close(log_fd);
+    close_mmap_log(&log_file);
 
     if(error == 2){
         // If error occurs while writing on log file
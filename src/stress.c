@@ -0,0 +1,597 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "./../include/pose_stream.h"
+#include "./../include/velocity_command.h"
+#include "./../include/metrics.h"
+#include "./../include/hoist_config.h"
+#include "./../include/readiness.h"
+#include "./../include/tick_timer.h"
+
+// Stress test of the FIFO paths of the hoist.
+// Each stage runs its real program, started by this tool, which stands in for
+// its neighbours on the FIFOs:
+//   motor  the tool is the command console, it writes velocity commands on
+//          /tmp/vx_fifo and watches the commands counter of the metrics of mx
+//   world  the tool is the motor x, it writes positions on /tmp/x_pos_fifo and
+//          reads the real positions sent by world on /tmp/real_pos_fifo
+// The rate doubles at every step until a step violates the service levels (too
+// many records lost, or a 99th percentile latency too high), then the rate
+// between the last good step and the first bad one is bisected to find the knee
+// of the curve: the highest rate the stage sustains.
+//
+// Every step starts a fresh process, so the backlog of a saturated step never
+// slows down the next one. The writes never block: a write refused because the
+// FIFO is full is a record lost, like a producer would lose it if it did not
+// wait. The positions sent to world encode their index (world is configured
+// without sensor error), so every real position received tells which record it
+// comes from; the records merged by world are delivered, not lost.
+//
+// The tool uses the same FIFOs and shared memory as the hoist, which must not be
+// running. Usage: stress [stage [seconds [p99_ms [loss_percent]]]]
+//   stage         motor, world or all (default)
+//   seconds       duration of a step, 1 by default
+//   p99_ms        latency objective, 20 ms by default
+//   loss_percent  loss objective, 0.1 % by default
+
+// FIFOs of the processes
+#define VX_FIFO "/tmp/vx_fifo"
+#define X_POS_FIFO "/tmp/x_pos_fifo"
+#define Z_POS_FIFO "/tmp/z_pos_fifo"
+#define REAL_POS_FIFO "/tmp/real_pos_fifo"
+
+// Checkpoint of the processes started by the tool, not to touch the one of the hoist
+#define STRESS_CHECKPOINT "/tmp/hoist_stress.ckpt"
+
+// Rates of the ramp, in records per second
+#define START_RATE 100
+#define MAX_RATE 1600000
+
+// Bisections between the last good and the first bad step
+#define KNEE_BISECTIONS 3
+
+// Time given to a process to start and to a stage to drain its queue after a step
+#define STARTUP_TIMEOUT_MS 5000
+#define DRAIN_TIMEOUT_MS 1000
+
+// Period of the generator, the records due are written in a burst every period
+// It is also the resolution of the latency of the motor, read from a counter
+#define GENERATOR_PERIOD_US 200
+
+// A step offering less than this fraction of its rate is limited by the generator
+#define GENERATOR_MIN_FRACTION 0.95
+
+// Distinct positions encoding the index of a record: x goes up to 40000 with the
+// 0.01 resolution of the sensor, exactly representable as a float
+#define POSITION_WINDOW 4000000
+
+// Result of a step
+typedef struct {
+    double rate;
+    double offered;
+    double delivered;
+    unsigned long accepted;
+    unsigned long dropped;
+    unsigned long undelivered;
+    double loss;
+    double p50_ms;
+    double p99_ms;
+    double max_ms;
+    // NULL if the step is within the objectives, otherwise the objective violated
+    const char *violation;
+} STEP_RESULT;
+
+// Stage under test
+typedef struct {
+    const char *name;
+    const char *program;
+    const char *unit;
+    // Open the channels the program needs before it starts, and the ones needing it after
+    int (*open_before)();
+    int (*open_after)();
+    // Write the record of index i, returns 0 if written, 1 if the FIFO is full, -1 on error
+    int (*send)(unsigned long i);
+    // Collect the records delivered up to now
+    int (*collect)(uint64_t now);
+    void (*close_channels)();
+} STAGE;
+
+// Service level objectives
+double slo_p99_ms = 20.0;
+double slo_loss = 0.001;
+
+// Send time of each accepted record and latency of each delivery of the current step
+uint64_t *send_ns;
+uint64_t *latency_ns;
+unsigned long accepted, dropped, deliveries, capacity;
+
+// Records delivered: applied by the motor, or the newest record seen by world
+unsigned long delivered;
+
+// Descriptors of the current step
+int fd_in = -1, fd_out = -1, fd_ready = -1;
+pid_t stage_pid;
+
+// Metrics of mx, where the commands applied are counted
+METRICS_SHM *metrics_shm;
+
+// Reassembly buffer of the records read from the stage
+POSE_READER reader;
+POSE_STATS reader_stats;
+
+// Function to record the latency of a delivered record
+void record_latency(uint64_t now, unsigned long index)
+{
+    if (deliveries < capacity)
+    {
+        latency_ns[deliveries++] = now - send_ns[index];
+    }
+}
+
+// Function to read and drop what a stage writes, without blocking
+int drain_fd(int fd)
+{
+    char buffer[4096];
+    int n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+    }
+    return (n == -1 && errno != EAGAIN) ? -1 : 0;
+}
+
+// Motor stage: the tool reads the positions sent by mx so that it never blocks
+int motor_open_before()
+{
+    return fd_out = open(X_POS_FIFO, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+int motor_open_after()
+{
+    return fd_in = open(VX_FIFO, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+// Alternate steps up and down so the velocity stays bounded
+int motor_send(unsigned long i)
+{
+    char record[VELOCITY_BATCH_MAX];
+    VELOCITY_BATCH batch = {0, 0, 0};
+    batch_velocity_delta(&batch, (i % 2) ? -1 : 1);
+    int len = format_velocity_batch(record, &batch);
+
+    int m = write(fd_in, record, len);
+    if (m == -1)
+    {
+        return (errno == EAGAIN) ? 1 : -1;
+    }
+    return 0;
+}
+
+// The commands are applied in order, the counter of mx tells how many
+int motor_collect(uint64_t now)
+{
+    unsigned long applied = __atomic_load_n(&metrics_shm->slots[METRICS_MX].counters[METRIC_COMMANDS], __ATOMIC_RELAXED);
+    while (delivered < applied && delivered < accepted)
+    {
+        record_latency(now, delivered);
+        delivered++;
+    }
+
+    return drain_fd(fd_out);
+}
+
+void stage_close()
+{
+    if (fd_in != -1)
+    {
+        close(fd_in);
+    }
+    if (fd_out != -1)
+    {
+        close(fd_out);
+    }
+    fd_in = fd_out = -1;
+}
+
+// World stage: the tool reads the real positions, world blocks on this FIFO until it is open
+int world_open_before()
+{
+    return fd_out = open(REAL_POS_FIFO, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+int world_open_after()
+{
+    return fd_in = open(X_POS_FIFO, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+// The position is the index of the record, in hundredths
+int world_send(unsigned long i)
+{
+    char record[POSE_RECORD_MAX];
+    int len = format_axis_record(record, i + 1, ((i % POSITION_WINDOW) + 0.5) / 100.0);
+
+    int m = write(fd_in, record, len);
+    if (m == -1)
+    {
+        return (errno == EAGAIN) ? 1 : -1;
+    }
+    return 0;
+}
+
+// Every real position tells the newest record merged by world
+int world_collect(uint64_t now)
+{
+    // Read until the FIFO is empty, world may have sent more than a buffer
+    int n;
+    while ((n = fill_pose_reader(fd_out, &reader, &reader_stats)) > 0)
+    {
+        char *record;
+        while (next_pose_record(&reader, &record))
+        {
+            uint32_t seq;
+            float x, z;
+            if (parse_pose_record(record, &seq, &x, &z) || accepted == 0)
+            {
+                continue;
+            }
+
+            // The most recent record sent with this position
+            long k = (long)(x * 100 + 0.5);
+            long last = accepted - 1;
+            long index = last - ((last - k) % POSITION_WINDOW + POSITION_WINDOW) % POSITION_WINDOW;
+            if (index < 0)
+            {
+                continue;
+            }
+
+            record_latency(now, index);
+            if ((unsigned long)index + 1 > delivered)
+            {
+                delivered = index + 1;
+            }
+        }
+    }
+
+    return (n == -1 && errno != EAGAIN) ? -1 : 0;
+}
+
+STAGE stages[] = {
+    {"motor", "./bin/mx", "commands/s", motor_open_before, motor_open_after, motor_send, motor_collect, stage_close},
+    {"world", "./bin/world", "positions/s", world_open_before, world_open_after, world_send, world_collect, stage_close},
+};
+
+#define N_STAGES (int)(sizeof(stages) / sizeof(stages[0]))
+
+// Function to start the program of a stage and wait for its readiness record
+// Returns 0 when it is ready, -1 on error or timeout
+int start_stage(STAGE *stage)
+{
+    stage_pid = fork();
+    if (stage_pid == -1)
+    {
+        return -1;
+    }
+    if (stage_pid == 0)
+    {
+        execl(stage->program, stage->program, (char *)NULL);
+        perror(stage->program);
+        _exit(1);
+    }
+
+    uint64_t deadline = monotonic_ns() + STARTUP_TIMEOUT_MS * 1000000ULL;
+    POSE_READER ready_reader;
+    POSE_STATS ready_stats;
+    memset(&ready_reader, 0, sizeof(ready_reader));
+
+    while (monotonic_ns() < deadline)
+    {
+        if (waitpid(stage_pid, NULL, WNOHANG) == stage_pid)
+        {
+            stage_pid = 0;
+            return -1;
+        }
+
+        struct pollfd pfd = {fd_ready, POLLIN, 0};
+        if (poll(&pfd, 1, 10) <= 0)
+        {
+            continue;
+        }
+        if (fill_pose_reader(fd_ready, &ready_reader, &ready_stats) == -1 && errno != EAGAIN)
+        {
+            return -1;
+        }
+
+        char *record;
+        while (next_pose_record(&ready_reader, &record))
+        {
+            int pid;
+            char name[32];
+            if (sscanf(record, "%31s %d", name, &pid) == 2 && pid == stage_pid)
+            {
+                return 0;
+            }
+        }
+    }
+
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+// Function to stop the program of a stage
+void stop_stage()
+{
+    if (stage_pid > 0)
+    {
+        kill(stage_pid, SIGTERM);
+        waitpid(stage_pid, NULL, 0);
+    }
+    stage_pid = 0;
+}
+
+// Function to compare two latencies for qsort()
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to run a step of a stage at the given rate
+// Returns 0 with the result, -1 if the stage could not run
+int run_step(STAGE *stage, double rate, double seconds, STEP_RESULT *result)
+{
+    memset(result, 0, sizeof(STEP_RESULT));
+    result->rate = rate;
+
+    accepted = dropped = deliveries = delivered = 0;
+    capacity = rate * seconds * 1.1 + 1024;
+    send_ns = malloc(capacity * sizeof(uint64_t));
+    latency_ns = malloc(capacity * sizeof(uint64_t));
+    memset(&reader, 0, sizeof(reader));
+    memset(&reader_stats, 0, sizeof(reader_stats));
+
+    int ret = -1;
+    if (send_ns == NULL || latency_ns == NULL || stage->open_before() == -1 || start_stage(stage) == -1 || stage->open_after() == -1)
+    {
+        goto end;
+    }
+
+    // Write the records due every period and collect the ones delivered
+    struct timespec period = {0, GENERATOR_PERIOD_US * 1000};
+    uint64_t start = monotonic_ns(), now = start;
+    uint64_t end_ns = start + seconds * 1e9;
+    while (now < end_ns)
+    {
+        unsigned long due = (now - start) * rate / 1e9;
+        while (accepted + dropped < due && accepted < capacity)
+        {
+            send_ns[accepted] = monotonic_ns();
+            int sent = stage->send(accepted);
+            if (sent == -1)
+            {
+                goto end;
+            }
+            sent ? dropped++ : accepted++;
+        }
+
+        if (stage->collect(monotonic_ns()) == -1)
+        {
+            goto end;
+        }
+
+        struct pollfd pfd = {fd_out, POLLIN, 0};
+        ppoll(&pfd, 1, &period, NULL);
+        now = monotonic_ns();
+    }
+    double elapsed = (now - start) / 1e9;
+
+    // Let the stage drain its queue, what is still queued after the timeout is lost
+    uint64_t drain_end = monotonic_ns() + DRAIN_TIMEOUT_MS * 1000000ULL;
+    while (delivered < accepted && monotonic_ns() < drain_end)
+    {
+        struct pollfd pfd = {fd_out, POLLIN, 0};
+        ppoll(&pfd, 1, &period, NULL);
+        if (stage->collect(monotonic_ns()) == -1)
+        {
+            goto end;
+        }
+    }
+
+    result->accepted = accepted;
+    result->dropped = dropped;
+    result->undelivered = accepted - delivered;
+    result->offered = (accepted + dropped) / elapsed;
+    result->delivered = delivered / elapsed;
+    result->loss = (accepted + dropped) ? (double)(dropped + result->undelivered) / (accepted + dropped) : 0;
+
+    if (deliveries > 0)
+    {
+        qsort(latency_ns, deliveries, sizeof(uint64_t), compare_u64);
+        result->p50_ms = latency_ns[deliveries / 2] / 1e6;
+        result->p99_ms = latency_ns[(unsigned long)(deliveries * 0.99)] / 1e6;
+        result->max_ms = latency_ns[deliveries - 1] / 1e6;
+    }
+
+    if (result->loss > slo_loss)
+    {
+        result->violation = "loss";
+    }
+    else if (result->p99_ms > slo_p99_ms || deliveries == 0)
+    {
+        result->violation = "p99 latency";
+    }
+    else if (result->offered < rate * GENERATOR_MIN_FRACTION)
+    {
+        result->violation = "generator";
+    }
+    ret = 0;
+
+end:
+    if (ret == -1)
+    {
+        perror(stage->name);
+    }
+    stop_stage();
+    stage->close_channels();
+    free(send_ns);
+    free(latency_ns);
+    return ret;
+}
+
+// Function to print the result of a step
+void print_step(STAGE *stage, STEP_RESULT *r)
+{
+    printf("%-6s %10.0f %10.0f %11.0f %8.3f %9.3f %9.3f %9.3f  %s\n", stage->name, r->rate, r->offered, r->delivered, r->loss * 100, r->p50_ms, r->p99_ms,
+           r->max_ms, r->violation ? r->violation : "ok");
+    fflush(stdout);
+}
+
+// Function to ramp the rate of a stage up to its knee
+// Returns 0 on success, -1 if the stage could not run
+int ramp_stage(STAGE *stage, double seconds)
+{
+    STEP_RESULT good = {0}, bad = {0}, step;
+    int have_good = 0, have_bad = 0;
+
+    for (double rate = START_RATE; rate <= MAX_RATE; rate *= 2)
+    {
+        if (run_step(stage, rate, seconds, &step) == -1)
+        {
+            return -1;
+        }
+        print_step(stage, &step);
+
+        if (step.violation)
+        {
+            bad = step;
+            have_bad = 1;
+            break;
+        }
+        good = step;
+        have_good = 1;
+    }
+
+    // Bisect between the last good step and the first bad one
+    for (int i = 0; i < KNEE_BISECTIONS && have_good && have_bad && strcmp(bad.violation, "generator") != 0; i++)
+    {
+        if (run_step(stage, (good.rate + bad.rate) / 2, seconds, &step) == -1)
+        {
+            return -1;
+        }
+        print_step(stage, &step);
+        if (step.violation)
+        {
+            bad = step;
+        }
+        else
+        {
+            good = step;
+        }
+    }
+
+    if (!have_good)
+    {
+        printf("%s: no knee, already over the objectives at %d %s (%s)\n\n", stage->name, START_RATE, stage->unit, bad.violation);
+    }
+    else if (!have_bad)
+    {
+        printf("%s: knee above %.0f %s, the highest rate tried\n\n", stage->name, good.rate, stage->unit);
+    }
+    else if (strcmp(bad.violation, "generator") == 0)
+    {
+        printf("%s: knee above %.0f %s, the tool cannot offer %.0f\n\n", stage->name, good.rate, stage->unit, bad.rate);
+    }
+    else
+    {
+        printf("%s: knee at %.0f %s (p99 %.3f ms, loss %.3f %%), at %.0f: %s over the objective (p99 %.3f ms, loss %.3f %%)\n\n", stage->name, good.rate,
+               stage->unit, good.p99_ms, good.loss * 100, bad.rate, bad.violation, bad.p99_ms, bad.loss * 100);
+    }
+
+    return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+    const char *only = (argc > 1) ? argv[1] : "all";
+    double seconds = (argc > 2 && atof(argv[2]) > 0) ? atof(argv[2]) : 1.0;
+    if (argc > 3 && atof(argv[3]) > 0)
+    {
+        slo_p99_ms = atof(argv[3]);
+    }
+    if (argc > 4 && atof(argv[4]) >= 0)
+    {
+        slo_loss = atof(argv[4]) / 100;
+    }
+
+    // The hoist must not be running, its master would be listening on the readiness FIFO
+    int probe = open(READY_FIFO, O_WRONLY | O_NONBLOCK);
+    if (probe != -1)
+    {
+        close(probe);
+        fprintf(stderr, "The hoist is running, stop it before the stress test\n");
+        exit(1);
+    }
+
+    // A stage that exits must not kill the tool while it writes
+    signal(SIGPIPE, SIG_IGN);
+
+    // Create the FIFOs and listen for the readiness records
+    mkfifo(VX_FIFO, 0666);
+    mkfifo(X_POS_FIFO, 0666);
+    mkfifo(Z_POS_FIFO, 0666);
+    mkfifo(REAL_POS_FIFO, 0666);
+    mkfifo(READY_FIFO, 0666);
+    if ((fd_ready = open(READY_FIFO, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) == -1 || (metrics_shm = open_metrics_shm()) == NULL)
+    {
+        perror("Error opening the readiness FIFO or the metrics");
+        exit(1);
+    }
+
+    // Configuration of the processes: no sensor error and x wide enough to encode the index of the records
+    CONFIG_SHM *config_shm = open_config_shm(1);
+    if (config_shm == NULL)
+    {
+        perror("Error creating the configuration");
+        exit(1);
+    }
+    HOIST_CONFIG config;
+    default_config(&config);
+    config.x_max = POSITION_WINDOW / 100;
+    config.sensor_error = 0;
+    publish_config(config_shm, &config);
+
+    setenv("HOIST_CHECKPOINT", STRESS_CHECKPOINT, 1);
+
+    printf("objectives: p99 latency <= %.3f ms, loss <= %.3f %%, steps of %.1f s\n\n", slo_p99_ms, slo_loss * 100, seconds);
+    printf("%-6s %10s %10s %11s %8s %9s %9s %9s  %s\n", "stage", "rate", "offered/s", "delivered/s", "loss %", "p50 ms", "p99 ms", "max ms", "verdict");
+
+    int ret = 0, found = 0;
+    for (int i = 0; i < N_STAGES && ret == 0; i++)
+    {
+        if (strcmp(only, "all") == 0 || strcmp(only, stages[i].name) == 0)
+        {
+            found = 1;
+            ret = ramp_stage(&stages[i], seconds);
+        }
+    }
+    if (!found)
+    {
+        fprintf(stderr, "usage: %s [motor|world|all [seconds [p99_ms [loss_percent]]]]\n", argv[0]);
+        ret = -1;
+    }
+
+    // Leave nothing of the test behind
+    close(fd_ready);
+    unlink(READY_FIFO);
+    unlink(STRESS_CHECKPOINT);
+    shm_unlink(CONFIG_SHM_NAME);
+
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,778 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <strings.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "./../include/coroutine_scheduler.h"
+#include "./../include/pose_bus.h"
+#include "./../include/websocket.h"
+#include "./../include/metrics.h"
+#include "./../include/mmap_log.h"
+#include "./../include/hoist_config.h"
+
+// Web view of the hoist: an HTTP server on the loopback interface serving a
+// page that plots the position, and a WebSocket stream of the positions read
+// from the pose bus. The samples of a period are encoded once in a binary
+// frame and the same frame is sent to all the viewers, so the world process
+// does not do any work for them.
+//
+//   web_viewer [port [frames per second]]
+//
+// Frame, little endian: u32 sequence number of the first sample, u16 number
+// of samples, u16 samples lost before this frame, then the samples as i16 x
+// and z differences in thousandths from the previous sample, or, for the
+// first sample of a key frame and for differences that do not fit, i16
+// -32768 followed by i32 x and z in thousandths.
+
+// Default port and frame rate
+#define DEFAULT_PORT 8080
+#define DEFAULT_RATE 20
+#define MAX_RATE 1000
+
+// Maximum number of viewers, including the browsers still loading the page
+#define MAX_VIEWERS 256
+
+// Maximum number of samples in a frame, older samples are skipped
+#define FRAME_MAX_SAMPLES 1024
+
+// Size of the frames
+#define FRAME_HEADER 8
+#define FRAME_MAX (WS_HEADER_MAX + FRAME_HEADER + FRAME_MAX_SAMPLES * 10)
+
+// Escape of an absolute sample
+#define FRAME_ABSOLUTE -32768
+
+// Period of the report written on the log file
+#define REPORT_PERIOD_NS 10000000000ULL
+
+// State of a connection
+#define VIEWER_FREE 0
+#define VIEWER_HTTP 1
+#define VIEWER_STREAM 2
+
+typedef struct {
+    int fd;
+    int state;
+    CO_TASK task;
+    int spawned;
+    // Request or client frames received and not handled yet
+    uint8_t input[2048];
+    size_t input_len;
+    // Part of the last frame the socket did not accept
+    uint8_t pending[FRAME_MAX];
+    size_t pending_len;
+    // The next frame must not depend on the previous ones
+    int need_key;
+} VIEWER;
+
+// Page of the viewer, a format with the limits of the axes from the shared configuration
+char *page_format =
+    "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Hoist</title>\n"
+    "<style>body{font-family:sans-serif;background:#111;color:#ddd}canvas{background:#000;display:block;margin:8px 0}</style></head>\n"
+    "<body><div id=\"status\">connecting</div><canvas id=\"yard\" width=\"800\" height=\"200\"></canvas>\n"
+    "<canvas id=\"plot\" width=\"800\" height=\"240\"></canvas>\n<script>\n"
+    "const X0=%g,W=%g,Z0=%g,H=%g,KEEP=2000,yard=document.getElementById('yard').getContext('2d'),plot=document.getElementById('plot').getContext('2d');\n"
+    "let x=0,z=0,next=0,lost=0,frames=0,samples=[];\n"
+    "function draw(){yard.clearRect(0,0,800,200);yard.strokeStyle='#888';yard.strokeRect(0,0,800,200);\n"
+    " const px=(x-X0)/W*800,pz=(z-Z0)/H*200;yard.strokeStyle='#4c4';yard.beginPath();yard.moveTo(px,0);yard.lineTo(px,pz);yard.stroke();\n"
+    " yard.fillStyle='#4c4';yard.fillRect(px-6,pz-6,12,12);\n"
+    " plot.clearRect(0,0,800,240);[['#e84',0,X0,W],['#48e',1,Z0,H]].forEach(([c,i,o,m])=>{plot.strokeStyle=c;plot.beginPath();\n"
+    "  samples.forEach((s,k)=>{const px=k/KEEP*800,py=120*i+118-(s[i]-o)/m*116;k?plot.lineTo(px,py):plot.moveTo(px,py);});plot.stroke();});\n"
+    " document.getElementById('status').textContent=`x ${x.toFixed(3)}  z ${z.toFixed(3)}  frames ${frames}  lost ${lost}`;}\n"
+    "function connect(){const ws=new WebSocket(`ws://${location.host}/ws`);ws.binaryType='arraybuffer';\n"
+    " ws.onmessage=e=>{const v=new DataView(e.data),seq=v.getUint32(0,true),n=v.getUint16(4,true);let o=8;\n"
+    "  lost+=v.getUint16(6,true);frames++;\n"
+    "  for(let i=0;i<n;i++){const dx=v.getInt16(o,true);\n"
+    "   if(dx==-32768){x=v.getInt32(o+2,true)/1000;z=v.getInt32(o+6,true)/1000;o+=10;}\n"
+    "   else{x+=dx/1000;z+=v.getInt16(o+2,true)/1000;o+=4;}samples.push([x,z]);}\n"
+    "  if(samples.length>KEEP)samples.splice(0,samples.length-KEEP);requestAnimationFrame(draw);};\n"
+    " ws.onclose=()=>{document.getElementById('status').textContent='disconnected';setTimeout(connect,1000);};}\n"
+    "connect();\n</script></body></html>\n";
+
+// Memory mapped log file
+MMAP_LOG log_file;
+
+// Buffer to store the log message
+char log_buffer[200];
+
+// Variable to store the errors
+// 0 = no error
+// 1 = system call error
+// 2 = error while writing on log file
+int error = 0;
+
+// Listening socket and viewers
+int listen_fd;
+VIEWER viewers[MAX_VIEWERS];
+int n_streams = 0;
+
+// Scheduler running all the tasks
+CO_SCHEDULER scheduler;
+
+// Pose bus and position of the reader
+POSE_BUS *bus;
+uint64_t cursor;
+
+// Last sample sent, in thousandths, for the differences of the next frame
+int32_t last_x, last_z;
+int have_last = 0;
+
+// Period of the frames in nanoseconds
+uint64_t frame_period_ns;
+
+// Shared configuration, NULL until the master publishes it
+CONFIG_SHM *config_shm;
+
+// Counters written in the report
+unsigned long frames_sent = 0, frames_skipped = 0;
+uint64_t samples_lost = 0;
+
+// Metrics of this process
+METRICS_SLOT *metrics;
+
+// Function to write on log
+int write_log(char *to_write, char type)
+{
+    time_t t = time(NULL);
+    struct tm tm = *localtime(&t);
+
+    // If type is 'e' then it is an error
+    if (type == 'e')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <web_process> error: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'c' then a viewer connected or disconnected
+    else if (type == 'c')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <web_process> viewer %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'r' then it is the periodic report
+    else if (type == 'r')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <web_process> report: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 's' then it is a signal
+    else if (type == 's')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <web_process> signal received: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+
+    // Copy the message in the mapped segment
+    if (mmap_log_write(&log_file, log_buffer, strlen(log_buffer)) == -1)
+    {
+        return 2;
+    }
+
+    return 0;
+}
+
+// Function to write little endian integers
+void put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+void put_u32(uint8_t *out, uint32_t value)
+{
+    put_u16(out, value);
+    put_u16(out + 2, value >> 16);
+}
+
+// Function to encode samples in a WebSocket message, starting from the sample (*x, *z),
+// or from nothing if key is set. The last sample encoded is stored in (*x, *z)
+// Returns the length of the message
+int encode_pose_frame(uint8_t *out, POSE_SAMPLE *samples, int n, int32_t *x, int32_t *z, int key, uint64_t lost)
+{
+    uint8_t payload[FRAME_HEADER + FRAME_MAX_SAMPLES * 10];
+    int len = FRAME_HEADER;
+
+    put_u32(payload, n > 0 ? (uint32_t)samples[0].seq : 0);
+    put_u16(payload + 4, n);
+    put_u16(payload + 6, lost > 0xFFFF ? 0xFFFF : lost);
+
+    for (int i = 0; i < n; i++)
+    {
+        int32_t qx = (int32_t)lroundf(samples[i].x * 1000);
+        int32_t qz = (int32_t)lroundf(samples[i].z * 1000);
+        int32_t dx = qx - *x, dz = qz - *z;
+
+        if ((key && i == 0) || dx <= FRAME_ABSOLUTE || dx > 32767 || dz <= FRAME_ABSOLUTE || dz > 32767)
+        {
+            put_u16(payload + len, (uint16_t)FRAME_ABSOLUTE);
+            put_u32(payload + len + 2, qx);
+            put_u32(payload + len + 6, qz);
+            len += 10;
+        }
+        else
+        {
+            put_u16(payload + len, dx);
+            put_u16(payload + len + 2, dz);
+            len += 4;
+        }
+        *x = qx;
+        *z = qz;
+    }
+
+    int header = ws_frame_header(out, WS_OP_BINARY, len);
+    memcpy(out + header, payload, len);
+
+    return header + len;
+}
+
+// Function to send as much as possible of a message without blocking
+// Returns the number of bytes sent, -1 if the connection is broken
+ssize_t send_some(int fd, uint8_t *data, size_t len)
+{
+    ssize_t m = send(fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (m == -1)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    return m;
+}
+
+// Function to send a frame to a viewer, keeping what the socket did not accept.
+// A broken connection is shut down, its task sees the end of the stream and closes it
+// Returns 1 if the frame was sent or queued, 0 if the viewer is too slow and the frame was skipped
+int send_frame(VIEWER *viewer, uint8_t *frame, size_t len)
+{
+    // Finish the previous frame first
+    if (viewer->pending_len > 0)
+    {
+        ssize_t m = send_some(viewer->fd, viewer->pending, viewer->pending_len);
+        if (m == -1)
+        {
+            shutdown(viewer->fd, SHUT_RDWR);
+            return 0;
+        }
+        memmove(viewer->pending, viewer->pending + m, viewer->pending_len - m);
+        viewer->pending_len -= m;
+
+        if (viewer->pending_len > 0)
+        {
+            // The frame is dropped, the next one must not depend on it
+            viewer->need_key = 1;
+            return 0;
+        }
+    }
+
+    ssize_t m = send_some(viewer->fd, frame, len);
+    if (m == -1)
+    {
+        shutdown(viewer->fd, SHUT_RDWR);
+        return 0;
+    }
+    memcpy(viewer->pending, frame + m, len - m);
+    viewer->pending_len = len - m;
+    metrics_count(metrics, METRIC_BYTES_WRITTEN, len);
+
+    return 1;
+}
+
+// Function to send a whole reply, the socket not accepting it at once is an error
+// Returns 0 on success, -1 on error
+int send_all(int fd, char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t m = send(fd, data, len, MSG_NOSIGNAL);
+        if (m == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += m;
+        len -= m;
+    }
+    return 0;
+}
+
+// Function to write the page with the limits of the current configuration, the defaults without the master
+// Returns its length
+int format_page(char *out, size_t size)
+{
+    if (config_shm == NULL)
+    {
+        config_shm = open_config_shm(0);
+    }
+
+    HOIST_CONFIG config;
+    read_config(config_shm, &config);
+
+    return snprintf(out, size, page_format, config.x_min, config.x_max - config.x_min, config.z_min, config.z_max - config.z_min);
+}
+
+// Function to answer an HTTP request
+// Returns 1 if the connection becomes a stream, 0 if it must be closed
+int handle_request(VIEWER *viewer)
+{
+    char *request = (char *)viewer->input;
+    char response[512];
+
+    if (strncmp(request, "GET /ws ", 8) == 0)
+    {
+        // Value of the key header, up to the end of the line
+        char *key = strcasestr(request, "\r\nSec-WebSocket-Key:");
+        if (key != NULL)
+        {
+            key += strlen("\r\nSec-WebSocket-Key:");
+            while (*key == ' ')
+            {
+                key++;
+            }
+            size_t key_len = strcspn(key, " \r\n");
+
+            char accept[WS_ACCEPT_LEN + 1];
+            ws_accept_key(key, key_len, accept);
+            int len = sprintf(response, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+            if (send_all(viewer->fd, response, len) == -1)
+            {
+                return 0;
+            }
+
+            // Disable Nagle, so each frame leaves at once instead of waiting for the previous one to be acknowledged
+            int one = 1;
+            setsockopt(viewer->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return 1;
+        }
+    }
+
+    if (strncmp(request, "GET / ", 6) == 0 || strncmp(request, "GET /index.html ", 16) == 0)
+    {
+        // The page is drawn with the limits of the configuration, a new version is shown when the page is loaded again
+        char page[4096];
+        int page_len = format_page(page, sizeof(page));
+        int len = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", page_len);
+        if (send_all(viewer->fd, response, len) == 0)
+        {
+            send_all(viewer->fd, page, page_len);
+        }
+        return 0;
+    }
+
+    int len = sprintf(response, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    send_all(viewer->fd, response, len);
+    return 0;
+}
+
+// Function to handle the frames sent by a browser: answers the pings and the close
+// Returns 1 if the connection stays open, 0 if it must be closed
+int handle_client_frames(VIEWER *viewer)
+{
+    size_t offset = 0;
+
+    while (offset < viewer->input_len)
+    {
+        int opcode;
+        uint8_t *payload;
+        uint64_t payload_len;
+        long len = ws_parse_frame(viewer->input + offset, viewer->input_len - offset, &opcode, &payload, &payload_len);
+
+        if (len == -1)
+        {
+            return 0;
+        }
+        if (len == 0)
+        {
+            break;
+        }
+        offset += len;
+
+        if (opcode == WS_OP_CLOSE)
+        {
+            uint8_t close_frame[2];
+            ws_frame_header(close_frame, WS_OP_CLOSE, 0);
+            send_some(viewer->fd, close_frame, 2);
+            return 0;
+        }
+        if (opcode == WS_OP_PING && payload_len < 126)
+        {
+            uint8_t pong[2 + 125];
+            int header = ws_frame_header(pong, WS_OP_PONG, payload_len);
+            memcpy(pong + header, payload, payload_len);
+            send_some(viewer->fd, pong, header + payload_len);
+        }
+    }
+
+    // Keep the incomplete frame, a frame bigger than the buffer is not accepted
+    memmove(viewer->input, viewer->input + offset, viewer->input_len - offset);
+    viewer->input_len -= offset;
+
+    return viewer->input_len < sizeof(viewer->input);
+}
+
+// Task serving a connection, first the HTTP request, then the WebSocket stream
+int viewer_task(CO_TASK *task)
+{
+    VIEWER *viewer = task->data;
+
+    CO_BEGIN(task);
+
+    while (1)
+    {
+        CO_AWAIT_READABLE(task, viewer->fd);
+        metrics_count(metrics, METRIC_WAKEUPS, 1);
+
+        size_t room = sizeof(viewer->input) - viewer->input_len - 1;
+        ssize_t n = read(viewer->fd, viewer->input + viewer->input_len, room);
+        if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        viewer->input_len += n;
+
+        if (viewer->state == VIEWER_HTTP)
+        {
+            viewer->input[viewer->input_len] = '\0';
+
+            // Wait for the end of the headers
+            if (strstr((char *)viewer->input, "\r\n\r\n") == NULL)
+            {
+                if (viewer->input_len == sizeof(viewer->input) - 1)
+                {
+                    break;
+                }
+                continue;
+            }
+
+            if (!handle_request(viewer))
+            {
+                break;
+            }
+
+            viewer->state = VIEWER_STREAM;
+            viewer->input_len = 0;
+            viewer->pending_len = 0;
+            viewer->need_key = 1;
+            n_streams++;
+            metrics_gauge(metrics, METRIC_QUEUE_DEPTH, n_streams);
+
+            char to_write[60];
+            sprintf(to_write, "connected, %d streams", n_streams);
+            if (error = write_log(to_write, 'c'))
+            {
+                return CO_ERROR;
+            }
+        }
+        else if (!handle_client_frames(viewer))
+        {
+            break;
+        }
+    }
+
+    // Close the connection and free the slot
+    close(viewer->fd);
+    viewer->fd = -1;
+    if (viewer->state == VIEWER_STREAM)
+    {
+        n_streams--;
+        metrics_gauge(metrics, METRIC_QUEUE_DEPTH, n_streams);
+
+        char to_write[60];
+        sprintf(to_write, "disconnected, %d streams", n_streams);
+        if (error = write_log(to_write, 'c'))
+        {
+            return CO_ERROR;
+        }
+    }
+    viewer->state = VIEWER_FREE;
+
+    CO_END(task);
+}
+
+// Task accepting the connections
+int accept_task(CO_TASK *task)
+{
+    CO_BEGIN(task);
+
+    while (1)
+    {
+        CO_AWAIT_READABLE(task, listen_fd);
+
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            // The client may have gone already, or there are no descriptors left for now
+            if (errno == EAGAIN || errno == ECONNABORTED || errno == EINTR || errno == EMFILE || errno == ENFILE)
+            {
+                continue;
+            }
+            error = 1;
+            return CO_ERROR;
+        }
+
+        // Free slot whose task is done or was never started
+        VIEWER *viewer = NULL;
+        for (int i = 0; i < MAX_VIEWERS && viewer == NULL; i++)
+        {
+            if (viewers[i].state == VIEWER_FREE && (!viewers[i].spawned || viewers[i].task.done))
+            {
+                viewer = &viewers[i];
+            }
+        }
+        if (viewer == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        viewer->fd = fd;
+        viewer->state = VIEWER_HTTP;
+        viewer->input_len = 0;
+        int ret = viewer->spawned ? restart_task(&viewer->task, viewer_task, viewer) : spawn_task(&scheduler, &viewer->task, viewer_task, viewer);
+        if (ret == -1)
+        {
+            error = 1;
+            return CO_ERROR;
+        }
+        viewer->spawned = 1;
+    }
+
+    CO_END(task);
+}
+
+// Task reading the pose bus and sending a frame to the viewers every period
+int frame_task(CO_TASK *task)
+{
+    static POSE_SAMPLE samples[FRAME_MAX_SAMPLES];
+    static uint8_t delta_frame[FRAME_MAX], key_frame[FRAME_MAX];
+
+    CO_BEGIN(task);
+
+    // Start from the last published sample
+    cursor = pose_bus_head(bus);
+    if (cursor > 0)
+    {
+        cursor--;
+    }
+
+    while (1)
+    {
+        CO_AWAIT_TICK(task, frame_period_ns);
+        if (task->expirations > 1)
+        {
+            metrics_count(metrics, METRIC_DEADLINE_MISSES, task->expirations - 1);
+        }
+
+        // Skip the samples that do not fit in a frame
+        uint64_t lost = 0;
+        uint64_t head = pose_bus_head(bus);
+        if (head > cursor + FRAME_MAX_SAMPLES)
+        {
+            lost = head - FRAME_MAX_SAMPLES - cursor;
+            cursor = head - FRAME_MAX_SAMPLES;
+        }
+        int n = read_pose_samples(bus, &cursor, samples, FRAME_MAX_SAMPLES, &lost);
+        samples_lost += lost;
+        metrics_count(metrics, METRIC_SAMPLES, n);
+
+        // The frames are encoded once for all the viewers, the key frame only if someone needs it
+        int32_t key_x = last_x, key_z = last_z;
+        int delta_len = 0, key_len = 0;
+        if (n > 0)
+        {
+            delta_len = encode_pose_frame(delta_frame, samples, n, &last_x, &last_z, !have_last, lost);
+            have_last = 1;
+        }
+
+        for (int i = 0; i < MAX_VIEWERS; i++)
+        {
+            VIEWER *viewer = &viewers[i];
+            if (viewer->state != VIEWER_STREAM || viewer->fd == -1)
+            {
+                continue;
+            }
+
+            if (viewer->need_key && have_last)
+            {
+                if (key_len == 0)
+                {
+                    // A viewer joining while the hoist does not move gets the last position
+                    POSE_SAMPLE last = {.seq = cursor, .x = key_x / 1000.0, .z = key_z / 1000.0};
+                    key_len = (n > 0) ? encode_pose_frame(key_frame, samples, n, &key_x, &key_z, 1, lost) : encode_pose_frame(key_frame, &last, 1, &key_x, &key_z, 1, 0);
+                }
+                if (send_frame(viewer, key_frame, key_len))
+                {
+                    viewer->need_key = 0;
+                    frames_sent++;
+                }
+                else
+                {
+                    frames_skipped++;
+                }
+            }
+            else if (delta_len > 0)
+            {
+                if (send_frame(viewer, delta_frame, delta_len))
+                {
+                    frames_sent++;
+                }
+                else
+                {
+                    frames_skipped++;
+                }
+            }
+        }
+    }
+
+    CO_END(task);
+}
+
+// Task writing the counters on the log file
+int report_task(CO_TASK *task)
+{
+    CO_BEGIN(task);
+
+    while (1)
+    {
+        CO_AWAIT_TICK(task, REPORT_PERIOD_NS);
+
+        char to_write[150];
+        sprintf(to_write, "%d streams, %lu frames sent, %lu skipped, %lu samples lost", n_streams, frames_sent, frames_skipped, (unsigned long)samples_lost);
+        if (error = write_log(to_write, 'r'))
+        {
+            return CO_ERROR;
+        }
+    }
+
+    CO_END(task);
+}
+
+// Task stopping the server when the signal in task->data is received
+int signal_task(CO_TASK *task)
+{
+    int *signo = task->data;
+
+    CO_BEGIN(task);
+
+    CO_AWAIT_SIGNAL(task, *signo);
+
+    error = write_log(*signo == SIGINT ? "SIGINT" : "SIGTERM", 's');
+    stop_scheduler(task->scheduler);
+
+    CO_END(task);
+}
+
+// Function to open the listening socket on the loopback interface
+// Returns 0 on success, -1 on error
+int open_listen_socket(int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1)
+    {
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd, MAX_VIEWERS) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+    int port = (argc > 1) ? atoi(argv[1]) : DEFAULT_PORT;
+    int rate = (argc > 2) ? atoi(argv[2]) : DEFAULT_RATE;
+    if (port < 1 || port > 65535 || rate < 1 || rate > MAX_RATE)
+    {
+        fprintf(stderr, "usage: %s [port [frames per second, 1-%d]]\n", argv[0], MAX_RATE);
+        exit(1);
+    }
+    frame_period_ns = 1000000000ULL / rate;
+
+    // Open the log file
+    if (open_mmap_log(&log_file, "log/web.log") == -1)
+    {
+        // If error occurs while opening the log file
+        exit(errno);
+    }
+
+    for (int i = 0; i < MAX_VIEWERS; i++)
+    {
+        viewers[i].fd = -1;
+        viewers[i].state = VIEWER_FREE;
+    }
+
+    // Create the tasks
+    static int sigint = SIGINT, sigterm = SIGTERM;
+    CO_TASK accept, frames, report, int_task, term_task;
+
+    int ret = 0;
+    if ((bus = open_pose_bus()) == NULL || (metrics = register_metrics(METRICS_WEB, "web")) == NULL || open_listen_socket(port) == -1 ||
+        init_scheduler(&scheduler) == -1 || spawn_task(&scheduler, &accept, accept_task, NULL) == -1 || spawn_task(&scheduler, &frames, frame_task, NULL) == -1 ||
+        spawn_task(&scheduler, &report, report_task, NULL) == -1 || spawn_task(&scheduler, &int_task, signal_task, &sigint) == -1 ||
+        spawn_task(&scheduler, &term_task, signal_task, &sigterm) == -1)
+    {
+        ret = -1;
+    }
+
+    // Run until an error occurs or the server is stopped
+    if (ret == -1 || (run_scheduler(&scheduler) == -1 && !error))
+    {
+        error = 1;
+    }
+
+    // Close the connections
+    for (int i = 0; i < MAX_VIEWERS; i++)
+    {
+        if (viewers[i].fd != -1)
+        {
+            close(viewers[i].fd);
+        }
+    }
+    close(listen_fd);
+
+    if (error == 1)
+    {
+        // Log the error
+        ret = write_log(strerror(errno), 'e');
+        // Close the log file
+        close_mmap_log(&log_file);
+        if (ret)
+        {
+            // If error occurs while writing on log file
+            exit(errno);
+        }
+        exit(1);
+    }
+
+    // Close the log file
+    close_mmap_log(&log_file);
+
+    if (error == 2)
+    {
+        // If error occurs while writing on log file
+        exit(errno);
+    }
+
+    exit(0);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <time.h>
 #include <sys/types.h>
@@ -7,22 +8,68 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
-
-// Define maximum and minimum positions
-const float min_x_pos = 0.0;
-const float max_x_pos = 40.0;
-const float min_z_pos = 0.0;
-const float max_z_pos = 10.0;
+#include <sys/ioctl.h>
+#include "./../include/pose_stream.h"
+#include "./../include/world_core.h"
+#include "./../include/coroutine_scheduler.h"
+#include "./../include/metrics.h"
+#include "./../include/runtime_profile.h"
+#include "./../include/mmap_log.h"
+#include "./../include/pose_bus.h"
+#include "./../include/checkpoint.h"
+#include "./../include/readiness.h"
+#include "./../include/hoist_config.h"
 
 // Buffer to store the log message
-char log_buffer[100];
+char log_buffer[200];
 
-// File descriptor for log file
-int log_fd;
+// Memory mapped log file
+MMAP_LOG log_file;
 
 // Variable to store the error
 volatile int error = 0;
 
+// Reassembly buffers and counters of the motors position streams
+POSE_READER x_reader, z_reader;
+POSE_STATS x_stats, z_stats;
+
+// Sequence number of the last record sent to the inspection process
+uint32_t real_pos_seq = 0;
+
+// Variables to store the real values of the positions
+float real_x_pos = 0.0;
+float real_z_pos = 0.0;
+
+// File descriptors
+int fdx_pos, fdz_pos, fd_real_pos;
+
+// Variable to store the number of records sent
+int loops = 0;
+
+// Scheduler running the tasks of this process
+CO_SCHEDULER scheduler;
+
+// State of the task reading a motor position FIFO
+typedef struct {
+    char axis;
+    int *fd;
+    float *real_pos;
+} AXIS_TASK;
+
+// Metrics of this process
+METRICS_SLOT *metrics;
+
+// Ring of the positions for the readers that do not use the FIFO
+POSE_BUS *pose_bus;
+
+// Checkpoint file where the last position sent is saved
+CHECKPOINT_FILE *checkpoint;
+
+// Shared configuration and the version applied
+CONFIG_SHM *config_shm;
+HOIST_CONFIG config;
+uint32_t config_seen;
+
 // Function to write on log file
 int write_log(char *to_write, char type)
 {
@@ -40,12 +87,29 @@ int write_log(char *to_write, char type)
     {
         sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <world_process> Position: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
     }
+    // If type is 's' write the stream counters
+    else if (type == 's')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <world_process> Stream %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'p' then it is the runtime profile
+    else if (type == 'p')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <world_process> runtime profile: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'g' then it is a new configuration
+    else if (type == 'g')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <world_process> configuration: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
+    // If type is 'w' then it is a warm start from the checkpoint
+    else if (type == 'w')
+    {
+        sprintf(log_buffer, "%d-%d-%d %d:%d:%d: <world_process> warm start: %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, to_write);
+    }
 
-    // Write on log file
-    int m = write(log_fd, log_buffer, strlen(log_buffer));
-
-    // Check for errors
-    if (m == -1 || m != strlen(log_buffer))
+    // Write on log file, copying the message in the mapped segment
+    if (mmap_log_write(&log_file, log_buffer, strlen(log_buffer)) == -1)
     {
         return 2;
     }
@@ -53,108 +117,216 @@ int write_log(char *to_write, char type)
     return 0;
 }
 
-// Function to return maximum of two integers
-int max(int a, int b)
+// Function to read the records available on a position FIFO
+// Only the last record is used, the previous ones are just counted
+// If no complete record is available the position is left unchanged
+// Returns 0 on success, -1 on error
+int read_real_pos(int *fd, char axis, float *pos)
 {
-    return (a > b) ? a : b;
-}
+    POSE_READER *reader = (axis == 'x') ? &x_reader : &z_reader;
+    POSE_STATS *stats = (axis == 'x') ? &x_stats : &z_stats;
 
-// Function to randomly get a number between two integers
-int random_between(int a, int b)
-{
-    return (rand() % (b - a + 1)) + a;
-}
+    // Read the records from the FIFO
+    if (fill_pose_reader(*fd, reader, stats) == -1)
+    {
+        return -1;
+    }
 
-// Function to pick a random number between two integers
-int pick_random(int a, int b)
-{
-    int num = random_between(a, b);
+    // Variables to store the last valid record
+    int found = 0;
+    float last_pos;
 
-    // If num is closer to a, return a
-    if (num - a < b - num)
+    char *record;
+    while (next_pose_record(reader, &record))
     {
-        return a;
+        uint32_t seq;
+        float value;
+
+        if (parse_axis_record(record, &seq, &value))
+        {
+            stats->malformed++;
+            continue;
+        }
+
+        track_pose_sequence(stats, seq);
+        last_pos = value;
+        found = 1;
     }
-    // If num is closer to b, return b
-    else
+
+    if (!found)
     {
-        return b;
+        return 0;
     }
+
+    // Store the value in the real position variable and add a random 0.5% error
+    *pos = sense_position(axis, last_pos);
+    return 0;
 }
 
-// Function to add a random 0.5% error to the position
-float add_error(float pos)
+// Function to log the counters of both position streams
+int log_stream_stats()
 {
-    // Calculate the error
-    float error = pos * 0.005;
+    char to_write[150];
+    char stats[120];
 
-    // Calculate the minimum and maximum values
-    float min = pos - error;
-    float max = pos + error;
+    format_pose_stats(stats, &x_stats);
+    sprintf(to_write, "x: %s", stats);
+    if (write_log(to_write, 's'))
+    {
+        return 2;
+    }
 
-    // Return a random value between the minimum and maximum
-    return (float)random_between((int)(min * 100), (int)(max * 100)) / 100;
+    format_pose_stats(stats, &z_stats);
+    sprintf(to_write, "z: %s", stats);
+    return write_log(to_write, 's');
 }
 
-// Function to read and return the real position
-float read_real_pos(int *fd, char axis)
+// Function to send the real position to the inspection process
+// Returns 0 on success, 1 on FIFO error, 2 on log error
+int send_real_pos()
 {
-    // Variable to store the position
-    char pos[10];
+    // Increment loops
+    loops++;
 
-    // Read the position from the file
-    if (read(*fd, pos, 10) == -1)
-    {
-        // If error return -1.0
-        return -1.0;
-    }
-
-    // Store the value in the real position variable and add a random 0.5% error
-    float real_pos = add_error(atof(pos));
+    // Create a record with the real position with the format "seq;x_pos;z_pos"
+    char real_pos[POSE_RECORD_MAX];
+    int len = format_pose_record(real_pos, real_pos_seq + 1, real_x_pos, real_z_pos);
 
-    // Check if the position is out of bounds
-    if (axis == 'x')
+    // Log every 10 loops, with the streams counters every 100 loops
+    if (loops % 10 == 0)
     {
-        if (real_pos < min_x_pos)
+        char to_write[40];
+        sprintf(to_write, "%f;%f", real_x_pos, real_z_pos);
+        if (write_log(to_write, 'i'))
         {
-            real_pos = min_x_pos;
+            // If error occurs while writing on log file
+            return 2;
         }
-        else if (real_pos > max_x_pos)
+    }
+    if (loops == 100)
+    {
+        if (log_stream_stats())
         {
-            real_pos = max_x_pos;
+            // If error occurs while writing on log file
+            return 2;
         }
+        loops = 0;
     }
-    else if (axis == 'z')
+
+    // Write the real position to the FIFO
+    int m = write(fd_real_pos, real_pos, len);
+    if (m == -1 || m != len)
     {
-        if (real_pos < min_z_pos)
+        // If error occurs while writing on the FIFO
+        return 1;
+    }
+    real_pos_seq++;
+
+    // Snapshot the position sent, it is only a copy in the mapped file
+    save_world_checkpoint(checkpoint, real_pos_seq, real_x_pos, real_z_pos);
+
+    // Publish the position on the bus too, the readers of the bus never slow down this process
+    publish_pose_sample(pose_bus, real_x_pos, real_z_pos);
+    metrics_count(metrics, METRIC_SAMPLES, 1);
+    metrics_count(metrics, METRIC_BYTES_WRITTEN, len);
+    metrics_gauge(metrics, METRIC_POSITION_X, real_x_pos);
+    metrics_gauge(metrics, METRIC_POSITION_Z, real_z_pos);
+
+    return 0;
+}
+
+// Function to apply the configuration read in config to the limits and the error of the sensors
+// Returns 0 on success, 2 on log error
+int apply_config()
+{
+    min_x_pos = config.x_min;
+    max_x_pos = config.x_max;
+    min_z_pos = config.z_min;
+    max_z_pos = config.z_max;
+    sensor_relative_error = config.sensor_error;
+
+    char to_write[120];
+    sprintf(to_write, "version %u, limits x %.2f-%.2f z %.2f-%.2f, sensor error %.4f", config_seen, min_x_pos, max_x_pos, min_z_pos, max_z_pos,
+            sensor_relative_error);
+    return write_log(to_write, 'g');
+}
+
+// Task reading the positions sent by a motor
+// Every update is sent to the inspection process
+int axis_task(CO_TASK *task)
+{
+    AXIS_TASK *state = task->data;
+
+    CO_BEGIN(task);
+
+    while (1)
+    {
+        // Wait for the motor to send its position, without timeout
+        CO_AWAIT_READABLE(task, *state->fd);
+
+        // Count the wakeups and how many bytes are waiting to be read
+        metrics_count(metrics, METRIC_WAKEUPS, 1);
+        int queued = 0;
+        ioctl(*state->fd, FIONREAD, &queued);
+        metrics_gauge(metrics, METRIC_QUEUE_DEPTH, queued);
+
+        // Apply a new configuration before the position, a single load when there is none
+        if (config_changed(config_shm, &config_seen, &config) && (error = apply_config()))
         {
-            real_pos = min_z_pos;
+            return CO_ERROR;
         }
-        else if (real_pos > max_z_pos)
+
+        // Read and store the value in the real position variable
+        if (read_real_pos(state->fd, state->axis, state->real_pos) == -1)
         {
-            real_pos = max_z_pos;
+            error = 1;
+            return CO_ERROR;
+        }
+
+        if (error = send_real_pos())
+        {
+            return CO_ERROR;
         }
     }
 
-    // Return the position
-    return real_pos;
+    CO_END(task);
+}
+
+// Task stopping the process on SIGTERM, after logging the streams counters
+int term_task_function(CO_TASK *task)
+{
+    CO_BEGIN(task);
+
+    CO_AWAIT_SIGNAL(task, SIGTERM);
+
+    error = log_stream_stats();
+    stop_scheduler(task->scheduler);
+
+    CO_END(task);
 }
 
 int main(int argc, char const *argv[])
 {
     // Open log file
-    if ((log_fd = open("log/world.log", O_WRONLY | O_APPEND | O_CREAT, 0666)) == -1)
+    if (open_mmap_log(&log_file, "log/world.log") == -1)
     {
         // If error occurs while opening the log file
         exit(errno);
     }
 
-    // Variables to store the real values of the positions
-    float real_x_pos = 0.0;
-    float real_z_pos = 0.0;
+    // Apply the memory settings of the runtime profile passed by the master
+    // A failure does not stop the process, it runs without the memory locked and logs it as an error
+    char profile_report[100];
+    int profile_failed = apply_memory_profile(profile_report);
+    if (profile_report[0] != '\0' && write_log(profile_report, profile_failed ? 'e' : 'p'))
+    {
+        // If error occurs while writing to the log file
+        close_mmap_log(&log_file);
+        exit(errno);
+    }
 
-    // File descriptors
-    int fdx_pos, fdz_pos, fd_real_pos;
+    // Seed the noise of the sensors, HOIST_SEED makes the measures reproducible
+    seed_random_from_env(DEFAULT_SEED);
 
     // FIFOs locations
     char *x_pos_fifo = "/tmp/x_pos_fifo";
@@ -173,7 +345,7 @@ int main(int argc, char const *argv[])
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close the log file
-        close(log_fd);
+        close_mmap_log(&log_file);
         if (ret)
         {
             // If error occurs while writing on log file
@@ -189,7 +361,7 @@ int main(int argc, char const *argv[])
         int ret = write_log(strerror(errno), 'e');
         // Close the file descriptors
         close(fdx_pos);
-        close(log_fd);
+        close_mmap_log(&log_file);
         if (ret)
         {
             // If error occurs while writing on log file
@@ -206,7 +378,7 @@ int main(int argc, char const *argv[])
         // Close the file descriptors
         close(fdx_pos);
         close(fdz_pos);
-        close(log_fd);
+        close_mmap_log(&log_file);
         if (ret)
         {
             // If error occurs while writing on log file
@@ -215,104 +387,79 @@ int main(int argc, char const *argv[])
         exit(1);
     }
 
-    // Variable to store the number of loops
-    int loops = 0;
-
-    // Infinite loop
-    while (1)
+    // Register the metrics, open the pose bus and map the checkpoint
+    if ((metrics = register_metrics(METRICS_WORLD, "world")) == NULL || (pose_bus = open_pose_bus()) == NULL || (checkpoint = open_checkpoint(0)) == NULL)
     {
-        // Variable to store the read values
-        char x_pos[10];
-        char z_pos[10];
-
-        // Setting parameters for select function
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(fdx_pos, &readfds);
-        FD_SET(fdz_pos, &readfds);
-        int max_fd = max(fdx_pos, fdz_pos) + 1;
-
-        // Setting timeout for select function
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 250000;
-
-        // Wait for the file descriptor to be ready
-        int ready = select(max_fd, &readfds, NULL, NULL, &timeout);
-
-        // Check if the file descriptor is ready
-        if (ready < 0)
+        // Log the error
+        int ret = write_log(strerror(errno), 'e');
+        // Close the file descriptors
+        close(fdx_pos);
+        close(fdz_pos);
+        close(fd_real_pos);
+        close_mmap_log(&log_file);
+        if (ret)
         {
-            // If error occurs while waiting for the file descriptor
-            error = 1;
-            break;
+            // If error occurs while writing on log file
+            exit(errno);
         }
-        else if (ready > 0)
+        exit(1);
+    }
+
+    // After a crash, resume from the last position sent
+    CHECKPOINT_WORLD snapshot;
+    if (load_world_checkpoint(checkpoint, &snapshot))
+    {
+        real_pos_seq = snapshot.stream_seq;
+        real_x_pos = snapshot.x;
+        real_z_pos = snapshot.z;
+
+        char to_write[100];
+        sprintf(to_write, "position %f;%f from the snapshot taken %.1f ms before", real_x_pos, real_z_pos, (checkpoint_time_ns() - snapshot.time_ns) / 1e6);
+        if (error = write_log(to_write, 'w'))
         {
-            // Increment loops
-            loops++;
-
-            // If both file descriptors are ready
-            if (FD_ISSET(fdx_pos, &readfds) && FD_ISSET(fdz_pos, &readfds))
-            {
-                // Randomly select one of the file descriptors
-                if (pick_random(fdx_pos, fdz_pos) == fdx_pos)
-                {
-                    // Read and store the value in the x position variable
-                    real_x_pos = read_real_pos(&fdx_pos, 'x');
-                }
-                else
-                {
-                    // Read and store the value in the z position variable
-                    real_z_pos = read_real_pos(&fdz_pos, 'z');
-                }
-            }
-            // If only the x position file descriptor is ready
-            else if (FD_ISSET(fdx_pos, &readfds))
-            {
-                // Read and store the value in the x position variable
-                real_x_pos = read_real_pos(&fdx_pos, 'x');
-            }
-            // If only the z position file descriptor is ready
-            else if (FD_ISSET(fdz_pos, &readfds))
-            {
-                // Read and store the value in the z position variable
-                real_z_pos = read_real_pos(&fdz_pos, 'z');
-            }
-
-            // If error occurs while reading the position
-            if (real_x_pos == -1.0 || real_z_pos == -1.0)
-            {
-                error = 1;
-                break;
-            }
-
-            // Create a string to store the real position with the format "x_pos;z_pos"
-            char real_pos[20];
-            sprintf(real_pos, "%f;%f", real_x_pos, real_z_pos);
-
-            // Log every 10 loops
-            if (loops == 10)
-            {
-                if (error = write_log(real_pos, 'i'))
-                {
-                    // If error occurs while writing on log file
-                    break;
-                }
-                loops = 0;
-            }
-
-            // Write the real position to the FIFO
-            int m = write(fd_real_pos, real_pos, strlen(real_pos));
-            if (m == -1 || m != strlen(real_pos))
-            {
-                // If error occurs while writing on the FIFO
-                error = 1;
-                break;
-            }
+            // If error occurs while writing on log file
+            close(fdx_pos);
+            close(fdz_pos);
+            close(fd_real_pos);
+            close_mmap_log(&log_file);
+            exit(errno);
         }
     }
 
+    // Read the configuration published by the master, the defaults without it
+    config_shm = open_config_shm(0);
+    config_seen = read_config(config_shm, &config);
+    if (error = apply_config())
+    {
+        // If error occurs while writing on log file
+        close(fdx_pos);
+        close(fdz_pos);
+        close(fd_real_pos);
+        close_mmap_log(&log_file);
+        exit(errno);
+    }
+
+    // One task for each motor FIFO and one for the termination signal
+    CO_TASK x_task, z_task, term_task;
+    AXIS_TASK x_state = {'x', &fdx_pos, &real_x_pos};
+    AXIS_TASK z_state = {'z', &fdz_pos, &real_z_pos};
+
+    if (init_scheduler(&scheduler) == -1 || spawn_task(&scheduler, &x_task, axis_task, &x_state) == -1 ||
+        spawn_task(&scheduler, &z_task, axis_task, &z_state) == -1 || spawn_task(&scheduler, &term_task, term_task_function, NULL) == -1)
+    {
+        error = 1;
+    }
+    // Tell the master that the world process is ready
+    else if (notify_ready("world") == -1)
+    {
+        error = 1;
+    }
+    // Run until an error occurs or the process is terminated
+    else if (run_scheduler(&scheduler) == -1 && !error)
+    {
+        error = 1;
+    }
+
     // Close the FIFOs
     close(fdx_pos);
     close(fdz_pos);
@@ -324,7 +471,7 @@ int main(int argc, char const *argv[])
         // Log the error
         int ret = write_log(strerror(errno), 'e');
         // Close the log file
-        close(log_fd);
+        close_mmap_log(&log_file);
         if (ret)
         {
             // If error occurs while writing on log file
@@ -334,7 +481,7 @@ int main(int argc, char const *argv[])
     }
 
     // Close the log file
-    close(log_fd);
+    close_mmap_log(&log_file);
 
     if (error == 2)
     {